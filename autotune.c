@@ -0,0 +1,151 @@
+#include <string.h>
+
+#include "autotune.h"
+
+/* Floor of the square root, bit by bit. */
+static uint32_t
+autotune_isqrt(uint64_t x)
+{
+  uint64_t root = 0;
+  uint64_t bit  = (uint64_t) 1 << 62;
+
+  while (bit > x)
+    bit >>= 2;
+
+  for (; bit; bit >>= 2) {
+    if (x >= root + bit) {
+      x   -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+  }
+
+  return (uint32_t) root;
+}
+
+void
+autotune_start(autotune_t* tune, temp_t setpoint, temp_t hysteresis, unsigned high,
+               uint32_t now_ms)
+{
+  memset(tune, 0, sizeof(*tune));
+
+  tune->state      = AUTOTUNE_RUNNING;
+  tune->setpoint   = setpoint;
+  tune->hysteresis = hysteresis;
+  tune->high       = high;
+  tune->switch_ms  = now_ms;
+}
+
+void
+autotune_stop(autotune_t* tune)
+{
+  if (tune->state == AUTOTUNE_RUNNING)
+    tune->state = AUTOTUNE_IDLE;
+}
+
+static void
+autotune_finish(autotune_t* tune)
+{
+  const temp_t amplitude = tune->amplitude_sum / AUTOTUNE_CYCLES;
+
+  tune->pu_ms     = tune->period_sum_ms / AUTOTUNE_CYCLES;
+  tune->amplitude = amplitude;
+  tune->bias      = (int64_t) tune->high * PID_OUT_ONE * tune->on_sum_ms / tune->period_sum_ms;
+
+  const int64_t a2 = (int64_t) amplitude * amplitude - (int64_t) tune->hysteresis * tune->hysteresis;
+
+  /* An oscillation within the hysteresis says nothing about the gain. */
+  if (a2 <= 0 || tune->pu_ms == 0) {
+    tune->state = AUTOTUNE_FAILED;
+    return;
+  }
+
+  /* 4 d / pi with d = high / 2, 4 / pi = 1.27324 */
+  tune->ku    = (uint64_t) tune->high * PID_GAIN_ONE * TEMP_ONE * 127324
+              / (200000 * (uint64_t) autotune_isqrt(a2));
+  tune->state = AUTOTUNE_DONE;
+}
+
+/* The temperature went over the top of the band, a cycle is complete. */
+static void
+autotune_cycle(autotune_t* tune, uint32_t now_ms)
+{
+  /* The first one came from wherever the run started. */
+  if (tune->cycles >= 2) {
+    tune->period_sum_ms += now_ms - tune->up_ms;
+    tune->on_sum_ms     += tune->on_ms;
+    tune->amplitude_sum += (tune->max - tune->min) / 2;
+  }
+
+  tune->cycles++;
+  tune->up_ms = now_ms;
+  tune->on_ms = 0;
+  tune->max   = tune->setpoint;
+  tune->min   = tune->setpoint;
+
+  if (tune->cycles == AUTOTUNE_CYCLES + 2)
+    autotune_finish(tune);
+}
+
+unsigned
+autotune_update(autotune_t* tune, temp_t pv, uint32_t now_ms)
+{
+  if (tune->state != AUTOTUNE_RUNNING)
+    return 0;
+
+  if (pv > tune->max)
+    tune->max = pv;
+  if (pv < tune->min)
+    tune->min = pv;
+
+  if (tune->heating && pv > tune->setpoint + tune->hysteresis) {
+    tune->on_ms    += now_ms - tune->switch_ms;
+    tune->heating   = false;
+    tune->switch_ms = now_ms;
+    autotune_cycle(tune, now_ms);
+  } else if (!tune->heating && pv < tune->setpoint - tune->hysteresis) {
+    tune->heating   = true;
+    tune->switch_ms = now_ms;
+  } else if (now_ms - tune->switch_ms > AUTOTUNE_SWITCH_MAX_MS) {
+    tune->state = AUTOTUNE_FAILED;
+  }
+
+  if (tune->state != AUTOTUNE_RUNNING)
+    return 0;
+
+  return tune->heating ? tune->high : 0;
+}
+
+void
+autotune_gains(const autotune_t* tune, pid_config_t* config)
+{
+  /*
+   * Ziegler-Nichols "no overshoot" PID: kp = 0.2 Ku, ti = Pu / 2,
+   * td = Pu / 3. A furnace takes ages to shed heat, so the gentle end of
+   * the rules is the one worth having.
+   */
+  config->kp   = tune->ku / 5;
+  config->ti_s = (tune->pu_ms / 2 + 500) / 1000;
+  config->td_s = (tune->pu_ms / 3 + 500) / 1000;
+
+  if (config->kp > PID_KP_MAX)
+    config->kp = PID_KP_MAX;
+  if (config->ti_s > PID_TIME_MAX_S)
+    config->ti_s = PID_TIME_MAX_S;
+  if (config->td_s > PID_TIME_MAX_S)
+    config->td_s = PID_TIME_MAX_S;
+}
+
+const char*
+autotune_state_name(uint8_t state)
+{
+  switch (state) {
+    case AUTOTUNE_IDLE:    return "idle";
+    case AUTOTUNE_RUNNING: return "running";
+    case AUTOTUNE_DONE:    return "done";
+    case AUTOTUNE_FAILED:  return "failed";
+  }
+
+  return "?";
+}
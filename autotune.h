@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "pid.h"
+
+/*
+ * Relay autotune (Astrom-Hagglund) for the pilot's PID controller.
+ *
+ * The heater is switched between 0 and high around the setpoint, with
+ * hysteresis against noise: off once the temperature is hysteresis above
+ * it, on again once it is hysteresis below. The furnace settles into an
+ * oscillation, whose period is the ultimate period Pu and whose amplitude
+ * a gives the ultimate gain from the relay's describing function:
+ *
+ *   Ku = 4 d / (pi sqrt(a^2 - hysteresis^2)),  d = high / 2
+ *
+ * The first cycle, coming from wherever the temperature started, is
+ * thrown away and the next AUTOTUNE_CYCLES are averaged. The average
+ * heater output over them is what holds the setpoint, the pilot starts
+ * from it once the gains are in.
+ *
+ * Pu is the now_ms between two switch-ons, the average output the time
+ * on over them.
+ */
+
+#define AUTOTUNE_CYCLES         4
+#define AUTOTUNE_PERIOD_MS      250
+
+/* Has to stay clear of the noise on the reading, or the relay chatters. */
+#define AUTOTUNE_HYSTERESIS     TEMP_C(1)
+#define AUTOTUNE_HYSTERESIS_MAX 20
+
+/* Giving up if the relay doesn't switch for so long, the setpoint is out of reach. */
+#define AUTOTUNE_SWITCH_MAX_MS  (4u * 3600 * 1000)
+
+enum {
+  AUTOTUNE_IDLE,
+  AUTOTUNE_RUNNING,
+  AUTOTUNE_DONE,
+  AUTOTUNE_FAILED,
+};
+
+typedef struct {
+  uint8_t  state;      /* AUTOTUNE_* */
+  temp_t   setpoint;
+  temp_t   hysteresis;
+  uint16_t high;       /* PWM level while heating */
+
+  bool     heating;
+  uint8_t  cycles;     /* up switches so far */
+  uint32_t switch_ms;  /* last switch either way */
+  uint32_t up_ms;      /* last switch to off, a cycle runs from one to the next */
+  uint32_t on_ms;      /* heating time within the current cycle */
+  temp_t   max;        /* within the current cycle */
+  temp_t   min;
+
+  uint64_t period_sum_ms;
+  uint64_t on_sum_ms;
+  int64_t  amplitude_sum;
+
+  /* Valid once state is AUTOTUNE_DONE. */
+  uint32_t ku;         /* PID_GAIN_ONE is one level per degree */
+  uint32_t pu_ms;
+  temp_t   amplitude;
+  int32_t  bias;       /* average output, PID_OUT_ONE is one level */
+} autotune_t;
+
+void
+autotune_start(autotune_t* tune, temp_t setpoint, temp_t hysteresis, unsigned high,
+               uint32_t now_ms);
+
+void
+autotune_stop(autotune_t* tune);
+
+/* One step of the relay, returns the PWM level to run the heater at. */
+unsigned
+autotune_update(autotune_t* tune, temp_t pv, uint32_t now_ms);
+
+/* Gains for the pilot from Ku and Pu, keeps the period of config. */
+void
+autotune_gains(const autotune_t* tune, pid_config_t* config);
+
+const char*
+autotune_state_name(uint8_t state);
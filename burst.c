@@ -0,0 +1,38 @@
+#include <string.h>
+
+#include "burst.h"
+
+static void
+burst_set(burst_pattern_t* pattern, unsigned half_cycle)
+{
+  pattern->bits[half_cycle / 32] |= (uint32_t) 1 << (half_cycle % 32);
+}
+
+void
+burst_pattern(burst_pattern_t* pattern, unsigned on, unsigned runs)
+{
+  memset(pattern, 0, sizeof(*pattern));
+
+  if (runs < 1)
+    runs = 1;
+  if (runs > BURST_CYCLES)
+    runs = BURST_CYCLES;
+
+  const unsigned cycles = (on > BURST_HALF_CYCLES ? BURST_HALF_CYCLES : on) / 2;
+
+  /*
+   * Slot s spans cycles [begin, end) and gets what a straight line from 0
+   * to `cycles` over the window gains there. That is never more than the
+   * slot holds, and the slots add up to `cycles` exactly.
+   */
+  for (unsigned s = 0; s < runs; s++) {
+    const unsigned begin = s * BURST_CYCLES / runs;
+    const unsigned end   = (s + 1) * BURST_CYCLES / runs;
+    const unsigned n     = end * cycles / BURST_CYCLES - begin * cycles / BURST_CYCLES;
+
+    for (unsigned c = begin; c < begin + n; c++) {
+      burst_set(pattern, 2 * c);
+      burst_set(pattern, 2 * c + 1);
+    }
+  }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Burst firing (cycle skipping) patterns for the SSR.
+ *
+ * Instead of a duty cycle at 8 Hz the heater gets windows of
+ * BURST_HALF_CYCLES mains half-cycles, every one of them either fully on
+ * or fully off, one bit each. pwm.c clocks them out from a hardware timer
+ * that isn't synced to the mains, see there.
+ *
+ * burst_pattern switches whole cycles only, so the element sees no DC
+ * component as long as the slots line up with the mains, and splits the
+ * window into `runs` equal slots with one burst at the start of each, as
+ * evenly sized as they go. The SSR turns on at most `runs` times per
+ * window: 1 is a single burst, the lowest switching rate, BURST_CYCLES
+ * spreads every cycle on its own, the flattest load on the mains.
+ *
+ * A window is one cycle of resolution, 2 % of full power with 100 half
+ * cycles. What a window rounded off is carried over to the next by the
+ * caller, with dither.c.
+ */
+
+#define BURST_HALF_CYCLES 100
+#define BURST_CYCLES      50                 /* plain number for STR() */
+#define BURST_WORDS       ((BURST_HALF_CYCLES + 31) / 32)
+#define BURST_RUNS        4
+
+_Static_assert(BURST_CYCLES * 2 == BURST_HALF_CYCLES, "bursts are whole cycles");
+
+typedef struct {
+  uint32_t bits[BURST_WORDS]; /* half-cycle i is bit i % 32 of word i / 32 */
+} burst_pattern_t;
+
+/*
+ * Pattern with `on` half-cycles, rounded down to whole cycles and capped
+ * at the window, in `runs` bursts (1 .. BURST_CYCLES, clamped).
+ */
+void
+burst_pattern(burst_pattern_t* pattern, unsigned on, unsigned runs);
+
+static inline bool
+burst_bit(const burst_pattern_t* pattern, unsigned half_cycle)
+{
+  return (pattern->bits[half_cycle / 32] >> (half_cycle % 32)) & 1;
+}
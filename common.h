@@ -1,12 +1,85 @@
 #pragma once
 
+#include <stdint.h>
+
 #define CONSTEVAL_HEADER "consteval_header.h"
 
+/*
+ * Temperatures are fixed point degrees Celsius with TEMP_FRAC_BITS
+ * fractional bits, from the converter all the way to the status line and
+ * flash. 1/256 C keeps the full 1/128 C of the MAX31856 and still leaves
+ * room for products in 32 bits up to a few thousand degrees.
+ */
+typedef int32_t temp_t;
+
+#define TEMP_FRAC_BITS 8
+#define TEMP_ONE       ((temp_t) 1 << TEMP_FRAC_BITS)
+
+/* Whole degrees to temp_t. */
+#define TEMP_C(c) ((temp_t) (c) * TEMP_ONE)
+
+/* temp_t to whole degrees, rounded towards minus infinity. */
+#define TEMP_WHOLE(t) ((t) >> TEMP_FRAC_BITS)
+
+/* Prints a temp_t with two decimals: printf(TEMP_FMT, TEMP_ARGS(t)) */
+#define TEMP_FMT     "%s%d.%02d"
+#define TEMP_ARGS(t) ((t) < 0 ? "-" : ""),                                        \
+                     (int) (((t) < 0 ? -(t) : (t)) >> TEMP_FRAC_BITS),            \
+                     (int) (((((t) < 0 ? -(t) : (t)) & (TEMP_ONE - 1)) * 100) >> TEMP_FRAC_BITS)
+
+/*
+ * Modules that keep time (profile, autotune, ident, preheat) are handed
+ * now_ms: milliseconds of any clock that counts up, to_ms_since_boot on
+ * the board. They only look at differences between two of them, so where
+ * the clock starts doesn't matter and the uint32_t may wrap.
+ */
+
 #define MAX_TEMP 1100
 #define MAX_PWM ((unsigned int)(CONFIG_MAX_PWM))
+
+/*
+ * Heater output in PWM levels with PWM_FINE_BITS fraction bits, what the
+ * pilot asks for. pwm.c dithers it onto the heater.
+ */
+#define PWM_FINE_BITS 16
+#define PWM_FINE_ONE  ((int32_t) 1 << PWM_FINE_BITS)
+
+/* Two decimals: printf(PWM_FINE_FMT, PWM_FINE_ARGS(f)), f >= 0 */
+#define PWM_FINE_FMT     "%u.%02u"
+#define PWM_FINE_ARGS(f) (unsigned) ((f) >> PWM_FINE_BITS),                       \
+                         (unsigned) ((((f) & (PWM_FINE_ONE - 1)) * 100) >> PWM_FINE_BITS)
 #define MAX_AUTO 1
 
-#define FORMAT_STATUS_FMT "temp:%d/%d, pwm:%u/%u/%u, auto:%d\n"
+#define FORMAT_STATUS_BASE "temp:" TEMP_FMT "/" TEMP_FMT ", pwm:%u/%u/%u, auto:%d"
+#define FORMAT_STATUS_FMT  FORMAT_STATUS_BASE "\n"
+
+/*
+ * Once a firing program was started, the status line goes on with where it
+ * is: segment, phase and minutes left in it.
+ *   temp:412.50/412.75, pwm:21/50/50, auto:1, profile:2/4 ramp 113 min
+ */
+#define PROFILE_STATUS_FMT ", profile:%u/%u %s %u min"
+
+/*
+ * With a thermocouple it goes on with the heating rate estimator.c sees,
+ * in C/h, before the profile:
+ *   temp:412.50/412.75, pwm:21/50/50, auto:1, rate:96.25
+ */
+#define RATE_STATUS_FMT      ", rate:" TEMP_FMT
+#define ESTIMATOR_RATE_MAX_C 36000
+
+/*
+ * With more than one thermocouple every status is followed by a line with
+ * all of them, the one cur_temp follows is marked with a '*':
+ *   sensors: crucible:812.50* wall:402.25 element:905.00
+ */
+#define THERMO_SENSORS       CONFIG_THERMO_SENSORS
+#define SENSOR_STATUS_PREFIX "sensors:"
+#define SENSOR_STATUS_FMT    " %s:" TEMP_FMT "%s"
+
+/* The pilot, with its pid, profiles and what hands over to it, in every auto mode but none. */
+#define CONFIG_PILOT \
+  (CONFIG_AUTO == CONFIG_AUTO_PILOT || CONFIG_AUTO == CONFIG_AUTO_MAPPER || CONFIG_AUTO == CONFIG_AUTO_MPC)
 
 #if CONFIG_AUTO == CONFIG_AUTO_MAPPER
 /*
@@ -14,13 +87,13 @@
  * it is easier to search for max temp on given pwm in logs.
  */
 
-  #define MAPPER_STATUS_FMT     "!!! pwm:%u, max_temp:%d !!!\n"
+  #define MAPPER_STATUS_FMT     "!!! pwm:%u, max_temp:" TEMP_FMT " !!!\n"
 
-  #define FALLBACK_TEMP         MAX_TEMP - 400
+  #define FALLBACK_TEMP         (MAX_TEMP - 400)
 #endif
 
 #if CONFIG_AUTO == CONFIG_AUTO_NONE
-  #define FORMAT_STATUS_AUTO_NONE "temp:%d, pwm:%u/%u\n"
+  #define FORMAT_STATUS_AUTO_NONE "temp:" TEMP_FMT ", pwm:%u/%u\n"
 #endif
 
 #if CONFIG_STIRRER
@@ -0,0 +1,31 @@
+#include "dither.h"
+
+void
+dither_reset(dither_t* dither)
+{
+  dither->error = 0;
+}
+
+uint32_t
+dither_next(dither_t* dither, uint32_t duty, uint32_t quantum, uint32_t top)
+{
+  const int64_t full = (int64_t) top << DITHER_FRAC_BITS;
+
+  if (duty == 0) {
+    dither->error = 0;
+    return 0;
+  }
+
+  const int64_t want = dither->error + (duty < full ? duty : full);
+
+  if (want >= full) {
+    dither->error = want - full;
+    return top;
+  }
+
+  const int64_t out = want / quantum * quantum;
+
+  dither->error = want - out;
+
+  return (uint32_t) (out >> DITHER_FRAC_BITS);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * First order sigma-delta modulator for the heater.
+ *
+ * The SSR only switches at zero crossings, so within one PWM period the
+ * heater runs for a whole number of mains half-cycles however finely the
+ * counter is set: 12.5 of them per period at 8 Hz on 50 Hz mains, steps of
+ * 8 % of full power. dither_next hands out whole quanta each period and
+ * carries what it rounded away over to the next one, so averaged over a few
+ * periods the heater delivers the duty that was asked for.
+ *
+ * Duty and quantum are PWM counts with 16 fraction bits, what comes out is
+ * the counter level for the next period.
+ */
+
+#define DITHER_FRAC_BITS 16
+
+typedef struct {
+  int64_t error; /* asked for but not delivered yet, 0 <= error < quantum */
+} dither_t;
+
+void
+dither_reset(dither_t* dither);
+
+/*
+ * Level for the next period, a multiple of quantum or top itself (full
+ * power, whatever is left of the last quantum included). Duty is clamped
+ * to top, and 0 is off right away with nothing carried over.
+ */
+uint32_t
+dither_next(dither_t* dither, uint32_t duty, uint32_t quantum, uint32_t top);
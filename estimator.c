@@ -0,0 +1,91 @@
+#include <string.h>
+
+#include "estimator.h"
+
+/* ESTIMATOR_RATE_MAX in C/s, ESTIMATOR_BITS. */
+#define ESTIMATOR_RATE_LIMIT ((int64_t) ESTIMATOR_RATE_MAX_C * ESTIMATOR_ONE / 3600)
+
+/*
+ * alpha and beta have more fraction bits than the state: beta goes with
+ * alpha squared, 0.005 would leave less than one bit of it.
+ */
+#define ESTIMATOR_GAIN_BITS 30
+#define ESTIMATOR_GAIN_ONE  ((int64_t) 1 << ESTIMATOR_GAIN_BITS)
+
+/*
+ * No furnace moves that far off the prediction from one sample to the
+ * next: a first conversion or a sensor coming back. The estimate starts
+ * over there, which also keeps residuals small enough for 64 bit products.
+ */
+#define ESTIMATOR_JUMP ((int64_t) TEMP_C(20) << (ESTIMATOR_BITS - TEMP_FRAC_BITS))
+
+bool
+estimator_config_valid(const estimator_config_t* config)
+{
+  return config->alpha >= ESTIMATOR_ALPHA_MIN && config->alpha <= ESTIMATOR_ALPHA_MAX &&
+         config->gain <= ESTIMATOR_GAIN_MAX_C * 1000;
+}
+
+void
+estimator_init(estimator_t* est, const estimator_config_t* config)
+{
+  memset(est, 0, sizeof(*est));
+  estimator_configure(est, config);
+}
+
+void
+estimator_configure(estimator_t* est, const estimator_config_t* config)
+{
+  const int64_t alpha = (int64_t) config->alpha * ESTIMATOR_GAIN_ONE / 1000;
+
+  est->config = *config;
+  est->alpha  = (int32_t) alpha;
+  est->beta   = (int32_t) (alpha * alpha / (2 * ESTIMATOR_GAIN_ONE - alpha));
+}
+
+void
+estimator_reset(estimator_t* est)
+{
+  est->primed   = false;
+  est->temp     = 0;
+  est->rate     = 0;
+  est->residual = 0;
+}
+
+void
+estimator_update(estimator_t* est, temp_t temp, uint32_t dt_ms, int32_t input)
+{
+  const int32_t z = temp << (ESTIMATOR_BITS - TEMP_FRAC_BITS);
+
+  if (dt_ms == 0)
+    dt_ms = 1;
+
+  /* gain is thousandths of a C/h per level, input has PWM_FINE_BITS. */
+  int64_t rate = est->rate + (int64_t) est->config.gain * (input - est->input)
+                             * ESTIMATOR_ONE / ((int64_t) 3600 * 1000 * PWM_FINE_ONE);
+
+  const int64_t predicted = est->temp + rate * dt_ms / 1000;
+  const int64_t residual  = z - predicted;
+
+  if (!est->primed || residual > ESTIMATOR_JUMP || residual < -ESTIMATOR_JUMP) {
+    est->primed   = true;
+    est->temp     = z;
+    est->rate     = 0;
+    est->input    = input;
+    est->residual = 0;
+    return;
+  }
+
+  /* beta * residual / dt, 16 of the gain's fraction bits dropped before the ms. */
+  rate += ((((int64_t) est->beta * residual) >> (ESTIMATOR_GAIN_BITS - 16)) * 1000 / dt_ms) >> 16;
+
+  if (rate > ESTIMATOR_RATE_LIMIT)
+    rate = ESTIMATOR_RATE_LIMIT;
+  if (rate < -ESTIMATOR_RATE_LIMIT)
+    rate = -ESTIMATOR_RATE_LIMIT;
+
+  est->temp     = (int32_t) (predicted + (((int64_t) est->alpha * residual) >> ESTIMATOR_GAIN_BITS));
+  est->rate     = (int32_t) rate;
+  est->input    = input;
+  est->residual = (int32_t) residual;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Temperature and heating rate of the regulated sensor, estimated from
+ * every sample (alpha-beta filter, the steady state form of a Kalman
+ * filter for a temperature and its rate).
+ *
+ * Between two samples the temperature moves on at the estimated rate, and
+ * a change of heater output moves the rate by gain C/h per PWM level right
+ * away: the heater is the known input. The sample then corrects the
+ * temperature by alpha and the rate by beta / dt of what it disagrees
+ * with the prediction. beta follows from alpha (Benedict-Bordner,
+ * beta = alpha^2 / (2 - alpha)), so alpha alone trades noise for lag.
+ *
+ * The plant's dead time isn't modelled, so with a gain the rate runs ahead
+ * of what the sensor shows after a change of output, which is what a
+ * controller wants to know. Gain 0 is a plain alpha-beta filter.
+ *
+ * Temperature and rate are kept with ESTIMATOR_BITS fraction bits, the
+ * rate per second. Outside they are temp_t and temp_t per hour.
+ */
+
+#define ESTIMATOR_BITS        16
+#define ESTIMATOR_ONE         ((int32_t) 1 << ESTIMATOR_BITS)
+
+#define ESTIMATOR_ALPHA       20           /* thousandths */
+#define ESTIMATOR_ALPHA_MIN   1
+#define ESTIMATOR_ALPHA_MAX   1000
+#define ESTIMATOR_GAIN_MAX_C  1000         /* C/h per level */
+#define ESTIMATOR_RATE_MAX    TEMP_C(ESTIMATOR_RATE_MAX_C) /* per hour */
+
+typedef struct {
+  uint16_t alpha;     /* thousandths, ESTIMATOR_ALPHA_MIN..ESTIMATOR_ALPHA_MAX */
+  uint32_t gain;      /* thousandths of a C/h per PWM level */
+} estimator_config_t;
+
+typedef struct {
+  estimator_config_t config;
+  int32_t alpha;      /* 30 fraction bits, see estimator.c */
+  int32_t beta;
+
+  bool    primed;     /* temp holds a sample */
+  int32_t temp;       /* C, ESTIMATOR_BITS */
+  int32_t rate;       /* C/s, ESTIMATOR_BITS */
+  int32_t input;      /* heater output of the last update, PWM_FINE_BITS */
+  int32_t residual;   /* sample minus prediction at the last update, ESTIMATOR_BITS */
+} estimator_t;
+
+/* Limits hold: alpha within its range, gain up to ESTIMATOR_GAIN_MAX_C. */
+bool
+estimator_config_valid(const estimator_config_t* config);
+
+void
+estimator_init(estimator_t* est, const estimator_config_t* config);
+
+/* Changes alpha and gain, keeps the estimate. */
+void
+estimator_configure(estimator_t* est, const estimator_config_t* config);
+
+/* Forgets the estimate, the next sample starts it over at rate 0. */
+void
+estimator_reset(estimator_t* est);
+
+/*
+ * One sample, dt_ms after the one before, while the heater ran at input
+ * (PWM_FINE_BITS). The first one after a reset is taken as it is, and so
+ * is one more than 20 C off the prediction: the estimate starts over.
+ */
+void
+estimator_update(estimator_t* est, temp_t temp, uint32_t dt_ms, int32_t input);
+
+static inline temp_t
+estimator_temp(const estimator_t* est)
+{
+  return est->temp >> (ESTIMATOR_BITS - TEMP_FRAC_BITS);
+}
+
+/* temp_t per hour. */
+static inline int32_t
+estimator_rate(const estimator_t* est)
+{
+  return (int32_t) (((int64_t) est->rate * 3600) >> (ESTIMATOR_BITS - TEMP_FRAC_BITS));
+}
@@ -21,15 +21,17 @@
  *
  *  Memory layout:
  *
- *    TAG                    -> Distinguishes between random bytes and a valid entry
+ *    TAG                    -> Distinguishes between random bytes and a valid entry,
+ *                              its low byte is FLASH_LAYOUT_VERSION
  *    targets                -> Indicates which targets are initialized
  *
  *                              TAG and targets are consts, set at compile-time.
  *                              The remaining fields are copied values from the runtime
  *
- *    log_bits               -> These three fields are always written to memory.
+ *    log_bits               -> These fields are always written to memory.
  *    pwm_level              -> They describe the device driver state, and are thus
  *    ceiling_pwm            -> always written in.
+ *    heater_burst_runs      -> 0 is PWM, see the heater command
  *
  *                           -> Below this line, every fields are written only
  *                              if corrensponding driver is activated
@@ -43,9 +45,16 @@
  *
  *    pilot_is_enabled
  *    pilot_des_temp
+ *    pilot_pid              -> gains and period, see the pid command
+ *    pilot_profile          -> segments of the firing program, not how far it ran
  *
  *    mapper_is_enabled
  *    mapper_max_pwm_temp
+ *    mapper_map             -> PWM to temperature table, see pwm_map.h
+ *    mapper_steady          -> when a level counts as settled, see steady.h
+ *
+ *    thermo_regulate        -> sensor cur_temp follows, see the sensor command
+ *    thermo_model           -> fit and memory of the model command, see model.h
  *
  *  End of memory layout
  *
@@ -58,9 +67,13 @@
  *      log_bits
  *      pwm_level
  *      ceiling_pwm
+ *      heater_burst_runs
  *      pwm_water
  *      mapper_is_enabled
  *      mapper_max_pwm_temp
+ *      mapper_map
+ *      padding up to the last 8 bytes of the record
+ *      TAG                  -> again, written last, see below
  *
  *
  *
@@ -100,15 +113,19 @@
  *     the two sectors for each write.
  *
  *     Since the entries are of a fixed size, the algorithm treats memory as
- *     an array of flash pages, making it easier to iterate over entries.
+ *     an array of records, making it easier to iterate over entries.
+ *     A record is FLASH_RECORD_PAGES flash pages, as many as the data
+ *     needs. The pages of a record are programmed in order, so the TAG
+ *     closing it only shows up once the whole record made it to flash.
  *
  *
  *    Algorithm explanation:
  *
- *     For simplicity, assume each flash sector holds 3 flash pages
- *     (in reality, a sector holds 16 pages, as 4096 / 256 = 16).
+ *     For simplicity, assume each flash sector holds 3 records
+ *     (in reality, a sector holds 16 one page records, as 4096 / 256 = 16,
+ *      or 8 of two pages and so on).
  *
- *     Each row represents a flash page:
+ *     Each row represents a record:
  *     - A blank space ("[   ]") indicates default-initialized memory.
  *     - A " * " symbol indicates non-default data (valid entry or garbage).
  *
@@ -193,7 +210,7 @@
  *     The algorithm expects:
  *       * Sector_1.index == Sector_2.index
  *       * Sector_1.index == Sector_2.index + 1
- *       * Sector_1.index == 0 && Sector_2.index == FLASH_MAX_PAGE_INDEX
+ *       * Sector_1.index == 0 && Sector_2.index == FLASH_MAX_RECORD_INDEX
  *
  *     If these conditions are not met (e.g., Sector 1 is misaligned):
  *
@@ -209,11 +226,23 @@
 
 
 
-#define NUM_PAGES_PER_SECTOR (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
-#define FLASH_MAX_PAGE_INDEX (NUM_PAGES_PER_SECTOR - 1)
+/*
+ * Bumped whenever a field changes its size or meaning, so that a record
+ * written by an older firmware is not loaded as garbage.
+ *
+ *   1 - temperatures are temp_t (1/256 C) instead of whole degrees
+ *   2 - thermo_regulate
+ *   3 - pilot_pid
+ *   4 - pilot_profile
+ *   5 - mapper_map, records span several pages and end in a second TAG
+ *   6 - mapper_steady
+ *   7 - heater_burst_runs
+ *   8 - thermo_model
+ */
+#define FLASH_LAYOUT_VERSION 8
 
 // Identifier to distinguish between random bytes and our data in flash memory.
-#define TAG 0xAAAAAAAAAAAAAAAA
+#define TAG (0xAAAAAAAAAAAAAA00 | FLASH_LAYOUT_VERSION)
 
 // this symbol is defined in the linker script (memmap.ld)
 extern size_t
@@ -250,6 +279,7 @@ typedef struct __attribute__((packed))
   uint8_t            log_bits;
   uint8_t            pwm_level;
   int                ceiling_pwm;
+  uint8_t            heater_burst_runs;
 
 #if CONFIG_WATER
   uint8_t            pwm_water;
@@ -260,28 +290,46 @@ typedef struct __attribute__((packed))
   absolute_time_t    magnetron_deadline;
 #endif
 
-#if CONFIG_AUTO == CONFIG_AUTO_PILOT || CONFIG_AUTO == CONFIG_AUTO_MAPPER
+#if CONFIG_PILOT
   bool               pilot_is_enabled;
-  int                pilot_des_temp;
+  temp_t             pilot_des_temp;
+  pid_config_t       pilot_pid;
+  profile_program_t  pilot_profile;
 #endif
 
 #if CONFIG_AUTO == CONFIG_AUTO_MAPPER
   bool               mapper_is_enabled;
-  int                mapper_max_pwm_temp;
+  temp_t             mapper_max_pwm_temp;
+  pwm_map_t          mapper_map;
+  steady_config_t    mapper_steady;
+#endif
+
+#if CONFIG_THERMO
+  uint8_t            thermo_regulate;
+  model_params_t     thermo_model;
 #endif
 
 } flash_valid_data_t;
 
 #define FLASH_VALID_DATA_SIZE sizeof(flash_valid_data_t)
 
+/* A record takes as many whole pages as the data and the closing TAG need. */
+#define FLASH_RECORD_PAGES     ((FLASH_VALID_DATA_SIZE + sizeof(int64_t) + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE)
+#define FLASH_RECORD_SIZE      (FLASH_RECORD_PAGES * FLASH_PAGE_SIZE)
+#define NUM_RECORDS_PER_SECTOR (FLASH_SECTOR_SIZE / FLASH_RECORD_SIZE)
+#define FLASH_MAX_RECORD_INDEX (NUM_RECORDS_PER_SECTOR - 1)
+
 typedef struct __attribute__((packed))
 {
   flash_valid_data_t data;
-  uint8_t            padding[FLASH_PAGE_SIZE - FLASH_VALID_DATA_SIZE];
+  uint8_t            padding[FLASH_RECORD_SIZE - FLASH_VALID_DATA_SIZE - sizeof(int64_t)];
+  const int64_t      tail_tag; /* programmed last, a record cut short by power loss has none */
 } flash_data_t;
 
-// flash_data_t must be the same size as a page. It is required by the algorithm
-static_assert(sizeof(flash_data_t) == FLASH_PAGE_SIZE, "FLASH ERROR: sizeof(flash_data_t) != FLASH_PAGE_SIZE\n");
+// flash_data_t must be a whole number of pages. It is required by the algorithm
+static_assert(sizeof(flash_data_t) == FLASH_RECORD_SIZE, "FLASH ERROR: sizeof(flash_data_t) != FLASH_RECORD_SIZE\n");
+// current_index is an int8_t, and a sector has to take two records at least
+static_assert(NUM_RECORDS_PER_SECTOR >= 2 && NUM_RECORDS_PER_SECTOR <= 127, "FLASH ERROR: bad NUM_RECORDS_PER_SECTOR\n");
 
 typedef struct
 {
@@ -300,7 +348,7 @@ target = {
   .water = 1,
 #endif
 
-#if CONFIG_AUTO == CONFIG_AUTO_PILOT || CONFIG_AUTO == CONFIG_AUTO_MAPPER
+#if CONFIG_PILOT
   .pilot = 1,
 #endif
 
@@ -340,12 +388,13 @@ static flash_data_t flash_current =
   {
     .data.targets = target,
     .data.tag     = TAG,
+    .tail_tag     = TAG,
   };
 
 static bool
-flash_is_page_empty(const int8_t* ptr)
+flash_is_record_empty(const int8_t* ptr)
 {
-  for(int i = 0; i < FLASH_PAGE_SIZE; i++)
+  for(int i = 0; i < FLASH_RECORD_SIZE; i++)
   {
      if(*ptr != -1)
       return false;
@@ -362,14 +411,14 @@ flash_find_last_blocks()
   bool empty_1 = true;
   bool empty_2 = true;
 
-  for(int i = FLASH_MAX_PAGE_INDEX; i >= 0; i--)
+  for(int i = FLASH_MAX_RECORD_INDEX; i >= 0; i--)
   {
     const int8_t* ptr_1 = (int8_t*)&flash_ptr_1.ptr[i];
     const int8_t* ptr_2 = (int8_t*)&flash_ptr_2.ptr[i];
 
     if(empty_1)
     {
-      if(!flash_is_page_empty(ptr_1))
+      if(!flash_is_record_empty(ptr_1))
       {
         flash_ptr_1.current_index = i;
         empty_1 = false;
@@ -378,7 +427,7 @@ flash_find_last_blocks()
 
     if(empty_2)
     {
-      if(!flash_is_page_empty(ptr_2))
+      if(!flash_is_record_empty(ptr_2))
       {
         flash_ptr_2.current_index = i;
         empty_2 = false;
@@ -395,6 +444,8 @@ flash_read(flash_ptr_t* flash_ptr_, furnace_context_t* ctx)
   ctx->log_bits    = flash_ptr->log_bits;
   ctx->pwm_level   = flash_ptr->pwm_level;
   ctx->ceiling_pwm = flash_ptr->ceiling_pwm;
+  if (flash_ptr->heater_burst_runs <= BURST_CYCLES)
+    ctx->burst.runs = flash_ptr->heater_burst_runs;
 
 #if CONFIG_WATER
   ctx->pwm_water = flash_ptr->pwm_water;
@@ -405,14 +456,30 @@ flash_read(flash_ptr_t* flash_ptr_, furnace_context_t* ctx)
   ctx->magnetron_deadline = flash_ptr->magnetron_deadline;
 #endif
 
-#if CONFIG_AUTO == CONFIG_AUTO_PILOT || CONFIG_AUTO == CONFIG_AUTO_MAPPER
+#if CONFIG_PILOT
   ctx->pilot.des_temp   = flash_ptr->pilot_des_temp;
   ctx->pilot.is_enabled = flash_ptr->pilot_is_enabled;
+  pid_configure(&ctx->pilot.pid, &flash_ptr->pilot_pid);
+  if (flash_ptr->pilot_profile.count <= PROFILE_SEGMENTS_MAX)
+    ctx->profile.engine.program = flash_ptr->pilot_profile;
 #endif
 
 #if CONFIG_AUTO == CONFIG_AUTO_MAPPER
   ctx->mapper.max_pwm_temp = flash_ptr->mapper_max_pwm_temp;
   ctx->mapper.is_enabled   = flash_ptr->mapper_is_enabled;
+  ctx->mapper.map          = flash_ptr->mapper_map;
+  if (steady_config_valid(&flash_ptr->mapper_steady))
+    ctx->mapper.steady_config = flash_ptr->mapper_steady;
+#endif
+
+#if CONFIG_THERMO
+  /* Written by a build with more sensors fitted, maybe. */
+  if (flash_ptr->thermo_regulate < THERMO_SENSORS)
+    ctx->thermo.regulate = flash_ptr->thermo_regulate;
+  if (model_params_valid(&flash_ptr->thermo_model)) {
+    ctx->model.saved = flash_ptr->thermo_model;
+    model_restore(&ctx->model.model, &ctx->model.saved);
+  }
 #endif
 }
 
@@ -444,9 +511,9 @@ flash_fix_blocks()
    * These invalid states may result from power loss.
    */
 
-  // if index_2 == FLASH_MAX_PAGE_INDEX, index_1 is expected to be -1 (data not found)
-  if(index_1 == FLASH_MAX_PAGE_INDEX &&
-     index_2 == FLASH_MAX_PAGE_INDEX)
+  // if index_2 == FLASH_MAX_RECORD_INDEX, index_1 is expected to be -1 (data not found)
+  if(index_1 == FLASH_MAX_RECORD_INDEX &&
+     index_2 == FLASH_MAX_RECORD_INDEX)
   {
      flash_clear_sector(flash_ptr_1.ptr);
      flash_ptr_1.current_index = -1;
@@ -455,7 +522,7 @@ flash_fix_blocks()
 
   // if index_1 == 0, index_2 is expected to be -1 (data not found)
   if(index_1 == 0 &&
-     index_2 == FLASH_MAX_PAGE_INDEX)
+     index_2 == FLASH_MAX_RECORD_INDEX)
   {
      flash_clear_sector(flash_ptr_2.ptr);
      flash_ptr_2.current_index = -1;
@@ -467,7 +534,7 @@ flash_fix_blocks()
    */
   if( index_1 == index_2                               ||
       index_1 == index_2 + 1                           ||
-      (index_1 == -1 && index_2 == FLASH_MAX_PAGE_INDEX)
+      (index_1 == -1 && index_2 == FLASH_MAX_RECORD_INDEX)
      )
   {
      return;
@@ -496,6 +563,7 @@ flash_validate_blocks()
   if(f1_index != -1)
   {
     if(flash_ptr_1.ptr[f1_index].data.tag                 == TAG &&
+       flash_ptr_1.ptr[f1_index].tail_tag                 == TAG &&
        flash_ptr_1.ptr[f1_index].data.targets.as_unsigned == target.as_unsigned)
     {
       valid = VALID_1;
@@ -505,6 +573,7 @@ flash_validate_blocks()
   if(f2_index != -1)
   {
     if(flash_ptr_2.ptr[f2_index].data.tag                 == TAG &&
+       flash_ptr_2.ptr[f2_index].tail_tag                 == TAG &&
        flash_ptr_2.ptr[f2_index].data.targets.as_unsigned == target.as_unsigned)
     {
       if(valid == VALID_1)
@@ -523,6 +592,7 @@ flash_update_lookup(flash_valid_data_t* lookup, furnace_context_t* ctx)
   lookup->log_bits    = ctx->log_bits;
   lookup->pwm_level   = ctx->pwm_level;
   lookup->ceiling_pwm = ctx->ceiling_pwm;
+  lookup->heater_burst_runs = ctx->burst.runs;
 
 #if CONFIG_WATER
   lookup->pwm_water = ctx->pwm_water;
@@ -533,14 +603,23 @@ flash_update_lookup(flash_valid_data_t* lookup, furnace_context_t* ctx)
   lookup->magnetron_deadline    = ctx->magnetron_deadline;
 #endif
 
-#if CONFIG_AUTO == CONFIG_AUTO_PILOT || CONFIG_AUTO == CONFIG_AUTO_MAPPER
+#if CONFIG_PILOT
   lookup->pilot_is_enabled = ctx->pilot.is_enabled;
   lookup->pilot_des_temp   = ctx->pilot.des_temp;
+  lookup->pilot_pid        = ctx->pilot.pid.config;
+  lookup->pilot_profile    = ctx->profile.engine.program;
 #endif
 
 #if CONFIG_AUTO == CONFIG_AUTO_MAPPER
   lookup->mapper_is_enabled   = ctx->mapper.is_enabled;
   lookup->mapper_max_pwm_temp = ctx->mapper.max_pwm_temp;
+  lookup->mapper_map          = ctx->mapper.map;
+  lookup->mapper_steady       = ctx->mapper.steady_config;
+#endif
+
+#if CONFIG_THERMO
+  lookup->thermo_regulate = ctx->thermo.regulate;
+  lookup->thermo_model    = ctx->model.saved;
 #endif
 
 }
@@ -551,7 +630,7 @@ flash_write_(flash_ptr_t* flash_ptr)
   const uint32_t ints = save_and_disable_interrupts();
 
   flash_range_program((uint32_t)&flash_ptr->ptr[flash_ptr->current_index] - XIP_BASE,
-                       (uint8_t*)&flash_current, FLASH_PAGE_SIZE);
+                       (uint8_t*)&flash_current, FLASH_RECORD_SIZE);
 
   restore_interrupts(ints);
 }
@@ -562,19 +641,19 @@ flash_write()
   if(flash_ptr_1.current_index == flash_ptr_2.current_index)
   {
     flash_ptr_1.current_index++;
-    flash_ptr_1.current_index %= NUM_PAGES_PER_SECTOR;
+    flash_ptr_1.current_index %= NUM_RECORDS_PER_SECTOR;
     flash_write_(&flash_ptr_1);
 
-    if(flash_ptr_2.current_index == FLASH_MAX_PAGE_INDEX)
+    if(flash_ptr_2.current_index == FLASH_MAX_RECORD_INDEX)
       flash_clear_sector(flash_ptr_2.ptr);
   }
   else
   {
     flash_ptr_2.current_index++;
-    flash_ptr_2.current_index %= NUM_PAGES_PER_SECTOR;
+    flash_ptr_2.current_index %= NUM_RECORDS_PER_SECTOR;
     flash_write_(&flash_ptr_2);
 
-    if(flash_ptr_1.current_index == FLASH_MAX_PAGE_INDEX)
+    if(flash_ptr_1.current_index == FLASH_MAX_RECORD_INDEX)
       flash_clear_sector(flash_ptr_1.ptr);
   }
 }
@@ -600,7 +679,7 @@ init_flash(furnace_context_t* ctx)
       // We can read from this if:
       // flash_ptr_1.current_index == flash_ptr_2.current_index ||
       // flash_ptr_1.current_index == -1 &&
-      //   flash_ptr_2.current_index == FLASH_MAX_PAGE_INDEX
+      //   flash_ptr_2.current_index == FLASH_MAX_RECORD_INDEX
 
       if(flash_ptr_1.current_index <= flash_ptr_2.current_index)
          flash_read(&flash_ptr_2, ctx);
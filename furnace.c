@@ -5,8 +5,12 @@
 #include "pico/bootrom.h"
 #include "pico/cyw43_arch.h"
 #include "pico/stdlib.h"
+#if CONFIG_MULTICORE
+  #include "pico/multicore.h"
+#endif
 
 #include "hardware/spi.h"
+#include "hardware/sync.h"
 
 #include "lwip/pbuf.h"
 #include "lwip/tcp.h"
@@ -16,6 +20,7 @@
   #include "max318xx.h"
 #endif
 #include "logger.h"
+#include "stats.h"
 
 #if CONFIG_FLASH
   #include "flash_io.h"
@@ -88,7 +93,19 @@ tcp_server_send_data(furnace_context_t* ctx,
                      const uint8_t*     data,
                      u16_t              size)
 {
-  return tcp_write(tpcb, data, size, TCP_WRITE_FLAG_COPY);
+  /* A segment at a time, anything longer doesn't get through the heap in one piece. */
+  while (size > 0) {
+    const u16_t chunk = size > TCP_MSS ? TCP_MSS : size;
+    const err_t err   = tcp_write(tpcb, data, chunk, TCP_WRITE_FLAG_COPY);
+
+    if (err != ERR_OK)
+      return err;
+
+    data += chunk;
+    size -= chunk;
+  }
+
+  return ERR_OK;
 }
 
 static void
@@ -111,690 +128,3686 @@ tcp_server_recv_(furnace_context_t *ctx, struct tcp_pcb* tpcb, struct pbuf* p)
   tcp_recved(tpcb, p->tot_len);
 }
 
-#if CONFIG_WATER
-static void
-handle_command_water(furnace_context_t* ctx, void (*feedback)(const char *, const size_t), unsigned arg) {
-    const int res = set_pwm_safe(WATER_PIN, ctx, arg);
-
-    if(res == 0)
-      return;
+/*
+ * Hands a command over to the control path. Returns false if the control
+ * path is not keeping up and the inbox is full.
+ */
+static bool
+control_post(furnace_context_t* ctx, uint8_t op, unsigned arg)
+{
+  const control_msg_t msg = { .op = op, .arg = arg };
 
-    if (res  == 1){
-      const char msg[] = "water pwm argument too big!\r\n";
-      const size_t msg_len = sizeof(msg)-1;
-      feedback(msg, msg_len);
-      return;
-    }
+  if (!spsc_push(&ctx->control.inbox, &msg))
+    return false;
 
-    if(res == -1){
-      const char msg[] = "set_pwm_safe: unexpected pin argument!\r\n";
-      const size_t msg_len = sizeof(msg)-1;
-      feedback(msg, msg_len);
-      return;
-    }
+  /* Wake the control path up if it is waiting for an event. */
+  __sev();
 
-    const char msg[] = "set_pwm_safe: unexpected return value!\r\n";
-    const size_t msg_len = sizeof(msg)-1;
-    feedback(msg, msg_len);
+  return true;
 }
-#endif
 
-static int
-set_max_pwm_safe(furnace_context_t *ctx, int new_max_pwm)
+/*
+ * Core0 reads control path state that spans more than a word between
+ * these two, and goes again while control_read_retry says it changed
+ * under it: copy it out, check, then use the copy.
+ *
+ *   do {
+ *     seq = control_read_begin(ctx);
+ *     pid = ctx->pilot.pid;
+ *   } while (control_read_retry(ctx, seq));
+ */
+static uint32_t
+control_read_begin(furnace_context_t* ctx)
 {
-    if (new_max_pwm > MAX_PWM)
-      return 1;
+  uint32_t seq;
 
-    if (ctx->pwm_level > new_max_pwm)
-      ctx->pwm_level = new_max_pwm;
-
-    ctx->ceiling_pwm = new_max_pwm;
+  /* A pass takes microseconds, and the copy has to be after it anyway. */
+  while ((seq = __atomic_load_n(&ctx->control.seq, __ATOMIC_ACQUIRE)) & 1)
+    tight_loop_contents();
 
-    return 0;
+  return seq;
 }
 
-#if CONFIG_STIRRER
-static void
-set_stirrer(bool opt)
+static bool
+control_read_retry(furnace_context_t* ctx, uint32_t seq)
 {
-  gpio_put(STIRRER_PIN, opt);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+  return __atomic_load_n(&ctx->control.seq, __ATOMIC_RELAXED) != seq;
 }
-#endif
 
 static void
-command_handler(furnace_context_t* ctx, uint8_t* buffer, void (*feedback)(const char*, const size_t))
+command_post(furnace_context_t* ctx, void (*feedback)(const char *, const size_t), uint8_t op, unsigned arg)
 {
-  unsigned arg;
-  char     str_arg[BUF_SIZE];
+  if (control_post(ctx, op, arg))
+    return;
 
-  if (buffer[0] == '\n') return;
+  const char msg[] = "control loop busy, command dropped!\r\n";
+  const size_t msg_len = sizeof(msg)-1;
+  feedback(msg, msg_len);
+}
 
-  if (memcmp(buffer, "reboot", 6) == 0) {
-    reset_usb_boot(0,0);
-  } else if (sscanf(buffer, "max_pwm %u", &arg) == 1) {
-    const int res = set_max_pwm_safe(ctx, arg);
-    if (res == 1) {
-      const char msg[] = "pwm argument too big!\r\n";
+#if CONFIG_WATER
+static void
+handle_command_water(furnace_context_t* ctx, void (*feedback)(const char *, const size_t), unsigned arg) {
+    if (arg > MAX_PWM) {
+      const char msg[] = "water pwm argument too big!\r\n";
       const size_t msg_len = sizeof(msg)-1;
       feedback(msg, msg_len);
+      return;
     }
-  } else if (strncmp(buffer, "pwm\n", 4) == 0) {
-      char msg[16];
-      const size_t msg_len = snprintf(msg, sizeof(msg), "pwm = %d\r\n", ctx->pwm_level);
-      feedback(msg, msg_len);
-  } else if (sscanf(buffer, "pwm %u", &arg) == 1) {
-    const int res= set_pwm_safe(FURNACE_FIRE_PIN, ctx, arg);
-    if (res == 0){
-#if CONFIG_AUTO == CONFIG_AUTO_PILOT || CONFIG_AUTO == CONFIG_AUTO_MAPPER
-      ctx->pilot.is_enabled = 0;
+
+    command_post(ctx, feedback, CONTROL_WATER, arg);
+}
 #endif
-    } else if ( res == 1){
-      const char msg[] = "pwm argument too big!\r\n";
-      const size_t msg_len = sizeof(msg)-1;
-      feedback(msg, msg_len);
-    } else if ( res == -1){
-      const char msg[] = "set_pwm_safe: unexpected pin argument!\r\n";
-      const size_t msg_len = sizeof(msg)-1;
-      feedback(msg, msg_len);
-    } else {
-      const char msg[] = "set_pwm_safe: unexpected return value!\r\n";
-      const size_t msg_len = sizeof(msg)-1;
-      feedback(msg, msg_len);
-    }
+
+#if CONFIG_THERMO
+/* Fastest a period of the sample command may go and the longest one. */
+#define SAMPLE_PERIOD_MIN_MS MAX318xx_CONVERSION_MS
+#define SAMPLE_PERIOD_MAX_MS 60000
+#define SAMPLE_REJECT_MAX    100
+
+static void
+handle_command_sample(furnace_context_t* ctx, void (*feedback)(const char *, const size_t),
+                      const char* name, unsigned arg)
+{
+  const char*     error = NULL;
+  uint8_t         op;
+  sample_config_t config;
+  uint32_t        seq;
+
+  do {
+    seq    = control_read_begin(ctx);
+    config = ctx->thermo.sensors[0].pipe.config;
+  } while (control_read_retry(ctx, seq));
+
+  if (strcmp(name, "period") == 0) {
+    op = CONTROL_SAMPLE_PERIOD;
+    if (arg < SAMPLE_PERIOD_MIN_MS || arg > SAMPLE_PERIOD_MAX_MS)
+      error = "sample period needs to be " STR(SAMPLE_PERIOD_MIN_MS) " to " STR(SAMPLE_PERIOD_MAX_MS) " ms\r\n";
+  } else if (strcmp(name, "median") == 0) {
+    op = CONTROL_SAMPLE_MEDIAN;
+    if (arg < 1 || arg > SAMPLE_MEDIAN_MAX || arg % 2 == 0)
+      error = "sample median needs to be odd, 1 to " STR(SAMPLE_MEDIAN_MAX) "\r\n";
+    else if (arg == 1 && config.reject)
+      error = "sample reject needs a median of 3 or more, set reject 0 first\r\n";
+  } else if (strcmp(name, "ema") == 0) {
+    op = CONTROL_SAMPLE_EMA;
+    if (arg > SAMPLE_EMA_MAX)
+      error = "sample ema needs to be 0 to " STR(SAMPLE_EMA_MAX) "\r\n";
+  } else if (strcmp(name, "decimate") == 0) {
+    op = CONTROL_SAMPLE_DECIMATE;
+    if (arg < 1 || arg > SAMPLE_DECIMATE_MAX)
+      error = "sample decimate needs to be 1 to " STR(SAMPLE_DECIMATE_MAX) "\r\n";
+  } else if (strcmp(name, "reject") == 0) {
+    op  = CONTROL_SAMPLE_REJECT;
+    if (arg > SAMPLE_REJECT_MAX)
+      error = "sample reject needs to be 0 to " STR(SAMPLE_REJECT_MAX) " C\r\n";
+    else if (arg && config.median < 3)
+      error = "sample reject needs a median of 3 or more\r\n";
+    arg = TEMP_C(arg);
+  } else {
+    error = "unknown sample option!\r\n";
   }
-#if CONFIG_AUTO == CONFIG_AUTO_PILOT
-  else if (strncmp(buffer, "auto\n", 5) == 0) {
-      char msg[16];
-      const size_t msg_len = snprintf(msg, sizeof(msg), "auto = %d\r\n", ctx->pilot.is_enabled);
-      feedback(msg, msg_len);
-  } else if (sscanf(buffer, "auto %u", &arg) == 1) {
-    if (arg > 1) {
-      const char msg[] = "auto argument needs to be 0 or 1\r\n";
-      const size_t msg_len = sizeof(msg)-1;
-      feedback(msg, msg_len);
-    } else {
-      ctx->pilot.is_enabled = arg;
-    }
-  } else if (sscanf(buffer, "temp %u", &arg) == 1) {
-    if (arg > MAX_TEMP) {
-      const char msg[] = "temp argument too big!\r\n";
-      const size_t msg_len = sizeof(msg)-1;
-      feedback(msg, msg_len);
-    } else {
-      ctx->pilot.des_temp = arg;
+
+  if (error) {
+    feedback(error, strlen(error));
+    return;
+  }
+
+  command_post(ctx, feedback, op, arg);
+}
+
+static void
+print_sample(furnace_context_t* ctx, void (*feedback)(const char *, const size_t))
+{
+  sample_config_t config;
+  uint32_t        samples[THERMO_SENSORS], rejected[THERMO_SENSORS];
+  uint32_t        seq;
+  char msg[128];
+
+  do {
+    seq    = control_read_begin(ctx);
+    config = ctx->thermo.sensors[0].pipe.config;
+
+    for (unsigned i = 0; i < THERMO_SENSORS; i++) {
+      samples[i]  = ctx->thermo.sensors[i].pipe.samples;
+      rejected[i] = ctx->thermo.sensors[i].pipe.rejected;
     }
-  } else if (strncmp(buffer, "temp\n", 5) == 0) {
-    char msg[16];
-    const size_t msg_len = snprintf(msg, sizeof(msg), "temp = %d\r\n", ctx->pilot.des_temp);
+  } while (control_read_retry(ctx, seq));
+
+  size_t msg_len = snprintf(msg, sizeof(msg),
+                            "period = %u ms\r\n"
+                            "median = %u\r\n"
+                            "ema = %u\r\n"
+                            "decimate = %u\r\n"
+                            "reject = " TEMP_FMT "\r\n",
+                            config.period_ms, config.median,
+                            config.ema_shift, config.decimate,
+                            TEMP_ARGS(config.reject));
+  feedback(msg, msg_len);
+
+  for (unsigned i = 0; i < THERMO_SENSORS; i++) {
+    msg_len = snprintf(msg, sizeof(msg), "%s: samples = %u, rejected %u\r\n",
+                       max318xx_sensors[i].name,
+                       (unsigned) samples[i], (unsigned) rejected[i]);
     feedback(msg, msg_len);
   }
-#endif
-  else if (sscanf(buffer, "log %" STR(BUF_SIZE) "s %u", &str_arg, &arg) == 2) {
-    if(arg >= 2) {
-      const char msg[] = "log value too big!\r\n";
-      const size_t msg_len = sizeof(msg)-1;
-      feedback(msg, msg_len);
-    } else {
-      set_log(str_arg, arg, &ctx->log_bits);
+}
+
+static void
+print_sensors(furnace_context_t* ctx, void (*feedback)(const char *, const size_t))
+{
+  temp_t          temp[THERMO_SENSORS];
+  absolute_time_t sample_at[THERMO_SENSORS];
+  uint8_t         faults[THERMO_SENSORS];
+  uint8_t         regulate;
+  uint32_t        seq;
+  char msg[96];
+
+  do {
+    seq      = control_read_begin(ctx);
+    regulate = ctx->thermo.regulate;
+
+    for (unsigned i = 0; i < THERMO_SENSORS; i++) {
+      temp[i]      = ctx->thermo.sensors[i].temp;
+      sample_at[i] = ctx->thermo.sensors[i].sample_at;
+      faults[i]    = ctx->thermo.sensors[i].snapshot.faults;
     }
-  } else if (strncmp(buffer, "log\n", 4) == 0) {
-    char msg[LOG_MSG_BUFFER_SIZE];
-    const size_t msg_len = get_logs(msg, ctx->log_bits);
-    feedback(msg, msg_len);
-  } else if(memcmp(buffer, "help\n", 5) == 0) {
+  } while (control_read_retry(ctx, seq));
 
-    const char msg[] = "help              \t\t shows this message\n"
-                        "reboot            \t\t reboot device\n"
-                        "pwm <0;50>        \t\t sets pwm\n"
-                        "pwm               \t\t prints current pwm level\n"
-                        "max_pwm <0;50>    \t\t sets max pwm level.\n"
-                        "                  \t\t\t Device will never exceed this pwm value\n"
-#if CONFIG_THERMO && CONFIG_AUTO == CONFIG_AUTO_PILOT
-                        "temp <0;" STR(MAX_TEMP) ">     \t\t sets wanted temperature\n"
-                        "temp              \t\t shows current wanted temperature\n"
-                        "auto <0;1>        \t\t sets automatic pwm control, it is\n"
-                        "                  \t\t reaching temperature set by 'temp' command\n"
-                        "                  \t\t\t 0 - off\n"
-                        "                  \t\t\t 1 - on\n"
-                        "auto              \t\t shows current auto status\n"
-#endif
-#if CONFIG_MAGNETRON
-                        "pulse <0:127>     \t\t starts pulses of magnetron\n"
-#endif
-#if CONFIG_WATER
-                        "water <0:10>      \t\t sets pwm duty of water channel\n"
-                        "water             \t\t shows current water pwm\n"
-#endif
-#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
-                        "map <0;1>         \t\t sets automatic pwm mapping, it is\n"
-                        "                  \t\t checking max temperature on every pwm\n"
-                        "                  \t\t\t 0 - off\n"
-                        "                  \t\t\t 1 - on\n"
-                        "map               \t\t shows current map status\n"
-#endif
-#if CONFIG_STIRRER
-                        "stir <0;1>        \t\t turns on the stirring cap for beaker\n"
-                        "                  \t\t\t 0 - off\n"
-                        "                  \t\t\t 1 - on\n"
-#endif
-                        "log <option> <0;1>\t\t sets output level on stdio\n"
-                        "                  \t\t\t options:\n"
-                        "                  \t\t\t\t server,\n"
-                        "                  \t\t\t\t thermocouple,\n"
-                        "                  \t\t\t\t basic\n"
-                        "                  \t\t\t 0 - off\n"
-                        "                  \t\t\t 1 - on\n"
-                        "log               \t\t prints names of turned on log options\n";
-    const size_t msg_len = sizeof(msg)-1;
+  const absolute_time_t now = get_absolute_time();
+
+  for (unsigned i = 0; i < THERMO_SENSORS; i++) {
+    const size_t msg_len = snprintf(msg, sizeof(msg), "%u %s = " TEMP_FMT " (%u ms old), %s%s\r\n",
+                                    i, max318xx_sensors[i].name, TEMP_ARGS(temp[i]),
+                                    (unsigned) (absolute_time_diff_us(sample_at[i], now) / 1000),
+                                    max318xx_fault_name(faults[i]),
+                                    i == regulate ? ", regulating" : "");
     feedback(msg, msg_len);
   }
-#if CONFIG_MAGNETRON
-  else if(sscanf(buffer, "pulse %u", &arg) == 1) {
-    if(arg > 127){
-      const char msg[] = "pulse value too big!\r\n";
-      const size_t msg_len = sizeof(msg)-1;
-      feedback(msg, msg_len);
-    } else {
-      ctx->pulse_count = arg*2;
+}
+
+/* Picks the sensor cur_temp follows, by name or by number. */
+static void
+handle_command_sensor(furnace_context_t* ctx, void (*feedback)(const char *, const size_t),
+                      const char* name)
+{
+  char*          end;
+  const unsigned index = strtoul(name, &end, 10);
+
+  for (unsigned i = 0; i < THERMO_SENSORS; i++) {
+    if ((*end == '\0' && end != name && index == i) || strcmp(name, max318xx_sensors[i].name) == 0) {
+      command_post(ctx, feedback, CONTROL_SENSOR, i);
+      return;
     }
   }
+
+  const char msg[] = "unknown sensor!\r\n";
+  const size_t msg_len = sizeof(msg)-1;
+  feedback(msg, msg_len);
+}
 #endif
-#if CONFIG_WATER
-  else if(sscanf(buffer, "water %u", &arg) == 1) {
-    handle_command_water(ctx, feedback, arg);
-  } else if(memcmp(buffer, "water\n", 6) == 0){
-    char msg[16];
-    const size_t msg_len = snprintf(msg, sizeof(msg), "water = %d\r\n", ctx->pwm_water);
-    feedback(msg, msg_len);
-  }
-#endif
-#if CONFIG_SHUTTER
-  else if(sscanf(buffer, "shutter %u", &arg) == 1){
-    if(arg > MAX_SHUTTER_MS){
-      const char msg[] = "time argument too big !!!\r\n";
-      const size_t msg_len = sizeof(msg)-1;
-      feedback(msg, msg_len);
-    } else if(ctx->shutter.time_ms == 0){
-      ctx->shutter.time_ms = arg;
-    } else{
-      const char msg[] = "shutter already in work \n";
-      const size_t msg_len = sizeof(msg)-1;
-      feedback(msg, msg_len);
-    }
-  } else if(sscanf(buffer, "shutter %s", str_arg) == 1) {
-    if(strncmp(str_arg, "on", 2) == 0){
-      ctx->shutter.time_ms = 1;
-      ctx->shutter.intern_state = SHUTTER_ON_OPTION;
-    }else if((strncmp(str_arg, "off", 3) == 0)){
-      ctx->shutter.time_ms = 1;
-      ctx->shutter.intern_state = SHUTTER_OFF_OPTION;
-    }
+
+#if CONFIG_THERMO || CONFIG_PILOT
+/* "4", "4.5" or "0.125" to thousandths, false if it isn't such a number. */
+static bool
+parse_milli(const char* str, unsigned* milli)
+{
+  unsigned whole = 0, frac = 0, scale = 1000;
+
+  if (*str < '0' || *str > '9')
+    return false;
+
+  for (; *str >= '0' && *str <= '9'; str++) {
+    whole = whole * 10 + (*str - '0');
+    if (whole > UINT32_MAX / 1000)
+      return false;
   }
-#endif
-#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
-  else if(sscanf(buffer, "map %u", &arg) == 1) {
-    if(arg > 1){
-      const char msg[] = "map argument needs to be 0 or 1\r\n";
-      const size_t msg_len = sizeof(msg)-1;
-      feedback(msg, msg_len);
-    } else {
-      if(ctx->cur_temp >= 40){
-        const char msg[] = "map can be started only at temperatures lower than 40\r\n";
-        const size_t msg_len = sizeof(msg)-1;
-        feedback(msg, msg_len);
-      } else {
-        ctx->pwm_level = 0;
-        ctx->pilot.is_enabled = false;
-        ctx->mapper.is_enabled = arg;
+
+  if (*str == '.') {
+    for (str++; *str >= '0' && *str <= '9'; str++) {
+      if (scale > 1) {
+        scale /= 10;
+        frac += (*str - '0') * scale;
       }
     }
-  } else if(strncmp(buffer, "map\n", 4) == 0) {
-      char msg[16];
-      const size_t msg_len = snprintf(msg, sizeof(msg), "map = %d\r\n", ctx->mapper.is_enabled);
-      feedback(msg, msg_len);
-  }
-#endif
-#if CONFIG_STIRRER
-  else if(sscanf(buffer, "stir %u", &arg) == 1){
-    if(arg > 1){
-      const char msg[] = "stir argument needs to be 0 or 1\r\n";
-      const size_t msg_len = sizeof(msg)-1;
-      feedback(msg, msg_len);
-    } else {
-      set_stirrer((bool) arg);
-    }
   }
-#endif
+
+  if (*str != '\0')
+    return false;
+
+  *milli = whole * 1000 + frac;
+
+  return true;
 }
+#endif
 
+#if CONFIG_THERMO
 static void
-tcp_command_handler(furnace_context_t* ctx, struct tcp_pcb* tpcb)
+handle_command_estimate(furnace_context_t* ctx, void (*feedback)(const char *, const size_t),
+                        const char* name, const char* value)
 {
-  void
-  send(const char* msg, const size_t msg_len)
-  {
-    tcp_server_send_data(ctx, tpcb, msg, msg_len);
+  const char* error = NULL;
+  unsigned    arg;
+  uint8_t     op;
+
+  if (strcmp(name, "alpha") == 0) {
+    op = CONTROL_ESTIMATE_ALPHA;
+    if (!parse_milli(value, &arg) || arg < ESTIMATOR_ALPHA_MIN || arg > ESTIMATOR_ALPHA_MAX)
+      error = "estimate alpha needs to be 0.001 to 1\r\n";
+  } else if (strcmp(name, "gain") == 0) {
+    op = CONTROL_ESTIMATE_GAIN;
+    if (!parse_milli(value, &arg) || arg > ESTIMATOR_GAIN_MAX_C * 1000)
+      error = "estimate gain needs to be 0 to " STR(ESTIMATOR_GAIN_MAX_C) " C/h per pwm level\r\n";
+  } else {
+    error = "unknown estimate option!\r\n";
   }
 
-  command_handler(ctx, ctx->tcp.recv_buffer, &send);
+  if (error) {
+    feedback(error, strlen(error));
+    return;
+  }
+
+  command_post(ctx, feedback, op, arg);
 }
 
-static err_t
-tcp_server_recv(void* ctx_, struct tcp_pcb* tpcb, struct pbuf* p, err_t err)
+static void
+print_estimate(furnace_context_t* ctx, void (*feedback)(const char *, const size_t))
 {
-  furnace_context_t *ctx = (furnace_context_t*)ctx_;
+  estimator_t est;
+  uint32_t    seq;
+  char msg[160];
+
+  do {
+    seq = control_read_begin(ctx);
+    est = ctx->thermo.estimator;
+  } while (control_read_retry(ctx, seq));
+
+  const int32_t rate = estimator_rate(&est);
+  const temp_t  temp = estimator_temp(&est);
+
+  const size_t msg_len = snprintf(msg, sizeof(msg),
+                                  "temp = " TEMP_FMT " C\r\n"
+                                  "rate = " TEMP_FMT " C/h\r\n"
+                                  "alpha = %u.%03u\r\n"
+                                  "gain = %u.%03u C/h per pwm level\r\n",
+                                  TEMP_ARGS(temp), TEMP_ARGS(rate),
+                                  est.config.alpha / 1000, est.config.alpha % 1000,
+                                  (unsigned) est.config.gain / 1000,
+                                  (unsigned) est.config.gain % 1000);
+  feedback(msg, msg_len);
+}
 
-  if (!p) {
-    tcp_server_close(ctx);
-    return err;
+static void
+print_model(furnace_context_t* ctx, void (*feedback)(const char *, const size_t))
+{
+  /* Too big for the stack, and core0 is the only one printing. */
+  static model_t model;
+  model_fopdt_t  fit;
+  uint32_t       seq;
+  char msg[200];
+  size_t msg_len;
+
+  do {
+    seq   = control_read_begin(ctx);
+    model = ctx->model.model;
+  } while (control_read_retry(ctx, seq));
+
+  if (model_get(&model, &fit)) {
+    msg_len = snprintf(msg, sizeof(msg),
+                       "gain = " TEMP_FMT " C per pwm level\r\n"
+                       "time constant = %u s\r\n"
+                       "dead time = %u s\r\n"
+                       "ambient = " TEMP_FMT " C\r\n"
+                       "error = " TEMP_FMT " C per minute\r\n",
+                       TEMP_ARGS(fit.gain), (unsigned) fit.tau_s, (unsigned) fit.dead_s,
+                       TEMP_ARGS(fit.ambient), TEMP_ARGS(model_error(&model)));
+  } else {
+    msg_len = snprintf(msg, sizeof(msg), "no model yet\r\n");
   }
 
-  tcp_server_recv_(ctx, tpcb, p);
-  //We are expecting only strings, we can manually terminate the string
-  ctx->tcp.recv_buffer[p->tot_len] = '\0';
+  msg_len += snprintf(msg + msg_len, sizeof(msg) - msg_len,
+                      "updates = %u\r\n"
+                      "memory = %u min\r\n",
+                      (unsigned) model.updates, model.memory_min);
+  feedback(msg, msg_len);
+}
+#endif
 
-  pbuf_free(p);
+#if CONFIG_AUTO == CONFIG_AUTO_MPC
+static void
+print_mpc(furnace_context_t* ctx, void (*feedback)(const char *, const size_t))
+{
+  static mpc_t mpc;
+  uint32_t     seq;
+  char msg[200];
+  size_t msg_len;
+
+  do {
+    seq = control_read_begin(ctx);
+    mpc = ctx->pilot.mpc;
+  } while (control_read_retry(ctx, seq));
+
+  if (mpc.primed) {
+    msg_len = snprintf(msg, sizeof(msg),
+                       "output = " PWM_FINE_FMT "\r\n"
+                       "predicted = " TEMP_FMT " C in %u s\r\n"
+                       "offset = " TEMP_FMT " C off the model\r\n"
+                       "limited by = %s\r\n",
+                       PWM_FINE_ARGS(mpc.inputs[mpc.head]),
+                       TEMP_ARGS(mpc.predicted),
+                       (unsigned) ((mpc.delay + MPC_HORIZON) * MPC_PERIOD_MS / 1000),
+                       TEMP_ARGS(mpc.offset), mpc_bound_name(mpc.bound));
+  } else {
+    msg_len = snprintf(msg, sizeof(msg), "no model yet, the pid has the heater\r\n");
+  }
 
-  // Echo back for debugging
-  // tcp_server_send_data(ctx, tpcb, ctx->recv_buffer, ctx->recv_len);
+  msg_len += snprintf(msg + msg_len, sizeof(msg) - msg_len,
+                      "rate = %u C/h\r\n", mpc.rate_max);
+  feedback(msg, msg_len);
+}
+#endif
 
-  tcp_command_handler(ctx, tpcb);
+#if CONFIG_PILOT
 
-  log_stdout_server(ctx->log_bits, "tcp_server_recv: %.*s\n", p->tot_len, ctx->tcp.recv_buffer);
+static void
+handle_command_pid(furnace_context_t* ctx, void (*feedback)(const char *, const size_t),
+                   const char* name, const char* value)
+{
+  const char* error = NULL;
+  unsigned    arg;
+  uint8_t     op;
+
+  if (strcmp(name, "kp") == 0) {
+    op = CONTROL_PID_KP;
+    if (!parse_milli(value, &arg) || arg > PID_KP_MAX)
+      error = "pid kp needs to be 0 to " STR(PID_KP_MAX_LEVELS) ", e.g. 2.5\r\n";
+  } else if (strcmp(name, "ti") == 0 || strcmp(name, "td") == 0) {
+    op = name[1] == 'i' ? CONTROL_PID_TI : CONTROL_PID_TD;
+    if (sscanf(value, "%u", &arg) != 1 || arg > PID_TIME_MAX_S)
+      error = "pid ti and td need to be 0 to " STR(PID_TIME_MAX_S) " s\r\n";
+  } else if (strcmp(name, "period") == 0) {
+    op = CONTROL_PID_PERIOD;
+    if (sscanf(value, "%u", &arg) != 1 || arg < PID_PERIOD_MIN_MS || arg > PID_PERIOD_MAX_MS)
+      error = "pid period needs to be " STR(PID_PERIOD_MIN_MS) " to " STR(PID_PERIOD_MAX_MS) " ms\r\n";
+  } else {
+    error = "unknown pid option!\r\n";
+  }
 
-  return ERR_OK;
+  if (error) {
+    feedback(error, strlen(error));
+    return;
+  }
+
+  command_post(ctx, feedback, op, arg);
 }
 
 static void
-tcp_server_err(void* ctx_, err_t err)
+print_pid(furnace_context_t* ctx, void (*feedback)(const char *, const size_t))
 {
-  furnace_context_t *ctx = (furnace_context_t*)ctx_;
+  pid_controller_t pid;
+  uint32_t         seq;
+  char msg[160];
+
+  do {
+    seq = control_read_begin(ctx);
+    pid = ctx->pilot.pid;
+  } while (control_read_retry(ctx, seq));
+
+  const size_t msg_len = snprintf(msg, sizeof(msg),
+                                  "kp = %u.%03u\r\n"
+                                  "ti = %u s\r\n"
+                                  "td = %u s\r\n"
+                                  "period = %u ms\r\n"
+                                  "out = " PID_OUT_FMT " (p " PID_OUT_FMT ", i " PID_OUT_FMT
+                                  ", d " PID_OUT_FMT ")\r\n",
+                                  (unsigned) pid.config.kp / PID_GAIN_ONE,
+                                  (unsigned) pid.config.kp % PID_GAIN_ONE,
+                                  pid.config.ti_s, pid.config.td_s, pid.config.period_ms,
+                                  PID_OUT_ARGS(pid.out), PID_OUT_ARGS(pid.p),
+                                  PID_OUT_ARGS(pid.integral), PID_OUT_ARGS(pid.d));
+  feedback(msg, msg_len);
+}
+#endif
 
-  log_stdout_server(ctx->log_bits, "tcp_client_err_fn %d\n", err);
-  tcp_server_close(ctx);
+#if CONFIG_THERMO && CONFIG_PILOT
+static void
+print_autotune(furnace_context_t* ctx, void (*feedback)(const char *, const size_t))
+{
+  autotune_t tune;
+  temp_t     hysteresis;
+  uint32_t   seq;
+  char msg[128];
+  size_t msg_len;
+
+  do {
+    seq        = control_read_begin(ctx);
+    tune       = ctx->autotune.tune;
+    hysteresis = ctx->autotune.hysteresis;
+  } while (control_read_retry(ctx, seq));
+
+  if (tune.state == AUTOTUNE_RUNNING) {
+    msg_len = snprintf(msg, sizeof(msg), "autotune = running around " TEMP_FMT ", cycle %u of %u\r\n",
+                       TEMP_ARGS(tune.setpoint), tune.cycles, AUTOTUNE_CYCLES + 2);
+  } else if (tune.state == AUTOTUNE_DONE) {
+    msg_len = snprintf(msg, sizeof(msg), "autotune = done around " TEMP_FMT ", ku %u.%03u, pu %u s, amplitude " TEMP_FMT "\r\n",
+                       TEMP_ARGS(tune.setpoint), (unsigned) tune.ku / PID_GAIN_ONE,
+                       (unsigned) tune.ku % PID_GAIN_ONE, (unsigned) tune.pu_ms / 1000,
+                       TEMP_ARGS(tune.amplitude));
+  } else {
+    msg_len = snprintf(msg, sizeof(msg), "autotune = %s\r\n", autotune_state_name(tune.state));
+  }
+
+  feedback(msg, msg_len);
+
+  msg_len = snprintf(msg, sizeof(msg), "hysteresis = " TEMP_FMT "\r\n",
+                     TEMP_ARGS(hysteresis));
+  feedback(msg, msg_len);
 }
 
-static err_t
-tcp_server_accept(void* ctx_, struct tcp_pcb* client_pcb, err_t err)
+/* Streams the log from the top, to whichever client is connected. */
+static void
+ident_dump_start(furnace_context_t *ctx)
 {
-  furnace_context_t *ctx = (furnace_context_t*)ctx_;
+  ctx->ident.dumping       = true;
+  ctx->ident.dump_line     = 0;
+  ctx->ident.dump_pcb      = NULL;
+  ctx->ident.dump_deadline = get_absolute_time();
+  sched_refresh(&ctx->sched, ctx);
+}
 
-  if (err != ERR_OK || client_pcb == NULL) {
-    log_stdout_server(ctx->log_bits, "Failure in accept\n");
-    tcp_server_close(ctx);
-    return ERR_VAL;
+static void
+print_ident(furnace_context_t* ctx, void (*feedback)(const char *, const size_t))
+{
+  /* Everything but the log, which is far too big to copy. */
+  uint8_t  state;
+  int32_t  low, high;
+  uint16_t count;
+  uint32_t sample_ms, bit_ms;
+  uint32_t seq;
+  char msg[128];
+  size_t msg_len;
+
+  do {
+    seq       = control_read_begin(ctx);
+    state     = ctx->ident.run.state;
+    low       = ctx->ident.run.low;
+    high      = ctx->ident.run.high;
+    count     = ctx->ident.run.count;
+    sample_ms = ctx->ident.run.sample_ms;
+    bit_ms    = ctx->ident.bit_ms;
+  } while (control_read_retry(ctx, seq));
+
+  if (state == IDENT_RUNNING || count) {
+    msg_len = snprintf(msg, sizeof(msg), "ident = %s, pwm " PWM_FINE_FMT " and " PWM_FINE_FMT
+                       ", sample %u of %u, %u ms apart%s\r\n",
+                       ident_state_name(state), PWM_FINE_ARGS(low), PWM_FINE_ARGS(high),
+                       (unsigned) count, IDENT_SAMPLES, (unsigned) sample_ms,
+                       ctx->ident.dumping ? ", streaming" : "");
+  } else {
+    msg_len = snprintf(msg, sizeof(msg), "ident = %s\r\n", ident_state_name(state));
   }
 
-  log_stdout_server(ctx->log_bits, "Client connected\n");
+  feedback(msg, msg_len);
 
-  ctx->tcp.client_pcb = client_pcb;
-  tcp_arg(client_pcb, ctx);
-  tcp_recv(client_pcb, tcp_server_recv);
-  tcp_err(client_pcb, tcp_server_err);
+  msg_len = snprintf(msg, sizeof(msg), "bit = %u s\r\n", (unsigned) bit_ms / 1000);
+  feedback(msg, msg_len);
+}
 
-  client_pcb->so_options |= SOF_KEEPALIVE;
-  client_pcb->keep_intvl = 4000; /* 4 seconds */
+#define PREHEAT_MIN_ARGS(ms) (unsigned) ((ms) / 60000), (unsigned) ((ms) / 6000 % 10)
 
-  return ERR_OK;
+/*
+ *   <from> to <setpoint> C in <min> min, full power <min> min, <C> C over
+ *   <from> to <setpoint> C, not in the band after <min> min, ...
+ */
+static int
+format_preheat(char* buffer, size_t size, const preheat_t* run)
+{
+  const uint32_t elapsed_ms = run->now_ms - run->start_ms;
+  const temp_t   over       = run->peak > run->setpoint ? run->peak - run->setpoint : 0;
+  int            len;
+
+  len = snprintf(buffer, size, TEMP_FMT " to " TEMP_FMT " C", TEMP_ARGS(run->from),
+                 TEMP_ARGS(run->setpoint));
+
+  if (run->reached_ms != PREHEAT_NEVER)
+    len += snprintf(buffer + len, size - len, " in %u.%u min", PREHEAT_MIN_ARGS(run->reached_ms));
+  else
+    len += snprintf(buffer + len, size - len, ", not in the band after %u.%u min",
+                    PREHEAT_MIN_ARGS(elapsed_ms));
+
+  return len + snprintf(buffer + len, size - len, ", full power %u.%u min, " TEMP_FMT " C over",
+                        PREHEAT_MIN_ARGS(run->boost_ms), TEMP_ARGS(over));
+}
+
+static void
+print_preheat(furnace_context_t* ctx, void (*feedback)(const char *, const size_t))
+{
+  preheat_t run;
+  bool      boost;
+  temp_t    band;
+  uint32_t  seq;
+  char msg[160];
+  size_t msg_len;
+
+  do {
+    seq   = control_read_begin(ctx);
+    run   = ctx->preheat.run;
+    boost = ctx->preheat.boost;
+    band  = ctx->preheat.band;
+  } while (control_read_retry(ctx, seq));
+
+  if (run.state == PREHEAT_IDLE) {
+    msg_len = snprintf(msg, sizeof(msg), "preheat = idle\r\n");
+  } else {
+    msg_len = snprintf(msg, sizeof(msg), "preheat = %s, ", preheat_state_name(run.state));
+    msg_len += format_preheat(msg + msg_len, sizeof(msg) - msg_len, &run);
+    msg_len += snprintf(msg + msg_len, sizeof(msg) - msg_len, "\r\n");
+  }
+
+  feedback(msg, msg_len);
+
+  msg_len = snprintf(msg, sizeof(msg),
+                     "boost = %s\r\n"
+                     "band = " TEMP_FMT " C\r\n",
+                     boost ? "on" : "off", TEMP_ARGS(band));
+  feedback(msg, msg_len);
 }
+#endif
 
+#if CONFIG_PILOT
 static bool
-tcp_server_open(void* ctx_)
+profile_active(const furnace_context_t *ctx)
 {
-  furnace_context_t *ctx = (furnace_context_t*)ctx_;
+  const uint8_t state = ctx->profile.engine.state;
 
-  log_stdout_server(ctx->log_bits,
-                     "Starting server at %s on port %u\n",
-                     ip4addr_ntoa(netif_ip4_addr(netif_list)),
-                     TCP_PORT);
+  return state == PROFILE_RUNNING || state == PROFILE_PAUSED;
+}
 
-  struct tcp_pcb* pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
-  if (!pcb) {
-    log_stdout_server(ctx->log_bits, "Failed to create pcb\n");
-    return false;
+static void
+handle_command_profile(furnace_context_t* ctx, void (*feedback)(const char *, const size_t),
+                       const char* name)
+{
+  static const struct {
+    const char* name;
+    uint8_t     op;
+  } actions[] = {
+    { "clear",  CONTROL_PROFILE_CLEAR  },
+    { "start",  CONTROL_PROFILE_START  },
+    { "stop",   CONTROL_PROFILE_STOP   },
+    { "pause",  CONTROL_PROFILE_PAUSE  },
+    { "resume", CONTROL_PROFILE_RESUME },
+    { "skip",   CONTROL_PROFILE_SKIP   },
+  };
+
+  for (unsigned i = 0; i < sizeof(actions) / sizeof(actions[0]); i++) {
+    if (strcmp(name, actions[i].name) == 0) {
+      command_post(ctx, feedback, actions[i].op, 0);
+      return;
+    }
   }
 
-  err_t err = tcp_bind(pcb, NULL, TCP_PORT);
-  if (err) {
-    log_stdout_server(ctx->log_bits, "Failed to bind to port %u\n", TCP_PORT);
-    return false;
+  const char msg[] = "unknown profile option!\r\n";
+  const size_t msg_len = sizeof(msg)-1;
+  feedback(msg, msg_len);
+}
+
+static void
+handle_command_profile_add(furnace_context_t* ctx, void (*feedback)(const char *, const size_t),
+                           unsigned target, unsigned rate, unsigned hold)
+{
+  const char* error = NULL;
+
+  if (target > MAX_TEMP)
+    error = "profile target too big!\r\n";
+  else if (rate > PROFILE_RATE_MAX)
+    error = "profile rate needs to be 0 to " STR(PROFILE_RATE_MAX) " C/h\r\n";
+  else if (hold > PROFILE_HOLD_MAX)
+    error = "profile hold needs to be 0 to " STR(PROFILE_HOLD_MAX) " min\r\n";
+  else if (profile_active(ctx))
+    error = "profile is running, stop it first\r\n";
+  else if (ctx->profile.engine.program.count >= PROFILE_SEGMENTS_MAX)
+    error = "profile is full, " STR(PROFILE_SEGMENTS_MAX) " segments at most\r\n";
+
+  if (error) {
+    feedback(error, strlen(error));
+    return;
   }
 
-  ctx->tcp.server_pcb = tcp_listen_with_backlog(pcb, 1);
-  if (!ctx->tcp.server_pcb) {
-    log_stdout_server(ctx->log_bits, "Failed to listen\n");
-    if (pcb) {
-      tcp_close(pcb);
-    }
-    return false;
+  command_post(ctx, feedback, CONTROL_PROFILE_ADD, PROFILE_SEGMENT_PACK(target, rate, hold));
+}
+
+static void
+print_profile(furnace_context_t* ctx, void (*feedback)(const char *, const size_t))
+{
+  profile_t                profile;
+  const profile_program_t* program = &profile.program;
+  uint32_t                 seq;
+  char msg[96];
+  size_t msg_len;
+
+  do {
+    seq     = control_read_begin(ctx);
+    profile = ctx->profile.engine;
+  } while (control_read_retry(ctx, seq));
+
+  if (profile.state == PROFILE_RUNNING || profile.state == PROFILE_PAUSED) {
+    msg_len = snprintf(msg, sizeof(msg), "profile = %s, segment %u of %u, setpoint " TEMP_FMT ", %u min left\r\n",
+                       profile_phase_name(profile.state, profile.phase),
+                       profile.segment + 1, program->count, TEMP_ARGS(profile.setpoint),
+                       (unsigned) profile_phase_left_min(&profile));
+  } else {
+    msg_len = snprintf(msg, sizeof(msg), "profile = %s, %u segments\r\n",
+                       profile_phase_name(profile.state, profile.phase), program->count);
   }
+  feedback(msg, msg_len);
 
-  tcp_arg(ctx->tcp.server_pcb, ctx);
-  tcp_accept(ctx->tcp.server_pcb, tcp_server_accept);
+  for (unsigned i = 0; i < program->count; i++) {
+    const profile_segment_t* segment = &program->segments[i];
 
-  return true;
+    msg_len = snprintf(msg, sizeof(msg), "%u: to " TEMP_FMT " at %u C/h, hold %u min\r\n",
+                       i + 1, TEMP_ARGS(segment->target), segment->rate, segment->hold_min);
+    feedback(msg, msg_len);
+  }
 }
+#endif
 
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
 static void
-do_thermocouple_work(furnace_context_t *ctx, bool deadline_met)
+print_map(furnace_context_t* ctx, void (*feedback)(const char *, const size_t))
 {
-  if (!deadline_met)
-    return;
+  static mapper_context_t mapper;
+  uint8_t                 pwm_level;
+  uint32_t                seq;
+  char msg[64];
+  size_t msg_len;
+
+  do {
+    seq       = control_read_begin(ctx);
+    mapper    = ctx->mapper;
+    pwm_level = ctx->pwm_level;
+  } while (control_read_retry(ctx, seq));
+
+  const pwm_map_t*       map    = &mapper.map;
+  const steady_config_t* config = &mapper.steady_config;
+
+  msg_len = snprintf(msg, sizeof(msg), "map = %d, %u levels mapped\r\n",
+                     mapper.is_enabled, map->levels);
+  feedback(msg, msg_len);
+
+  msg_len = snprintf(msg, sizeof(msg), "settled below " TEMP_FMT " C/h, after %u to %u min\r\n",
+                     TEMP_ARGS(config->slope), config->dwell_min_min, config->dwell_max_min);
+  feedback(msg, msg_len);
+
+  if (mapper.is_enabled) {
+    const int64_t dwell_us = absolute_time_diff_us(mapper.step_at, get_absolute_time());
+
+    msg_len = snprintf(msg, sizeof(msg), "pwm %u for %u min, slope " TEMP_FMT " C/h\r\n",
+                       pwm_level, (unsigned) (dwell_us / 60000000),
+                       TEMP_ARGS(steady_slope(&mapper.steady, config)));
+    feedback(msg, msg_len);
+  }
+
+  for (unsigned i = 0; i < map->levels && i <= MAX_PWM; i++) {
+    msg_len = snprintf(msg, sizeof(msg), "pwm %u: " TEMP_FMT "\r\n", i, TEMP_ARGS(map->temp[i]));
+    feedback(msg, msg_len);
+  }
+}
+#endif
+
+static int
+set_max_pwm_safe(furnace_context_t *ctx, int new_max_pwm)
+{
+    if (new_max_pwm > MAX_PWM)
+      return 1;
+
+    ctx->ceiling_pwm = new_max_pwm;
+
+    if (ctx->pwm_fine > (int32_t) new_max_pwm << PWM_FINE_BITS)
+      set_heater_fine(ctx, ctx->pwm_fine);
+
+    return 0;
+}
+
+#if CONFIG_STIRRER
+static void
+set_stirrer(bool opt)
+{
+  gpio_put(STIRRER_PIN, opt);
+}
+#endif
+
+/*
+ * Time spent in every stage of the work loops, see the stats command.
+ * The control path stages are only written by the control path, the rest
+ * only by core0, resets of the control half go through the inbox.
+ */
+enum {
+  STAGE_THERMOCOUPLE,
+  STAGE_HEATER,
+  STAGE_PILOT,
+  STAGE_MAPPER,
+  STAGE_PROFILE,
+  STAGE_AUTOTUNE,
+  STAGE_IDENT,
+  STAGE_PREHEAT,
+  STAGE_SHUTTER,
+  STAGE_MAGNETRON,
+  STAGE_MODEL,
+  STAGE_CONTROL_COUNT,
+
+  STAGE_TCP = STAGE_CONTROL_COUNT,
+  STAGE_STDIO,
+  STAGE_TELEMETRY,
+  STAGE_FLASH,
+  STAGE_DUMP,
+  STAGE_COUNT
+};
+
+static const char* const stage_names[STAGE_COUNT] = {
+  [STAGE_THERMOCOUPLE] = "thermocouple",
+  [STAGE_HEATER]       = "heater",
+  [STAGE_PILOT]        = "pilot",
+  [STAGE_MAPPER]       = "mapper",
+  [STAGE_PROFILE]      = "profile",
+  [STAGE_AUTOTUNE]     = "autotune",
+  [STAGE_IDENT]        = "ident",
+  [STAGE_PREHEAT]      = "preheat",
+  [STAGE_SHUTTER]      = "shutter",
+  [STAGE_MAGNETRON]    = "magnetron",
+  [STAGE_MODEL]        = "model",
+  [STAGE_TCP]          = "tcp",
+  [STAGE_STDIO]        = "stdio",
+  [STAGE_TELEMETRY]    = "telemetry",
+  [STAGE_FLASH]        = "flash",
+  [STAGE_DUMP]         = "dump",
+};
+
+enum {
+  LOOP_CORE0,
+  LOOP_CONTROL,
+  LOOP_COUNT
+};
+
+static stats_hist_t    stage_stats[STAGE_COUNT];
+static uint32_t        loop_count[LOOP_COUNT];
+static absolute_time_t loop_since[LOOP_COUNT];
+
+static void
+stats_reset_stages(unsigned first, unsigned last, unsigned loop)
+{
+  for (unsigned i = first; i < last; i++)
+    stats_reset(&stage_stats[i]);
+
+  loop_count[loop] = 0;
+  loop_since[loop] = get_absolute_time();
+}
+
+static void
+stats_reset_core0(void)
+{
+  stats_reset_stages(STAGE_CONTROL_COUNT, STAGE_COUNT, LOOP_CORE0);
+}
+
+static void
+stats_reset_control(void)
+{
+  stats_reset_stages(0, STAGE_CONTROL_COUNT, LOOP_CONTROL);
+}
+
+static uint32_t
+stats_loops_per_s(unsigned loop)
+{
+  const int64_t us = absolute_time_diff_us(loop_since[loop], get_absolute_time());
+
+  if (us < 1000000)
+    return loop_count[loop];
+
+  return (uint64_t) loop_count[loop] * 1000000 / us;
+}
+
+/* Records the time since start for the stage, returns the current time. */
+static uint32_t
+stats_stage_done(unsigned stage, uint32_t start)
+{
+  const uint32_t now = time_us_32();
+
+  stats_record(&stage_stats[stage], now - start);
+
+  return now;
+}
+
+static void
+print_stats(furnace_context_t* ctx, void (*feedback)(const char*, const size_t))
+{
+  static stats_hist_t hist;
+  uint32_t            seq;
+  char   line[BUF_SIZE];
+  size_t len;
+
+  len = snprintf(line, sizeof(line), "%-12s %8s %7s %7s %7s %7s [us]\r\n",
+                 "stage", "runs", "min", "avg", "p99", "max");
+  feedback(line, len);
+
+  for (unsigned i = 0; i < STAGE_COUNT; i++) {
+    /* The control path's stages are recorded by the other core. */
+    do {
+      seq  = control_read_begin(ctx);
+      hist = stage_stats[i];
+    } while (control_read_retry(ctx, seq));
+
+    if (hist.count == 0)
+      continue;
+
+    len = snprintf(line, sizeof(line), "%-12s %8u %7u %7u %7u %7u\r\n",
+                   stage_names[i],
+                   (unsigned) hist.count,
+                   (unsigned) hist.min_us,
+                   (unsigned) stats_average(&hist),
+                   (unsigned) stats_percentile(&hist, 99),
+                   (unsigned) hist.max_us);
+    feedback(line, len);
+  }
+
+  len = snprintf(line, sizeof(line), "loops/s core0 %u control %u\r\n",
+                 (unsigned) stats_loops_per_s(LOOP_CORE0),
+                 (unsigned) stats_loops_per_s(LOOP_CONTROL));
+  feedback(line, len);
+}
+
+/*
+ * The help, by topic. TCP copies every write into lwIP's MEM_SIZE heap,
+ * 4 KiB, where all of it in one piece doesn't fit: every topic has to
+ * fit a segment.
+ */
+#define HELP_TOPICS (CONFIG_THERMO || CONFIG_PILOT)
+
+static const char help_main[] =
+                        "help              \t\t shows this message\n"
+#if HELP_TOPICS
+                        "help <topic>      \t\t more commands on:"
+#endif
+#if CONFIG_PILOT
+                        " pilot profile"
+#endif
+#if CONFIG_THERMO && CONFIG_PILOT
+                        " tune"
+#endif
+#if CONFIG_THERMO
+                        " sensor"
+#endif
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+                        " map"
+#endif
+#if HELP_TOPICS
+                        "\n"
+#endif
+                        "reboot            \t\t reboot device\n"
+                        "pwm <0;50>        \t\t sets pwm\n"
+                        "pwm               \t\t prints current pwm level\n"
+                        "max_pwm <0;50>    \t\t sets max pwm level.\n"
+                        "                  \t\t\t Device will never exceed this pwm value\n"
+                        "heater            \t\t shows how the heater is switched\n"
+                        "heater pwm        \t\t 8 Hz PWM, the default\n"
+                        "heater burst [runs]\t\t mains cycles on or off, in that many runs\n"
+                        "                  \t\t a second (default " STR(BURST_RUNS) "), kept in flash,\n"
+                        "                  \t\t not synced to the mains: zero-cross SSR only\n"
+#if CONFIG_MAGNETRON
+                        "pulse <0:127>     \t\t starts pulses of magnetron\n"
+#endif
+#if CONFIG_WATER
+                        "water <0:10>      \t\t sets pwm duty of water channel\n"
+                        "water             \t\t shows current water pwm\n"
+#endif
+#if CONFIG_STIRRER
+                        "stir <0;1>        \t\t turns on the stirring cap for beaker\n"
+                        "                  \t\t\t 0 - off\n"
+                        "                  \t\t\t 1 - on\n"
+#endif
+                        "stats             \t\t shows time spent in every stage of the loop\n"
+                        "stats reset       \t\t clears the stage timings\n"
+                        "log <option> <0;1>\t\t sets output level on stdio\n"
+                        "                  \t\t\t options:\n"
+                        "                  \t\t\t\t server,\n"
+                        "                  \t\t\t\t thermocouple,\n"
+                        "                  \t\t\t\t basic\n"
+                        "                  \t\t\t 0 - off\n"
+                        "                  \t\t\t 1 - on\n"
+                        "log               \t\t prints names of turned on log options\n";
+
+#if CONFIG_PILOT
+static const char help_pilot[] =
+#if CONFIG_THERMO
+                        "temp <0;" STR(MAX_TEMP) ">     \t\t sets wanted temperature\n"
+                        "temp              \t\t shows current wanted temperature\n"
+                        "auto <0;1>        \t\t sets automatic pwm control, it is\n"
+                        "                  \t\t reaching temperature set by 'temp' command\n"
+                        "                  \t\t\t 0 - off\n"
+                        "                  \t\t\t 1 - on\n"
+                        "auto              \t\t shows current auto status\n"
+#endif
+                        "pid               \t\t shows the gains and terms of the pilot\n"
+                        "pid <option> <n>  \t\t changes them, kept in flash, options:\n"
+                        "                  \t\t\t kp - pwm levels per C, e.g. 2.5\n"
+                        "                  \t\t\t ti - integral time in s, 0 is off\n"
+                        "                  \t\t\t td - derivative time in s, 0 is off\n"
+                        "                  \t\t\t period - ms between two updates\n"
+#if CONFIG_THERMO
+                        "preheat <0;1>     \t\t on a jump of " STR(PREHEAT_JUMP_C) " C or more up, runs the heater\n"
+                        "                  \t\t at the ceiling until the model says to coast,\n"
+                        "                  \t\t the time to setpoint of every jump is reported\n"
+                        "                  \t\t\t 0 - off, only the pilot\n"
+                        "                  \t\t\t 1 - on\n"
+                        "preheat band <" STR(PREHEAT_BAND_MIN_C) ";" STR(PREHEAT_BAND_MAX_C) ">\t\t C off the setpoint that count as there\n"
+                        "preheat           \t\t shows the last run\n"
+#endif
+#if CONFIG_AUTO == CONFIG_AUTO_MPC
+                        "mpc               \t\t shows what the model predictive pilot plans\n"
+                        "mpc rate <C/h>    \t\t heating rate it never plans past, 0 is off\n"
+#endif
+                        "";
+
+static const char help_profile[] =
+                        "profile           \t\t shows the firing program and how far it got\n"
+                        "profile add <temp> <rate> <hold>\n"
+                        "                  \t\t appends a segment: ramp to temp at rate C/h\n"
+                        "                  \t\t (0 is a step), then hold for hold minutes\n"
+                        "profile <action>  \t\t clear, start, stop, pause, resume or skip\n"
+                        "                  \t\t\t the program is kept in flash\n";
+#endif
+
+#if CONFIG_THERMO && CONFIG_PILOT
+static const char help_tune[] =
+                        "autotune <0;" STR(MAX_TEMP) ">\t\t finds pid gains by switching the heater\n"
+                        "                  \t\t on and off around that temperature,\n"
+                        "                  \t\t then holds it with them, 0 stops it\n"
+                        "autotune          \t\t shows how far it got\n"
+                        "autotune hysteresis <1;" STR(AUTOTUNE_HYSTERESIS_MAX) ">\t switches that many C off the temperature,\n"
+                        "                  \t\t has to be above the noise\n"
+                        "ident <0;50>      \t\t switches the heater that many levels around\n"
+                        "                  \t\t its output in a pseudo-random sequence and\n"
+                        "                  \t\t logs every sample, streamed over tcp when\n"
+                        "                  \t\t the log is full, 0 stops it\n"
+                        "ident             \t\t shows how far it got\n"
+                        "ident bit <1;" STR(IDENT_BIT_MAX_S) ">\t\t s between two bits of the sequence\n"
+                        "ident dump        \t\t streams the last log again\n";
+#endif
+
+#if CONFIG_THERMO
+static const char help_sensor[] =
+                        "sample            \t\t shows the temperature sampling setup\n"
+                        "sample <option> <n>\t\t changes it, options:\n"
+                        "                  \t\t\t period - ms between samples, " STR(SAMPLE_PERIOD_MIN_MS) " or more\n"
+                        "                  \t\t\t median - odd window, 1 is off\n"
+                        "                  \t\t\t ema - smoothing over 2^n samples, 0 is off\n"
+                        "                  \t\t\t decimate - publish every n-th sample\n"
+                        "                  \t\t\t reject - drop jumps of more than n C, 0 is off, needs median 3+\n"
+                        "sensor            \t\t shows every thermocouple\n"
+                        "sensor <name>     \t\t regulates on that one, by name or number\n"
+                        "estimate          \t\t shows temperature and heating rate as the\n"
+                        "                  \t\t controllers see them\n"
+                        "estimate <option> <n>\t\t changes the estimator, options:\n"
+                        "                  \t\t\t alpha - 0.001 to 1, less is smoother but slower\n"
+                        "                  \t\t\t gain - C/h per pwm level the heater adds, 0 is off\n"
+                        "model             \t\t shows gain, time constant and dead time\n"
+                        "                  \t\t learned from how the furnace responds\n"
+                        "model reset       \t\t forgets them and starts over\n"
+                        "model memory <n>  \t\t minutes after which data counts about a third,\n"
+                        "                  \t\t " STR(MODEL_MEMORY_MIN_MIN) " to " STR(MODEL_MEMORY_MAX_MIN) ", kept in flash\n";
+#endif
+
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+static const char help_map[] =
+                        "map <0;1>         \t\t sets automatic pwm mapping, it is\n"
+                        "                  \t\t waiting for the temperature to settle on every pwm\n"
+                        "                  \t\t\t 0 - off\n"
+                        "                  \t\t\t 1 - on\n"
+                        "map slope <C/h>   \t\t a level is settled once the temperature\n"
+                        "                  \t\t moves slower than that, e.g. 0.5\n"
+                        "map dwell <min> <max>\t\t minutes on every level at least and at most\n"
+                        "map               \t\t shows current map status and the table,\n"
+                        "                  \t\t kept in flash, the pilot starts from it\n";
+#endif
+
+#if HELP_TOPICS
+typedef struct {
+  const char* name;
+  const char* text;
+  size_t      len;
+} help_topic_t;
+
+#define HELP_TOPIC(name) { #name, help_##name, sizeof(help_##name) - 1 }
+
+static const help_topic_t help_topics[] = {
+#if CONFIG_PILOT
+  HELP_TOPIC(pilot),
+  HELP_TOPIC(profile),
+#endif
+#if CONFIG_THERMO && CONFIG_PILOT
+  HELP_TOPIC(tune),
+#endif
+#if CONFIG_THERMO
+  HELP_TOPIC(sensor),
+#endif
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+  HELP_TOPIC(map),
+#endif
+};
+
+_Static_assert(sizeof(help_main) - 1 <= TCP_MSS, "help has to fit a TCP segment");
+#if CONFIG_PILOT
+_Static_assert(sizeof(help_pilot) - 1 <= TCP_MSS, "help pilot has to fit a TCP segment");
+_Static_assert(sizeof(help_profile) - 1 <= TCP_MSS, "help profile has to fit a TCP segment");
+#endif
+#if CONFIG_THERMO && CONFIG_PILOT
+_Static_assert(sizeof(help_tune) - 1 <= TCP_MSS, "help tune has to fit a TCP segment");
+#endif
+#if CONFIG_THERMO
+_Static_assert(sizeof(help_sensor) - 1 <= TCP_MSS, "help sensor has to fit a TCP segment");
+#endif
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+_Static_assert(sizeof(help_map) - 1 <= TCP_MSS, "help map has to fit a TCP segment");
+#endif
+
+static void
+print_help(void (*feedback)(const char *, const size_t), const char* topic)
+{
+  for (size_t i = 0; i < sizeof(help_topics) / sizeof(help_topics[0]); i++) {
+    if (strcmp(topic, help_topics[i].name) == 0) {
+      feedback(help_topics[i].text, help_topics[i].len);
+      return;
+    }
+  }
+
+  const char msg[] = "no such help topic, help lists them\r\n";
+  feedback(msg, sizeof(msg)-1);
+}
+#endif
+
+static void
+command_handler(furnace_context_t* ctx, uint8_t* buffer, void (*feedback)(const char*, const size_t))
+{
+  unsigned arg;
+  char     str_arg[BUF_SIZE];
+#if CONFIG_THERMO || CONFIG_PILOT
+  char     str_val[BUF_SIZE];
+#endif
+#if CONFIG_PILOT
+  unsigned arg2, arg3;
+#endif
+
+  if (buffer[0] == '\n') return;
+
+  if (memcmp(buffer, "reboot", 6) == 0) {
+    reset_usb_boot(0,0);
+  } else if (sscanf(buffer, "max_pwm %u", &arg) == 1) {
+    if (arg > MAX_PWM) {
+      const char msg[] = "pwm argument too big!\r\n";
+      const size_t msg_len = sizeof(msg)-1;
+      feedback(msg, msg_len);
+    } else {
+      command_post(ctx, feedback, CONTROL_MAX_PWM, arg);
+    }
+  } else if (strncmp(buffer, "pwm\n", 4) == 0) {
+      char msg[32];
+      const size_t msg_len = snprintf(msg, sizeof(msg), "pwm = %d (" PWM_FINE_FMT ")\r\n",
+                                      ctx->pwm_level, PWM_FINE_ARGS(ctx->pwm_fine));
+      feedback(msg, msg_len);
+  } else if (sscanf(buffer, "pwm %u", &arg) == 1) {
+    if (arg > MAX_PWM) {
+      const char msg[] = "pwm argument too big!\r\n";
+      const size_t msg_len = sizeof(msg)-1;
+      feedback(msg, msg_len);
+    } else {
+      command_post(ctx, feedback, CONTROL_PWM, arg);
+    }
+  } else if (strncmp(buffer, "heater\n", 7) == 0) {
+      char msg[64];
+      const size_t msg_len = ctx->burst.runs
+        ? snprintf(msg, sizeof(msg), "heater = burst, %u runs per %u half-cycles\r\n",
+                   (unsigned) ctx->burst.runs, BURST_HALF_CYCLES)
+        : snprintf(msg, sizeof(msg), "heater = pwm, %u Hz\r\n", PWM_FREQ_HZ);
+      feedback(msg, msg_len);
+  } else if (strncmp(buffer, "heater pwm\n", 11) == 0) {
+    command_post(ctx, feedback, CONTROL_HEATER, 0);
+  } else if (strncmp(buffer, "heater burst\n", 13) == 0) {
+    command_post(ctx, feedback, CONTROL_HEATER, BURST_RUNS);
+  } else if (sscanf(buffer, "heater burst %u", &arg) == 1) {
+    if (arg < 1 || arg > BURST_CYCLES) {
+      const char msg[] = "heater burst needs 1 to " STR(BURST_CYCLES) " runs\r\n";
+      const size_t msg_len = sizeof(msg)-1;
+      feedback(msg, msg_len);
+    } else {
+      command_post(ctx, feedback, CONTROL_HEATER, arg);
+    }
+  }
+#if CONFIG_PILOT
+  else if (strncmp(buffer, "auto\n", 5) == 0) {
+      char msg[16];
+      const size_t msg_len = snprintf(msg, sizeof(msg), "auto = %d\r\n", ctx->pilot.is_enabled);
+      feedback(msg, msg_len);
+  } else if (sscanf(buffer, "auto %u", &arg) == 1) {
+    if (arg > 1) {
+      const char msg[] = "auto argument needs to be 0 or 1\r\n";
+      const size_t msg_len = sizeof(msg)-1;
+      feedback(msg, msg_len);
+    } else {
+      command_post(ctx, feedback, CONTROL_AUTO, arg);
+    }
+  } else if (sscanf(buffer, "temp %u", &arg) == 1) {
+    if (arg > MAX_TEMP) {
+      const char msg[] = "temp argument too big!\r\n";
+      const size_t msg_len = sizeof(msg)-1;
+      feedback(msg, msg_len);
+    } else {
+      command_post(ctx, feedback, CONTROL_TEMP, TEMP_C(arg));
+    }
+  } else if (strncmp(buffer, "temp\n", 5) == 0) {
+    char msg[24];
+    const size_t msg_len = snprintf(msg, sizeof(msg), "temp = " TEMP_FMT "\r\n",
+                                    TEMP_ARGS(ctx->pilot.des_temp));
+    feedback(msg, msg_len);
+  }
+#endif
+#if CONFIG_PILOT
+  else if (strncmp(buffer, "pid\n", 4) == 0) {
+    print_pid(ctx, feedback);
+  } else if (sscanf(buffer, "pid %" STR(BUF_SIZE) "s %" STR(BUF_SIZE) "s", &str_arg, &str_val) == 2) {
+    handle_command_pid(ctx, feedback, str_arg, str_val);
+  } else if (strncmp(buffer, "profile\n", 8) == 0) {
+    print_profile(ctx, feedback);
+  } else if (sscanf(buffer, "profile add %u %u %u", &arg, &arg2, &arg3) == 3) {
+    handle_command_profile_add(ctx, feedback, arg, arg2, arg3);
+  } else if (sscanf(buffer, "profile %" STR(BUF_SIZE) "s", &str_arg) == 1) {
+    handle_command_profile(ctx, feedback, str_arg);
+  }
+#endif
+#if CONFIG_THERMO && CONFIG_PILOT
+  else if (strncmp(buffer, "autotune\n", 9) == 0) {
+    print_autotune(ctx, feedback);
+  } else if (sscanf(buffer, "autotune hysteresis %u", &arg) == 1) {
+    if (arg < 1 || arg > AUTOTUNE_HYSTERESIS_MAX) {
+      const char msg[] = "autotune hysteresis needs to be 1 to " STR(AUTOTUNE_HYSTERESIS_MAX) " C\r\n";
+      const size_t msg_len = sizeof(msg)-1;
+      feedback(msg, msg_len);
+    } else {
+      command_post(ctx, feedback, CONTROL_AUTOTUNE_HYSTERESIS, TEMP_C(arg));
+    }
+  } else if (sscanf(buffer, "autotune %u", &arg) == 1) {
+    if (arg > MAX_TEMP) {
+      const char msg[] = "autotune argument too big!\r\n";
+      const size_t msg_len = sizeof(msg)-1;
+      feedback(msg, msg_len);
+    } else {
+      command_post(ctx, feedback, CONTROL_AUTOTUNE, TEMP_C(arg));
+    }
+  } else if (strncmp(buffer, "ident\n", 6) == 0) {
+    print_ident(ctx, feedback);
+  } else if (strncmp(buffer, "ident dump\n", 11) == 0) {
+    if (ctx->ident.run.state == IDENT_RUNNING || ctx->ident.run.count == 0) {
+      const char msg[] = "ident has no finished log to stream\r\n";
+      feedback(msg, sizeof(msg)-1);
+    } else {
+      ident_dump_start(ctx);
+    }
+  } else if (sscanf(buffer, "ident bit %u", &arg) == 1) {
+    if (arg < 1 || arg > IDENT_BIT_MAX_S) {
+      const char msg[] = "ident bit needs to be 1 to " STR(IDENT_BIT_MAX_S) " s\r\n";
+      feedback(msg, sizeof(msg)-1);
+    } else {
+      command_post(ctx, feedback, CONTROL_IDENT_BIT, arg * 1000);
+    }
+  } else if (sscanf(buffer, "ident %u", &arg) == 1) {
+    if (arg > MAX_PWM) {
+      const char msg[] = "ident argument too big!\r\n";
+      feedback(msg, sizeof(msg)-1);
+    } else if (arg && ctx->ident.dumping) {
+      /* The new run would overwrite the log while it goes out. */
+      const char msg[] = "ident log still streaming, ident 0 drops it\r\n";
+      feedback(msg, sizeof(msg)-1);
+    } else {
+      if (!arg)
+        ctx->ident.dumping = false;
+      command_post(ctx, feedback, CONTROL_IDENT, arg);
+    }
+  } else if (strncmp(buffer, "preheat\n", 8) == 0) {
+    print_preheat(ctx, feedback);
+  } else if (sscanf(buffer, "preheat band %u", &arg) == 1) {
+    if (arg < PREHEAT_BAND_MIN_C || arg > PREHEAT_BAND_MAX_C) {
+      const char msg[] = "preheat band needs to be " STR(PREHEAT_BAND_MIN_C) " to "
+                         STR(PREHEAT_BAND_MAX_C) " C\r\n";
+      feedback(msg, sizeof(msg)-1);
+    } else {
+      command_post(ctx, feedback, CONTROL_PREHEAT_BAND, TEMP_C(arg));
+    }
+  } else if (sscanf(buffer, "preheat %u", &arg) == 1) {
+    if (arg >= 2) {
+      const char msg[] = "preheat value too big!\r\n";
+      feedback(msg, sizeof(msg)-1);
+    } else {
+      command_post(ctx, feedback, CONTROL_PREHEAT, arg);
+    }
+  }
+#endif
+  else if (sscanf(buffer, "log %" STR(BUF_SIZE) "s %u", &str_arg, &arg) == 2) {
+    if(arg >= 2) {
+      const char msg[] = "log value too big!\r\n";
+      const size_t msg_len = sizeof(msg)-1;
+      feedback(msg, msg_len);
+    } else {
+      set_log(str_arg, arg, &ctx->log_bits);
+    }
+  } else if (strncmp(buffer, "stats\n", 6) == 0) {
+    print_stats(ctx, feedback);
+  } else if (strncmp(buffer, "stats reset\n", 12) == 0) {
+    stats_reset_core0();
+    command_post(ctx, feedback, CONTROL_STATS_RESET, 0);
+  }
+#if CONFIG_THERMO
+  else if (strncmp(buffer, "sample\n", 7) == 0) {
+    print_sample(ctx, feedback);
+  } else if (sscanf(buffer, "sample %" STR(BUF_SIZE) "s %u", &str_arg, &arg) == 2) {
+    handle_command_sample(ctx, feedback, str_arg, arg);
+  } else if (strncmp(buffer, "sensor\n", 7) == 0) {
+    print_sensors(ctx, feedback);
+  } else if (sscanf(buffer, "sensor %" STR(BUF_SIZE) "s", &str_arg) == 1) {
+    handle_command_sensor(ctx, feedback, str_arg);
+  } else if (strncmp(buffer, "estimate\n", 9) == 0) {
+    print_estimate(ctx, feedback);
+  } else if (sscanf(buffer, "estimate %" STR(BUF_SIZE) "s %" STR(BUF_SIZE) "s", &str_arg, &str_val) == 2) {
+    handle_command_estimate(ctx, feedback, str_arg, str_val);
+  } else if (strncmp(buffer, "model\n", 6) == 0) {
+    print_model(ctx, feedback);
+  } else if (strncmp(buffer, "model reset\n", 12) == 0) {
+    command_post(ctx, feedback, CONTROL_MODEL_RESET, 0);
+  } else if (sscanf(buffer, "model memory %u", &arg) == 1) {
+    if (arg < MODEL_MEMORY_MIN_MIN || arg > MODEL_MEMORY_MAX_MIN) {
+      const char msg[] = "model memory needs to be " STR(MODEL_MEMORY_MIN_MIN) " to "
+                         STR(MODEL_MEMORY_MAX_MIN) " minutes\r\n";
+      feedback(msg, sizeof(msg) - 1);
+    } else {
+      command_post(ctx, feedback, CONTROL_MODEL_MEMORY, arg);
+    }
+  }
+#endif
+#if CONFIG_AUTO == CONFIG_AUTO_MPC
+  else if (strncmp(buffer, "mpc\n", 4) == 0) {
+    print_mpc(ctx, feedback);
+  } else if (sscanf(buffer, "mpc rate %u", &arg) == 1) {
+    if (arg > MPC_RATE_MAX_C_H) {
+      const char msg[] = "mpc rate needs to be 0 to " STR(MPC_RATE_MAX_C_H) " C/h\r\n";
+      feedback(msg, sizeof(msg) - 1);
+    } else {
+      command_post(ctx, feedback, CONTROL_MPC_RATE, arg);
+    }
+  }
+#endif
+  else if (strncmp(buffer, "log\n", 4) == 0) {
+    char msg[LOG_MSG_BUFFER_SIZE];
+    const size_t msg_len = get_logs(msg, ctx->log_bits);
+    feedback(msg, msg_len);
+  } else if (memcmp(buffer, "help\n", 5) == 0) {
+    feedback(help_main, sizeof(help_main) - 1);
+#if HELP_TOPICS
+  } else if (sscanf(buffer, "help %" STR(BUF_SIZE) "s", &str_arg) == 1) {
+    print_help(feedback, str_arg);
+#endif
+  }
+#if CONFIG_MAGNETRON
+  else if(sscanf(buffer, "pulse %u", &arg) == 1) {
+    if(arg > 127){
+      const char msg[] = "pulse value too big!\r\n";
+      const size_t msg_len = sizeof(msg)-1;
+      feedback(msg, msg_len);
+    } else {
+      command_post(ctx, feedback, CONTROL_PULSE, arg);
+    }
+  }
+#endif
+#if CONFIG_WATER
+  else if(sscanf(buffer, "water %u", &arg) == 1) {
+    handle_command_water(ctx, feedback, arg);
+  } else if(memcmp(buffer, "water\n", 6) == 0){
+    char msg[16];
+    const size_t msg_len = snprintf(msg, sizeof(msg), "water = %d\r\n", ctx->pwm_water);
+    feedback(msg, msg_len);
+  }
+#endif
+#if CONFIG_SHUTTER
+  else if(sscanf(buffer, "shutter %u", &arg) == 1){
+    if(arg > MAX_SHUTTER_MS){
+      const char msg[] = "time argument too big !!!\r\n";
+      const size_t msg_len = sizeof(msg)-1;
+      feedback(msg, msg_len);
+    } else if(ctx->shutter.time_ms == 0){
+      command_post(ctx, feedback, CONTROL_SHUTTER, arg);
+    } else{
+      const char msg[] = "shutter already in work \n";
+      const size_t msg_len = sizeof(msg)-1;
+      feedback(msg, msg_len);
+    }
+  } else if(sscanf(buffer, "shutter %s", str_arg) == 1) {
+    if(strncmp(str_arg, "on", 2) == 0){
+      command_post(ctx, feedback, CONTROL_SHUTTER_ON, 0);
+    }else if((strncmp(str_arg, "off", 3) == 0)){
+      command_post(ctx, feedback, CONTROL_SHUTTER_OFF, 0);
+    }
+  }
+#endif
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+  else if(sscanf(buffer, "map %u", &arg) == 1) {
+    if(arg > 1){
+      const char msg[] = "map argument needs to be 0 or 1\r\n";
+      const size_t msg_len = sizeof(msg)-1;
+      feedback(msg, msg_len);
+    } else {
+      if(ctx->cur_temp >= TEMP_C(40)){
+        const char msg[] = "map can be started only at temperatures lower than 40\r\n";
+        const size_t msg_len = sizeof(msg)-1;
+        feedback(msg, msg_len);
+      } else {
+        command_post(ctx, feedback, CONTROL_MAP, arg);
+      }
+    }
+  } else if(strncmp(buffer, "map\n", 4) == 0) {
+      print_map(ctx, feedback);
+  } else if(sscanf(buffer, "map slope %" STR(BUF_SIZE) "s", &str_arg) == 1) {
+    unsigned milli;
+
+    if(!parse_milli(str_arg, &milli) || milli > STEADY_SLOPE_MAX_C * 1000){
+      const char msg[] = "map slope needs to be 0 to " STR(STEADY_SLOPE_MAX_C) " C/h, e.g. 0.5\r\n";
+      feedback(msg, sizeof(msg)-1);
+    } else {
+      command_post(ctx, feedback, CONTROL_MAP_SLOPE, (uint64_t) milli * TEMP_ONE / 1000);
+    }
+  } else if(sscanf(buffer, "map dwell %u %u", &arg, &arg2) == 2) {
+    if(arg < 1 || arg > arg2 || arg2 > STEADY_DWELL_LIMIT){
+      const char msg[] = "map dwell needs 1 <= min <= max <= " STR(STEADY_DWELL_LIMIT) " minutes\r\n";
+      feedback(msg, sizeof(msg)-1);
+    } else {
+      command_post(ctx, feedback, CONTROL_MAP_DWELL, (arg << 16) | arg2);
+    }
+  }
+#endif
+#if CONFIG_STIRRER
+  else if(sscanf(buffer, "stir %u", &arg) == 1){
+    if(arg > 1){
+      const char msg[] = "stir argument needs to be 0 or 1\r\n";
+      const size_t msg_len = sizeof(msg)-1;
+      feedback(msg, msg_len);
+    } else {
+      set_stirrer((bool) arg);
+    }
+  }
+#endif
+}
+
+static void
+tcp_command_handler(furnace_context_t* ctx, struct tcp_pcb* tpcb)
+{
+  void
+  send(const char* msg, const size_t msg_len)
+  {
+    const err_t err = tcp_server_send_data(ctx, tpcb, msg, msg_len);
+
+    if (err != ERR_OK)
+      log_stdout_server(ctx->log_bits, "tcp write failed %d, reply of %u bytes lost\n", err, (unsigned) msg_len);
+  }
+
+  command_handler(ctx, ctx->tcp.recv_buffer, &send);
+}
+
+static err_t
+tcp_server_recv(void* ctx_, struct tcp_pcb* tpcb, struct pbuf* p, err_t err)
+{
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
+
+  if (!p) {
+    tcp_server_close(ctx);
+    return err;
+  }
+
+  tcp_server_recv_(ctx, tpcb, p);
+  //We are expecting only strings, we can manually terminate the string
+  ctx->tcp.recv_buffer[p->tot_len] = '\0';
+
+  pbuf_free(p);
+
+  // Echo back for debugging
+  // tcp_server_send_data(ctx, tpcb, ctx->recv_buffer, ctx->recv_len);
+
+  tcp_command_handler(ctx, tpcb);
+
+  log_stdout_server(ctx->log_bits, "tcp_server_recv: %.*s\n", p->tot_len, ctx->tcp.recv_buffer);
+
+  return ERR_OK;
+}
+
+static void
+tcp_server_err(void* ctx_, err_t err)
+{
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
+
+  log_stdout_server(ctx->log_bits, "tcp_client_err_fn %d\n", err);
+  tcp_server_close(ctx);
+}
+
+static err_t
+tcp_server_accept(void* ctx_, struct tcp_pcb* client_pcb, err_t err)
+{
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
+
+  if (err != ERR_OK || client_pcb == NULL) {
+    log_stdout_server(ctx->log_bits, "Failure in accept\n");
+    tcp_server_close(ctx);
+    return ERR_VAL;
+  }
+
+  log_stdout_server(ctx->log_bits, "Client connected\n");
+
+  ctx->tcp.client_pcb = client_pcb;
+  tcp_arg(client_pcb, ctx);
+  tcp_recv(client_pcb, tcp_server_recv);
+  tcp_err(client_pcb, tcp_server_err);
+
+  client_pcb->so_options |= SOF_KEEPALIVE;
+  client_pcb->keep_intvl = 4000; /* 4 seconds */
+
+  return ERR_OK;
+}
+
+static bool
+tcp_server_open(void* ctx_)
+{
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
+
+  log_stdout_server(ctx->log_bits,
+                     "Starting server at %s on port %u\n",
+                     ip4addr_ntoa(netif_ip4_addr(netif_list)),
+                     TCP_PORT);
+
+  struct tcp_pcb* pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+  if (!pcb) {
+    log_stdout_server(ctx->log_bits, "Failed to create pcb\n");
+    return false;
+  }
+
+  err_t err = tcp_bind(pcb, NULL, TCP_PORT);
+  if (err) {
+    log_stdout_server(ctx->log_bits, "Failed to bind to port %u\n", TCP_PORT);
+    return false;
+  }
+
+  ctx->tcp.server_pcb = tcp_listen_with_backlog(pcb, 1);
+  if (!ctx->tcp.server_pcb) {
+    log_stdout_server(ctx->log_bits, "Failed to listen\n");
+    if (pcb) {
+      tcp_close(pcb);
+    }
+    return false;
+  }
+
+  tcp_arg(ctx->tcp.server_pcb, ctx);
+  tcp_accept(ctx->tcp.server_pcb, tcp_server_accept);
+
+  return true;
+}
+
+#if CONFIG_THERMO
+static void
+telemetry_publish(furnace_context_t *ctx, uint8_t kind);
+
+#if CONFIG_PILOT
+static void
+ident_done_(furnace_context_t *ctx);
+
+static void
+preheat_setpoint_(furnace_context_t *ctx);
+#endif
+
+#ifdef MAX318xx_DRDY_PIN
+  /* Only a lost DRDY edge lets this run out, the next sample re-arms it. */
+  #define THERMO_POLL_MS (2 * MAX318xx_CONVERSION_MS)
+#endif
+
+/* Until the sample command says otherwise: 10 Hz, straight through. */
+#define THERMO_SAMPLE_PERIOD_MS 100
+_Static_assert(THERMO_SAMPLE_PERIOD_MS >= MAX318xx_CONVERSION_MS);
+
+static void
+init_thermocouple(furnace_context_t *ctx)
+{
+  const sample_config_t config = {
+    .period_ms = THERMO_SAMPLE_PERIOD_MS,
+    .median    = 1,
+    .ema_shift = 0,
+    .decimate  = 1,
+    .reject    = 0,
+  };
+
+  ctx->thermo.xfer.busy     = false;
+  ctx->thermo.pending       = false;
+  ctx->thermo.sensor        = 0;
+  ctx->thermo.regulate      = 0;
+  ctx->thermo.faults        = 0;
+  ctx->thermo.poll_deadline = get_absolute_time();
+  ctx->thermo.next_sample   = nil_time;
+  ctx->thermo.drdy          = false;
+
+  for (unsigned i = 0; i < THERMO_SENSORS; i++) {
+    ctx->thermo.sensors[i].temp      = 0;
+    ctx->thermo.sensors[i].sample_at = nil_time;
+    memset(&ctx->thermo.sensors[i].snapshot, 0, sizeof(ctx->thermo.sensors[i].snapshot));
+    sample_pipeline_init(&ctx->thermo.sensors[i].pipe, &config);
+  }
+
+  const estimator_config_t estimate = {
+    .alpha = ESTIMATOR_ALPHA,
+    .gain  = 0,
+  };
+
+  estimator_init(&ctx->thermo.estimator, &estimate);
+  ctx->thermo.estimated_at = nil_time;
+}
+
+#ifdef MAX318xx_DRDY_PIN
+static furnace_context_t *thermo_irq_ctx;
+
+static void
+thermocouple_drdy_irq(uint gpio, uint32_t events)
+{
+  thermo_irq_ctx->thermo.drdy_us = time_us_32();
+  thermo_irq_ctx->thermo.drdy    = true;
+}
+
+/* The interrupt goes to the core that calls this, the control path's one. */
+static void
+init_thermocouple_irq(furnace_context_t *ctx)
+{
+  thermo_irq_ctx = ctx;
+
+  gpio_init(MAX318xx_DRDY_PIN);
+  gpio_set_dir(MAX318xx_DRDY_PIN, GPIO_IN);
+  gpio_pull_up(MAX318xx_DRDY_PIN);
+  gpio_set_irq_enabled_with_callback(MAX318xx_DRDY_PIN, GPIO_IRQ_EDGE_FALL, true,
+                                     thermocouple_drdy_irq);
+}
+#endif
+
+/*
+ * Kicks off a sample of ctx->thermo.sensor, returns without waiting for
+ * the bus. Returns false if the bus is taken and the caller should try
+ * again later.
+ */
+static bool
+thermocouple_start(furnace_context_t *ctx)
+{
+  spi_xfer_t *xfer = &ctx->thermo.xfer;
+
+  /* The first sensor's conversion stands for the whole round. */
+  if (ctx->thermo.sensor == 0) {
+    ctx->thermo.xfer_at = get_absolute_time();
+
+#ifdef MAX318xx_DRDY_PIN
+    /* Cleared before the read, a conversion finishing meanwhile sets it again. */
+    if (ctx->thermo.drdy) {
+      const uint32_t age_us = time_us_32() - ctx->thermo.drdy_us;
+
+      ctx->thermo.drdy    = false;
+      ctx->thermo.xfer_at = from_us_since_boot(to_us_since_boot(ctx->thermo.xfer_at) - age_us);
+    }
+#endif
+  }
+
+  max318xx_sample_request(xfer->tx);
+  xfer->len    = MAX318xx_SAMPLE_LEN;
+  xfer->cs_pin = max318xx_sensors[ctx->thermo.sensor].cs_pin;
+
+  if (!spi_async_start(xfer))
+    return false;
+
+  ctx->thermo.pending  = true;
+  ctx->thermo.deadline = make_timeout_time_us(spi_async_time_us(xfer));
+
+  return true;
+}
+
+/*
+ * Decides, once the first sensor is in, whether the round goes on or the
+ * conversion is dropped, and when the next round is due.
+ */
+static bool
+thermocouple_round_due(furnace_context_t *ctx)
+{
+  const uint32_t period_ms = ctx->thermo.sensors[0].pipe.config.period_ms;
+
+#ifdef MAX318xx_DRDY_PIN
+  /*
+   * The converter runs at its own pace and every conversion has to be read
+   * to re-arm DRDY. Those that come in faster than asked for are dropped.
+   */
+  ctx->thermo.poll_deadline = make_timeout_time_ms(period_ms + THERMO_POLL_MS);
+
+  if (absolute_time_diff_us(ctx->thermo.next_sample, ctx->thermo.xfer_at) < 0)
+    return false;
+
+  /* Half a conversion early, so that jitter doesn't skip a due one. */
+  ctx->thermo.next_sample = delayed_by_ms(ctx->thermo.xfer_at,
+                                          period_ms - MAX318xx_CONVERSION_MS / 2);
+#else
+  ctx->thermo.poll_deadline = delayed_by_ms(ctx->thermo.xfer_at, period_ms);
+#endif
+
+  return true;
+}
+
+/*
+ * cur_temp (and cold_temp) follow the sensor picked with the sensor command.
+ * While that one reports a fault there is nothing to regulate on, so the
+ * heater stays off until the sensor is back.
+ */
+static void
+thermocouple_regulate(furnace_context_t *ctx)
+{
+  const thermo_sensor_t *sensor = &ctx->thermo.sensors[ctx->thermo.regulate];
+  const uint8_t          faults = sensor->snapshot.faults & MAX318xx_FAULT_FATAL;
+
+  ctx->cur_temp = sensor->temp;
+#if CONFIG_THERMO == CONFIG_THERMO_KTYPE
+  ctx->cold_temp = sensor->snapshot.cold_temp;
+#endif
+
+  /* New samples only, a decimating pipe hands out the same one for a while. */
+  const uint64_t sample_us    = to_us_since_boot(sensor->sample_at);
+  const uint64_t estimated_us = to_us_since_boot(ctx->thermo.estimated_at);
+
+  if (sample_us != to_us_since_boot(nil_time) && sample_us != estimated_us) {
+    const uint32_t dt_ms = estimated_us != to_us_since_boot(nil_time)
+                         ? (sample_us - estimated_us) / 1000 : 0;
+
+    estimator_update(&ctx->thermo.estimator, sensor->temp, dt_ms, ctx->pwm_fine);
+    ctx->thermo.estimated_at = sensor->sample_at;
+
+    ctx->model.input_sum += ctx->pwm_fine;
+    ctx->model.input_count++;
+
+#if CONFIG_PILOT
+    if (ctx->ident.run.state == IDENT_RUNNING) {
+      ident_record(&ctx->ident.run, sensor->temp, ctx->pwm_fine);
+
+      if (ctx->ident.run.state == IDENT_DONE)
+        ident_done_(ctx);
+    }
+#endif
+  }
+
+  if (faults) {
+    set_pwm_safe(FURNACE_FIRE_PIN, ctx, 0);
+
+    if (!ctx->thermo.faults)
+      telemetry_publish(ctx, TELEMETRY_SENSOR_FAULT);
+  }
+
+  ctx->thermo.faults = faults;
+}
+
+/*
+ * Picks up the sample started by thermocouple_start, false if not in yet.
+ * Moves on to the next sensor, back to the first one once the round is over.
+ */
+static bool
+thermocouple_finish(furnace_context_t *ctx)
+{
+  spi_xfer_t      *xfer   = &ctx->thermo.xfer;
+  thermo_sensor_t *sensor = &ctx->thermo.sensors[ctx->thermo.sensor];
+
+  if (!spi_async_done(xfer))
+    return false;
+
+  ctx->thermo.pending = false;
+
+  if (ctx->thermo.sensor == 0 && !thermocouple_round_due(ctx))
+    return true;
+
+  max318xx_snapshot_decode(&sensor->snapshot, xfer->rx);
+
+  temp_t temp;
+
+  /* A faulty reading would only drag the filters off, temp keeps the last good one. */
+  if (!(sensor->snapshot.faults & MAX318xx_FAULT_FATAL)
+      && sample_pipeline_push(&sensor->pipe, sensor->snapshot.temp, &temp)) {
+    sensor->sample_at = ctx->thermo.xfer_at;
+    sensor->temp      = temp;
+  }
+
+  if (++ctx->thermo.sensor < THERMO_SENSORS)
+    return true;
+
+  ctx->thermo.sensor = 0;
+  thermocouple_regulate(ctx);
+
+  return true;
+}
+
+/* Takes a setting of the sample command, already validated by command_handler. */
+static void
+thermocouple_configure(furnace_context_t *ctx, const control_msg_t *msg)
+{
+  sample_config_t config = ctx->thermo.sensors[0].pipe.config;
+
+  switch (msg->op) {
+    case CONTROL_SAMPLE_PERIOD:   config.period_ms = msg->arg;          break;
+    case CONTROL_SAMPLE_MEDIAN:   config.median    = msg->arg;          break;
+    case CONTROL_SAMPLE_EMA:      config.ema_shift = msg->arg;          break;
+    case CONTROL_SAMPLE_DECIMATE: config.decimate  = msg->arg;          break;
+    case CONTROL_SAMPLE_REJECT:   config.reject    = (temp_t) msg->arg; break;
+  }
+
+  for (unsigned i = 0; i < THERMO_SENSORS; i++)
+    sample_pipeline_configure(&ctx->thermo.sensors[i].pipe, &config);
+
+  /* The new period starts right away. */
+  ctx->thermo.next_sample = nil_time;
+  if (!ctx->thermo.pending)
+    ctx->thermo.poll_deadline = get_absolute_time();
+}
+
+/* Flash gets the model once an hour. */
+#define MODEL_SAVE_PERIODS (60 * 60 * 1000 / MODEL_PERIOD_MS)
+
+static void
+init_model(furnace_context_t *ctx)
+{
+  ctx->model.deadline    = make_timeout_time_ms(MODEL_PERIOD_MS);
+  ctx->model.input_sum   = 0;
+  ctx->model.input_count = 0;
+  ctx->model.periods     = 0;
+  model_init(&ctx->model.model, MODEL_MEMORY_MIN);
+  model_save(&ctx->model.model, &ctx->model.saved);
+}
+
+static void
+do_model_work(furnace_context_t *ctx)
+{
+  model_context_t *m     = &ctx->model;
+  const int32_t    input = m->input_count ? (int32_t) (m->input_sum / m->input_count) : ctx->pwm_fine;
+
+  m->deadline    = make_timeout_time_ms(MODEL_PERIOD_MS);
+  m->input_sum   = 0;
+  m->input_count = 0;
+
+  /* Nothing to learn while the sensor is out, the gap starts the history over. */
+  if (ctx->thermo.faults || !ctx->thermo.estimator.primed) {
+    model_pause(&m->model);
+    return;
+  }
+
+  model_update(&m->model, estimator_temp(&ctx->thermo.estimator), input);
+
+  if (++m->periods >= MODEL_SAVE_PERIODS) {
+    m->periods = 0;
+    model_save(&m->model, &m->saved);
+  }
+}
+#endif
+
+/*
+ * Reports the control state to core0. Never blocks, if core0 is stuck
+ * in the network stack the report is dropped and counted in outbox.drops.
+ */
+static void
+telemetry_publish(furnace_context_t *ctx, uint8_t kind)
+{
+  telemetry_t telemetry = {
+    .kind         = kind,
+    .pwm_level    = ctx->pwm_level,
+    .ceiling_pwm  = ctx->ceiling_pwm,
+    .cur_temp     = ctx->cur_temp,
+#if CONFIG_THERMO == CONFIG_THERMO_KTYPE
+    .cold_temp    = ctx->cold_temp,
+#endif
+#if CONFIG_THERMO
+    .sample_age_ms = absolute_time_diff_us(ctx->thermo.sensors[ctx->thermo.regulate].sample_at,
+                                           get_absolute_time()) / 1000,
+    .regulate     = ctx->thermo.regulate,
+    .faults       = ctx->thermo.sensors[ctx->thermo.regulate].snapshot.faults,
+#endif
+#if CONFIG_PILOT
+    .auto_enabled = ctx->pilot.is_enabled,
+    .des_temp     = ctx->pilot.des_temp,
+#endif
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+    .max_pwm_temp = ctx->mapper.max_pwm_temp,
+#endif
+#if CONFIG_PILOT
+    .profile_state   = ctx->profile.engine.state,
+    .profile_phase   = ctx->profile.engine.phase,
+    .profile_segment = ctx->profile.engine.segment,
+    .profile_count   = ctx->profile.engine.program.count,
+#endif
+#if CONFIG_THERMO && CONFIG_PILOT
+    .autotune_ku        = ctx->autotune.tune.ku,
+    .autotune_pu_ms     = ctx->autotune.tune.pu_ms,
+    .autotune_amplitude = ctx->autotune.tune.amplitude,
+    .pid                = ctx->pilot.pid.config,
+    .preheat            = ctx->preheat.run,
+#endif
+  };
+
+#if CONFIG_THERMO
+  for (unsigned i = 0; i < THERMO_SENSORS; i++)
+    telemetry.sensor_temp[i] = ctx->thermo.sensors[i].temp;
+
+  telemetry.rate = estimator_rate(&ctx->thermo.estimator);
+#endif
+#if CONFIG_PILOT
+  const uint32_t left_min = profile_phase_left_min(&ctx->profile.engine);
+
+  telemetry.profile_left_min = left_min > UINT16_MAX ? UINT16_MAX : left_min;
+#endif
+
+  if (spsc_push(&ctx->control.outbox, &telemetry))
+    __sev();
+}
+
+static int
+format_status(char* buffer, const telemetry_t* telemetry)
+{
+#if CONFIG_AUTO == CONFIG_AUTO_NONE
+  return snprintf(
+      buffer,
+      FORMAT_STATUS_AUTO_NONE_SIZE,
+      FORMAT_STATUS_AUTO_NONE,
+      TEMP_ARGS(telemetry->cur_temp),
+      telemetry->pwm_level,
+      MAX_PWM
+      );
+#else
+  int len = snprintf(
+      buffer,
+      FORMAT_STATUS_AUTO_PILOT_SIZE,
+      FORMAT_STATUS_BASE,
+      TEMP_ARGS(telemetry->cur_temp),
+      TEMP_ARGS(telemetry->des_temp),
+      telemetry->pwm_level,
+      telemetry->ceiling_pwm,
+      MAX_PWM,
+      telemetry->auto_enabled
+    );
+
+#if CONFIG_THERMO
+  len += snprintf(buffer + len, FORMAT_STATUS_AUTO_PILOT_SIZE - len, RATE_STATUS_FMT,
+                  TEMP_ARGS(telemetry->rate));
+#endif
+
+  if (telemetry->profile_state != PROFILE_IDLE)
+    len += snprintf(buffer + len, FORMAT_STATUS_AUTO_PILOT_SIZE - len, PROFILE_STATUS_FMT,
+                    telemetry->profile_segment + 1, telemetry->profile_count,
+                    profile_phase_name(telemetry->profile_state, telemetry->profile_phase),
+                    telemetry->profile_left_min);
+
+  len += snprintf(buffer + len, FORMAT_STATUS_AUTO_PILOT_SIZE - len, "\n");
+
+  return len;
+#endif
+}
+
+#if CONFIG_THERMO && THERMO_SENSORS > 1
+static int
+format_sensors(char* buffer, const telemetry_t* telemetry)
+{
+  int len = snprintf(buffer, SENSOR_STATUS_SIZE, SENSOR_STATUS_PREFIX);
+
+  for (unsigned i = 0; i < THERMO_SENSORS; i++)
+    len += snprintf(buffer + len, SENSOR_STATUS_SIZE - len, SENSOR_STATUS_FMT,
+                    max318xx_sensors[i].name, TEMP_ARGS(telemetry->sensor_temp[i]),
+                    i == telemetry->regulate ? "*" : "");
+
+  len += snprintf(buffer + len, SENSOR_STATUS_SIZE - len, "\n");
+
+  return len;
+}
+#endif
+
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+
+static int
+format_mapper(char *buffer, const telemetry_t* telemetry)
+{
+    return snprintf(
+      buffer,
+      MAPPER_STATUS_SIZE,
+      MAPPER_STATUS_FMT,
+      telemetry->pwm_level,
+      TEMP_ARGS(telemetry->max_pwm_temp)
+    );
+}
+
+#endif
+
+static void
+do_tcp_work(furnace_context_t *ctx)
+{
+  cyw43_arch_poll();
+
+  // If disconnected, reset and setup listening
+  if (ctx->tcp.server_pcb == NULL || ctx->tcp.server_pcb->state == CLOSED) {
+    memset(&ctx->tcp, 0, sizeof(ctx->tcp));
+    if (!tcp_server_open(ctx)) {
+      tcp_server_close(ctx);
+    }
+  }
+}
+
+static void
+report_status(furnace_context_t *ctx, const telemetry_t *telemetry)
+{
+#if CONFIG_AUTO == CONFIG_AUTO_NONE
+  char temperature_str[FORMAT_STATUS_AUTO_NONE_SIZE];
+#else
+  char temperature_str[FORMAT_STATUS_AUTO_PILOT_SIZE];
+#endif
+
+#if CONFIG_THERMO == CONFIG_THERMO_KTYPE
+  log_stdout_thermocouple(ctx->log_bits, "cold: " TEMP_FMT "\n", TEMP_ARGS(telemetry->cold_temp));
+#endif
+#if CONFIG_THERMO
+  log_stdout_thermocouple(ctx->log_bits, "hot: " TEMP_FMT " (%u ms old)\n",
+                          TEMP_ARGS(telemetry->cur_temp), telemetry->sample_age_ms);
+#else
+  log_stdout_thermocouple(ctx->log_bits, "hot: " TEMP_FMT "\n", TEMP_ARGS(telemetry->cur_temp));
+#endif
+
+  const int temperature_str_len = format_status(temperature_str, telemetry);
+
+  if (ctx->tcp.client_pcb) {
+    tcp_server_send_data(
+      ctx,
+      ctx->tcp.client_pcb,
+      (uint8_t*)temperature_str,
+      temperature_str_len
+    );
+  }
+
+  log_stdout_basic(ctx->log_bits, temperature_str);
+
+#if CONFIG_THERMO && THERMO_SENSORS > 1
+  char sensors_str[SENSOR_STATUS_SIZE];
+
+  const int sensors_str_len = format_sensors(sensors_str, telemetry);
+
+  if (ctx->tcp.client_pcb)
+    tcp_server_send_data(ctx, ctx->tcp.client_pcb, (uint8_t*)sensors_str, sensors_str_len);
+
+  log_stdout_basic(ctx->log_bits, sensors_str);
+#endif
+}
+
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+static void
+report_mapper(furnace_context_t *ctx, const telemetry_t *telemetry)
+{
+  if (!ctx->tcp.client_pcb)
+    return;
+
+  switch (telemetry->kind) {
+    case TELEMETRY_MAPPER_STEP: {
+      char buffer[MAPPER_STATUS_SIZE];
+
+      const int size = format_mapper(buffer, telemetry);
+      tcp_server_send_data(ctx, ctx->tcp.client_pcb, (uint8_t*)buffer, size);
+      break;
+    }
+
+    case TELEMETRY_MAPPER_MAX_PWM: {
+      const char msg[] = "pwm_level has reached MAX_PWM, enabling auto and steering temp towards FALLBACK_TEMP!\r\n";
+      const size_t msg_len = sizeof(msg)-1;
+      tcp_server_send_data(ctx, ctx->tcp.client_pcb, (uint8_t*)msg, msg_len);
+      break;
+    }
+
+    case TELEMETRY_MAPPER_MAX_TEMP: {
+      const char msg[] = "cur_temp has reached MAX_TEMP, enabling auto and steering temp towards FALLBACK_TEMP!\r\n";
+      const size_t msg_len = sizeof(msg)-1;
+      tcp_server_send_data(ctx, ctx->tcp.client_pcb, (uint8_t*)msg, msg_len);
+      break;
+    }
+  }
+}
+#endif
+
+#if CONFIG_THERMO
+static void
+report_sensor_fault(furnace_context_t *ctx, const telemetry_t *telemetry)
+{
+  char msg[96];
+
+  const int msg_len = snprintf(msg, sizeof(msg), "thermocouple %s: %s, heater off!\r\n",
+                               max318xx_sensors[telemetry->regulate].name,
+                               max318xx_fault_name(telemetry->faults));
+
+  if (ctx->tcp.client_pcb)
+    tcp_server_send_data(ctx, ctx->tcp.client_pcb, (uint8_t*)msg, msg_len);
+
+  log_stdout_basic(ctx->log_bits, msg);
+}
+#endif
+
+#if CONFIG_THERMO && CONFIG_PILOT
+static void
+report_autotune(furnace_context_t *ctx, const telemetry_t *telemetry)
+{
+  char msg[160];
+  int  msg_len;
+
+  if (telemetry->kind == TELEMETRY_AUTOTUNE_DONE) {
+    msg_len = snprintf(msg, sizeof(msg),
+                       "autotune done: ku %u.%03u, pu %u s, amplitude " TEMP_FMT
+                       ", kp %u.%03u, ti %u s, td %u s, holding " TEMP_FMT "\r\n",
+                       (unsigned) telemetry->autotune_ku / PID_GAIN_ONE,
+                       (unsigned) telemetry->autotune_ku % PID_GAIN_ONE,
+                       (unsigned) telemetry->autotune_pu_ms / 1000,
+                       TEMP_ARGS(telemetry->autotune_amplitude),
+                       (unsigned) telemetry->pid.kp / PID_GAIN_ONE,
+                       (unsigned) telemetry->pid.kp % PID_GAIN_ONE,
+                       telemetry->pid.ti_s, telemetry->pid.td_s,
+                       TEMP_ARGS(telemetry->des_temp));
+  } else {
+    msg_len = snprintf(msg, sizeof(msg), "autotune failed, heater off!\r\n");
+  }
+
+  if (ctx->tcp.client_pcb)
+    tcp_server_send_data(ctx, ctx->tcp.client_pcb, (uint8_t*)msg, msg_len);
+
+  log_stdout_basic(ctx->log_bits, msg);
+}
+#endif
+
+#if CONFIG_THERMO && CONFIG_PILOT
+/* Lines per pass, lwIP copies every one and the status lines go out in between. */
+#define IDENT_DUMP_LINES   32
+#define IDENT_DUMP_WAIT_MS 100
+
+/*
+ *   ident begin: <count> samples <ms> ms apart, pwm <low> and <high>, bit <s> s
+ *   ident <ms since the start>,<pwm>,<temp>
+ *   ident end
+ */
+static int
+format_ident_line(char *buffer, size_t size, const ident_t *run, uint32_t line)
+{
+  if (line == 0)
+    return snprintf(buffer, size, "ident begin: %u samples %u ms apart, pwm " PWM_FINE_FMT
+                    " and " PWM_FINE_FMT ", bit %u s\r\n",
+                    (unsigned) run->count, (unsigned) run->sample_ms,
+                    PWM_FINE_ARGS(run->low), PWM_FINE_ARGS(run->high),
+                    (unsigned) run->bit_ms / 1000);
+
+  if (line > run->count)
+    return snprintf(buffer, size, "ident end\r\n");
+
+  const uint32_t i     = line - 1;
+  const int32_t  input = (int32_t) run->inputs[i] << (PWM_FINE_BITS - IDENT_INPUT_BITS);
+
+  return snprintf(buffer, size, "ident %u," PWM_FINE_FMT "," TEMP_FMT "\r\n",
+                  (unsigned) (i * run->sample_ms), PWM_FINE_ARGS(input), TEMP_ARGS(run->temps[i]));
+}
+
+static void
+do_ident_dump(furnace_context_t *ctx)
+{
+  ident_context_t *ident = &ctx->ident;
+  struct tcp_pcb  *pcb   = ctx->tcp.client_pcb;
+
+  ident->dump_deadline = make_timeout_time_ms(IDENT_DUMP_WAIT_MS);
+
+  /* Nobody to stream to yet, a new client gets it from the top. */
+  if (!pcb) {
+    ident->dump_pcb = NULL;
+    return;
+  }
+
+  if (pcb != ident->dump_pcb) {
+    ident->dump_pcb  = pcb;
+    ident->dump_line = 0;
+  }
+
+  for (unsigned i = 0; i < IDENT_DUMP_LINES; i++) {
+    char      line[80];
+    const int len = format_ident_line(line, sizeof(line), &ident->run, ident->dump_line);
+
+    /* Send buffer full, the rest once lwIP got acks for it. */
+    if (tcp_server_send_data(ctx, pcb, (uint8_t*)line, len) != ERR_OK)
+      break;
+
+    if (++ident->dump_line > ident->run.count + 1u) {
+      ident->dumping = false;
+      break;
+    }
+
+    ident->dump_deadline = get_absolute_time();
+  }
+
+  tcp_output(pcb);
+}
+
+static void
+report_ident(furnace_context_t *ctx, const telemetry_t *telemetry)
+{
+  char msg[96];
+  int  msg_len;
+
+  if (telemetry->kind == TELEMETRY_IDENT_DONE) {
+    msg_len = snprintf(msg, sizeof(msg), "ident done: %u samples, streaming them over tcp\r\n",
+                       (unsigned) ctx->ident.run.count);
+    ident_dump_start(ctx);
+  } else {
+    msg_len = snprintf(msg, sizeof(msg), "ident failed, heater off!\r\n");
+  }
+
+  if (ctx->tcp.client_pcb)
+    tcp_server_send_data(ctx, ctx->tcp.client_pcb, (uint8_t*)msg, msg_len);
+
+  log_stdout_basic(ctx->log_bits, msg);
+}
+
+/* Time to setpoint of every run, to see what the full power part gains. */
+static void
+report_preheat(furnace_context_t *ctx, const telemetry_t *telemetry)
+{
+  char msg[160];
+  int  msg_len;
+
+  msg_len  = snprintf(msg, sizeof(msg), "preheat done: ");
+  msg_len += format_preheat(msg + msg_len, sizeof(msg) - msg_len, &telemetry->preheat);
+  msg_len += snprintf(msg + msg_len, sizeof(msg) - msg_len, "\r\n");
+
+  if (ctx->tcp.client_pcb)
+    tcp_server_send_data(ctx, ctx->tcp.client_pcb, (uint8_t*)msg, msg_len);
+
+  log_stdout_basic(ctx->log_bits, msg);
+}
+#endif
+
+#if CONFIG_PILOT
+static void
+report_profile_done(furnace_context_t *ctx)
+{
+  const char msg[] = "profile done, heater off!\r\n";
+  const size_t msg_len = sizeof(msg)-1;
+
+  if (ctx->tcp.client_pcb)
+    tcp_server_send_data(ctx, ctx->tcp.client_pcb, (uint8_t*)msg, msg_len);
+
+  log_stdout_basic(ctx->log_bits, msg);
+}
+#endif
+
+/* Core0 side of the outbox, turns control reports into text. */
+static void
+do_telemetry_work(furnace_context_t *ctx)
+{
+  telemetry_t telemetry;
+
+  while (spsc_pop(&ctx->control.outbox, &telemetry)) {
+    if (telemetry.kind == TELEMETRY_STATUS)
+      report_status(ctx, &telemetry);
+#if CONFIG_THERMO
+    else if (telemetry.kind == TELEMETRY_SENSOR_FAULT)
+      report_sensor_fault(ctx, &telemetry);
+#endif
+#if CONFIG_PILOT
+    else if (telemetry.kind == TELEMETRY_PROFILE_DONE)
+      report_profile_done(ctx);
+#endif
+#if CONFIG_THERMO && CONFIG_PILOT
+    else if (telemetry.kind == TELEMETRY_AUTOTUNE_DONE || telemetry.kind == TELEMETRY_AUTOTUNE_FAILED)
+      report_autotune(ctx, &telemetry);
+    else if (telemetry.kind == TELEMETRY_IDENT_DONE || telemetry.kind == TELEMETRY_IDENT_FAILED)
+      report_ident(ctx, &telemetry);
+    else if (telemetry.kind == TELEMETRY_PREHEAT_DONE)
+      report_preheat(ctx, &telemetry);
+#endif
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+    else
+      report_mapper(ctx, &telemetry);
+#endif
+  }
+}
+
+static inline uint8_t
+clamp_u8(int min, int max, int val)
+{
+  uint8_t value = (uint8_t)val;
+
+  if(val < min)
+    value = min;
+
+  if(val > max)
+    value = max;
+
+  return value;
+}
+
+static void
+init_furnace(furnace_context_t *ctx)
+{
+  memset(ctx, 0, sizeof(*ctx));
+
+  ctx->ceiling_pwm = MAX_PWM;
+}
+
+#if CONFIG_PILOT
+/*
+ * Until the pid command says otherwise. Picked on bench_control against
+ * the furnace model: full power from cold, into the band without
+ * overshooting it.
+ */
+#define PILOT_PID_KP   4000
+#define PILOT_PID_TI_S 600
+#define PILOT_PID_TD_S 0
+
+#if CONFIG_AUTO == CONFIG_AUTO_MPC
+/*
+ * Where des_temp is heading: the end of the ramp a running profile is
+ * on, des_temp itself otherwise.
+ */
+static temp_t
+pilot_target(furnace_context_t *ctx)
+{
+  const profile_t *profile = &ctx->profile.engine;
+
+  if (profile->state == PROFILE_RUNNING && profile->phase == PROFILE_RAMP)
+    return profile->program.segments[profile->segment].target;
+
+  return ctx->pilot.des_temp;
+}
+
+/*
+ * One period of the MPC, false without a model: the PID has the heater
+ * until there is one. It is kept at the MPC's output all along, so that
+ * it carries on from there should the model turn implausible.
+ */
+static bool
+pilot_mpc(furnace_context_t *ctx)
+{
+  mpc_t        *mpc = &ctx->pilot.mpc;
+  model_fopdt_t model;
+
+  if (ctx->thermo.faults || !ctx->thermo.estimator.primed || !model_get(&ctx->model.model, &model)) {
+    mpc->primed = false;
+    return false;
+  }
+
+  mpc_set_model(mpc, &model);
+
+  const temp_t temp = estimator_temp(&ctx->thermo.estimator);
+
+  if (!mpc->primed)
+    mpc_reset(mpc, temp, ctx->pwm_fine);
+
+  const int32_t out = mpc_update(mpc, ctx->pilot.des_temp, pilot_target(ctx), temp,
+                                 (int32_t) ctx->ceiling_pwm << PWM_FINE_BITS);
+
+  pid_reset(&ctx->pilot.pid, out);
+  ctx->pilot.pilot_deadline = make_timeout_time_ms(MPC_PERIOD_MS);
+  set_heater_fine(ctx, out);
+
+  return true;
+}
+#endif
+
+static void
+do_pilot_work(furnace_context_t *ctx)
+{
+  if (!ctx->pilot.is_enabled)
+    return;
+
+#if CONFIG_THERMO
+  /* The preheat has the heater up to the coast point, see preheat_handover_. */
+  if (ctx->preheat.run.state == PREHEAT_BOOST)
+    return;
+
+  /*
+   * Nothing to regulate on, thermocouple_regulate keeps the heater off.
+   * The integrator wound up against that meanwhile, so the pilot starts
+   * over from the heater off once the sensor is back.
+   */
+  if (ctx->thermo.faults) {
+    ctx->pilot.faulted = true;
+    return;
+  }
+
+  if (ctx->pilot.faulted) {
+    ctx->pilot.faulted = false;
+    pid_reset(&ctx->pilot.pid, ctx->pwm_fine);
+#if CONFIG_AUTO == CONFIG_AUTO_MPC
+    ctx->pilot.mpc.primed     = false;
+#endif
+    ctx->pilot.pilot_deadline = get_absolute_time();
+  }
+#endif
+
+  const bool deadline_met = get_absolute_time() > ctx->pilot.pilot_deadline;
+
+  if (!deadline_met)
+    return;
+
+#if CONFIG_AUTO == CONFIG_AUTO_MPC
+  if (pilot_mpc(ctx))
+    return;
+#endif
+
+  pid_controller_t *pid = &ctx->pilot.pid;
+
+  ctx->pilot.pilot_deadline = make_timeout_time_ms(pid->config.period_ms);
+
+  /* The rate for the derivative comes from the estimator, not this period's difference. */
+#if CONFIG_THERMO
+  const int32_t rate = estimator_rate(&ctx->thermo.estimator);
+#else
+  const int32_t rate = 0;
+#endif
+  const int32_t out  = pid_update(pid, ctx->pilot.des_temp, ctx->cur_temp, rate,
+                                  (int32_t) ctx->ceiling_pwm << PID_OUT_BITS);
+
+  _Static_assert(PID_OUT_BITS == PWM_FINE_BITS);
+  set_heater_fine(ctx, out);
+}
+
+/*
+ * Hands the heater over to the pilot, which carries on from the PWM it
+ * runs at right now. Does nothing if the pilot has it already.
+ */
+static void
+pilot_engage(furnace_context_t *ctx)
+{
+  if (ctx->pilot.is_enabled)
+    return;
+
+  pid_reset(&ctx->pilot.pid, ctx->pwm_fine);
+#if CONFIG_AUTO == CONFIG_AUTO_MPC
+  ctx->pilot.mpc.primed     = false;
+#endif
+  ctx->pilot.is_enabled     = true;
+  ctx->pilot.pilot_deadline = get_absolute_time();
+}
+
+/*
+ * Starts the running pilot over from the output the mapper found to hold
+ * des_temp, so that it only corrects around it instead of integrating its
+ * way there. Does nothing without a map.
+ */
+static void
+pilot_feed_forward(furnace_context_t *ctx)
+{
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+  int32_t out;
+
+  if (!ctx->pilot.is_enabled || !pwm_map_lookup(&ctx->mapper.map, ctx->pilot.des_temp, &out))
+    return;
+
+  pid_reset(&ctx->pilot.pid, out);
+  ctx->pilot.pilot_deadline = get_absolute_time();
+#else
+  (void) ctx;
+#endif
+}
+
+/* Takes a setting of the pid command, already validated by command_handler. */
+static void
+pilot_configure(furnace_context_t *ctx, const control_msg_t *msg)
+{
+  pid_config_t config = ctx->pilot.pid.config;
+
+  switch (msg->op) {
+    case CONTROL_PID_KP:     config.kp        = msg->arg; break;
+    case CONTROL_PID_TI:     config.ti_s      = msg->arg; break;
+    case CONTROL_PID_TD:     config.td_s      = msg->arg; break;
+    case CONTROL_PID_PERIOD: config.period_ms = msg->arg; break;
+  }
+
+  pid_configure(&ctx->pilot.pid, &config);
+
+  /* A shorter period starts right away. */
+  if (msg->op == CONTROL_PID_PERIOD)
+    ctx->pilot.pilot_deadline = make_timeout_time_ms(config.period_ms);
+}
+
+static void
+init_pilot(furnace_context_t *ctx)
+{
+  const pid_config_t config = {
+    .kp        = PILOT_PID_KP,
+    .ti_s      = PILOT_PID_TI_S,
+    .td_s      = PILOT_PID_TD_S,
+    .period_ms = CONFIG_FURNACE_DEADLINE_MS,
+  };
+
+  ctx->pilot.des_temp = 0;
+  ctx->pilot.is_enabled = false;
+  pid_init(&ctx->pilot.pid, &config);
+#if CONFIG_AUTO == CONFIG_AUTO_MPC
+  mpc_init(&ctx->pilot.mpc);
+#endif
+}
+#endif
+
+#if CONFIG_STIRRER
+static void
+init_stirrer(void)
+{
+  gpio_init(STIRRER_PIN);
+  gpio_set_dir(STIRRER_PIN, GPIO_OUT);
+}
+#endif
+
+static void
+init_stdio(furnace_context_t* ctx)
+{
+  ctx->stdio.parser = ctx->stdio.buffer;
+  memset(&ctx->stdio.buffer, 0, BUF_SIZE);
+}
+
+static void
+reset_stdio_data(furnace_context_t* ctx)
+{
+  memset(&ctx->stdio.buffer, 0, BUF_SIZE);
+  ctx->stdio.parser = ctx->stdio.buffer;
+}
+
+static void
+stdio_command_handler(furnace_context_t* ctx)
+{
+  void
+  send_stdio(const char* msg, const size_t msg_len)
+  {
+    if(msg_len == 0) return;
+    printf(msg);
+  }
+
+  command_handler(ctx, ctx->stdio.buffer, &send_stdio);
+}
+
+/*
+ * Returns true if it stopped after a complete line, there may be more
+ * input waiting then.
+ */
+static bool
+do_stdio_work(furnace_context_t* ctx)
+{
+  while(1) {
+    uint8_t c = getchar_timeout_us(0);
+
+    if(c == (uint8_t) PICO_ERROR_TIMEOUT) return false;
+
+    if(ctx->stdio.parser == ctx->stdio.buffer + BUF_SIZE){
+      printf("\nLines longer than %d are invalid!\nResetting stdio buffer.\n", BUF_SIZE);
+      reset_stdio_data(ctx);
+      return true;
+    }
+
+    // User may change last sent character from lf to cr, vice versa or crlf
+    // Although, in parsing command, we do not care how user sent this
+    // and we are always putting '\n' at the end of command
+    if(c == '\n' || c == '\r') {
+      *ctx->stdio.parser = '\n';
+      stdio_command_handler(ctx);
+      reset_stdio_data(ctx);
+      return true;
+    }
+
+    *ctx->stdio.parser = c;
+    ctx->stdio.parser++;
+  }
+}
+
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+
+/* Next level, or the first one: the window starts over. */
+static void
+mapper_step_start_(furnace_context_t *ctx)
+{
+  steady_reset(&ctx->mapper.steady);
+  ctx->mapper.step_at  = get_absolute_time();
+  ctx->mapper.deadline = make_timeout_time_ms(steady_period_ms(&ctx->mapper.steady_config));
+}
+
+static void
+mapper_deadline__(furnace_context_t *ctx)
+{
+  mapper_context_t *mapper   = &ctx->mapper;
+  const uint32_t    dwell_ms = absolute_time_diff_us(mapper->step_at, get_absolute_time()) / 1000;
+
+  steady_push(&mapper->steady, ctx->cur_temp);
+
+  if (!steady_settled(&mapper->steady, &mapper->steady_config, dwell_ms))
+    return;
+
+  mapper->max_pwm_temp = steady_mean(&mapper->steady);
+  pwm_map_record(&mapper->map, ctx->pwm_level, mapper->max_pwm_temp);
+  telemetry_publish(ctx, TELEMETRY_MAPPER_STEP);
+
+  const unsigned pwm = ctx->pwm_level + 1;
+
+  const int res = set_pwm_safe(FURNACE_FIRE_PIN, ctx, pwm);
+
+  if ( res == 1 ) {
+    telemetry_publish(ctx, TELEMETRY_MAPPER_MAX_PWM);
+
+    ctx->mapper.is_enabled = false;
+    ctx->pilot.des_temp = TEMP_C(FALLBACK_TEMP);
+    pilot_engage(ctx);
+    pilot_feed_forward(ctx);
+    return;
+  }
+
+  mapper_step_start_(ctx);
+}
+
+static void
+init_mapper(furnace_context_t *ctx)
+{
+  const steady_config_t config = {
+    .slope         = STEADY_SLOPE,
+    .dwell_min_min = STEADY_DWELL_MIN_MIN,
+    .dwell_max_min = STEADY_DWELL_MAX_MIN,
+  };
+
+  ctx->mapper.steady_config = config;
+  steady_reset(&ctx->mapper.steady);
+}
+
+static void
+mapper_deadline_(furnace_context_t *ctx)
+{
+  ctx->mapper.deadline = make_timeout_time_ms(steady_period_ms(&ctx->mapper.steady_config));
+  mapper_deadline__(ctx);
+}
+
+static void
+mapper_maxtemp_reached_(furnace_context_t *ctx)
+{
+  telemetry_publish(ctx, TELEMETRY_MAPPER_MAX_TEMP);
+
+  ctx->mapper.is_enabled = false;
+  ctx->pilot.des_temp = TEMP_C(FALLBACK_TEMP);
+  pilot_engage(ctx);
+  pilot_feed_forward(ctx);
+}
+
+static void
+do_mapper_work(furnace_context_t *ctx)
+{
+  if(!ctx->mapper.is_enabled)
+    return;
+
+  if(ctx->cur_temp >= TEMP_C(MAX_TEMP))
+    return mapper_maxtemp_reached_(ctx);
+
+  const bool deadline_met = get_absolute_time() > ctx->mapper.deadline;
+  if (deadline_met)
+    return mapper_deadline_(ctx);
+}
+
+#endif
+
+#if CONFIG_PILOT
+/* Someone took the heater or the setpoint over by hand, the program is off. */
+static void
+profile_abort_(furnace_context_t *ctx)
+{
+  if (profile_active(ctx))
+    profile_stop(&ctx->profile.engine);
+}
+
+static void
+profile_start_(furnace_context_t *ctx)
+{
+  const uint32_t now_ms = to_ms_since_boot(get_absolute_time());
+
+  if (!profile_start(&ctx->profile.engine, ctx->cur_temp, now_ms))
+    return;
+
+#if CONFIG_THERMO
+  autotune_stop(&ctx->autotune.tune);
+  ident_stop(&ctx->ident.run);
+#endif
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+  ctx->mapper.is_enabled = false;
+#endif
+  ctx->pilot.des_temp = ctx->profile.engine.setpoint;
+  pilot_engage(ctx);
+#if CONFIG_THERMO
+  preheat_setpoint_(ctx);
+#endif
+  ctx->profile.deadline = get_absolute_time();
+}
+
+static void
+profile_done_(furnace_context_t *ctx)
+{
+  ctx->pilot.is_enabled = false;
+  set_pwm_safe(FURNACE_FIRE_PIN, ctx, 0);
+  telemetry_publish(ctx, TELEMETRY_PROFILE_DONE);
+}
+
+static void
+do_profile_work(furnace_context_t *ctx)
+{
+  profile_t *profile = &ctx->profile.engine;
+
+  ctx->pilot.des_temp   = profile_update(profile, ctx->cur_temp, to_ms_since_boot(get_absolute_time()));
+  ctx->profile.deadline = make_timeout_time_ms(PROFILE_PERIOD_MS);
+
+  if (profile->state == PROFILE_DONE)
+    profile_done_(ctx);
+#if CONFIG_THERMO
+  else
+    preheat_setpoint_(ctx);
+#endif
+}
+
+static void
+profile_apply(furnace_context_t *ctx, const control_msg_t *msg)
+{
+  profile_t         *profile = &ctx->profile.engine;
+  profile_segment_t  segment;
+
+  switch (msg->op) {
+    case CONTROL_PROFILE_ADD:
+      profile_segment_unpack(&segment, msg->arg);
+      profile_add(profile, &segment);
+      break;
+
+    case CONTROL_PROFILE_CLEAR:
+      profile_clear(profile);
+      break;
+
+    case CONTROL_PROFILE_START:
+      profile_start_(ctx);
+      break;
+
+    case CONTROL_PROFILE_STOP:
+      if (profile_active(ctx)) {
+        profile_stop(profile);
+        ctx->pilot.is_enabled = false;
+        set_pwm_safe(FURNACE_FIRE_PIN, ctx, 0);
+      }
+      break;
+
+    case CONTROL_PROFILE_PAUSE:
+      profile_pause(profile);
+      break;
+
+    case CONTROL_PROFILE_RESUME:
+      profile_resume(profile, to_ms_since_boot(get_absolute_time()));
+      ctx->profile.deadline = get_absolute_time();
+      break;
+
+    case CONTROL_PROFILE_SKIP:
+      profile_skip(profile, to_ms_since_boot(get_absolute_time()));
+      ctx->profile.deadline = get_absolute_time();
+      if (profile->state == PROFILE_DONE)
+        profile_done_(ctx);
+      break;
+  }
+}
+
+static void
+init_profile(furnace_context_t *ctx)
+{
+  ctx->profile.engine.state = PROFILE_IDLE;
+}
+#endif
+
+#if CONFIG_THERMO && CONFIG_PILOT
+static void
+autotune_start_(furnace_context_t *ctx, temp_t setpoint)
+{
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+  ctx->mapper.is_enabled = false;
+#endif
+  ctx->pilot.is_enabled = false;
+  profile_abort_(ctx);
+  ident_stop(&ctx->ident.run);
+
+  autotune_start(&ctx->autotune.tune, setpoint, ctx->autotune.hysteresis, ctx->ceiling_pwm,
+                 to_ms_since_boot(get_absolute_time()));
+  ctx->autotune.deadline = get_absolute_time();
+}
+
+static void
+autotune_failed_(furnace_context_t *ctx)
+{
+  ctx->autotune.tune.state = AUTOTUNE_FAILED;
+  set_pwm_safe(FURNACE_FIRE_PIN, ctx, 0);
+  telemetry_publish(ctx, TELEMETRY_AUTOTUNE_FAILED);
+}
+
+/* Gains are in, the pilot holds the setpoint from the output that held it during the run. */
+static void
+autotune_done_(furnace_context_t *ctx)
+{
+  const autotune_t *tune   = &ctx->autotune.tune;
+  pid_config_t      config = ctx->pilot.pid.config;
+
+  autotune_gains(tune, &config);
+  pid_configure(&ctx->pilot.pid, &config);
+
+  set_heater_fine(ctx, tune->bias);
+  ctx->pilot.des_temp = tune->setpoint;
+  pilot_engage(ctx);
+
+  telemetry_publish(ctx, TELEMETRY_AUTOTUNE_DONE);
+}
+
+static void
+do_autotune_work(furnace_context_t *ctx)
+{
+  autotune_t *tune = &ctx->autotune.tune;
+
+  if (tune->state != AUTOTUNE_RUNNING)
+    return;
+
+  if (ctx->cur_temp >= TEMP_C(MAX_TEMP) || ctx->thermo.faults)
+    return autotune_failed_(ctx);
+
+  const unsigned pwm = autotune_update(tune, ctx->cur_temp, to_ms_since_boot(get_absolute_time()));
+
+  ctx->autotune.deadline = make_timeout_time_ms(AUTOTUNE_PERIOD_MS);
+
+  if (tune->state == AUTOTUNE_RUNNING)
+    set_pwm_safe(FURNACE_FIRE_PIN, ctx, pwm);
+  else if (tune->state == AUTOTUNE_DONE)
+    autotune_done_(ctx);
+  else
+    autotune_failed_(ctx);
+}
+
+static void
+init_autotune(furnace_context_t *ctx)
+{
+  ctx->autotune.hysteresis = AUTOTUNE_HYSTERESIS;
+  ctx->autotune.tune.state = AUTOTUNE_IDLE;
+}
+
+/* The PRBS switches around the output the heater is at right now. */
+static void
+ident_start_(furnace_context_t *ctx, unsigned amplitude)
+{
+  const sample_config_t *sample = &ctx->thermo.sensors[ctx->thermo.regulate].pipe.config;
+
+  ctx->ident.pilot = ctx->pilot.is_enabled;
+
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+  ctx->mapper.is_enabled = false;
+#endif
+  ctx->pilot.is_enabled = false;
+  profile_abort_(ctx);
+  autotune_stop(&ctx->autotune.tune);
+
+  ident_start(&ctx->ident.run, ctx->pwm_fine, (int32_t) amplitude << PWM_FINE_BITS,
+              (int32_t) ctx->ceiling_pwm << PWM_FINE_BITS, ctx->ident.bit_ms,
+              (uint32_t) sample->period_ms * sample->decimate, to_ms_since_boot(get_absolute_time()));
+  ctx->ident.deadline = get_absolute_time();
+
+  if (ctx->ident.run.state == IDENT_FAILED)
+    telemetry_publish(ctx, TELEMETRY_IDENT_FAILED);
+}
+
+static void
+ident_failed_(furnace_context_t *ctx)
+{
+  ident_fail(&ctx->ident.run);
+  set_pwm_safe(FURNACE_FIRE_PIN, ctx, 0);
+  telemetry_publish(ctx, TELEMETRY_IDENT_FAILED);
+}
+
+/* Log is full: the heater goes back to the operating point, and to the pilot if it had it. */
+static void
+ident_done_(furnace_context_t *ctx)
+{
+  set_heater_fine(ctx, ctx->ident.run.base);
+
+  if (ctx->ident.pilot)
+    pilot_engage(ctx);
+
+  telemetry_publish(ctx, TELEMETRY_IDENT_DONE);
+}
+
+static void
+do_ident_work(furnace_context_t *ctx)
+{
+  ident_t *run = &ctx->ident.run;
+
+  if (run->state != IDENT_RUNNING)
+    return;
+
+  if (ctx->cur_temp >= TEMP_C(MAX_TEMP) || ctx->thermo.faults)
+    return ident_failed_(ctx);
+
+  const uint32_t now_ms = to_ms_since_boot(get_absolute_time());
+
+  set_heater_fine(ctx, ident_update(run, now_ms));
+  ctx->ident.deadline = make_timeout_time_ms(run->bit_ms - (now_ms - run->bit_at_ms));
+}
+
+static void
+init_ident(furnace_context_t *ctx)
+{
+  ctx->ident.bit_ms    = IDENT_BIT_S * 1000;
+  ctx->ident.run.state = IDENT_IDLE;
+  ctx->ident.dumping   = false;
+}
+
+/*
+ * Full power is over, the pilot carries on from out: the power that
+ * holds the setpoint instead of integrating its way there. The MPC plans
+ * from the full power it really had over the dead time, right away.
+ */
+static void
+preheat_handover_(furnace_context_t *ctx, int32_t out)
+{
+  pid_reset(&ctx->pilot.pid, out);
+  set_heater_fine(ctx, out);
+
+#if CONFIG_AUTO == CONFIG_AUTO_MPC
+  mpc_reset(&ctx->pilot.mpc, estimator_temp(&ctx->thermo.estimator),
+            (int32_t) ctx->ceiling_pwm << PWM_FINE_BITS);
+  ctx->pilot.pilot_deadline = get_absolute_time();
+#else
+  ctx->pilot.pilot_deadline = make_timeout_time_ms(ctx->pilot.pid.config.period_ms);
+#endif
+}
+
+/* Power that holds the setpoint: the map's if it has one, the model's otherwise. */
+static int32_t
+preheat_hold_(furnace_context_t *ctx, const model_fopdt_t *model)
+{
+  const int32_t ceiling = (int32_t) ctx->ceiling_pwm << PWM_FINE_BITS;
+
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+  int32_t out;
+
+  if (pwm_map_lookup(&ctx->mapper.map, ctx->pilot.des_temp, &out))
+    return out < ceiling ? out : ceiling;
+#endif
+
+  return preheat_hold(model, ctx->pilot.des_temp, ceiling);
+}
+
+/*
+ * The pilot's setpoint or the pilot itself changed: a run for another
+ * setpoint is over, and a jump big enough starts the next one. A run cut
+ * short at full power gives the pilot the heater back where it is.
+ */
+static void
+preheat_setpoint_(furnace_context_t *ctx)
+{
+  preheat_context_t *preheat = &ctx->preheat;
+  model_fopdt_t      model;
+
+  if (preheat_active(&preheat->run) && ctx->pilot.is_enabled
+      && preheat->run.setpoint == ctx->pilot.des_temp)
+    return;
+
+  const bool boosting = preheat->run.state == PREHEAT_BOOST;
+
+  if (preheat_stop(&preheat->run)) {
+    if (boosting && ctx->pilot.is_enabled)
+      preheat_handover_(ctx, ctx->pwm_fine);
+    telemetry_publish(ctx, TELEMETRY_PREHEAT_DONE);
+  }
+
+  if (!ctx->pilot.is_enabled || !ctx->thermo.estimator.primed)
+    return;
+
+  const bool boost = preheat->boost && model_get(&ctx->model.model, &model);
+
+  if (!preheat_start(&preheat->run, ctx->pilot.des_temp, estimator_temp(&ctx->thermo.estimator),
+                     preheat->band, boost, to_ms_since_boot(get_absolute_time())))
+    return;
+
+  if (boost)
+    set_heater_fine(ctx, (int32_t) ctx->ceiling_pwm << PWM_FINE_BITS);
+  preheat->deadline = make_timeout_time_ms(PREHEAT_PERIOD_MS);
+}
+
+static void
+do_preheat_work(furnace_context_t *ctx)
+{
+  preheat_t    *run = &ctx->preheat.run;
+  model_fopdt_t model;
+
+  ctx->preheat.deadline = make_timeout_time_ms(PREHEAT_PERIOD_MS);
+
+  /* Somebody took the heater or moved the setpoint. */
+  if (!ctx->pilot.is_enabled || ctx->pilot.des_temp != run->setpoint)
+    return preheat_setpoint_(ctx);
+
+  const bool    known = model_get(&ctx->model.model, &model);
+  const uint8_t event = preheat_update(run, estimator_temp(&ctx->thermo.estimator),
+                                       estimator_rate(&ctx->thermo.estimator),
+                                       known ? model.dead_s : 0,
+                                       to_ms_since_boot(get_absolute_time()));
+
+  if (event == PREHEAT_EVENT_DONE)
+    telemetry_publish(ctx, TELEMETRY_PREHEAT_DONE);
+
+  /* The heater is off, the pilot starts over once the sensor is back. */
+  if (run->state == PREHEAT_BOOST && ctx->thermo.faults)
+    return preheat_coast(run);
+
+  /* Nothing left to predict the coast point with, the pilot takes over now. */
+  if (run->state == PREHEAT_BOOST && (!known || ctx->cur_temp >= TEMP_C(MAX_TEMP))) {
+    preheat_coast(run);
+    return preheat_handover_(ctx, known ? preheat_hold_(ctx, &model) : ctx->pwm_fine);
+  }
+
+  if (event == PREHEAT_EVENT_COAST)
+    preheat_handover_(ctx, preheat_hold_(ctx, &model));
+  else if (run->state == PREHEAT_BOOST)
+    set_heater_fine(ctx, (int32_t) ctx->ceiling_pwm << PWM_FINE_BITS);
+}
+
+static void
+init_preheat(furnace_context_t *ctx)
+{
+  ctx->preheat.boost     = true;
+  ctx->preheat.band      = PREHEAT_BAND;
+  ctx->preheat.run.state = PREHEAT_IDLE;
+}
+#endif
+
+/*
+ * Control side of the inbox. Arguments were range checked by
+ * command_handler already.
+ */
+static void
+control_apply(furnace_context_t *ctx, const control_msg_t *msg)
+{
+  switch (msg->op) {
+    case CONTROL_PWM:
+      if (set_pwm_safe(FURNACE_FIRE_PIN, ctx, msg->arg) == 0) {
+#if CONFIG_PILOT
+        ctx->pilot.is_enabled = 0;
+        profile_abort_(ctx);
+#endif
+#if CONFIG_THERMO && CONFIG_PILOT
+        autotune_stop(&ctx->autotune.tune);
+        ident_stop(&ctx->ident.run);
+#endif
+      }
+      break;
+
+    case CONTROL_MAX_PWM:
+      set_max_pwm_safe(ctx, msg->arg);
+      break;
+
+#if CONFIG_PILOT
+    case CONTROL_AUTO:
+#if CONFIG_THERMO
+      autotune_stop(&ctx->autotune.tune);
+      ident_stop(&ctx->ident.run);
+#endif
+      if (msg->arg) {
+        pilot_engage(ctx);
+      } else {
+        ctx->pilot.is_enabled = false;
+        profile_abort_(ctx);
+      }
+#if CONFIG_THERMO
+      preheat_setpoint_(ctx);
+#endif
+      pilot_feed_forward(ctx);
+      break;
+
+    case CONTROL_TEMP:
+      profile_abort_(ctx);
+      ctx->pilot.des_temp = (temp_t) msg->arg;
+#if CONFIG_THERMO
+      preheat_setpoint_(ctx);
+#endif
+      pilot_feed_forward(ctx);
+      break;
+
+    case CONTROL_PID_KP:
+    case CONTROL_PID_TI:
+    case CONTROL_PID_TD:
+    case CONTROL_PID_PERIOD:
+      pilot_configure(ctx, msg);
+      break;
+
+    case CONTROL_PROFILE_ADD:
+    case CONTROL_PROFILE_CLEAR:
+    case CONTROL_PROFILE_START:
+    case CONTROL_PROFILE_STOP:
+    case CONTROL_PROFILE_PAUSE:
+    case CONTROL_PROFILE_RESUME:
+    case CONTROL_PROFILE_SKIP:
+      profile_apply(ctx, msg);
+      break;
+#endif
+
+#if CONFIG_THERMO && CONFIG_PILOT
+    case CONTROL_AUTOTUNE:
+      if (msg->arg) {
+        autotune_start_(ctx, (temp_t) msg->arg);
+      } else if (ctx->autotune.tune.state == AUTOTUNE_RUNNING) {
+        autotune_stop(&ctx->autotune.tune);
+        set_pwm_safe(FURNACE_FIRE_PIN, ctx, 0);
+      }
+      break;
+
+    case CONTROL_AUTOTUNE_HYSTERESIS:
+      ctx->autotune.hysteresis = (temp_t) msg->arg;
+      break;
+
+    case CONTROL_IDENT:
+      if (msg->arg) {
+        ident_start_(ctx, msg->arg);
+      } else if (ctx->ident.run.state == IDENT_RUNNING) {
+        ident_stop(&ctx->ident.run);
+        set_pwm_safe(FURNACE_FIRE_PIN, ctx, 0);
+      }
+      break;
+
+    case CONTROL_IDENT_BIT:
+      ctx->ident.bit_ms = msg->arg;
+      break;
+
+    case CONTROL_PREHEAT:
+      ctx->preheat.boost = msg->arg;
+      /* A run at full power goes on being clocked, the pilot has the heater from here. */
+      if (!msg->arg && ctx->preheat.run.state == PREHEAT_BOOST) {
+        preheat_coast(&ctx->preheat.run);
+        preheat_handover_(ctx, ctx->pwm_fine);
+      }
+      break;
+
+    case CONTROL_PREHEAT_BAND:
+      ctx->preheat.band = (temp_t) msg->arg;
+      break;
+#endif
+
+#if CONFIG_AUTO == CONFIG_AUTO_MPC
+    case CONTROL_MPC_RATE:
+      ctx->pilot.mpc.rate_max = msg->arg;
+      break;
+#endif
+
+#if CONFIG_MAGNETRON
+    case CONTROL_PULSE:
+      ctx->pulse_count = msg->arg*2;
+      break;
+#endif
+
+#if CONFIG_WATER
+    case CONTROL_WATER:
+      set_pwm_safe(WATER_PIN, ctx, msg->arg);
+      break;
+#endif
+
+#if CONFIG_SHUTTER
+    case CONTROL_SHUTTER:
+      if (ctx->shutter.time_ms == 0)
+        ctx->shutter.time_ms = msg->arg;
+      break;
+
+    case CONTROL_SHUTTER_ON:
+      ctx->shutter.time_ms = 1;
+      ctx->shutter.intern_state = SHUTTER_ON_OPTION;
+      break;
+
+    case CONTROL_SHUTTER_OFF:
+      ctx->shutter.time_ms = 1;
+      ctx->shutter.intern_state = SHUTTER_OFF_OPTION;
+      break;
+#endif
+
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+    case CONTROL_MAP:
+#if CONFIG_THERMO
+      autotune_stop(&ctx->autotune.tune);
+      ident_stop(&ctx->ident.run);
+#endif
+      profile_abort_(ctx);
+      set_pwm_safe(FURNACE_FIRE_PIN, ctx, 0);
+      ctx->pilot.is_enabled = false;
+      ctx->mapper.is_enabled = msg->arg;
+      /* A new run maps from scratch, the old table stays until then. */
+      if (msg->arg) {
+        pwm_map_clear(&ctx->mapper.map);
+        ctx->mapper.max_pwm_temp = ctx->cur_temp;
+        mapper_step_start_(ctx);
+      }
+      break;
+
+    case CONTROL_MAP_SLOPE:
+      ctx->mapper.steady_config.slope = (temp_t) msg->arg;
+      break;
+
+    case CONTROL_MAP_DWELL:
+      /* The window spans the minimum dwell, samples so far were for another one. */
+      ctx->mapper.steady_config.dwell_min_min = msg->arg >> 16;
+      ctx->mapper.steady_config.dwell_max_min = msg->arg & 0xffff;
+      if (ctx->mapper.is_enabled) {
+        steady_reset(&ctx->mapper.steady);
+        ctx->mapper.deadline = make_timeout_time_ms(steady_period_ms(&ctx->mapper.steady_config));
+      }
+      break;
+#endif
+
+    case CONTROL_HEATER:
+      set_heater_burst(ctx, msg->arg);
+      break;
+
+    case CONTROL_STATS_RESET:
+      stats_reset_control();
+      break;
+
+#if CONFIG_THERMO
+    case CONTROL_SAMPLE_PERIOD:
+    case CONTROL_SAMPLE_MEDIAN:
+    case CONTROL_SAMPLE_EMA:
+    case CONTROL_SAMPLE_DECIMATE:
+    case CONTROL_SAMPLE_REJECT:
+      thermocouple_configure(ctx, msg);
+      break;
+
+    case CONTROL_SENSOR:
+      ctx->thermo.regulate = msg->arg;
+      estimator_reset(&ctx->thermo.estimator);
+      ctx->thermo.estimated_at = nil_time;
+      model_pause(&ctx->model.model);
+      thermocouple_regulate(ctx);
+      break;
+
+    case CONTROL_ESTIMATE_ALPHA:
+    case CONTROL_ESTIMATE_GAIN: {
+      estimator_config_t config = ctx->thermo.estimator.config;
+
+      if (msg->op == CONTROL_ESTIMATE_ALPHA)
+        config.alpha = msg->arg;
+      else
+        config.gain = msg->arg;
+
+      estimator_configure(&ctx->thermo.estimator, &config);
+      break;
+    }
+
+    case CONTROL_MODEL_RESET:
+      model_init(&ctx->model.model, ctx->model.model.memory_min);
+      model_save(&ctx->model.model, &ctx->model.saved);
+      break;
+
+    case CONTROL_MODEL_MEMORY:
+      model_set_memory(&ctx->model.model, msg->arg);
+      ctx->model.saved.memory_min = msg->arg;
+      break;
+#endif
+  }
+}
+
+/*
+ * Everything main_work_loop does on a timer is a task of a scheduler.
+ * next() tells when the task wants to run again, work() is the work itself.
+ * control_tasks belong to the control path, core0_tasks to core0.
+ */
+
+#if CONFIG_THERMO
+static absolute_time_t
+thermocouple_task_next(void *ctx_)
+{
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
+
+  /* Waiting for the wire, or for the bus in the middle of a round. */
+  if (ctx->thermo.pending || ctx->thermo.sensor)
+    return ctx->thermo.deadline;
+
+  if (ctx->thermo.drdy)
+    return nil_time;
+
+  return ctx->thermo.poll_deadline;
+}
+
+/*
+ * Runs once per sensor and once more per round: the first pass starts the
+ * first transaction, every later one, once it had time to finish on the
+ * wire, decodes it and starts the next sensor's.
+ */
+static void
+thermocouple_task_work(void *ctx_)
+{
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
+
+  if (ctx->thermo.pending) {
+    if (!thermocouple_finish(ctx)) {
+      ctx->thermo.deadline = make_timeout_time_us(10);
+      return;
+    }
+
+    /* Round is over, the next one starts on DRDY or poll_deadline. */
+    if (ctx->thermo.sensor == 0)
+      return;
+  }
+
+  if (thermocouple_start(ctx))
+    return;
+
+  if (ctx->thermo.sensor == 0)
+    ctx->thermo.poll_deadline = make_timeout_time_ms(1);
+  else
+    ctx->thermo.deadline = make_timeout_time_ms(1);
+}
+#endif
+
+static absolute_time_t
+update_task_next(void *ctx_)
+{
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
+
+  return ctx->update_deadline;
+}
+
+static void
+update_task_work(void *ctx_)
+{
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
+
+  telemetry_publish(ctx, TELEMETRY_STATUS);
+
+  ctx->update_deadline = make_timeout_time_ms(1000);
+}
+
+static absolute_time_t
+heater_task_next(void *ctx_)
+{
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
+
+  /* Off was written by set_heater_fine already. */
+  if (ctx->pwm_fine == 0)
+    return at_the_end_of_time;
+
+  return ctx->heater_deadline;
+}
+
+static void
+heater_task_work(void *ctx_)
+{
+  heater_output((furnace_context_t*)ctx_);
+}
+
+#if CONFIG_PILOT
+static absolute_time_t
+pilot_task_next(void *ctx_)
+{
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
+
+  if (!ctx->pilot.is_enabled)
+    return at_the_end_of_time;
 
 #if CONFIG_THERMO
-  ctx->cur_temp = max318xx_read_temperature();
-#endif
-#if CONFIG_THERMO == CONFIG_THERMO_KTYPE
-  log_stdout_thermocouple(ctx->log_bits, "cold: %u\n", max318xx_read_cold_junction());
+  /* The preheat has the heater up to the coast point and hands it over then. */
+  if (ctx->preheat.run.state == PREHEAT_BOOST)
+    return at_the_end_of_time;
 #endif
-  log_stdout_thermocouple(ctx->log_bits, "hot: %u\n", ctx->cur_temp);
+
+  return ctx->pilot.pilot_deadline;
 }
 
-static int
-format_status(char* buffer, furnace_context_t* ctx)
+static void
+pilot_task_work(void *ctx_)
 {
-#if CONFIG_AUTO == CONFIG_AUTO_NONE
-  return snprintf(
-      buffer,
-      FORMAT_STATUS_AUTO_NONE_SIZE,
-      FORMAT_STATUS_AUTO_NONE,
-      ctx->cur_temp,
-      ctx->pwm_level,
-      MAX_PWM
-      );
-#else
-    return snprintf(
-      buffer,
-      FORMAT_STATUS_AUTO_PILOT_SIZE,
-      FORMAT_STATUS_FMT,
-      ctx->cur_temp,
-      ctx->pilot.des_temp,
-      ctx->pwm_level,
-      ctx->ceiling_pwm,
-      MAX_PWM,
-      ctx->pilot.is_enabled
-    );
-#endif
+  do_pilot_work((furnace_context_t*)ctx_);
 }
+#endif
 
 #if CONFIG_AUTO == CONFIG_AUTO_MAPPER
-
-static int
-format_mapper(char *buffer, furnace_context_t *ctx)
+static absolute_time_t
+mapper_task_next(void *ctx_)
 {
-    return snprintf(
-      buffer,
-      MAPPER_STATUS_SIZE,
-      MAPPER_STATUS_FMT,
-      ctx->pwm_level,
-      ctx->mapper.max_pwm_temp
-    );
-}
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
 
-#endif
+  if (!ctx->mapper.is_enabled)
+    return at_the_end_of_time;
+
+  /* Reaching MAX_TEMP has to be handled as soon as it is measured. */
+  if (ctx->cur_temp >= TEMP_C(MAX_TEMP))
+    return nil_time;
+
+  return ctx->mapper.deadline;
+}
 
 static void
-do_tcp_work(furnace_context_t *ctx, bool deadline_met)
+mapper_task_work(void *ctx_)
 {
-#if CONFIG_AUTO == CONFIG_AUTO_NONE
-  char temperature_str[FORMAT_STATUS_AUTO_NONE_SIZE];
-#else
-  char temperature_str[FORMAT_STATUS_AUTO_PILOT_SIZE];
+  do_mapper_work((furnace_context_t*)ctx_);
+}
 #endif
 
-  cyw43_arch_poll();
+#if CONFIG_PILOT
+static absolute_time_t
+profile_task_next(void *ctx_)
+{
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
 
-  // If disconnected, reset and setup listening
-  if (ctx->tcp.server_pcb == NULL || ctx->tcp.server_pcb->state == CLOSED) {
-    memset(&ctx->tcp, 0, sizeof(ctx->tcp));
-    if (!tcp_server_open(ctx)) {
-      tcp_server_close(ctx);
-    }
-  }
+  if (ctx->profile.engine.state != PROFILE_RUNNING)
+    return at_the_end_of_time;
 
-  if (ctx->tcp.client_pcb && deadline_met) {
-    const int temperature_str_len = format_status(temperature_str, ctx);
+  return ctx->profile.deadline;
+}
 
-    tcp_server_send_data(
-      ctx,
-      ctx->tcp.client_pcb,
-      (uint8_t*)temperature_str,
-      temperature_str_len
-    );
-  }
+static void
+profile_task_work(void *ctx_)
+{
+  do_profile_work((furnace_context_t*)ctx_);
+}
+#endif
+
+#if CONFIG_THERMO && CONFIG_PILOT
+static absolute_time_t
+autotune_task_next(void *ctx_)
+{
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
 
+  if (ctx->autotune.tune.state != AUTOTUNE_RUNNING)
+    return at_the_end_of_time;
+
+  return ctx->autotune.deadline;
 }
 
-static inline int
-sgn(int val_1, int val_2)
+static void
+autotune_task_work(void *ctx_)
 {
-  if(val_1 > val_2)
-    return -1;
-  return 1;
+  do_autotune_work((furnace_context_t*)ctx_);
 }
 
-static inline uint8_t
-clamp_u8(int min, int max, int val)
+static absolute_time_t
+ident_task_next(void *ctx_)
 {
-  uint8_t value = (uint8_t)val;
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
 
-  if(val < min)
-    value = min;
+  if (ctx->ident.run.state != IDENT_RUNNING)
+    return at_the_end_of_time;
 
-  if(val > max)
-    value = max;
+  /* Reaching MAX_TEMP has to be handled as soon as it is measured. */
+  if (ctx->cur_temp >= TEMP_C(MAX_TEMP))
+    return nil_time;
 
-  return value;
+  return ctx->ident.deadline;
 }
 
 static void
-init_furnace(furnace_context_t *ctx)
+ident_task_work(void *ctx_)
 {
-  memset(ctx, 0, sizeof(*ctx));
+  do_ident_work((furnace_context_t*)ctx_);
+}
 
-  ctx->ceiling_pwm = MAX_PWM;
+static absolute_time_t
+preheat_task_next(void *ctx_)
+{
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
+
+  if (!preheat_active(&ctx->preheat.run))
+    return at_the_end_of_time;
+
+  return ctx->preheat.deadline;
 }
 
-#if CONFIG_AUTO == CONFIG_AUTO_PILOT || CONFIG_AUTO == CONFIG_AUTO_MAPPER
 static void
-do_pilot_work(furnace_context_t *ctx)
+preheat_task_work(void *ctx_)
 {
-  if (!ctx->pilot.is_enabled)
-    return;
+  do_preheat_work((furnace_context_t*)ctx_);
+}
 
-  const bool deadline_met = get_absolute_time() > ctx->pilot.pilot_deadline;
+static absolute_time_t
+dump_task_next(void *ctx_)
+{
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
 
-  if (!deadline_met)
-    return;
+  if (!ctx->ident.dumping)
+    return at_the_end_of_time;
 
-  const int min_increase_rate = 1;
-  const int diff = ctx->cur_temp - ctx->pilot.last_temp;
-  const int sign = sgn(ctx->cur_temp, ctx->pilot.des_temp);
-  unsigned pwm = ctx->pwm_level;
+  return ctx->ident.dump_deadline;
+}
+
+static void
+dump_task_work(void *ctx_)
+{
+  do_ident_dump((furnace_context_t*)ctx_);
+}
+#endif
 
-  ctx->pilot.last_temp = ctx->cur_temp;
-  ctx->pilot.pilot_deadline = make_timeout_time_ms(CONFIG_FURNACE_DEADLINE_MS);
+#if CONFIG_SHUTTER
+static absolute_time_t
+shutter_task_next(void *ctx_)
+{
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
 
-  /*
-   * If going in the wrong direction
-   * or going in the good direction,
-   * but slowly - nudge the PWM.
-   */
-  if(sign*diff <= min_increase_rate)
-    pwm += sign;
+  if (ctx->shutter.time_ms == 0)
+    return at_the_end_of_time;
 
-  set_pwm_safe(FURNACE_FIRE_PIN, ctx, pwm);
+  return ctx->shutter.deadline;
 }
 
 static void
-init_pilot(furnace_context_t *ctx)
+shutter_task_work(void *ctx_)
 {
-  ctx->pilot.des_temp = 0;
-  ctx->pilot.last_temp = 0;
-  ctx->pilot.is_enabled = false;
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
+
+  do_shutter_work(&ctx->shutter);
 }
 #endif
 
-#if CONFIG_STIRRER
+#if CONFIG_FLASH
+static absolute_time_t
+flash_task_next(void *ctx_)
+{
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
+
+  return ctx->flash_deadline;
+}
+
 static void
-init_stirrer(void)
+flash_task_work(void *ctx_)
 {
-  gpio_init(STIRRER_PIN);
-  gpio_set_dir(STIRRER_PIN, GPIO_OUT);
+#if CONFIG_MULTICORE
+  /*
+   * Core1 executes from flash too, and flash_update_lookup needs the
+   * control state to hold still while it is copied.
+   */
+  multicore_lockout_start_blocking();
+#endif
+  do_flash_work((furnace_context_t*)ctx_);
+#if CONFIG_MULTICORE
+  multicore_lockout_end_blocking();
+#endif
 }
 #endif
 
-static void
-init_stdio(furnace_context_t* ctx)
+#if CONFIG_MAGNETRON
+static absolute_time_t
+magnetron_task_next(void *ctx_)
 {
-  ctx->stdio.parser = ctx->stdio.buffer;
-  memset(&ctx->stdio.buffer, 0, BUF_SIZE);
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
+
+  if (ctx->pulse_count == 0)
+    return at_the_end_of_time;
+
+  return ctx->magnetron_deadline;
 }
 
 static void
-reset_stdio_data(furnace_context_t* ctx)
+magnetron_task_work(void *ctx_)
 {
-  memset(&ctx->stdio.buffer, 0, BUF_SIZE);
-  ctx->stdio.parser = ctx->stdio.buffer;
+  do_magnetron_work((furnace_context_t*)ctx_, true);
 }
+#endif
 
-static void
-stdio_command_handler(furnace_context_t* ctx)
+#if CONFIG_THERMO
+static absolute_time_t
+model_task_next(void *ctx_)
 {
-  void
-  send_stdio(const char* msg, const size_t msg_len)
-  {
-    if(msg_len == 0) return;
-    printf(msg);
-  }
+  furnace_context_t *ctx = (furnace_context_t*)ctx_;
 
-  command_handler(ctx, ctx->stdio.buffer, &send_stdio);
+  return ctx->model.deadline;
 }
 
 static void
-do_stdio_work(furnace_context_t* ctx, bool deadline_met)
+model_task_work(void *ctx_)
 {
-  if(deadline_met)
-  {
-    char buffer[FORMAT_STATUS_AUTO_PILOT_SIZE];
+  do_model_work((furnace_context_t*)ctx_);
+}
+#endif
 
-    format_status(buffer, ctx);
-    log_stdout_basic(ctx->log_bits, buffer);
-  }
+static sched_task_t control_tasks[] = {
+#if CONFIG_THERMO
+  { .name = "thermocouple", .next = thermocouple_task_next, .work = thermocouple_task_work,
+    .stats = &stage_stats[STAGE_THERMOCOUPLE] },
+#endif
+  { .name = "update",    .next = update_task_next,    .work = update_task_work },
+  { .name = "heater",    .next = heater_task_next,    .work = heater_task_work,
+    .stats = &stage_stats[STAGE_HEATER] },
+#if CONFIG_PILOT
+  { .name = "pilot",     .next = pilot_task_next,     .work = pilot_task_work,
+    .stats = &stage_stats[STAGE_PILOT] },
+#endif
+#if CONFIG_PILOT
+  { .name = "profile",   .next = profile_task_next,   .work = profile_task_work,
+    .stats = &stage_stats[STAGE_PROFILE] },
+#endif
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+  { .name = "mapper",    .next = mapper_task_next,    .work = mapper_task_work,
+    .stats = &stage_stats[STAGE_MAPPER] },
+#endif
+#if CONFIG_THERMO && CONFIG_PILOT
+  { .name = "autotune",  .next = autotune_task_next,  .work = autotune_task_work,
+    .stats = &stage_stats[STAGE_AUTOTUNE] },
+  { .name = "ident",     .next = ident_task_next,     .work = ident_task_work,
+    .stats = &stage_stats[STAGE_IDENT] },
+  { .name = "preheat",   .next = preheat_task_next,   .work = preheat_task_work,
+    .stats = &stage_stats[STAGE_PREHEAT] },
+#endif
+#if CONFIG_SHUTTER
+  { .name = "shutter",   .next = shutter_task_next,   .work = shutter_task_work,
+    .stats = &stage_stats[STAGE_SHUTTER] },
+#endif
+#if CONFIG_MAGNETRON
+  { .name = "magnetron", .next = magnetron_task_next, .work = magnetron_task_work,
+    .stats = &stage_stats[STAGE_MAGNETRON] },
+#endif
+#if CONFIG_THERMO
+  { .name = "model",     .next = model_task_next,     .work = model_task_work,
+    .stats = &stage_stats[STAGE_MODEL] },
+#endif
+};
 
-  while(1) {
-    uint8_t c = getchar_timeout_us(0);
+static sched_task_t core0_tasks[] = {
+#if CONFIG_FLASH
+  { .name = "flash",     .next = flash_task_next,     .work = flash_task_work,
+    .stats = &stage_stats[STAGE_FLASH] },
+#endif
+#if CONFIG_THERMO && CONFIG_PILOT
+  { .name = "dump",      .next = dump_task_next,      .work = dump_task_work,
+    .stats = &stage_stats[STAGE_DUMP] },
+#endif
+};
 
-    if(c == (uint8_t) PICO_ERROR_TIMEOUT) return;
+_Static_assert(sizeof(control_tasks) / sizeof(control_tasks[0]) <= SCHED_MAX_TASKS);
+_Static_assert(sizeof(core0_tasks) / sizeof(core0_tasks[0]) <= SCHED_MAX_TASKS);
 
-    if(ctx->stdio.parser == ctx->stdio.buffer + BUF_SIZE){
-      printf("\nLines longer than %d are invalid!\nResetting stdio buffer.\n", BUF_SIZE);
-      reset_stdio_data(ctx);
-      return;
-    }
+static void
+init_tasks(furnace_context_t *ctx)
+{
+  sched_init(&ctx->control.sched);
+  sched_init(&ctx->sched);
 
-    // User may change last sent character from lf to cr, vice versa or crlf
-    // Although, in parsing command, we do not care how user sent this
-    // and we are always putting '\n' at the end of command
-    if(c == '\n' || c == '\r') {
-      *ctx->stdio.parser = '\n';
-      stdio_command_handler(ctx);
-      reset_stdio_data(ctx);
-      return;
-    }
+  for (size_t i = 0; i < sizeof(control_tasks) / sizeof(control_tasks[0]); i++)
+    sched_add(&ctx->control.sched, &control_tasks[i], ctx);
 
-    *ctx->stdio.parser = c;
-    ctx->stdio.parser++;
-  }
+  for (size_t i = 0; i < sizeof(core0_tasks) / sizeof(core0_tasks[0]); i++)
+    sched_add(&ctx->sched, &core0_tasks[i], ctx);
 }
 
-#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+static void
+init_control(furnace_context_t *ctx)
+{
+  spsc_init(&ctx->control.inbox, ctx->control.inbox_slots,
+            sizeof(control_msg_t), CONTROL_INBOX_SIZE);
+  spsc_init(&ctx->control.outbox, ctx->control.outbox_slots,
+            sizeof(telemetry_t), CONTROL_OUTBOX_SIZE);
+}
 
+/* One pass of the control path: apply pending commands, run what is due. */
 static void
-mapper_deadline__(furnace_context_t *ctx)
+do_control_work(furnace_context_t *ctx)
 {
-  if(ctx->cur_temp > ctx->mapper.max_pwm_temp){
-    ctx->mapper.max_pwm_temp = ctx->cur_temp;
-    return;
-  }
+  control_msg_t msg;
+  bool          refresh = false;
 
-  char buffer[MAPPER_STATUS_SIZE];
+  /* Odd until the pass is over, core0 doesn't copy anything out meanwhile. */
+  __atomic_store_n(&ctx->control.seq, ctx->control.seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
 
-  const int size = format_mapper(buffer, ctx);
-  tcp_server_send_data(
-    ctx,
-    ctx->tcp.client_pcb,
-    (uint8_t*)buffer,
-    size
-  );
+  loop_count[LOOP_CONTROL]++;
 
-  const unsigned pwm = ctx->pwm_level + 1;
+  while (spsc_pop(&ctx->control.inbox, &msg)) {
+    control_apply(ctx, &msg);
+    refresh = true;
+  }
 
-  const int res = set_pwm_safe(FURNACE_FIRE_PIN, ctx, pwm);
+#if CONFIG_THERMO
+  /* A conversion came in, the thermocouple task wants to run right now. */
+  if (ctx->thermo.drdy && !ctx->thermo.pending)
+    refresh = true;
+#endif
 
-  if( res == -1 ) {
-    const char msg[] = "set_pwm_safe: unexpected pin argument!\r\n";
-    const size_t msg_len = sizeof(msg)-1;
-    tcp_server_send_data(
-      ctx,
-      ctx->tcp.client_pcb,
-      (uint8_t*)buffer,
-      size
-    );
-  } else if ( res == 1 ) {
-    const char msg[] = "pwm_level has reached MAX_PWM, enabling auto and steering temp towards FALLBACK_TEMP!\r\n";
-    const size_t msg_len = sizeof(msg)-1;
-    tcp_server_send_data(
-      ctx,
-      ctx->tcp.client_pcb,
-      (uint8_t*)buffer,
-      size
-    );
+  /* Commands move deadlines around (pilot enabled, shutter started, ...). */
+  if (refresh)
+    sched_refresh(&ctx->control.sched, ctx);
 
-    ctx->mapper.is_enabled = false;
-    ctx->pilot.is_enabled = true;
-    ctx->pilot.des_temp = FALLBACK_TEMP;
-  }
-}
+  sched_run(&ctx->control.sched, ctx);
 
-static void
-mapper_deadline_(furnace_context_t *ctx)
-{
-  mapper_deadline__(ctx);
-  ctx->mapper.deadline = make_timeout_time_ms(PWM_MAPPER_MINUTES * 60 * 1000);
+  __atomic_store_n(&ctx->control.seq, ctx->control.seq + 1, __ATOMIC_RELEASE);
 }
 
-static void
-mapper_maxtemp_reached_(furnace_context_t *ctx)
+static absolute_time_t
+idle_deadline(absolute_time_t deadline)
 {
-  const char msg[] = "cur_temp has reached MAX_TEMP, enabling auto and steering temp towards FALLBACK_TEMP!\r\n";
-  const size_t msg_len = sizeof(msg)-1;
-  tcp_server_send_data(
-    ctx,
-    ctx->tcp.client_pcb,
-    (uint8_t*)msg,
-    msg_len
-  );
+  /* Deadlines are met once we are past them. */
+  if (deadline < at_the_end_of_time)
+    deadline = delayed_by_us(deadline, 1);
 
-  ctx->mapper.is_enabled = false;
-  ctx->pilot.is_enabled = true;
-  ctx->pilot.des_temp = FALLBACK_TEMP;
+  return deadline;
 }
 
+#if CONFIG_MULTICORE
+static furnace_context_t* core1_ctx;
+
+/*
+ * Core1 only runs the control path, so neither a Wi-Fi stall nor a slow
+ * TCP write can hold the heater back. core0 wakes it up with __sev()
+ * when there is something in the inbox.
+ */
 static void
-do_mapper_work(furnace_context_t *ctx)
+core1_main(void)
 {
-  if(!ctx->mapper.is_enabled)
-    return;
+  furnace_context_t* ctx = core1_ctx;
 
-  if(ctx->cur_temp >= MAX_TEMP)
-    return mapper_maxtemp_reached_(ctx);
+  /* Core0 has to be able to park us while it writes to flash. */
+  multicore_lockout_victim_init();
+#if CONFIG_THERMO && defined(MAX318xx_DRDY_PIN)
+  init_thermocouple_irq(ctx);
+#endif
 
-  const bool deadline_met = get_absolute_time() > ctx->mapper.deadline;
-  if (deadline_met)
-    return mapper_deadline_(ctx);
+  while (1) {
+    do_control_work(ctx);
+    best_effort_wfe_or_timeout(idle_deadline(sched_next_deadline(&ctx->control.sched)));
+  }
 }
-
 #endif
 
 static int
@@ -810,10 +3823,24 @@ main_work_loop(void)
 
   init_pwm();
   init_furnace(ctx);
-#if CONFIG_AUTO == CONFIG_AUTO_MAPPER || CONFIG_AUTO == CONFIG_AUTO_PILOT
+#if CONFIG_PILOT
   init_pilot(ctx);
+  init_profile(ctx);
+#endif
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+  init_mapper(ctx);
+#endif
+#if CONFIG_THERMO && CONFIG_PILOT
+  init_autotune(ctx);
+  init_ident(ctx);
+  init_preheat(ctx);
 #endif
   init_stdio(ctx);
+#if CONFIG_THERMO
+  init_thermocouple(ctx);
+  init_model(ctx);
+#endif
+  init_control(ctx);
 
 #if CONFIG_MAGNETRON
   init_magnetron(ctx);
@@ -826,38 +3853,70 @@ main_work_loop(void)
 #if CONFIG_FLASH
   init_flash(ctx);
 #endif
+  {
+    /* Flash only said which mode, switching to it is up to the driver. */
+    const unsigned runs = ctx->burst.runs;
 
-  cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 1);
-
-  while (1) {
-    const absolute_time_t now = get_absolute_time();
-    const bool deadline_met = now > ctx->update_deadline;
-
-#if CONFIG_THERMO
-    do_thermocouple_work(ctx, deadline_met);
-#endif
-    do_tcp_work(ctx, deadline_met);
-    do_stdio_work(ctx, deadline_met);
-#if CONFIG_AUTO == CONFIG_AUTO_PILOT || CONFIG_AUTO == CONFIG_AUTO_MAPPER
-    do_pilot_work(ctx);
-#endif
-#if CONFIG_SHUTTER
-    do_shutter_work(&ctx->shutter);
+    ctx->burst.runs = 0;
+    set_heater_burst(ctx, runs);
+  }
+#if CONFIG_PILOT
+  /* Back from flash with the pilot on, it picks up from the stored PWM. */
+  pid_reset(&ctx->pilot.pid, (int32_t) ctx->pwm_level << PID_OUT_BITS);
 #endif
 #if CONFIG_AUTO == CONFIG_AUTO_MAPPER
-    do_mapper_work(ctx);
+  /* Or with the mapper on, the level it was at starts over. */
+  if (ctx->mapper.is_enabled)
+    mapper_step_start_(ctx);
 #endif
 
-#if CONFIG_FLASH
-    do_flash_work(ctx);
+  init_tasks(ctx);
+  stats_reset_core0();
+  stats_reset_control();
+
+#if CONFIG_MULTICORE
+  core1_ctx = ctx;
+  multicore_launch_core1(core1_main);
+#elif CONFIG_THERMO && defined(MAX318xx_DRDY_PIN)
+  init_thermocouple_irq(ctx);
 #endif
 
-    if (deadline_met)
-      ctx->update_deadline = make_timeout_time_ms(1000);
-#if CONFIG_MAGNETRON
-    const bool magnetron_deadline = now > ctx->magnetron_deadline;
-    do_magnetron_work(ctx, magnetron_deadline);
+  cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 1);
+
+  while (1) {
+    uint32_t start = time_us_32();
+
+    loop_count[LOOP_CORE0]++;
+
+    do_tcp_work(ctx);
+    start = stats_stage_done(STAGE_TCP, start);
+
+    const bool stdio_pending = do_stdio_work(ctx);
+    start = stats_stage_done(STAGE_STDIO, start);
+
+#if !CONFIG_MULTICORE
+    do_control_work(ctx);
+    start = time_us_32();
 #endif
+    do_telemetry_work(ctx);
+    stats_stage_done(STAGE_TELEMETRY, start);
+
+    sched_run(&ctx->sched, ctx);
+
+    if (stdio_pending)
+      continue;
+
+    /*
+     * Sleep until the next deadline, unless cyw43, lwIP, the other core or
+     * any other interrupt (USB stdio included) has work for us earlier.
+     */
+    absolute_time_t deadline = sched_next_deadline(&ctx->sched);
+#if !CONFIG_MULTICORE
+    const absolute_time_t control_deadline = sched_next_deadline(&ctx->control.sched);
+    if (control_deadline < deadline)
+      deadline = control_deadline;
+#endif
+    cyw43_arch_wait_for_work_until(idle_deadline(deadline));
   }
 
   free(ctx);
@@ -865,8 +3924,6 @@ main_work_loop(void)
   return 0;
 }
 
-int spi_main(void);
-
 static int
 main_(void)
 {
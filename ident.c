@@ -0,0 +1,94 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "ident.h"
+
+/* x^9 + x^5 + 1, maximal length. */
+#define IDENT_PRBS_TAPS ((1u << 8) | (1u << 4))
+#define IDENT_PRBS_SEED 1u
+
+/* Next bit of the sequence, Fibonacci form. */
+static bool
+ident_prbs_next(uint16_t* lfsr)
+{
+  const bool bit = __builtin_parity(*lfsr & IDENT_PRBS_TAPS);
+
+  *lfsr = ((*lfsr << 1) | bit) & IDENT_PRBS_LENGTH;
+
+  return bit;
+}
+
+void
+ident_start(ident_t* ident, int32_t base, int32_t amplitude, int32_t ceiling, uint32_t bit_ms,
+            uint32_t sample_ms, uint32_t now_ms)
+{
+  /* The log is big, only the head needs clearing. */
+  memset(ident, 0, offsetof(ident_t, temps));
+
+  if (base > ceiling)
+    base = ceiling;
+
+  ident->base      = base;
+  ident->low       = base - amplitude > 0 ? base - amplitude : 0;
+  ident->high      = base + amplitude < ceiling ? base + amplitude : ceiling;
+  ident->bit_ms    = bit_ms;
+  ident->sample_ms = sample_ms;
+  ident->lfsr      = IDENT_PRBS_SEED;
+  ident->bit       = ident_prbs_next(&ident->lfsr);
+  ident->bits      = 1;
+  ident->bit_at_ms = now_ms;
+  ident->state     = ident->high > ident->low ? IDENT_RUNNING : IDENT_FAILED;
+}
+
+void
+ident_stop(ident_t* ident)
+{
+  if (ident->state == IDENT_RUNNING)
+    ident->state = IDENT_IDLE;
+}
+
+void
+ident_fail(ident_t* ident)
+{
+  if (ident->state == IDENT_RUNNING)
+    ident->state = IDENT_FAILED;
+}
+
+int32_t
+ident_update(ident_t* ident, uint32_t now_ms)
+{
+  /* A late call catches up on every bit it missed. */
+  while (now_ms - ident->bit_at_ms >= ident->bit_ms) {
+    ident->bit        = ident_prbs_next(&ident->lfsr);
+    ident->bits++;
+    ident->bit_at_ms += ident->bit_ms;
+  }
+
+  return ident->bit ? ident->high : ident->low;
+}
+
+void
+ident_record(ident_t* ident, temp_t temp, int32_t input)
+{
+  if (ident->state != IDENT_RUNNING)
+    return;
+
+  ident->temps[ident->count]  = temp;
+  ident->inputs[ident->count] = (uint16_t) (input >> (PWM_FINE_BITS - IDENT_INPUT_BITS));
+
+  if (++ident->count == IDENT_SAMPLES)
+    ident->state = IDENT_DONE;
+}
+
+const char*
+ident_state_name(uint8_t state)
+{
+  switch (state) {
+    case IDENT_IDLE:    return "idle";
+    case IDENT_RUNNING: return "running";
+    case IDENT_DONE:    return "done";
+    case IDENT_FAILED:  return "failed";
+  }
+
+  return "?";
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * System identification run of the ident command.
+ *
+ * Around an operating point, the output the heater is at when the run
+ * starts, the heater switches between two levels amplitude below and
+ * above it. A pseudo-random binary sequence picks which one: a maximal
+ * length linear feedback shift register of IDENT_PRBS_ORDER bits, one
+ * bit every bit_ms, IDENT_PRBS_LENGTH bits before it repeats. Its
+ * spectrum is flat up to about 1 / (3 bit_ms), so one run excites every
+ * time constant from a few bits up to the sequence's length at once,
+ * where the mapper's staircase waits for every level to settle. The
+ * furnace stays around the operating point all along.
+ *
+ * Both levels are clamped to 0 .. ceiling, the run doesn't start if that
+ * leaves nothing to switch between.
+ *
+ * Every new sample of the regulated sensor goes into the log together
+ * with the output at that moment, until IDENT_SAMPLES are in. The log
+ * stays until the next run starts.
+ *
+ * A bit lasts bit_ms of now_ms, a late update clocks out every bit it
+ * missed.
+ */
+
+#define IDENT_PRBS_ORDER  9
+#define IDENT_PRBS_LENGTH ((1u << IDENT_PRBS_ORDER) - 1)
+
+/* 48 KiB of RAM: 13 minutes at 10 samples per second, 2 hours at one. */
+#define IDENT_SAMPLES     8192
+
+/* Output in the log, PWM_FINE_BITS cut down to this many fraction bits. */
+#define IDENT_INPUT_BITS  8
+
+#define IDENT_BIT_S       30
+#define IDENT_BIT_MAX_S   3600
+
+enum {
+  IDENT_IDLE,
+  IDENT_RUNNING,
+  IDENT_DONE,
+  IDENT_FAILED,
+};
+
+typedef struct {
+  uint8_t  state;     /* IDENT_* */
+  int32_t  base;      /* operating point, PWM_FINE_BITS */
+  int32_t  low;       /* output for a 0 bit, PWM_FINE_BITS */
+  int32_t  high;      /* and for a 1 bit */
+  uint32_t bit_ms;
+
+  uint16_t lfsr;
+  bool     bit;
+  uint32_t bits;      /* clocked out so far */
+  uint32_t bit_at_ms; /* the current bit started */
+
+  uint32_t sample_ms; /* between samples, what the log was taken at */
+  uint16_t count;     /* samples in the log */
+  temp_t   temps[IDENT_SAMPLES];
+  uint16_t inputs[IDENT_SAMPLES];
+} ident_t;
+
+/*
+ * Starts a run around base with amplitude (both PWM_FINE_BITS), levels
+ * clamped to ceiling. Fails right away if they come out the same.
+ */
+void
+ident_start(ident_t* ident, int32_t base, int32_t amplitude, int32_t ceiling, uint32_t bit_ms,
+            uint32_t sample_ms, uint32_t now_ms);
+
+/* Ends a running run, the log keeps what it got. */
+void
+ident_stop(ident_t* ident);
+
+void
+ident_fail(ident_t* ident);
+
+/* Clocks the sequence up to now, returns the output (PWM_FINE_BITS) to run the heater at. */
+int32_t
+ident_update(ident_t* ident, uint32_t now_ms);
+
+/* Logs one sample and the output it was taken at, the run is done once the log is full. */
+void
+ident_record(ident_t* ident, temp_t temp, int32_t input);
+
+const char*
+ident_state_name(uint8_t state);
@@ -1,102 +1,158 @@
 #pragma once
 
-#define MAX31856_REG_CR0   (0x00)
-#define MAX31856_REG_CR1   (0x01)
-#define MAX31856_REG_MASK  (0x02)
-#define MAX31856_REG_CJHF  (0x03)
-#define MAX31856_REG_CJLF  (0x04)
-#define MAX31856_REG_CJTO  (0x09)
-#define MAX31856_REG_CJTH  (0x0a)
-#define MAX31856_REG_CJTL  (0x0b)
-#define MAX31856_REG_LTCBH (0x0c)
-#define MAX31856_REG_LTCBM (0x0d)
-#define MAX31856_REG_LTCBL (0x0e)
+#define MAX31856_REG_CR0    (0x00)
+#define MAX31856_REG_CR1    (0x01)
+#define MAX31856_REG_MASK   (0x02)
+#define MAX31856_REG_CJHF   (0x03)
+#define MAX31856_REG_CJLF   (0x04)
+#define MAX31856_REG_LTHFTH (0x05)
+#define MAX31856_REG_LTHFTL (0x06)
+#define MAX31856_REG_LTLFTH (0x07)
+#define MAX31856_REG_LTLFTL (0x08)
+#define MAX31856_REG_CJTO   (0x09)
+#define MAX31856_REG_CJTH   (0x0a)
+#define MAX31856_REG_CJTL   (0x0b)
+#define MAX31856_REG_LTCBH  (0x0c)
+#define MAX31856_REG_LTCBM  (0x0d)
+#define MAX31856_REG_LTCBL  (0x0e)
+#define MAX31856_REG_SR     (0x0f)
+
+#define MAX318xx_REGS       (MAX31856_REG_SR + 1)
+
+/* Fault status register. */
+#define MAX31856_SR_CJ_RANGE (1 << 7)
+#define MAX31856_SR_TC_RANGE (1 << 6)
+#define MAX31856_SR_CJHIGH   (1 << 5)
+#define MAX31856_SR_CJLOW    (1 << 4)
+#define MAX31856_SR_TCHIGH   (1 << 3)
+#define MAX31856_SR_TCLOW    (1 << 2)
+#define MAX31856_SR_OVUV     (1 << 1)
+#define MAX31856_SR_OPEN     (1 << 0)
 
 /*
  * MAX31856 Precision Thermocouple to Digital Converter with Linearization.
  * Docs: https://holzcoredump.cc/MAX31856.pdf
  */
 
-static inline uint32_t max318xx_read_cold_junction(void)
-{
-  const uint16_t len = 2;
-  uint8_t src[len], dst[len];
-
-  memset(src, 0, len);
-  src[0] = MAX31856_REG_CJTH;
+/*
+ * Automatic conversion mode, open circuit detection for thermocouples
+ * under 5k, 50Hz filter. K type, one sample per conversion.
+ */
+#define MAX31856_CR0 0x91
+#define MAX31856_CR1 0x03
 
-  gpio_put(FURNACE_SPI_CSN_PIN, 0);
-  spi_write_read_blocking(MAX318xx_SPI_INSTANCE, src, dst, len);
-  gpio_put(FURNACE_SPI_CSN_PIN, 1);
+/*
+ * In automatic conversion mode DRDY goes low whenever a new conversion is
+ * ready and stays low until LTCBH is read, which every sample does.
+ * With the 50Hz filter that happens about every 100 ms.
+ */
+#define MAX318xx_DRDY_PIN       FURNACE_SPI_DRDY_PIN
+#define MAX318xx_CONVERSION_MS  100
 
-  sleep_ms(1);
+/*
+ * One sample is a single burst read of the whole register file, CR0
+ * through SR: configuration, cold junction, linearized thermocouple
+ * temperature and faults come from the same conversion.
+ */
+#define MAX318xx_SAMPLE_LEN (1 + MAX318xx_REGS)
 
-  return dst[1];
+static inline void max318xx_sample_request(uint8_t* tx)
+{
+  memset(tx, 0, MAX318xx_SAMPLE_LEN);
+  tx[0] = MAX318xx_REG_READ_BIT | MAX31856_REG_CR0;
 }
 
-static inline int max318xx_read_temperature(void)
+/*
+ * Cold junction is a 14 bit two's complement number, 2^-6 C LSB, left
+ * justified in CJTH:CJTL. Read as int16_t that is exactly C * 2^8.
+ */
+static inline temp_t max31856_cold_junction(const uint8_t* regs)
 {
-  const uint16_t len = 4;
-  uint8_t src[len], dst[len];
-  int temperature = 0;
+  _Static_assert(MAX31856_REG_CJTH + 1 == MAX31856_REG_CJTL);
+  _Static_assert(TEMP_FRAC_BITS <= 8);
+
+  const int16_t cj = (int16_t) ((regs[MAX31856_REG_CJTH] << 8) | regs[MAX31856_REG_CJTL]);
+
+  return (temp_t) cj >> (8 - TEMP_FRAC_BITS);
+}
 
+/*
+ * Linearized thermocouple temperature is a 19 bit two's complement number,
+ * 2^-7 C LSB, left justified in LTCBH:LTCBM:LTCBL, so C * 2^12 as a whole.
+ */
+static inline temp_t max31856_temperature(const uint8_t* regs)
+{
   _Static_assert(MAX31856_REG_LTCBH + 1 == MAX31856_REG_LTCBM);
   _Static_assert(MAX31856_REG_LTCBH + 2 == MAX31856_REG_LTCBL);
-  memset(src, 0, len);
-  src[0] = MAX31856_REG_LTCBH;
+  _Static_assert(TEMP_FRAC_BITS <= 12);
 
-  gpio_put(FURNACE_SPI_CSN_PIN, 0);
-  spi_write_read_blocking(MAX318xx_SPI_INSTANCE, src, dst, len);
-  gpio_put(FURNACE_SPI_CSN_PIN, 1);
+  /* Sign extend ltcbh and zero extend the rest. */
+  const int32_t  ltcbh = (int8_t) regs[MAX31856_REG_LTCBH];
+  const uint32_t ltcbm = regs[MAX31856_REG_LTCBM], ltcbl = regs[MAX31856_REG_LTCBL];
+  const int32_t  ltc   = (int32_t) (((uint32_t) ltcbh << 16) | (ltcbm << 8) | ltcbl);
 
-  sleep_ms(1);
+  return ltc >> (12 - TEMP_FRAC_BITS);
+}
 
-  /*
-   * Sign extend ltcbh and zero extend the rest.
-   * TODO: convert bits after the decimal point too.
-   */
-  const int32_t  ltcbh = (int8_t) dst[1];
-  const uint32_t ltcbm = dst[2], ltcbl = dst[3];
-  temperature = (((uint32_t) ltcbh) << 4)
-              | (((uint32_t) ltcbm) >> 4);
+static inline uint8_t max31856_faults(uint8_t sr)
+{
+  uint8_t faults = 0;
+
+  if (sr & MAX31856_SR_OPEN)
+    faults |= MAX318xx_FAULT_OPEN;
+  if (sr & (MAX31856_SR_TC_RANGE | MAX31856_SR_TCHIGH | MAX31856_SR_TCLOW))
+    faults |= MAX318xx_FAULT_RANGE;
+  if (sr & (MAX31856_SR_CJ_RANGE | MAX31856_SR_CJHIGH | MAX31856_SR_CJLOW))
+    faults |= MAX318xx_FAULT_CJ;
+  if (sr & MAX31856_SR_OVUV)
+    faults |= MAX318xx_FAULT_SUPPLY;
+
+  return faults;
+}
 
-  (void) ltcbl;
+/* Fills snap from the answer to max318xx_sample_request. */
+static inline void max318xx_snapshot_decode(max318xx_snapshot_t* snap, const uint8_t* rx)
+{
+  memcpy(snap->regs, rx + 1, MAX318xx_REGS);
 
-  return temperature;
+  snap->temp      = max31856_temperature(snap->regs);
+  snap->cold_temp = max31856_cold_junction(snap->regs);
+  snap->faults    = max31856_faults(snap->regs[MAX31856_REG_SR]);
 }
 
-static inline void max318xx_config(void)
+static inline void max318xx_config(const max318xx_sensor_t* sensor)
 {
-  printf("Initializing MAX31856...");
-
-  max318xx_spi_init();
+  _Static_assert(MAX31856_REG_CR0 + 1 == MAX31856_REG_CR1);
 
-  /* Enable automatic conversion mode and 50Hz noise filter. */
-  max318xx_write_reg8(MAX31856_REG_CR0, 0x81);
+  const uint8_t cr[] = { MAX31856_CR0, MAX31856_CR1 };
 
-  /* Set thermocouple type to S */
-  // max31856_write_reg8(MAX31856_REG_CR1, 0x06);
+  printf("Initializing MAX31856 (%s)...", sensor->name);
 
-  /* Set thermocouple type to K */
-  max318xx_write_reg8(MAX31856_REG_CR1, 0x03);
+  max318xx_write_regs(sensor->cs_pin, MAX31856_REG_CR0, cr, sizeof(cr));
 }
 
-static inline int max318xx_sanity_check(void)
+static inline int max318xx_sanity_check(const max318xx_sensor_t* sensor)
 {
-  /* 
+  uint8_t rx[MAX318xx_SAMPLE_LEN];
+  max318xx_snapshot_t snap;
+
+  /*
    * Sanity check.
-   * We read few first registers and check against default values.
+   * We read the register file and check against default values.
    * It's basically SPI connection check.
    */
-  if (max318xx_read_reg8(MAX31856_REG_CR0) != 0x81)
+  max318xx_read_regs(sensor->cs_pin, MAX31856_REG_CR0, rx + 1, MAX318xx_REGS);
+  max318xx_snapshot_decode(&snap, rx);
+
+  if (snap.regs[MAX31856_REG_CR0] != MAX31856_CR0)
     return 1;
-  if (max318xx_read_reg8(MAX31856_REG_CR1) != 0x03)
+  if (snap.regs[MAX31856_REG_CR1] != MAX31856_CR1)
     return 2;
-  if (max318xx_read_reg8(MAX31856_REG_MASK) != 0xff)
+  if (snap.regs[MAX31856_REG_MASK] != 0xff)
     return 3;
-  if (max318xx_read_reg8(MAX31856_REG_CJHF) != 0x7f)
+  if (snap.regs[MAX31856_REG_CJHF] != 0x7f)
     return 4;
-  if (max318xx_read_reg8(MAX31856_REG_CJLF) != 0xc0)
+  if (snap.regs[MAX31856_REG_CJLF] != 0xc0)
     return 5;
 
   printf(" OK\n");
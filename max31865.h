@@ -1,19 +1,9 @@
 #pragma once
 
-#include <math.h>
+#include "rtd.h"
+#include CONSTEVAL_HEADER
 
-#define R_REF           430
-#define RTD_NOMINAL     100
-#define CASUAL_WIRE_RES 2
-#define MAX_ADC_VALUE   1U << 15
-
-//Those are constants used to calculate temperature based on resistance
-//source : https://www.analog.com/media/en/technical-documentation/application-notes/AN709_0.pdf, page 4
-
-#define Z1          -3.9083e-3
-#define Z2          1.758480889e-5
-#define Z3          -2.36e-8
-#define Z4          -1.155e-6
+_Static_assert(sizeof(rtd_table) / sizeof(rtd_table[0]) == RTD_TABLE_SIZE);
 
 #define MAX31865_REG_CONF           (0x00)
 #define MAX31865_REG_RTD_MSB        (0x01)
@@ -24,63 +14,100 @@
 #define MAX31865_REG_LFT_LSB        (0x06)
 #define MAX31865_REG_FS             (0x07)
 
-static inline uint32_t max318xx_read_cold_junction(void)
+#define MAX318xx_REGS               (MAX31865_REG_FS + 1)
+
+/*
+ * In automatic conversion mode with the 50Hz filter a new conversion is in
+ * about every 21 ms. DRDY is not wired up, samples are polled.
+ */
+#define MAX318xx_CONVERSION_MS 21
+
+/* Fault status register. */
+#define MAX31865_FS_HIGH            (1 << 7)
+#define MAX31865_FS_LOW             (1 << 6)
+#define MAX31865_FS_REFIN_HIGH      (1 << 5)
+#define MAX31865_FS_REFIN_LOW       (1 << 4)
+#define MAX31865_FS_RTDIN_LOW       (1 << 3)
+#define MAX31865_FS_OVUV            (1 << 2)
+
+/* Automatic conversion mode, Vbias and 50Hz noise filter. */
+#define MAX31865_CONF               0xC1
+
+/*
+ * One sample is a single burst read of the whole register file, CONF
+ * through FS: the RTD code and its faults come from the same conversion.
+ */
+#define MAX318xx_SAMPLE_LEN (1 + MAX318xx_REGS)
+
+static inline void max318xx_sample_request(uint8_t* tx)
 {
-  return 0;
+  memset(tx, 0, MAX318xx_SAMPLE_LEN);
+  tx[0] = MAX318xx_REG_READ_BIT | MAX31865_REG_CONF;
 }
 
-static inline int max318xx_read_temperature(void)
+static inline temp_t max31865_temperature(const uint8_t* regs)
 {
-  const uint16_t len = 3;
-  uint8_t src[len], dst[len];
-
   _Static_assert(MAX31865_REG_RTD_MSB + 1 == MAX31865_REG_RTD_LSB);
-  memset(src, 0, len);
-  src[0] = MAX31865_REG_RTD_MSB;
 
-  gpio_put(FURNACE_SPI_CSN_PIN, 0);
-  spi_write_read_blocking(MAX318xx_SPI_INSTANCE, src, dst, len);
-  gpio_put(FURNACE_SPI_CSN_PIN, 1);
+  const uint32_t rtd_msb = regs[MAX31865_REG_RTD_MSB], rtd_lsb = regs[MAX31865_REG_RTD_LSB];
+
+  // LSB bit of RTD_LSB reg is acutally a fault bit thus we don't want to include it in read value.
+  const uint32_t adc_read = (uint32_t)( rtd_msb << 7 ) | (uint32_t)( rtd_lsb >> 1 );
 
-  sleep_ms(1);
+  // Resistance, wire resistance and both branches of Callendar-Van Dusen are in the table.
+  return rtd_lookup(rtd_table, adc_read);
+}
 
-  const uint32_t rtd_msb = dst[1], rtd_lsb = dst[2];
+static inline uint8_t max31865_faults(uint8_t fs)
+{
+  uint8_t faults = 0;
 
-  if(rtd_lsb & 0b01)
-    printf("max31865: Fault detected!!\n");
+  if (fs & (MAX31865_FS_REFIN_HIGH | MAX31865_FS_REFIN_LOW | MAX31865_FS_RTDIN_LOW))
+    faults |= MAX318xx_FAULT_OPEN;
+  if (fs & (MAX31865_FS_HIGH | MAX31865_FS_LOW))
+    faults |= MAX318xx_FAULT_RANGE;
+  if (fs & MAX31865_FS_OVUV)
+    faults |= MAX318xx_FAULT_SUPPLY;
 
-  // LSB bit of RTD_LSB reg is acutally a fault bit thus we don't want to include it in read value.
-  const uint32_t adc_read = (uint32_t)( rtd_msb << 7 ) | (uint32_t)( rtd_lsb >> 1 );
-  const float r_rtd = ((float)(adc_read* R_REF) / (MAX_ADC_VALUE)) - CASUAL_WIRE_RES;
+  return faults;
+}
 
-  // We don't expect values less than 0 Celcius.
-  // If we would like to handle this, there is different equation.
-  float temperature_f = (sqrt(Z2 + Z3*r_rtd) + Z1)/Z4;
+/* Fills snap from the answer to max318xx_sample_request. */
+static inline void max318xx_snapshot_decode(max318xx_snapshot_t* snap, const uint8_t* rx)
+{
+  memcpy(snap->regs, rx + 1, MAX318xx_REGS);
 
-  return (int) temperature_f;
+  snap->temp      = max31865_temperature(snap->regs);
+  snap->cold_temp = 0;
+  snap->faults    = max31865_faults(snap->regs[MAX31865_REG_FS]);
 }
 
-static inline void max318xx_config(void)
+static inline void max318xx_config(const max318xx_sensor_t* sensor)
 {
-  printf("Initializing MAX31865...");
+  const uint8_t conf = MAX31865_CONF;
 
-  max318xx_spi_init();
+  printf("Initializing MAX31865 (%s)...", sensor->name);
 
-  /* Enable automatic conversion mode, Vbias and 50Hz noise filter. */
-  max318xx_write_reg8(MAX31865_REG_CONF, 0xC1);
+  max318xx_write_regs(sensor->cs_pin, MAX31865_REG_CONF, &conf, 1);
 }
 
-static inline int max318xx_sanity_check(void)
+static inline int max318xx_sanity_check(const max318xx_sensor_t* sensor)
 {
-  if (max318xx_read_reg8(MAX31865_REG_HFT_MSB) != 0xFF)
+  uint8_t rx[MAX318xx_SAMPLE_LEN];
+  max318xx_snapshot_t snap;
+
+  max318xx_read_regs(sensor->cs_pin, MAX31865_REG_CONF, rx + 1, MAX318xx_REGS);
+  max318xx_snapshot_decode(&snap, rx);
+
+  if (snap.regs[MAX31865_REG_HFT_MSB] != 0xFF)
     return 1;
-  if (max318xx_read_reg8(MAX31865_REG_HFT_LSB) != 0xFF)
+  if (snap.regs[MAX31865_REG_HFT_LSB] != 0xFF)
     return 2;
-  if (max318xx_read_reg8(MAX31865_REG_LFT_MSB) != 0x00)
+  if (snap.regs[MAX31865_REG_LFT_MSB] != 0x00)
     return 3;
-  if (max318xx_read_reg8(MAX31865_REG_LFT_LSB) != 0x00)
+  if (snap.regs[MAX31865_REG_LFT_LSB] != 0x00)
     return 4;
-  if (max318xx_read_reg8(MAX31865_REG_CONF)    != 0xC1)
+  if (snap.regs[MAX31865_REG_CONF]    != MAX31865_CONF)
     return 5;
 
   printf(" OK\n");
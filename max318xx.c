@@ -2,13 +2,40 @@
 
 #include "max318xx.h"
 
+#if CONFIG_THERMO
+const max318xx_sensor_t max318xx_sensors[] = { FURNACE_THERMO_SENSORS };
+
+_Static_assert(THERMO_SENSORS >= 1);
+_Static_assert(THERMO_SENSORS <= sizeof(max318xx_sensors) / sizeof(max318xx_sensors[0]),
+               "CONFIG_THERMO_SENSORS is more than FURNACE_THERMO_SENSORS lists");
+#endif
+
 int max318xx_init(void)
 {
 #if CONFIG_THERMO
-  max318xx_config();
+  max318xx_spi_init();
 
-  return max318xx_sanity_check();
+  /*
+   * We set chipselect to gpio to make sure It's pulled up/down when we want.
+   * By default raspberry was pulling the CS up after each byte.
+   */
+  for (unsigned i = 0; i < THERMO_SENSORS; i++) {
+    gpio_init(max318xx_sensors[i].cs_pin);
+    gpio_set_dir(max318xx_sensors[i].cs_pin, GPIO_OUT);
+    gpio_put(max318xx_sensors[i].cs_pin, 1);
+  }
+
+  for (unsigned i = 0; i < THERMO_SENSORS; i++) {
+    max318xx_config(&max318xx_sensors[i]);
+
+    const int status = max318xx_sanity_check(&max318xx_sensors[i]);
+    if (status) {
+      printf(" failed\n");
+      return status;
+    }
+  }
+
+  return 0;
 #endif
   return -1;
 }
-
@@ -8,47 +8,73 @@
 #include "pico/binary_info.h"
 #include "hardware/spi.h"
 
+#include "common.h"
 #include "spi_config.h"
+#include "spi_async.h"
 
 #define MAX318xx_REG_READ_BIT (0x00)
 #define MAX318xx_REG_WRITE_BIT (0x80)
 
 #define MAX318xx_SPI_INSTANCE FURNACE_SPI_INSTANCE
 
+/* One converter on the bus, the first THERMO_SENSORS of max318xx_sensors are fitted. */
+typedef struct {
+  const char* name;
+  uint        cs_pin;
+} max318xx_sensor_t;
+
+extern const max318xx_sensor_t max318xx_sensors[];
+
+/* Faults decoded from the converter's fault status register. */
+#define MAX318xx_FAULT_OPEN   (1 << 0) /* thermocouple or RTD not connected */
+#define MAX318xx_FAULT_RANGE  (1 << 1) /* reading out of range or past a threshold */
+#define MAX318xx_FAULT_CJ     (1 << 2) /* cold junction out of range */
+#define MAX318xx_FAULT_SUPPLY (1 << 3) /* over or under voltage on the inputs */
+
+/* Readings with these faults are garbage. */
+#define MAX318xx_FAULT_FATAL  (MAX318xx_FAULT_OPEN | MAX318xx_FAULT_RANGE | MAX318xx_FAULT_SUPPLY)
+
+/*
+ * Whole register file of a converter, read in one burst, and what it says.
+ * The driver keeps the last one of every sensor, so status, logging and
+ * safety checks don't need to go back to the bus.
+ */
+#define MAX318xx_REGS_MAX 16
+
+typedef struct {
+  uint8_t regs[MAX318xx_REGS_MAX]; /* from register 0 up */
+  temp_t  temp;
+  temp_t  cold_temp;               /* 0 on converters without one */
+  uint8_t faults;                  /* MAX318xx_FAULT_* */
+} max318xx_snapshot_t;
+
 void max318xx_spi_init(void);
 
-static inline uint8_t max318xx_read_reg8(uint8_t addr)
+/* Blocking, for setup only: the sampling goes through spi_async. */
+static inline void max318xx_read_regs(uint cs_pin, uint8_t addr, uint8_t* val, size_t len)
 {
-  const uint16_t len = 2;
-  uint8_t src[len], dst[len];
+  uint8_t src[1 + MAX318xx_REGS_MAX], dst[1 + MAX318xx_REGS_MAX];
 
+  memset(src, 0, sizeof(src));
   src[0] = MAX318xx_REG_READ_BIT | addr;
-  src[1] = 0;
-
-  gpio_put(FURNACE_SPI_CSN_PIN, 0);
-  spi_write_read_blocking(MAX318xx_SPI_INSTANCE, src, dst, len);
-  gpio_put(FURNACE_SPI_CSN_PIN, 1);
 
-  sleep_ms(1);
+  gpio_put(cs_pin, 0);
+  spi_write_read_blocking(MAX318xx_SPI_INSTANCE, src, dst, 1 + len);
+  gpio_put(cs_pin, 1);
 
-  return dst[1];
+  memcpy(val, dst + 1, len);
 }
 
-static inline uint8_t max318xx_write_reg8(uint8_t addr, uint8_t val)
+static inline void max318xx_write_regs(uint cs_pin, uint8_t addr, const uint8_t* val, size_t len)
 {
-  const uint16_t len = 2;
-  uint8_t src[len], dst[len];
+  uint8_t src[1 + MAX318xx_REGS_MAX], dst[1 + MAX318xx_REGS_MAX];
 
   src[0] = MAX318xx_REG_WRITE_BIT | addr;
-  src[1] = val;
-
-  gpio_put(FURNACE_SPI_CSN_PIN, 0);
-  spi_write_read_blocking(MAX318xx_SPI_INSTANCE, src, dst, len);
-  gpio_put(FURNACE_SPI_CSN_PIN, 1);
+  memcpy(src + 1, val, len);
 
-  sleep_ms(1);
-
-  return dst[1];
+  gpio_put(cs_pin, 0);
+  spi_write_read_blocking(MAX318xx_SPI_INSTANCE, src, dst, 1 + len);
+  gpio_put(cs_pin, 1);
 }
 
 #if CONFIG_THERMO == CONFIG_THERMO_PT100
@@ -58,3 +84,22 @@ static inline uint8_t max318xx_write_reg8(uint8_t addr, uint8_t val)
 #elif CONFIG_THERMO >= 1
     #error "Invalid CONFIG_THERMO value"
 #endif
+
+#if CONFIG_THERMO
+_Static_assert(MAX318xx_REGS <= MAX318xx_REGS_MAX);
+_Static_assert(MAX318xx_SAMPLE_LEN <= SPI_XFER_MAX);
+
+/* Name of the worst of the MAX318xx_FAULT_* bits, for status and logs. */
+static inline const char* max318xx_fault_name(uint8_t faults)
+{
+  if (faults & MAX318xx_FAULT_OPEN)
+    return "open circuit";
+  if (faults & MAX318xx_FAULT_RANGE)
+    return "out of range";
+  if (faults & MAX318xx_FAULT_SUPPLY)
+    return "over/under voltage";
+  if (faults & MAX318xx_FAULT_CJ)
+    return "cold junction out of range";
+  return "ok";
+}
+#endif
@@ -0,0 +1,283 @@
+#include <string.h>
+
+#include "model.h"
+
+#define MODEL_THETA_ONE ((int64_t) 1 << MODEL_THETA_BITS)
+#define MODEL_P_ONE     ((int64_t) 1 << MODEL_P_BITS)
+#define MODEL_PHI_ONE   ((int32_t) 1 << MODEL_PHI_BITS)
+
+/* Covariance to start from, and the trace it may not grow past. */
+#define MODEL_P_START   (16 * MODEL_P_ONE)
+#define MODEL_P_RESTORE (MODEL_P_START / 64)
+#define MODEL_TRACE_MAX (MODEL_PARAMS * MODEL_P_START)
+
+/* Larger steps than that are a sensor glitch, not the furnace. */
+#define MODEL_STEP_MAX  (4 * MODEL_PHI_ONE)
+#define MODEL_THETA_MAX ((int64_t) 64 << MODEL_THETA_BITS)
+
+/* temp_t to the scaled y and y[k+1] - y[k], MODEL_PHI_BITS. */
+#define MODEL_PHI_TEMP(t) ((int32_t) (((int64_t) (t) << (MODEL_PHI_BITS - TEMP_FRAC_BITS)) / MODEL_SCALE_TEMP_C))
+#define MODEL_PHI_STEP(t) ((int32_t) (((int64_t) (t) << (MODEL_PHI_BITS - TEMP_FRAC_BITS)) / MODEL_SCALE_STEP_C))
+
+bool
+model_params_valid(const model_params_t* params)
+{
+  return params->delay <= MODEL_DELAYS &&
+         params->memory_min >= MODEL_MEMORY_MIN_MIN && params->memory_min <= MODEL_MEMORY_MAX_MIN;
+}
+
+static void
+model_fit_reset(model_fit_t* fit, const int32_t* theta, int64_t p)
+{
+  memset(fit, 0, sizeof(*fit));
+
+  for (unsigned i = 0; i < MODEL_PARAMS; i++) {
+    fit->theta[i] = theta ? theta[i] : 0;
+    fit->p[i][i]  = p;
+  }
+}
+
+void
+model_init(model_t* model, uint16_t memory_min)
+{
+  memset(model, 0, sizeof(*model));
+
+  for (unsigned d = 0; d < MODEL_DELAYS; d++)
+    model_fit_reset(&model->fits[d], NULL, MODEL_P_START);
+
+  model_set_memory(model, memory_min);
+}
+
+void
+model_set_memory(model_t* model, uint16_t memory_min)
+{
+  model->memory_min = memory_min;
+  model->lambda     = (int32_t) (MODEL_P_ONE - MODEL_P_ONE * MODEL_PERIOD_MS
+                                               / ((int64_t) memory_min * 60 * 1000));
+}
+
+void
+model_restore(model_t* model, const model_params_t* params)
+{
+  model_init(model, params->memory_min);
+
+  if (params->delay >= MODEL_DELAYS)
+    return;
+
+  int32_t theta[MODEL_PARAMS];
+
+  memcpy(theta, params->theta, sizeof(theta));
+
+  for (unsigned d = 0; d < MODEL_DELAYS; d++)
+    model_fit_reset(&model->fits[d], theta, MODEL_P_RESTORE);
+
+  model->best    = params->delay;
+  model->origin  = params->origin;
+  model->updates = MODEL_UPDATES_MIN;
+}
+
+void
+model_save(const model_t* model, model_params_t* params)
+{
+  const bool fitted = model->updates >= MODEL_UPDATES_MIN;
+
+  for (unsigned i = 0; i < MODEL_PARAMS; i++)
+    params->theta[i] = fitted ? model->fits[model->best].theta[i] : 0;
+
+  params->origin     = fitted ? model->origin : 0;
+  params->delay      = fitted ? model->best : MODEL_DELAYS;
+  params->memory_min = model->memory_min;
+}
+
+static int64_t
+model_clamp(int64_t value, int64_t limit)
+{
+  if (value > limit)
+    return limit;
+
+  if (value < -limit)
+    return -limit;
+
+  return value;
+}
+
+/* One recursive least squares step of a fit. */
+static void
+model_fit_update(model_fit_t* fit, const int32_t* phi, int32_t step, int32_t lambda)
+{
+  int64_t g[MODEL_PARAMS];
+  int64_t k[MODEL_PARAMS];
+  int64_t predicted = 0;
+  int64_t gain      = 0;
+
+  /* g = P phi, prediction phi' theta and phi' P phi. */
+  for (unsigned i = 0; i < MODEL_PARAMS; i++) {
+    int64_t sum = 0;
+
+    for (unsigned j = 0; j < MODEL_PARAMS; j++)
+      sum += fit->p[i][j] * phi[j];
+
+    g[i]       = sum >> MODEL_PHI_BITS;
+    predicted += (int64_t) fit->theta[i] * phi[i];
+  }
+
+  for (unsigned i = 0; i < MODEL_PARAMS; i++)
+    gain += (g[i] * phi[i]) >> MODEL_PHI_BITS;
+
+  const int64_t denom = lambda + gain;
+  const int32_t error = (int32_t) model_clamp(step - (predicted >> MODEL_THETA_BITS), MODEL_STEP_MAX);
+
+  for (unsigned i = 0; i < MODEL_PARAMS; i++) {
+    k[i] = (g[i] << MODEL_P_BITS) / denom;
+
+    fit->theta[i] = (int32_t) model_clamp(fit->theta[i]
+                                          + ((k[i] * error) >> (MODEL_PHI_BITS + MODEL_P_BITS - MODEL_THETA_BITS)),
+                                          MODEL_THETA_MAX);
+  }
+
+  /* P = (P - k g') / lambda, kept symmetric, forgetting only while the trace is in bounds. */
+  int64_t trace = 0;
+
+  for (unsigned i = 0; i < MODEL_PARAMS; i++) {
+    for (unsigned j = i; j < MODEL_PARAMS; j++) {
+      const int64_t p = fit->p[i][j] - ((k[i] * (g[j] >> 8)) >> (MODEL_P_BITS - 8));
+
+      fit->p[i][j] = fit->p[j][i] = p;
+    }
+
+    trace += fit->p[i][i];
+  }
+
+  if (trace < MODEL_TRACE_MAX) {
+    for (unsigned i = 0; i < MODEL_PARAMS; i++)
+      for (unsigned j = 0; j < MODEL_PARAMS; j++)
+        fit->p[i][j] = (fit->p[i][j] << MODEL_P_BITS) / lambda;
+  }
+
+  /* Forgets the error at the same pace as the fit. */
+  const int64_t square = (int64_t) error * error;
+
+  fit->error += ((square - fit->error) * (MODEL_P_ONE - lambda)) >> MODEL_P_BITS;
+}
+
+/*
+ * Moves r up by delta (MODEL_PHI_BITS): y - r shrinks by delta, so c
+ * takes over a delta. theta' = T theta and P' = T P T', T the identity
+ * with -delta in row c, column a.
+ */
+static void
+model_fit_shift(model_fit_t* fit, int32_t delta)
+{
+  const int64_t p00 = fit->p[0][0];
+  const int64_t p02 = fit->p[0][2];
+
+  fit->theta[2] = (int32_t) model_clamp(fit->theta[2] - (((int64_t) fit->theta[0] * delta) >> MODEL_PHI_BITS),
+                                        MODEL_THETA_MAX);
+
+  for (unsigned j = 0; j < 2; j++)
+    fit->p[2][j] = fit->p[j][2] = fit->p[2][j] - ((fit->p[0][j] * delta) >> MODEL_PHI_BITS);
+
+  fit->p[2][2] += ((((p00 * delta) >> MODEL_PHI_BITS) * delta) >> MODEL_PHI_BITS)
+                - 2 * ((p02 * delta) >> MODEL_PHI_BITS);
+}
+
+void
+model_pause(model_t* model)
+{
+  model->primed = false;
+}
+
+void
+model_update(model_t* model, temp_t temp, int32_t input)
+{
+  /* Output as a fraction of full power, MODEL_PHI_BITS. */
+  const int32_t u = (int32_t) (((int64_t) input << (MODEL_PHI_BITS - PWM_FINE_BITS)) / MAX_PWM);
+
+  if (!model->primed) {
+    /* No history yet, as if the heater had been at this output all along. */
+    for (unsigned d = 0; d < MODEL_DELAYS; d++)
+      model->inputs[d] = u;
+
+    /* A restored model keeps its r, the first step moves it here. */
+    if (!model->updates)
+      model->origin = temp;
+
+    model->primed    = true;
+    model->last_temp = temp;
+    return;
+  }
+
+  model->head = (model->head + MODEL_DELAYS - 1) % MODEL_DELAYS;
+  model->inputs[model->head] = u;
+
+  if (model->last_temp - model->origin > TEMP_C(MODEL_SCALE_TEMP_C)
+      || model->origin - model->last_temp > TEMP_C(MODEL_SCALE_TEMP_C)) {
+    const int32_t delta = MODEL_PHI_TEMP(model->last_temp - model->origin);
+
+    for (unsigned d = 0; d < MODEL_DELAYS; d++)
+      model_fit_shift(&model->fits[d], delta);
+
+    model->origin = model->last_temp;
+  }
+
+  const int32_t step = MODEL_PHI_STEP(temp - model->last_temp);
+
+  for (unsigned d = 0; d < MODEL_DELAYS; d++) {
+    const int32_t phi[MODEL_PARAMS] = {
+      -MODEL_PHI_TEMP(model->last_temp - model->origin),
+      model->inputs[(model->head + d) % MODEL_DELAYS],
+      MODEL_PHI_ONE,
+    };
+
+    model_fit_update(&model->fits[d], phi, step, model->lambda);
+
+    if (model->fits[d].error < model->fits[model->best].error)
+      model->best = d;
+  }
+
+  model->updates++;
+  model->last_temp = temp;
+}
+
+bool
+model_get(const model_t* model, model_fopdt_t* out)
+{
+  const model_fit_t* fit = &model->fits[model->best];
+  const int64_t      a   = fit->theta[0];
+  const int64_t      b   = fit->theta[1];
+
+  if (model->updates < MODEL_UPDATES_MIN || a <= 0 || b <= 0)
+    return false;
+
+  /*
+   * a is scaled by MODEL_SCALE_TEMP_C / MODEL_SCALE_STEP_C, b by full
+   * power / MODEL_SCALE_STEP_C, c by 1 / MODEL_SCALE_STEP_C.
+   */
+  const int64_t ratio = MODEL_SCALE_TEMP_C / MODEL_SCALE_STEP_C;
+
+  out->tau_s   = (uint32_t) ((int64_t) MODEL_PERIOD_MS / 1000 * ratio * MODEL_THETA_ONE / a);
+  out->gain    = (int32_t) (b * MODEL_SCALE_TEMP_C * TEMP_ONE / ((int64_t) MAX_PWM * a));
+  out->ambient = model->origin + (temp_t) ((int64_t) fit->theta[2] * MODEL_SCALE_TEMP_C * TEMP_ONE / a);
+  out->dead_s  = model->best * MODEL_PERIOD_MS / 1000;
+
+  return true;
+}
+
+temp_t
+model_error(const model_t* model)
+{
+  uint64_t square = model->fits[model->best].error;
+  uint64_t root   = 0;
+
+  /* Integer square root, twice MODEL_PHI_BITS in, MODEL_PHI_BITS out. */
+  for (uint64_t bit = (uint64_t) 1 << 62; bit; bit >>= 2) {
+    if (square >= root + bit) {
+      square -= root + bit;
+      root    = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+  }
+
+  return (temp_t) (((int64_t) root * MODEL_SCALE_STEP_C) >> (MODEL_PHI_BITS - TEMP_FRAC_BITS));
+}
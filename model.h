@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Online identification of a first order plus dead time model of the
+ * furnace, from the heater output and the temperature it leads to.
+ *
+ * Once every MODEL_PERIOD_MS the temperature has moved by
+ *
+ *   y[k+1] - y[k] = -a (y[k] - r) + b u[k-d] + c
+ *
+ * where u is the heater output d periods ago. a, b and c are fitted by
+ * recursive least squares with a forgetting factor, so the fit follows an
+ * ageing element or a different load: samples older than the memory count
+ * less and less. One fit runs for every dead time from 0 to
+ * MODEL_DELAYS - 1 periods, the one that predicts best is the model.
+ *
+ * From those: time constant tau = period / a, gain b / a C per PWM level
+ * and the temperature the furnace cools towards, r + c / a.
+ *
+ * The period is a minute, not the sample rate: the thermocouple's lag
+ * isn't in the model, over a few seconds it is most of what the fit
+ * sees and a time constant of hours hardly shows.
+ *
+ * The reference r follows the temperature in MODEL_SCALE_TEMP_C steps,
+ * the fits moved along with it. Measured from a fixed point, a furnace
+ * that hardly moves can't tell a from c, and the first change of power
+ * goes to both.
+ *
+ * Everything runs in fixed point. Distance from r, output and the step
+ * are scaled to about 1 (MODEL_SCALE_*), parameters have MODEL_THETA_BITS
+ * fraction bits and the covariance MODEL_P_BITS. Without excitation, at
+ * a steady temperature, the covariance would grow without bounds while
+ * forgetting: it stops forgetting once its trace reaches the start value.
+ */
+
+#define MODEL_PERIOD_MS      60000
+#define MODEL_DELAYS         8            /* dead times 0 .. 7 min */
+#define MODEL_PARAMS         3            /* a, b, c */
+
+#define MODEL_MEMORY_MIN     120          /* minutes */
+#define MODEL_MEMORY_MIN_MIN 10
+#define MODEL_MEMORY_MAX_MIN 1440
+
+/* After this many periods with data the model counts, half an hour. */
+#define MODEL_UPDATES_MIN    30
+
+#define MODEL_THETA_BITS     24
+#define MODEL_P_BITS         24
+#define MODEL_PHI_BITS       16
+
+#define MODEL_SCALE_TEMP_C   32           /* y - r, also how far r lags */
+#define MODEL_SCALE_STEP_C   16           /* y[k+1] - y[k] */
+
+/* Kept in flash: the fit of the best dead time and how long it remembers. */
+typedef struct __attribute__((packed)) {
+  int32_t  theta[MODEL_PARAMS];
+  temp_t   origin;      /* r */
+  uint8_t  delay;       /* periods, MODEL_DELAYS means nothing fitted yet */
+  uint16_t memory_min;
+} model_params_t;
+
+typedef struct {
+  int32_t  theta[MODEL_PARAMS];
+  int64_t  p[MODEL_PARAMS][MODEL_PARAMS];
+  int64_t  error;       /* mean square prediction error, twice MODEL_PHI_BITS */
+} model_fit_t;
+
+typedef struct {
+  uint16_t    memory_min;
+  int32_t     lambda;   /* forgetting factor, MODEL_P_BITS */
+
+  model_fit_t fits[MODEL_DELAYS];
+  int32_t     inputs[MODEL_DELAYS]; /* last periods' outputs, newest at head */
+  uint8_t     head;
+  bool        primed;   /* last_temp, origin and inputs hold values */
+  temp_t      last_temp;
+  temp_t      origin;   /* r */
+  uint32_t    updates;
+  uint8_t     best;     /* fit with the smallest error */
+} model_t;
+
+/* The model in the units the commands and controllers speak. */
+typedef struct {
+  int32_t  gain;        /* temp_t per PWM level, steady state */
+  uint32_t tau_s;
+  uint32_t dead_s;
+  temp_t   ambient;     /* where it cools towards with the heater off */
+} model_fopdt_t;
+
+/* Limits hold: a dead time in range, memory within MODEL_MEMORY_MIN_MIN..MODEL_MEMORY_MAX_MIN. */
+bool
+model_params_valid(const model_params_t* params);
+
+/* Starts over with nothing known. */
+void
+model_init(model_t* model, uint16_t memory_min);
+
+/* Changes the memory, keeps the fits. */
+void
+model_set_memory(model_t* model, uint16_t memory_min);
+
+/*
+ * Starts from a model saved before: every fit gets its parameters and a
+ * covariance small enough that they aren't thrown away right away.
+ */
+void
+model_restore(model_t* model, const model_params_t* params);
+
+void
+model_save(const model_t* model, model_params_t* params);
+
+/* A gap in the data, the next update starts the history over. */
+void
+model_pause(model_t* model);
+
+/*
+ * One period: the temperature now and the mean heater output
+ * (PWM_FINE_BITS) since the last call, MODEL_PERIOD_MS ago.
+ */
+void
+model_update(model_t* model, temp_t temp, int32_t input);
+
+/* False until the best fit has seen enough and makes physical sense. */
+bool
+model_get(const model_t* model, model_fopdt_t* out);
+
+/* Root mean square prediction error of the best fit, temp_t per period. */
+temp_t
+model_error(const model_t* model);
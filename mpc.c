@@ -0,0 +1,300 @@
+#include <string.h>
+
+#include "mpc.h"
+#include "profile.h"
+
+#define MPC_A_ONE   ((int64_t) 1 << MPC_A_BITS)
+
+/* temp_t to the solver's temperatures and back. */
+#define MPC_TEMP(t) ((int32_t) (t) * (1 << MPC_TEMP_BITS))
+#define MPC_TEMP_T(t) ((temp_t) ((t) >> MPC_TEMP_BITS))
+
+/* Penalty of a level of change, squared temperature per level squared. */
+#define MPC_LAMBDA  ((int64_t) MPC_TEMP(TEMP_C(MPC_MOVE_C)) * MPC_TEMP(TEMP_C(MPC_MOVE_C)))
+
+/* Far enough out of range that nothing in it matters. */
+#define MPC_SETTLE_MAX MPC_TEMP(TEMP_C(4 * MAX_TEMP))
+
+/* A setpoint moving faster than a profile can ramp has stepped. */
+#define MPC_SLOPE_MAX MPC_TEMP((int64_t) TEMP_C(PROFILE_RATE_MAX) * MPC_PERIOD_MS / 3600000)
+
+void
+mpc_init(mpc_t* mpc)
+{
+  memset(mpc, 0, sizeof(*mpc));
+}
+
+/* e^-x, both with MPC_A_BITS fraction bits. */
+static int64_t
+mpc_exp_neg(int64_t x)
+{
+  unsigned halvings = 0;
+
+  if (x >= 32 * MPC_A_ONE)
+    return 0;
+
+  while (x > MPC_A_ONE >> 6) {
+    x >>= 1;
+    halvings++;
+  }
+
+  /* Below 2^-6 the series' next term is past MPC_A_BITS. */
+  const int64_t x2 = (x * x) >> MPC_A_BITS;
+  const int64_t x3 = (x2 * x) >> MPC_A_BITS;
+  int64_t       e  = MPC_A_ONE - x + x2 / 2 - x3 / 6;
+
+  while (halvings--)
+    e = (e * e) >> MPC_A_BITS;
+
+  return e;
+}
+
+void
+mpc_set_model(mpc_t* mpc, const model_fopdt_t* model)
+{
+  if (mpc->ready && mpc->model.gain == model->gain && mpc->model.tau_s == model->tau_s
+      && mpc->model.dead_s == model->dead_s && mpc->model.ambient == model->ambient)
+    return;
+
+  const uint32_t tau_s = model->tau_s ? model->tau_s : 1;
+  const int64_t  a     = mpc_exp_neg(((int64_t) MPC_PERIOD_MS << MPC_A_BITS) / ((int64_t) tau_s * 1000));
+  const int32_t  gain  = model->gain < 0 ? 0 : model->gain > MPC_GAIN_MAX ? MPC_GAIN_MAX : model->gain;
+  const uint32_t delay = (model->dead_s * 1000 + MPC_PERIOD_MS / 2) / MPC_PERIOD_MS;
+
+  mpc->model   = *model;
+  mpc->decay   = a < MPC_A_ONE ? (int32_t) (MPC_A_ONE - a) : 1;
+  mpc->gain    = MPC_TEMP(gain);
+  mpc->ambient = MPC_TEMP(model->ambient);
+  mpc->delay   = delay > MPC_DELAY_MAX ? MPC_DELAY_MAX : (uint8_t) delay;
+
+  /* Step response, n periods after the output went up by a level. */
+  int32_t step[MPC_HORIZON + 1];
+  int64_t an = MPC_A_ONE;
+
+  for (unsigned n = 0; n <= MPC_HORIZON; n++) {
+    step[n] = (int32_t) (mpc->gain - ((mpc->gain * an) >> MPC_A_BITS));
+    an      = (an * a) >> MPC_A_BITS;
+  }
+
+  /* A block is a step up at its start and back down at its end, the last one never ends. */
+  for (unsigned p = 0; p < MPC_HORIZON; p++) {
+    for (unsigned j = 0; j < MPC_MOVES; j++) {
+      const int on  = (int) p + 1 - (int) (j * MPC_BLOCK);
+      const int off = (int) p + 1 - (int) ((j + 1) * MPC_BLOCK);
+
+      mpc->s[p][j] = (on > 0 ? step[on] : 0) - (off > 0 && j < MPC_MOVES - 1 ? step[off] : 0);
+    }
+  }
+
+  for (unsigned j = 0; j < MPC_MOVES; j++) {
+    int64_t h = 0;
+
+    for (unsigned p = 0; p < MPC_HORIZON; p++)
+      h += (int64_t) mpc->s[p][j] * mpc->s[p][j];
+
+    /* Every block but the last is in two changes. */
+    h += j < MPC_MOVES - 1 ? 2 * MPC_LAMBDA : MPC_LAMBDA;
+
+    if (j == MPC_MOVES - 1)
+      h += MPC_TERMINAL_WEIGHT * (int64_t) mpc->gain * mpc->gain;
+
+    mpc->h[j] = h;
+  }
+
+  mpc->ready = true;
+}
+
+void
+mpc_reset(mpc_t* mpc, temp_t temp, int32_t output)
+{
+  mpc->primed  = true;
+  mpc->x       = MPC_TEMP(temp);
+  mpc->head    = 0;
+  mpc->updates = 0;
+
+  for (unsigned i = 0; i <= MPC_DELAY_MAX; i++)
+    mpc->inputs[i] = output;
+
+  for (unsigned j = 0; j < MPC_MOVES; j++)
+    mpc->moves[j] = output >> (PWM_FINE_BITS - MPC_OUT_BITS);
+}
+
+/* The model one period on, output (PWM_FINE_BITS) reaching the furnace all along. */
+static int32_t
+mpc_step(const mpc_t* mpc, int32_t x, int32_t output)
+{
+  const int32_t settle = mpc->ambient + (int32_t) (((int64_t) mpc->gain * output) >> PWM_FINE_BITS);
+
+  return x + (int32_t) (((int64_t) mpc->decay * (settle - x)) >> MPC_A_BITS);
+}
+
+/* Puts at most limit on value / coef, if coef is positive and limit tighter than hi. */
+static int32_t
+mpc_bound(int32_t hi, int32_t u, int64_t slack, int32_t coef)
+{
+  if (coef <= 0 || (((int64_t) coef * (hi - u)) >> MPC_OUT_BITS) <= slack)
+    return hi;
+
+  return u + (int32_t) ((slack << MPC_OUT_BITS) / coef);
+}
+
+int32_t
+mpc_update(mpc_t* mpc, temp_t setpoint, temp_t target, temp_t temp, int32_t ceiling)
+{
+  const unsigned history = MPC_DELAY_MAX + 1;
+
+  /* The period that just ended, on the output that reached the furnace in it. */
+  mpc->x = mpc_step(mpc, mpc->x, mpc->inputs[(mpc->head + mpc->delay) % history]);
+
+  const int32_t offset = MPC_TEMP(temp) - mpc->x;
+
+  /* Through the dead time on what was sent already, then with the heater off. */
+  int32_t x = mpc->x;
+
+  for (unsigned i = mpc->delay; i-- > 0;)
+    x = mpc_step(mpc, x, mpc->inputs[(mpc->head + i) % history]);
+
+  const int32_t y0 = x + offset;
+  int32_t       y[MPC_HORIZON];
+  int32_t       r[MPC_HORIZON];
+
+  for (unsigned p = 0; p < MPC_HORIZON; p++) {
+    x    = mpc_step(mpc, x, 0);
+    y[p] = x + offset;
+  }
+
+  /* The setpoint goes on the way it moved, up to target. */
+  int32_t slope = mpc->updates ? MPC_TEMP(setpoint - mpc->last_setpoint) : 0;
+
+  if (slope > MPC_SLOPE_MAX || slope < -MPC_SLOPE_MAX || (slope > 0) != (target > setpoint))
+    slope = 0;
+
+  for (unsigned p = 0; p < MPC_HORIZON; p++) {
+    int32_t ref = MPC_TEMP(setpoint) + slope * (int32_t) (mpc->delay + p + 1);
+
+    if ((slope > 0 && ref > MPC_TEMP(target)) || (slope < 0 && ref < MPC_TEMP(target)))
+      ref = MPC_TEMP(target);
+
+    r[p] = ref;
+  }
+
+  /*
+   * What the last block's output should settle at: the setpoint, or on a
+   * ramp as far above it as it takes to keep the furnace rising with it.
+   */
+  int64_t settle_ref = r[MPC_HORIZON - 1]
+                       + ((int64_t) (r[MPC_HORIZON - 1] - r[MPC_HORIZON - 2]) << MPC_A_BITS) / mpc->decay;
+
+  if (settle_ref > MPC_SETTLE_MAX)
+    settle_ref = MPC_SETTLE_MAX;
+  else if (settle_ref < -MPC_SETTLE_MAX)
+    settle_ref = -MPC_SETTLE_MAX;
+
+  const int32_t hi_out   = ceiling >> (PWM_FINE_BITS - MPC_OUT_BITS);
+  const int32_t now      = mpc->inputs[mpc->head] >> (PWM_FINE_BITS - MPC_OUT_BITS);
+  const int32_t max_temp = MPC_TEMP(TEMP_C(MAX_TEMP));
+  const int32_t rise     = mpc->rate_max
+                           ? (int32_t) ((int64_t) MPC_TEMP(TEMP_C(mpc->rate_max)) * MPC_PERIOD_MS / 3600000)
+                           : INT32_MAX;
+  int32_t*      u        = mpc->moves;
+
+  /* Warm start from the last solution, the predictions along with it. */
+  for (unsigned j = 0; j < MPC_MOVES; j++) {
+    if (u[j] > hi_out)
+      u[j] = hi_out;
+
+    for (unsigned p = 0; p < MPC_HORIZON; p++)
+      y[p] += (int32_t) (((int64_t) mpc->s[p][j] * u[j]) >> MPC_OUT_BITS);
+  }
+
+  for (unsigned sweep = 0; sweep < MPC_SWEEPS; sweep++) {
+    for (unsigned j = 0; j < MPC_MOVES; j++) {
+      /* Half the cost's derivative along this block. */
+      int64_t g = 0;
+
+      for (unsigned p = j * MPC_BLOCK; p < MPC_HORIZON; p++)
+        g += (int64_t) mpc->s[p][j] * (y[p] - r[p]);
+
+      g += MPC_LAMBDA * (u[j] - (j ? u[j - 1] : now)) >> MPC_OUT_BITS;
+
+      if (j < MPC_MOVES - 1) {
+        g -= MPC_LAMBDA * (u[j + 1] - u[j]) >> MPC_OUT_BITS;
+      } else {
+        const int32_t settle = mpc->ambient + offset
+                               + (int32_t) (((int64_t) mpc->gain * u[j]) >> MPC_OUT_BITS);
+
+        g += MPC_TERMINAL_WEIGHT * (int64_t) mpc->gain * (settle - settle_ref);
+      }
+
+      int32_t v = u[j] - (int32_t) (g / (mpc->h[j] >> MPC_OUT_BITS));
+
+      /* Whatever the constraints leave, with every other block where it is. */
+      int32_t hi    = hi_out;
+      uint8_t bound = MPC_BOUND_CEILING;
+
+      for (unsigned p = j * MPC_BLOCK; p < MPC_HORIZON; p++) {
+        const int32_t prev  = p ? y[p - 1] : y0;
+        const int32_t dcoef = mpc->s[p][j] - (p ? mpc->s[p - 1][j] : 0);
+        int32_t       lim;
+
+        lim = mpc_bound(hi, u[j], (int64_t) max_temp - y[p], mpc->s[p][j]);
+        if (lim < hi) {
+          hi    = lim;
+          bound = MPC_BOUND_MAX_TEMP;
+        }
+
+        if (mpc->rate_max) {
+          lim = mpc_bound(hi, u[j], (int64_t) rise - (y[p] - prev), dcoef);
+          if (lim < hi) {
+            hi    = lim;
+            bound = MPC_BOUND_RATE;
+          }
+        }
+      }
+
+      /* Past a limit already, off is as close as it gets. */
+      if (hi < 0)
+        hi = 0;
+
+      if (v > hi)
+        v = hi;
+      else
+        bound = MPC_BOUND_NONE;
+
+      if (v < 0)
+        v = 0;
+
+      if (j == 0)
+        mpc->bound = bound;
+
+      for (unsigned p = j * MPC_BLOCK; p < MPC_HORIZON; p++)
+        y[p] += (int32_t) (((int64_t) mpc->s[p][j] * (v - u[j])) >> MPC_OUT_BITS);
+
+      u[j] = v;
+    }
+  }
+
+  const int32_t out = u[0] << (PWM_FINE_BITS - MPC_OUT_BITS);
+
+  mpc->head                = (mpc->head + history - 1) % history;
+  mpc->inputs[mpc->head]   = out;
+  mpc->last_setpoint       = setpoint;
+  mpc->offset              = MPC_TEMP_T(offset);
+  mpc->predicted           = MPC_TEMP_T(y[MPC_HORIZON - 1]);
+  mpc->updates++;
+
+  return out;
+}
+
+const char*
+mpc_bound_name(uint8_t bound)
+{
+  switch (bound) {
+    case MPC_BOUND_NONE:     return "none";
+    case MPC_BOUND_CEILING:  return "max_pwm";
+    case MPC_BOUND_MAX_TEMP: return "max temp";
+    case MPC_BOUND_RATE:     return "rate";
+  }
+
+  return "?";
+}
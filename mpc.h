@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "model.h"
+
+/*
+ * Model predictive control for the pilot with CONFIG_AUTO=mpc, on the
+ * first order plus dead time model fitted by model.c.
+ *
+ * Every MPC_PERIOD_MS the controller runs the model forward: through the
+ * dead time on the outputs already sent, which it can't change any more,
+ * and MPC_HORIZON periods past it on outputs it picks. Those are held
+ * over MPC_MOVES blocks of the horizon and chosen to minimise
+ *
+ *   sum (y - r)^2 + MPC_TERMINAL_WEIGHT (y_ss - r)^2 + lambda sum (du)^2
+ *
+ * y the predicted temperature, r the setpoint, y_ss where the furnace
+ * would settle on the last block's output and du the change from one
+ * block to the next, the first one from the output the heater is at.
+ * The horizon is short against the furnace's time constant, the terminal
+ * term is what ties the output to the power that holds the setpoint.
+ * Only the first block's output goes to the heater, the next period
+ * starts over from what the sensor says then.
+ *
+ * Every output stays within 0 .. ceiling, the predicted temperature below
+ * MAX_TEMP and, unless rate_max is 0, its rise below rate_max C/h.
+ *
+ * The solver is a fixed number of sweeps of projected coordinate descent:
+ * each block's output in turn goes to the minimum with the others held,
+ * then into the range the constraints leave it. The cost is a quadratic,
+ * so that is one division per block, and every constraint is linear in
+ * it. Starting from the last period's solution a few sweeps get close
+ * enough, and MPC_SWEEPS bounds the time a period takes.
+ *
+ * The model's own temperature runs along with the real one, whatever
+ * separates them (a model that is off, the thermocouple, a door left
+ * open) is taken to stay as it is over the horizon. That takes out the
+ * steady state error an integral would. A setpoint that moved since the
+ * last period is taken to keep moving that way up to target, so a ramp
+ * is anticipated instead of chased.
+ *
+ * Fixed point throughout: temperatures have MPC_TEMP_BITS fraction bits
+ * more than temp_t, block outputs are PWM levels with MPC_OUT_BITS and
+ * the decay per period has MPC_A_BITS.
+ */
+
+#define MPC_PERIOD_MS       10000
+#define MPC_HORIZON         24           /* periods past the dead time, 4 min */
+#define MPC_MOVES           4
+#define MPC_BLOCK           (MPC_HORIZON / MPC_MOVES)
+#define MPC_DELAY_MAX       48           /* periods, the model's dead times all fit */
+#define MPC_SWEEPS          4
+
+#define MPC_TEMP_BITS       8
+#define MPC_OUT_BITS        16
+#define MPC_A_BITS          30
+
+#define MPC_TERMINAL_WEIGHT 4
+#define MPC_MOVE_C          2            /* a level of change costs as much as that many C off */
+#define MPC_GAIN_MAX        TEMP_C(100)  /* per PWM level, beyond that the model is wrong */
+
+#define MPC_RATE_MAX_C_H    2000
+
+enum {
+  MPC_BOUND_NONE,
+  MPC_BOUND_CEILING,
+  MPC_BOUND_MAX_TEMP,
+  MPC_BOUND_RATE,
+};
+
+typedef struct {
+  /* The model the solver was set up for, see mpc_set_model. */
+  bool          ready;
+  model_fopdt_t model;
+  int32_t       decay;          /* 1 - e^(-period / tau), MPC_A_BITS */
+  int32_t       gain;           /* per PWM level */
+  int32_t       ambient;
+  uint8_t       delay;          /* periods */
+  int32_t       s[MPC_HORIZON][MPC_MOVES]; /* what a level on a block adds at every period */
+  int64_t       h[MPC_MOVES];   /* second derivative of the cost along a block, halved */
+
+  uint16_t      rate_max;       /* C/h, 0 is no limit */
+
+  bool          primed;
+  int32_t       x;              /* the model's temperature */
+  int32_t       inputs[MPC_DELAY_MAX + 1]; /* outputs of the last periods, newest at head */
+  uint8_t       head;
+  int32_t       moves[MPC_MOVES]; /* last solution */
+  temp_t        last_setpoint;
+  uint32_t      updates;
+
+  /* What the last period came up with, for the mpc command. */
+  temp_t        offset;         /* sensor minus model */
+  temp_t        predicted;      /* at the end of the horizon */
+  uint8_t       bound;          /* MPC_BOUND_* that held the output down */
+} mpc_t;
+
+void
+mpc_init(mpc_t* mpc);
+
+/* Sets the solver up for a model, does nothing if it has that one already. */
+void
+mpc_set_model(mpc_t* mpc, const model_fopdt_t* model);
+
+/*
+ * Starts over at temp, as if the heater had been at output (PWM_FINE_BITS)
+ * for as long as the dead time.
+ */
+void
+mpc_reset(mpc_t* mpc, temp_t temp, int32_t output);
+
+/*
+ * One period, needs a model and a reset first: setpoint, where it is
+ * heading (the end of a ramp, else setpoint itself), the temperature now
+ * and the highest output allowed. Returns the output for the next period,
+ * PWM_FINE_BITS.
+ */
+int32_t
+mpc_update(mpc_t* mpc, temp_t setpoint, temp_t target, temp_t temp, int32_t ceiling);
+
+const char*
+mpc_bound_name(uint8_t bound);
@@ -0,0 +1,152 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "burst.h"
+#include "dither.h"
+#include "check.h"
+
+/*
+ * Host test of the burst firing patterns from burst.c.
+ *
+ * Every count of half-cycles with every number of runs: the pattern has
+ * exactly that many half-cycles on, rounded down to whole cycles, every
+ * burst starts on a cycle boundary and is whole cycles long, the SSR is
+ * switched on no more than `runs` times per window (windows repeat back to
+ * back) and the cycles are spread over the window as evenly as the slots
+ * allow. Then random outputs go through dither.c the way pwm.c feeds it,
+ * and what the windows delivered has to stay within one cycle of what was
+ * asked for.
+ *
+ *   burst_test [-n windows]
+ *
+ * Exits with 1 if anything went wrong.
+ */
+
+#define FRAC_ONE ((int64_t) 1 << DITHER_FRAC_BITS)
+
+static void
+test_pattern(unsigned on, unsigned runs)
+{
+  burst_pattern_t p;
+
+  burst_pattern(&p, on, runs);
+
+  const unsigned want   = (on > BURST_HALF_CYCLES ? BURST_HALF_CYCLES : on) / 2 * 2;
+  unsigned       count  = 0;
+  unsigned       starts = 0;
+
+  for (unsigned i = 0; i < BURST_HALF_CYCLES; i++) {
+    const bool bit  = burst_bit(&p, i);
+    const bool prev = burst_bit(&p, (i + BURST_HALF_CYCLES - 1) % BURST_HALF_CYCLES);
+
+    count += bit;
+
+    if (bit && !prev) {
+      starts++;
+      CHECK(i % 2 == 0, "on %u runs %u: burst starts mid-cycle at %u", on, runs, i);
+    }
+    if (!bit && prev)
+      CHECK(i % 2 == 0, "on %u runs %u: burst ends mid-cycle at %u", on, runs, i);
+  }
+
+  CHECK(count == want, "on %u runs %u: %u half-cycles on", on, runs, count);
+  CHECK(starts <= runs, "on %u runs %u: switched on %u times", on, runs, starts);
+  CHECK((starts > 0) == (want > 0 && want < BURST_HALF_CYCLES),
+        "on %u runs %u: switched on %u times", on, runs, starts);
+
+  /* Cycles on up to the end of every slot, against a straight line. */
+  const unsigned cycles = want / 2;
+  unsigned       sofar  = 0;
+
+  for (unsigned s = 0; s < runs; s++) {
+    const unsigned begin = s * BURST_CYCLES / runs;
+    const unsigned end   = (s + 1) * BURST_CYCLES / runs;
+
+    for (unsigned c = begin; c < end; c++)
+      sofar += burst_bit(&p, 2 * c);
+
+    const double line = (double) end * cycles / BURST_CYCLES;
+
+    CHECK(sofar <= line + 1e-9 && sofar > line - 1.0,
+          "on %u runs %u: %u cycles by slot %u, %.2f expected", on, runs, sofar, s, line);
+  }
+}
+
+/* Output in half-cycles per window, DITHER_FRAC_BITS fraction bits. */
+static void
+test_dither(unsigned windows)
+{
+  dither_t dither;
+  int64_t  asked     = 0;
+  int64_t  delivered = 0;
+  uint32_t duty      = 0;
+
+  dither_reset(&dither);
+
+  for (unsigned w = 0; w < windows; w++) {
+    /* A new output every few windows, sometimes off or full power. */
+    if (w % 7 == 0) {
+      const int r = rand() % 20;
+
+      if (r == 0)
+        duty = 0;
+      else if (r == 1)
+        duty = BURST_HALF_CYCLES * FRAC_ONE;
+      else
+        duty = (uint32_t) ((uint64_t) rand() * BURST_HALF_CYCLES * FRAC_ONE / RAND_MAX);
+
+      /* Off drops what was carried, so does the sum here. */
+      if (duty == 0)
+        asked = delivered = 0;
+    }
+
+    const unsigned on = dither_next(&dither, duty, 2 * FRAC_ONE, BURST_HALF_CYCLES);
+    burst_pattern_t p;
+
+    burst_pattern(&p, on, BURST_RUNS);
+
+    for (unsigned i = 0; i < BURST_HALF_CYCLES; i++)
+      delivered += burst_bit(&p, i) * FRAC_ONE;
+    asked += duty;
+
+    CHECK(on % 2 == 0 && on <= BURST_HALF_CYCLES, "window %u: %u half-cycles", w, on);
+    CHECK(delivered <= asked && asked - delivered < 2 * FRAC_ONE,
+          "window %u: %.3f half-cycles behind", w, (double) (asked - delivered) / FRAC_ONE);
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  unsigned windows = 1000000;
+  int      opt;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n': windows = strtoul(optarg, NULL, 0); break;
+      default:
+        return 1;
+    }
+  }
+
+  srand(1);
+
+  unsigned patterns = 0;
+
+  for (unsigned runs = 1; runs <= BURST_CYCLES; runs++)
+    for (unsigned on = 0; on <= BURST_HALF_CYCLES + 2; on++, patterns++)
+      test_pattern(on, runs);
+
+  /* Out of range runs are clamped. */
+  burst_pattern_t a, b;
+  burst_pattern(&a, 40, 0);
+  burst_pattern(&b, 40, 1);
+  CHECK(a.bits[0] == b.bits[0], "runs 0 is not 1");
+
+  test_dither(windows);
+
+  printf("%u patterns, %u windows, %s\n", patterns, windows, failures ? "FAILED" : "ok");
+
+  return failures ? 1 : 0;
+}
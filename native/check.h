@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdio.h>
+
+/*
+ * Checks of the host tests: a failed one prints where and why, the first
+ * ten of them, and counts. The test exits with 1 if failures isn't 0.
+ */
+
+static unsigned failures;
+
+#define CHECK(cond, ...)                                  \
+  do {                                                    \
+    if (!(cond) && failures++ < 10) {                     \
+      fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);     \
+      fprintf(stderr, __VA_ARGS__);                       \
+      fputc('\n', stderr);                                \
+    }                                                     \
+  } while (0)
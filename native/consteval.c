@@ -1,6 +1,9 @@
+#include <math.h>
 #include <stdio.h>
 
 #include "common.h"
+#include "rtd.h"
+#include "spi_config.h"
 
 static void
 prepare(FILE* fptr)
@@ -11,7 +14,19 @@ prepare(FILE* fptr)
 static void
 calculate_status_size(FILE* fptr)
 {
-  const size_t size = snprintf(0, 0, FORMAT_STATUS_FMT, MAX_TEMP, MAX_TEMP, MAX_PWM, MAX_PWM, MAX_PWM, MAX_AUTO) + 1;
+  /* Longest temperature there is, sign and all. */
+  const temp_t temp = -TEMP_C(MAX_TEMP) - (TEMP_ONE - 1);
+  size_t       size = snprintf(0, 0, FORMAT_STATUS_FMT, TEMP_ARGS(temp), TEMP_ARGS(temp),
+                               MAX_PWM, MAX_PWM, MAX_PWM, MAX_AUTO) + 1;
+#if CONFIG_THERMO && CONFIG_PILOT
+  const temp_t rate = -TEMP_C(ESTIMATOR_RATE_MAX_C) - (TEMP_ONE - 1);
+
+  size += snprintf(0, 0, RATE_STATUS_FMT, TEMP_ARGS(rate));
+#endif
+#if CONFIG_PILOT
+  /* Minutes left are at most a ramp over the whole range at 1 C/h. */
+  size += snprintf(0, 0, PROFILE_STATUS_FMT, 255, 255, "paused", 65535);
+#endif
   fprintf(fptr, "#define FORMAT_STATUS_AUTO_PILOT_SIZE %u\n", size);
 }
 
@@ -19,7 +34,8 @@ calculate_status_size(FILE* fptr)
 static void
 calculate_mapper_size(FILE* fptr)
 {
-  const size_t size = snprintf(0, 0, MAPPER_STATUS_FMT, MAX_PWM, MAX_TEMP) + 1;
+  const temp_t temp = -TEMP_C(MAX_TEMP) - (TEMP_ONE - 1);
+  const size_t size = snprintf(0, 0, MAPPER_STATUS_FMT, MAX_PWM, TEMP_ARGS(temp)) + 1;
   fprintf(fptr, "#define MAPPER_STATUS_SIZE %u\n", size);
 }
 #endif
@@ -28,11 +44,46 @@ calculate_mapper_size(FILE* fptr)
 static void
 calculate_none_size(FILE* fptr)
 {
-  const size_t size = snprintf(0, 0, FORMAT_STATUS_AUTO_NONE, MAX_TEMP, MAX_PWM, MAX_PWM) + 1;
+  const temp_t temp = -TEMP_C(MAX_TEMP) - (TEMP_ONE - 1);
+  const size_t size = snprintf(0, 0, FORMAT_STATUS_AUTO_NONE, TEMP_ARGS(temp), MAX_PWM, MAX_PWM) + 1;
   fprintf(fptr, "#define FORMAT_STATUS_AUTO_NONE_SIZE %u\n", size);
 }
 #endif
 
+#if CONFIG_THERMO
+static void
+calculate_sensors_size(FILE* fptr)
+{
+  static const struct {
+    const char* name;
+    unsigned    cs_pin;
+  } sensors[] = { FURNACE_THERMO_SENSORS };
+
+  const temp_t temp = -TEMP_C(MAX_TEMP) - (TEMP_ONE - 1);
+  size_t       size = snprintf(0, 0, SENSOR_STATUS_PREFIX "\n") + 1;
+
+  for (unsigned i = 0; i < THERMO_SENSORS && i < sizeof(sensors) / sizeof(sensors[0]); i++)
+    size += snprintf(0, 0, SENSOR_STATUS_FMT, sensors[i].name, TEMP_ARGS(temp), "*");
+
+  fprintf(fptr, "#define SENSOR_STATUS_SIZE %u\n", size);
+}
+#endif
+
+static void
+calculate_rtd_table(FILE* fptr)
+{
+  fprintf(fptr, "\n/* temp_t at every 2^%u-th MAX31865 ADC code, see rtd.h */\n", RTD_TABLE_SHIFT);
+  fprintf(fptr, "static const temp_t rtd_table[%u] = {", RTD_TABLE_SIZE);
+
+  for (unsigned i = 0; i < RTD_TABLE_SIZE; i++) {
+    const double t = rtd_temperature(rtd_adc_resistance(i << RTD_TABLE_SHIFT));
+
+    fprintf(fptr, "%s%ld,", i % 8 ? " " : "\n  ", lround(t * TEMP_ONE));
+  }
+
+  fprintf(fptr, "\n};\n");
+}
+
 
 int
 main()
@@ -46,5 +97,9 @@ main()
 #if CONFIG_AUTO == CONFIG_AUTO_NONE
   calculate_none_size(fptr);
 #endif
+#if CONFIG_THERMO
+  calculate_sensors_size(fptr);
+#endif
+  calculate_rtd_table(fptr);
   fclose(fptr);
 }
@@ -0,0 +1,237 @@
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "common.h"
+#include "estimator.h"
+#include "sim/sim_plant.h"
+
+/*
+ * Benchmark of the temperature and rate estimator from estimator.c.
+ *
+ * Runs the furnace model from sim_plant.c from cold at full power, then
+ * through a random PWM level every ten minutes, and samples its
+ * thermocouple with noise and the MAX31856's 1/128 C resolution. Every
+ * estimator setting sees the same samples. For each it reports the time
+ * per update on this host, the temperature error left and the error of
+ * the rate, against what the noise free thermocouple does and against
+ * the chamber itself. The differences over one sample period and over a
+ * whole 21 s pilot period are there for comparison.
+ *
+ *   estimator_bench [-r rate] [-s seconds] [-n noise]
+ *
+ *   -r  samples per second (default 10, the MAX31856's pace)
+ *   -s  seconds of signal (default 36000)
+ *   -n  noise standard deviation in C (default 0.1)
+ *
+ * Exits with 1 if the default setting is further off the sensor's rate
+ * than the 21 s difference it replaces.
+ */
+
+#define BENCH_STEP_S    600
+#define BENCH_WARMUP_S  600        /* not counted, the estimators settle */
+#define BENCH_PERIOD_MS 21000      /* what the pilot differentiated over */
+#define BENCH_GAIN      9000       /* furnace model, thousandths of C/h per level */
+#define BENCH_LEVELS    50
+
+typedef struct {
+  const char*        name;
+  unsigned           diff_ms;      /* a plain difference over that long instead */
+  estimator_config_t config;
+} bench_config_t;
+
+static const bench_config_t configs[] = {
+  { "difference 21 s",       BENCH_PERIOD_MS, { 0 } },
+  { "difference 1 sample",   1,               { 0 } },
+  { "alpha 0.1",             0,               { .alpha = 100, .gain = 0 } },
+  { "alpha 0.05",            0,               { .alpha = 50,  .gain = 0 } },
+  { "alpha 0.02",            0,               { .alpha = 20,  .gain = 0 } },
+  { "alpha 0.01",            0,               { .alpha = 10,  .gain = 0 } },
+  { "alpha 0.005",           0,               { .alpha = 5,   .gain = 0 } },
+  { "alpha 0.02, gain 9",    0,               { .alpha = 20,  .gain = BENCH_GAIN } },
+  { "alpha 0.01, gain 9",    0,               { .alpha = 10,  .gain = BENCH_GAIN } },
+};
+
+typedef struct {
+  temp_t*  raw;
+  int32_t* input;   /* PWM_FINE_BITS */
+  double*  sensor;  /* noise free reading */
+  double*  chamber;
+  size_t   count;
+  uint32_t dt_ms;
+} bench_input_t;
+
+static double
+bench_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Box-Muller, good enough for test noise. */
+static double
+bench_gauss(void)
+{
+  const double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+  const double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+  return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+static bool
+bench_generate(double rate, double seconds, double noise, bench_input_t* input)
+{
+  static sim_plant_t plant;
+
+  input->count   = (size_t) (rate * seconds);
+  input->dt_ms   = (uint32_t) lround(1000.0 / rate);
+  input->raw     = calloc(input->count, sizeof(*input->raw));
+  input->input   = calloc(input->count, sizeof(*input->input));
+  input->sensor  = calloc(input->count + 1, sizeof(*input->sensor));
+  input->chamber = calloc(input->count + 1, sizeof(*input->chamber));
+
+  if (!input->raw || !input->input || !input->sensor || !input->chamber) {
+    perror("calloc");
+    return false;
+  }
+
+  srand(1);
+  sim_plant_init(&plant, &sim_plant_furnace);
+  plant.p.ssr_half_cycles = 0.0;
+
+  unsigned level = BENCH_LEVELS;
+
+  for (size_t i = 0; i <= input->count; i++) {
+    const double t_s = i / rate;
+
+    if (i && (size_t) (t_s / BENCH_STEP_S) != (size_t) ((i - 1) / rate / BENCH_STEP_S))
+      level = rand() % (BENCH_LEVELS + 1);
+
+    input->sensor[i]  = plant.sensor_c;
+    input->chamber[i] = plant.temp_c;
+
+    if (i < input->count) {
+      input->raw[i]   = (temp_t) lround((plant.sensor_c + noise * bench_gauss()) * 128)
+                      * (TEMP_ONE / 128);
+      input->input[i] = (int32_t) level << PWM_FINE_BITS;
+    }
+
+    sim_plant_advance(&plant, (double) level / BENCH_LEVELS, 1.0 / rate);
+  }
+
+  return true;
+}
+
+static bool
+bench_run(const bench_config_t* bench, const bench_input_t* input, double* limit)
+{
+  static estimator_t est;
+  const size_t       lag = bench->diff_ms / input->dt_ms ? bench->diff_ms / input->dt_ms : 1;
+  double             ns  = 0;
+  double             sum_t = 0, sum_s = 0, sum_c = 0;
+  size_t             n   = 0;
+
+  if (!bench->diff_ms) {
+    estimator_init(&est, &bench->config);
+
+    const double start = bench_now_ns();
+
+    for (size_t i = 0; i < input->count; i++)
+      estimator_update(&est, input->raw[i], input->dt_ms, input->input[i]);
+
+    ns = (bench_now_ns() - start) / input->count;
+    estimator_init(&est, &bench->config);
+  }
+
+  const double dt_s = input->dt_ms / 1000.0;
+
+  for (size_t i = 0; i < input->count; i++) {
+    double temp, rate;
+
+    if (bench->diff_ms) {
+      const size_t j = i >= lag ? i - lag : 0;
+
+      temp = (double) input->raw[i] / TEMP_ONE;
+      rate = i ? (double) (input->raw[i] - input->raw[j]) / TEMP_ONE / ((i - j) * dt_s) * 3600 : 0;
+    } else {
+      estimator_update(&est, input->raw[i], input->dt_ms, input->input[i]);
+      temp = (double) estimator_temp(&est) / TEMP_ONE;
+      rate = (double) estimator_rate(&est) / TEMP_ONE;
+    }
+
+    if (i * dt_s < BENCH_WARMUP_S)
+      continue;
+
+    /* Rates at this sample, central differences of the noise free signals. */
+    const double sensor  = (input->sensor[i + 1] - input->sensor[i - 1]) / (2 * dt_s) * 3600;
+    const double chamber = (input->chamber[i + 1] - input->chamber[i - 1]) / (2 * dt_s) * 3600;
+
+    sum_t += (temp - input->sensor[i]) * (temp - input->sensor[i]);
+    sum_s += (rate - sensor) * (rate - sensor);
+    sum_c += (rate - chamber) * (rate - chamber);
+    n++;
+  }
+
+  const double err_s  = sqrt(sum_s / n);
+  const bool   normal = !bench->diff_ms && bench->config.alpha == ESTIMATOR_ALPHA && !bench->config.gain;
+  const bool   ok     = !normal || err_s <= *limit;
+
+  if (bench->diff_ms == BENCH_PERIOD_MS)
+    *limit = err_s;
+
+  printf("%-22s %6.1f ns  temp %6.3f C  rate vs sensor %7.2f C/h  vs chamber %7.2f C/h  %s\n",
+         bench->name, ns, sqrt(sum_t / n), err_s, sqrt(sum_c / n),
+         !normal ? "" : ok ? "default, ok" : "default, FAILED");
+
+  return ok;
+}
+
+int
+main(int argc, char** argv)
+{
+  double        rate    = 10;
+  double        seconds = 36000;
+  double        noise   = 0.1;
+  double        limit   = INFINITY;
+  bench_input_t input;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "r:s:n:")) != -1) {
+    switch (opt) {
+      case 'r': rate    = strtod(optarg, NULL); break;
+      case 's': seconds = strtod(optarg, NULL); break;
+      case 'n': noise   = strtod(optarg, NULL); break;
+      default:
+        return 1;
+    }
+  }
+
+  if (rate <= 0 || rate > 1000 || seconds < 2 * BENCH_WARMUP_S) {
+    fprintf(stderr, "needs a rate up to 1000 Hz and at least %u s of signal\n", 2 * BENCH_WARMUP_S);
+    return 1;
+  }
+
+  if (!bench_generate(rate, seconds, noise, &input))
+    return 1;
+
+  printf("%zu samples at %.0f Hz, noise %.2f C, furnace model, a new PWM level every %u s\n",
+         input.count, rate, noise, BENCH_STEP_S);
+
+  bool ok = true;
+
+  for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++)
+    ok &= bench_run(&configs[i], &input, &limit);
+
+  free(input.raw);
+  free(input.input);
+  free(input.sensor);
+  free(input.chamber);
+
+  return ok ? 0 : 1;
+}
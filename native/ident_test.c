@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ident.h"
+#include "check.h"
+
+/*
+ * Host test of the PRBS run from ident.c.
+ *
+ * The sequence repeats after IDENT_PRBS_LENGTH bits and not before, has
+ * one more 1 than 0s, runs of at most IDENT_PRBS_ORDER equal bits, and
+ * the two-valued autocorrelation of a maximal length sequence: -1 at
+ * every shift but 0. Bits come every bit_ms, a late call catches up on
+ * the ones it missed. The levels stay within 0 .. ceiling around the
+ * operating point, and the log fills up sample by sample until the run
+ * is done.
+ *
+ *   ident_test
+ *
+ * Exits with 1 if anything went wrong.
+ */
+
+#define TEST_BIT_MS 1000
+
+static ident_t ident;
+
+static void
+test_sequence(void)
+{
+  static int seq[2 * IDENT_PRBS_LENGTH];
+  const int32_t low  = 2 * PWM_FINE_ONE;
+  const int32_t high = 8 * PWM_FINE_ONE;
+
+  ident_start(&ident, 5 * PWM_FINE_ONE, 3 * PWM_FINE_ONE, 10 * PWM_FINE_ONE, TEST_BIT_MS, 100, 0);
+
+  for (unsigned i = 0; i < 2 * IDENT_PRBS_LENGTH; i++) {
+    const int32_t out = ident_update(&ident, i * TEST_BIT_MS + TEST_BIT_MS / 2);
+
+    CHECK(out == low || out == high, "bit %u: output %d", i, (int) out);
+    seq[i] = out == high ? 1 : -1;
+  }
+
+  CHECK(ident.bits == 2 * IDENT_PRBS_LENGTH, "%u bits clocked out", (unsigned) ident.bits);
+
+  int      sum  = 0;
+  unsigned run  = 0;
+  unsigned runs[2] = { 0, 0 };
+
+  for (unsigned i = 0; i < IDENT_PRBS_LENGTH; i++) {
+    CHECK(seq[i] == seq[i + IDENT_PRBS_LENGTH], "not periodic at bit %u", i);
+    sum += seq[i];
+
+    run = i && seq[i] == seq[i - 1] ? run + 1 : 1;
+    if (run > runs[seq[i] > 0])
+      runs[seq[i] > 0] = run;
+  }
+
+  CHECK(sum == 1, "%d more 1s than 0s", sum);
+  CHECK(runs[1] == IDENT_PRBS_ORDER && runs[0] == IDENT_PRBS_ORDER - 1,
+        "longest runs %u ones, %u zeros", runs[1], runs[0]);
+
+  for (unsigned shift = 1; shift < IDENT_PRBS_LENGTH; shift++) {
+    int corr = 0;
+
+    for (unsigned i = 0; i < IDENT_PRBS_LENGTH; i++)
+      corr += seq[i] * seq[i + shift];
+
+    CHECK(corr == -1, "autocorrelation %d at shift %u", corr, shift);
+  }
+
+  /* Five and a half bits late: five more bits, the sixth starts half a bit later. */
+  const uint32_t bits = ident.bits;
+  const uint32_t now  = ident.bit_at_ms + 5 * TEST_BIT_MS + TEST_BIT_MS / 2;
+
+  ident_update(&ident, now);
+  CHECK(ident.bits == bits + 5, "caught up %u bits", (unsigned) (ident.bits - bits));
+  CHECK(now - ident.bit_at_ms == TEST_BIT_MS / 2, "bit started %u ms ago",
+        (unsigned) (now - ident.bit_at_ms));
+}
+
+static void
+test_levels(int base, int amplitude, int ceiling, int low, int high)
+{
+  ident_start(&ident, base * PWM_FINE_ONE, amplitude * PWM_FINE_ONE, ceiling * PWM_FINE_ONE,
+              TEST_BIT_MS, 100, 0);
+
+  if (low == high) {
+    CHECK(ident.state == IDENT_FAILED, "base %d amplitude %d ceiling %d: %s",
+          base, amplitude, ceiling, ident_state_name(ident.state));
+    return;
+  }
+
+  CHECK(ident.state == IDENT_RUNNING && ident.low == low * PWM_FINE_ONE && ident.high == high * PWM_FINE_ONE,
+        "base %d amplitude %d ceiling %d: %s between %d and %d, want %d and %d",
+        base, amplitude, ceiling, ident_state_name(ident.state),
+        (int) (ident.low >> PWM_FINE_BITS), (int) (ident.high >> PWM_FINE_BITS), low, high);
+}
+
+static void
+test_log(void)
+{
+  ident_start(&ident, 10 * PWM_FINE_ONE, 5 * PWM_FINE_ONE, 50 * PWM_FINE_ONE, TEST_BIT_MS, 100, 0);
+
+  for (unsigned i = 0; i < IDENT_SAMPLES; i++) {
+    CHECK(ident.state == IDENT_RUNNING, "%s after %u samples", ident_state_name(ident.state), i);
+    ident_record(&ident, TEMP_C(700) + (temp_t) i, ident_update(&ident, i * 100) + PWM_FINE_ONE / 4);
+  }
+
+  CHECK(ident.state == IDENT_DONE && ident.count == IDENT_SAMPLES, "%s with %u samples",
+        ident_state_name(ident.state), (unsigned) ident.count);
+
+  ident_record(&ident, 0, 0);
+  CHECK(ident.count == IDENT_SAMPLES, "recorded past the end");
+
+  for (unsigned i = 0; i < IDENT_SAMPLES; i++) {
+    const int32_t input = (int32_t) ident.inputs[i] << (PWM_FINE_BITS - IDENT_INPUT_BITS);
+
+    CHECK(ident.temps[i] == TEMP_C(700) + (temp_t) i, "sample %u: temp", i);
+    CHECK(input == 5 * PWM_FINE_ONE + PWM_FINE_ONE / 4 || input == 15 * PWM_FINE_ONE + PWM_FINE_ONE / 4,
+          "sample %u: input " PWM_FINE_FMT, i, PWM_FINE_ARGS(input));
+  }
+
+  /* Stopped halfway, the log keeps what it got. */
+  ident_start(&ident, 10 * PWM_FINE_ONE, 5 * PWM_FINE_ONE, 50 * PWM_FINE_ONE, TEST_BIT_MS, 100, 0);
+  CHECK(ident.count == 0, "log not cleared");
+
+  for (unsigned i = 0; i < 100; i++)
+    ident_record(&ident, TEMP_C(700), ident_update(&ident, i * 100));
+
+  ident_stop(&ident);
+  ident_record(&ident, TEMP_C(700), 0);
+  CHECK(ident.state == IDENT_IDLE && ident.count == 100, "%s with %u samples after a stop",
+        ident_state_name(ident.state), (unsigned) ident.count);
+}
+
+int
+main(void)
+{
+  test_sequence();
+
+  test_levels(10, 4, 50, 6, 14);
+  test_levels(10, 4, 12, 6, 12);
+  test_levels(20, 4, 12, 8, 12);
+  test_levels(2, 4, 50, 0, 6);
+  test_levels(0, 3, 0, 0, 0);
+
+  test_log();
+
+  printf("%u bit sequence, levels and a log of %u samples: %s\n",
+         IDENT_PRBS_LENGTH, IDENT_SAMPLES, failures ? "FAILED" : "ok");
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,167 @@
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "model.h"
+#include "sim/sim_plant.h"
+
+/*
+ * Test of the online model identification from model.c.
+ *
+ * Runs the furnace model from sim_plant.c, linearised around an
+ * operating point so that there is one right answer, through a random
+ * PWM level every TEST_STEP_S and feeds model_update the way the firmware
+ * does, once every MODEL_PERIOD_MS. Halfway through the element loses a
+ * fifth of its power, the way an ageing one does. At the end of each half
+ * the identified gain and time constant are compared with the plant's,
+ * and the dead time with what the transport delay and the thermocouple's
+ * lag add up to. Last the model goes through what flash keeps of it.
+ *
+ * Holding one temperature with small steps around it doesn't do: the
+ * time constant only shows in how the furnace moves over a wide range,
+ * and the forgetting would take a and c anywhere along the line that
+ * still predicts the next step.
+ *
+ *   model_test [-t temp] [-s hours] [-n noise]
+ *
+ *   -t  operating point in C (default 700)
+ *   -s  hours per half (default 8)
+ *   -n  noise standard deviation of the reading in C (default 0.1)
+ *
+ * Exits with 1 if the model is off by more than the tolerances below.
+ */
+
+#define TEST_STEP_S      900
+#define TEST_AGEING      0.8      /* power left in the second half */
+#define TEST_GAIN_TOL    0.15
+#define TEST_TAU_TOL     0.25
+#define TEST_DEAD_MIN_S  10
+#define TEST_DEAD_MAX_S  70
+
+/* Box-Muller, good enough for test noise. */
+static double
+test_gauss(void)
+{
+  const double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+  const double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+  return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/* Heat loss per kelvin at temp_c, radiation included. */
+static double
+test_conductance(const sim_plant_params_t* p, double temp_c)
+{
+  const double t = temp_c + 273.15;
+
+  return p->loss_wk + 4.0 * p->radiation_wk4 * t * t * t;
+}
+
+static bool
+test_check(const char* name, const sim_plant_params_t* p, const model_t* model)
+{
+  model_fopdt_t fit;
+
+  if (!model_get(model, &fit)) {
+    printf("%s: no model after %u updates  FAILED\n", name, (unsigned) model->updates);
+    return false;
+  }
+
+  const double gain  = p->heater_power_w / MAX_PWM / p->loss_wk;
+  const double tau   = p->thermal_mass_jk / p->loss_wk;
+  const double got_g = (double) fit.gain / TEMP_ONE;
+
+  const bool ok = fabs(got_g / gain - 1) <= TEST_GAIN_TOL && fabs(fit.tau_s / tau - 1) <= TEST_TAU_TOL
+               && fit.dead_s >= TEST_DEAD_MIN_S && fit.dead_s <= TEST_DEAD_MAX_S;
+
+  printf("%s: gain %.2f C/level (plant %.2f), tau %u s (plant %.0f), dead time %u s, "
+         "ambient %.0f C (plant %.0f), error %.3f C  %s\n",
+         name, got_g, gain, (unsigned) fit.tau_s, tau, (unsigned) fit.dead_s,
+         (double) fit.ambient / TEMP_ONE, p->ambient_c, (double) model_error(model) / TEMP_ONE,
+         ok ? "ok" : "FAILED");
+
+  return ok;
+}
+
+int
+main(int argc, char** argv)
+{
+  static sim_plant_t plant;
+  static model_t     model;
+  static model_t     restored;
+  model_params_t     saved;
+  double             temp_c = 700;
+  double             hours  = 8;
+  double             noise  = 0.1;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "t:s:n:")) != -1) {
+    switch (opt) {
+      case 't': temp_c = strtod(optarg, NULL); break;
+      case 's': hours  = strtod(optarg, NULL); break;
+      case 'n': noise  = strtod(optarg, NULL); break;
+      default:
+        return 1;
+    }
+  }
+
+  srand(1);
+
+  /*
+   * The tangent to the furnace's losses at temp_c: the same loss per
+   * kelvin there, and an ambient that puts the same loss through it.
+   */
+  sim_plant_params_t params = sim_plant_furnace;
+  const double       t      = temp_c + 273.15;
+  const double       ta     = params.ambient_c + 273.15;
+  const double       losses = params.loss_wk * (temp_c - params.ambient_c)
+                            + params.radiation_wk4 * (t * t * t * t - ta * ta * ta * ta);
+
+  params.ssr_half_cycles = 0.0;
+  params.loss_wk         = test_conductance(&params, temp_c);
+  params.radiation_wk4   = 0.0;
+  params.ambient_c       = temp_c - losses / params.loss_wk;
+
+  sim_plant_init(&plant, &params);
+  plant.temp_c = plant.sensor_c = temp_c;
+  for (unsigned i = 0; i <= plant.delay_len; i++)
+    plant.delay[i] = temp_c;
+
+  model_init(&model, MODEL_MEMORY_MIN);
+
+  printf("furnace model linearised at %.0f C, a new PWM level every %u s, %.0f h per half, noise %.2f C\n",
+         temp_c, TEST_STEP_S, hours, noise);
+
+  const unsigned periods  = (unsigned) (hours * 3600 * 1000 / MODEL_PERIOD_MS);
+  const unsigned per_step = TEST_STEP_S * 1000 / MODEL_PERIOD_MS;
+  int            level    = 0;
+  bool           ok       = true;
+
+  for (unsigned half = 0; half < 2; half++) {
+    if (half)
+      plant.p.heater_power_w *= TEST_AGEING;
+
+    for (unsigned k = 0; k < periods; k++) {
+      if (k % per_step == 0)
+        level = rand() % (MAX_PWM + 1);
+
+      sim_plant_advance(&plant, (double) level / MAX_PWM, MODEL_PERIOD_MS / 1000.0);
+
+      const double reading = sim_plant_reading(&plant) + noise * test_gauss();
+
+      model_update(&model, (temp_t) lround(reading * TEMP_ONE), level << PWM_FINE_BITS);
+    }
+
+    ok &= test_check(half ? "aged" : "new", &plant.p, &model);
+  }
+
+  /* What comes back from flash after a restart. */
+  model_save(&model, &saved);
+  model_restore(&restored, &saved);
+  ok &= test_check("restored", &plant.p, &restored);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,227 @@
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "common.h"
+#include "mpc.h"
+#include "sim/sim_plant.h"
+
+/*
+ * Benchmark of the model predictive pilot from mpc.c.
+ *
+ * Runs the MPC in closed loop with the furnace model from sim_plant.c,
+ * from cold, through a few setpoint programs: steps, ramps and a heating
+ * rate limit. It is given a first order plus dead time model like the one
+ * model.c learns on that furnace, with the gain off by a factor to see
+ * what a wrong model does. For every program it reports the time one
+ * period's solve takes on this host, mean and worst, and how the
+ * thermocouple followed: time to come within 5 C of the end temperature,
+ * overshoot, how far it lagged a ramp and the fastest it heated over a
+ * minute. Every solve is timed on BENCH_REPEAT copies of the controller
+ * and the fastest counts, so the worst case is the solver's and not the
+ * host scheduler's.
+ *
+ *   mpc_bench [-h hours] [-g factor] [-n noise]
+ *
+ *   -h  simulated hours per program (default 8)
+ *   -g  the model's gain against the furnace's (default 1)
+ *   -n  thermocouple noise, standard deviation in C (default 0.1)
+ *
+ * Exits with 1 if the thermocouple went more than 5 C past a setpoint,
+ * or heated more than a tenth faster than a rate limit. With the gain
+ * far enough off that happens, it only holds for a model that fits.
+ */
+
+#define BENCH_BAND_C       5.0
+#define BENCH_RATE_SLACK   1.1
+#define BENCH_RATE_WINDOW  6          /* periods, a minute */
+#define BENCH_REPEAT       8
+
+/* What model.c comes up with on the furnace model. */
+#define BENCH_MODEL_GAIN_C 24.8
+#define BENCH_MODEL_TAU_S  10250
+#define BENCH_MODEL_DEAD_S 60
+#define BENCH_MODEL_AMB_C  80.0
+
+typedef struct {
+  const char* name;
+  double      to_c;
+  double      ramp_c_h;  /* the setpoint moves at that rate from where the furnace is, 0 steps */
+  uint16_t    rate_max;  /* of the MPC, C/h */
+} bench_program_t;
+
+static const bench_program_t programs[] = {
+  { "step to 700",              700,  0,   0   },
+  { "step to 700, rate 150",    700,  0,   150 },
+  { "ramp 150 C/h to 900",      900,  150, 0   },
+  { "ramp 300 C/h to 600",      600,  300, 0   },
+  { "step to 1090",             1090, 0,   0   },
+};
+
+static double
+bench_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Box-Muller, good enough for test noise. */
+static double
+bench_gauss(void)
+{
+  const double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+  const double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+  return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+static bool
+bench_run(const bench_program_t* program, double hours, double gain_factor, double noise)
+{
+  static sim_plant_t plant;
+  static mpc_t       mpc;
+  static mpc_t       copy;
+
+  const model_fopdt_t model = {
+    .gain    = (int32_t) lround(BENCH_MODEL_GAIN_C * gain_factor * TEMP_ONE),
+    .tau_s   = BENCH_MODEL_TAU_S,
+    .dead_s  = BENCH_MODEL_DEAD_S,
+    .ambient = TEMP_C(BENCH_MODEL_AMB_C),
+  };
+
+  const unsigned periods = (unsigned) (hours * 3600 * 1000 / MPC_PERIOD_MS);
+  const double   dt_s    = MPC_PERIOD_MS / 1000.0;
+  double         window[BENCH_RATE_WINDOW] = { 0 };
+  double         ns_sum  = 0, ns_max = 0;
+  double         setpoint = 0;
+  double         lag_sum  = 0;
+  unsigned       lag_n    = 0;
+  double         over     = 0;
+  double         rate_max = 0;
+  double         settled_s = -1;
+
+  srand(1);
+  sim_plant_init(&plant, &sim_plant_furnace);
+  plant.p.ssr_half_cycles = 0.0;
+
+  mpc_init(&mpc);
+  mpc.rate_max = program->rate_max;
+  mpc_set_model(&mpc, &model);
+  mpc_reset(&mpc, TEMP_C(plant.sensor_c), 0);
+
+  setpoint = program->ramp_c_h ? plant.sensor_c : program->to_c;
+
+  for (unsigned i = 0; i < periods; i++) {
+    const temp_t temp = (temp_t) lround((plant.sensor_c + noise * bench_gauss()) * TEMP_ONE);
+
+    if (program->ramp_c_h) {
+      setpoint += program->ramp_c_h * dt_s / 3600;
+      if (setpoint > program->to_c)
+        setpoint = program->to_c;
+
+      if (setpoint < program->to_c) {
+        lag_sum += setpoint - plant.sensor_c;
+        lag_n++;
+      }
+    }
+
+    const temp_t  sp      = (temp_t) lround(setpoint * TEMP_ONE);
+    const int32_t ceiling = (int32_t) MAX_PWM << PWM_FINE_BITS;
+    double        ns      = INFINITY;
+
+    for (unsigned k = 0; k < BENCH_REPEAT; k++) {
+      copy = mpc;
+
+      const double start = bench_now_ns();
+
+      mpc_update(&copy, sp, TEMP_C(program->to_c), temp, ceiling);
+
+      const double spent = bench_now_ns() - start;
+
+      if (spent < ns)
+        ns = spent;
+    }
+
+    const int32_t out = mpc_update(&mpc, sp, TEMP_C(program->to_c), temp, ceiling);
+
+    ns_sum += ns;
+    if (ns > ns_max)
+      ns_max = ns;
+
+    sim_plant_advance(&plant, (double) out / ceiling, dt_s);
+
+    /* Fastest rise over a minute, once the window is full. */
+    const double oldest = window[i % BENCH_RATE_WINDOW];
+
+    window[i % BENCH_RATE_WINDOW] = plant.sensor_c;
+    if (i >= BENCH_RATE_WINDOW) {
+      const double rate = (plant.sensor_c - oldest) / (BENCH_RATE_WINDOW * dt_s) * 3600;
+
+      if (rate > rate_max)
+        rate_max = rate;
+    }
+
+    if (plant.sensor_c - setpoint > over)
+      over = plant.sensor_c - setpoint;
+
+    if (fabs(plant.sensor_c - program->to_c) > BENCH_BAND_C)
+      settled_s = -1;
+    else if (settled_s < 0)
+      settled_s = (i + 1) * dt_s;
+  }
+
+  const bool ok = over <= BENCH_BAND_C
+                  && (!program->rate_max || rate_max <= program->rate_max * BENCH_RATE_SLACK);
+
+  char settled[16] = "never";
+
+  if (settled_s >= 0)
+    snprintf(settled, sizeof(settled), "%5.1f min", settled_s / 60);
+
+  printf("%-24s %6.0f ns, max %6.0f ns  settled %9s  overshoot %5.2f C  ramp lag %5.2f C"
+         "  max rate %5.0f C/h  %s\n",
+         program->name, ns_sum / periods, ns_max, settled, over,
+         lag_n ? lag_sum / lag_n : 0.0, rate_max, ok ? "ok" : "FAILED");
+
+  return ok;
+}
+
+int
+main(int argc, char** argv)
+{
+  double hours       = 8;
+  double gain_factor = 1;
+  double noise       = 0.1;
+  int    opt;
+
+  while ((opt = getopt(argc, argv, "h:g:n:")) != -1) {
+    switch (opt) {
+      case 'h': hours       = strtod(optarg, NULL); break;
+      case 'g': gain_factor = strtod(optarg, NULL); break;
+      case 'n': noise       = strtod(optarg, NULL); break;
+      default:
+        return 1;
+    }
+  }
+
+  if (hours <= 0 || gain_factor <= 0) {
+    fprintf(stderr, "needs some hours and a positive gain factor\n");
+    return 1;
+  }
+
+  printf("%u s periods, %u past the dead time in %u blocks, %u sweeps, model gain x%.2f, noise %.2f C\n",
+         MPC_PERIOD_MS / 1000, MPC_HORIZON, MPC_MOVES, MPC_SWEEPS, gain_factor, noise);
+
+  bool ok = true;
+
+  for (size_t i = 0; i < sizeof(programs) / sizeof(programs[0]); i++)
+    ok &= bench_run(&programs[i], hours, gain_factor, noise);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,230 @@
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "preheat.h"
+#include "sim/sim_plant.h"
+#include "check.h"
+
+/*
+ * Test of the preheat from preheat.c.
+ *
+ * First the run on made up temperatures: jumps too small don't start
+ * one, a steady climb coasts where it is a dead time and a period short
+ * of the setpoint, into the band, the watch for overshoot, and a run cut
+ * short at full power. The power that holds a setpoint comes from the
+ * model within 0 .. ceiling.
+ *
+ * Then the furnace model from sim_plant.c goes up a few jumps with the
+ * preheat and nothing else: full power, and at the coast point the
+ * power that holds the setpoint on a first order plus dead time model
+ * like the one model.c learns on it. Time to setpoint has to be within
+ * a dead time of what full power all the way takes into the band, the
+ * bound nothing that stops on the setpoint gets below, and the
+ * thermocouple must not go past the setpoint by more than the band over
+ * the watch.
+ *
+ *   preheat_test [-n noise]
+ *
+ *   -n  thermocouple noise, standard deviation in C (default 0)
+ *
+ * Exits with 1 if anything went wrong.
+ */
+
+#define TEST_RATE_WINDOW 10        /* periods the rate is taken over */
+#define TEST_SETTLE_S    200000    /* about 20 time constants */
+
+/* What model.c comes up with on the furnace model. */
+#define TEST_MODEL_GAIN_C 24.8
+#define TEST_MODEL_TAU_S  10250
+#define TEST_MODEL_DEAD_S 60
+#define TEST_MODEL_AMB_C  80.0
+
+static const model_fopdt_t model = {
+  .gain    = (int32_t) (TEST_MODEL_GAIN_C * TEMP_ONE),
+  .tau_s   = TEST_MODEL_TAU_S,
+  .dead_s  = TEST_MODEL_DEAD_S,
+  .ambient = TEMP_C(TEST_MODEL_AMB_C),
+};
+
+static preheat_t preheat;
+
+static void
+test_run(void)
+{
+  CHECK(!preheat_start(&preheat, TEMP_C(700), TEMP_C(700) - PREHEAT_JUMP + 1, PREHEAT_BAND, true, 0),
+        "started on a small jump");
+  CHECK(!preheat_start(&preheat, TEMP_C(20), TEMP_C(700), PREHEAT_BAND, true, 0), "started going down");
+
+  /* 0.1 C a second and a minute ahead with the period: coasts 6 C short, in the band 10 s later. */
+  const int32_t  rate   = TEMP_C(360);
+  const uint32_t dead_s = 60 - PREHEAT_PERIOD_MS / 1000;
+
+  CHECK(preheat_start(&preheat, TEMP_C(700), TEMP_C(500), PREHEAT_BAND, true, 1000), "no run");
+
+  unsigned coast_s = 0, reached_s = 0, done_s = 0;
+
+  for (unsigned s = 1; s < 4000 && !done_s; s++) {
+    const temp_t  temp  = s < 2000 ? TEMP_C(500) + (temp_t) s * TEMP_ONE / 10 : TEMP_C(700);
+    const uint8_t state = preheat.state;
+    const uint8_t event = preheat_update(&preheat, temp, rate, dead_s, 1000 + s * 1000);
+
+    if (event == PREHEAT_EVENT_COAST)
+      coast_s = s;
+    if (state != PREHEAT_WATCH && preheat.state == PREHEAT_WATCH)
+      reached_s = s;
+    if (event == PREHEAT_EVENT_DONE)
+      done_s = s;
+  }
+
+  CHECK(coast_s == 1940 && preheat.boost_ms == coast_s * 1000, "coasted after %u s, %u ms at full power",
+        coast_s, (unsigned) preheat.boost_ms);
+  CHECK(reached_s == 1950 && preheat.reached_ms == reached_s * 1000, "reached after %u s, %u ms",
+        reached_s, (unsigned) preheat.reached_ms);
+  CHECK(done_s == reached_s + PREHEAT_WATCH_MS / 1000 && preheat.state == PREHEAT_DONE,
+        "%s after %u s", preheat_state_name(preheat.state), done_s);
+  CHECK(preheat.peak == TEMP_C(700) && preheat.from == TEMP_C(500), "peak " TEMP_FMT " from " TEMP_FMT,
+        TEMP_ARGS(preheat.peak), TEMP_ARGS(preheat.from));
+  CHECK(preheat_update(&preheat, TEMP_C(800), rate, dead_s, 10000000) == PREHEAT_EVENT_NONE
+        && preheat.peak == TEMP_C(700), "updated once done");
+
+  /* Cut short at full power, and a run without it that never gets there. */
+  preheat_start(&preheat, TEMP_C(700), TEMP_C(20), PREHEAT_BAND, true, 0);
+  preheat_update(&preheat, TEMP_C(100), rate, dead_s, 60000);
+  CHECK(preheat_stop(&preheat) && preheat.state == PREHEAT_DONE && preheat.boost_ms == 60000
+        && preheat.reached_ms == PREHEAT_NEVER, "%s after %u ms at full power",
+        preheat_state_name(preheat.state), (unsigned) preheat.boost_ms);
+  CHECK(!preheat_stop(&preheat), "stopped twice");
+
+  preheat_start(&preheat, TEMP_C(700), TEMP_C(20), PREHEAT_BAND, false, 0);
+  CHECK(preheat.state == PREHEAT_APPROACH, "%s without boost", preheat_state_name(preheat.state));
+  CHECK(preheat_update(&preheat, TEMP_C(690), rate, dead_s, 1000) == PREHEAT_EVENT_NONE,
+        "coasted without boost");
+  CHECK(preheat_stop(&preheat) && preheat.boost_ms == 0, "%u ms at full power", (unsigned) preheat.boost_ms);
+}
+
+static void
+test_hold(void)
+{
+  const int32_t ceiling = MAX_PWM * PWM_FINE_ONE;
+  const int32_t out     = preheat_hold(&model, TEMP_C(700), ceiling);
+  const double  want    = (700 - TEST_MODEL_AMB_C) / TEST_MODEL_GAIN_C;
+
+  CHECK(fabs((double) out / PWM_FINE_ONE - want) < 0.01, "holds 700 C at " PWM_FINE_FMT, PWM_FINE_ARGS(out));
+  CHECK(preheat_hold(&model, TEMP_C(20), ceiling) == 0, "below ambient");
+  CHECK(preheat_hold(&model, TEMP_C(700), 10 * PWM_FINE_ONE) == 10 * PWM_FINE_ONE, "past the ceiling");
+}
+
+/* The furnace model settled at temp_c, on the duty that holds it there. */
+static void
+sim_settle(sim_plant_t* plant, double temp_c)
+{
+  double lo = 0, hi = 1;
+
+  while (hi - lo > 1e-6) {
+    const double mid = (lo + hi) / 2;
+
+    if (sim_plant_equilibrium(&sim_plant_furnace, mid) < temp_c)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  sim_plant_init(plant, &sim_plant_furnace);
+  plant->p.ssr_half_cycles = 0.0;
+
+  for (unsigned i = 0; i < TEST_SETTLE_S; i++)
+    sim_plant_advance(plant, lo, 1.0);
+}
+
+/* Seconds full power takes from from into the band below to. */
+static unsigned
+sim_full_power(double from, double to, double band)
+{
+  static sim_plant_t plant;
+  unsigned           s = 0;
+
+  sim_settle(&plant, from);
+
+  while (plant.sensor_c < to - band) {
+    sim_plant_advance(&plant, 1.0, 1.0);
+    s++;
+  }
+
+  return s;
+}
+
+static void
+test_furnace(double from, double to, double noise)
+{
+  static sim_plant_t plant;
+  double             window[TEST_RATE_WINDOW];
+  const int32_t      ceiling = MAX_PWM * PWM_FINE_ONE;
+  int32_t            out     = ceiling;
+  const double       band    = (double) PREHEAT_BAND / TEMP_ONE;
+
+  sim_settle(&plant, from);
+
+  for (unsigned i = 0; i < TEST_RATE_WINDOW; i++)
+    window[i] = plant.sensor_c;
+
+  preheat_start(&preheat, TEMP_C(to), (temp_t) lround(plant.sensor_c * TEMP_ONE), PREHEAT_BAND, true, 0);
+
+  for (unsigned s = 1; preheat_active(&preheat) && s < 100000; s++) {
+    sim_plant_advance(&plant, (double) out / ceiling, PREHEAT_PERIOD_MS / 1000.0);
+
+    const double  reading = plant.sensor_c + noise * ((rand() + 0.5) / RAND_MAX - 0.5) * sqrt(12);
+    const double  oldest  = window[s % TEST_RATE_WINDOW];
+    const int32_t rate    = (int32_t) lround((reading - oldest) * 3600 / TEST_RATE_WINDOW * TEMP_ONE);
+
+    window[s % TEST_RATE_WINDOW] = reading;
+
+    if (preheat_update(&preheat, (temp_t) lround(reading * TEMP_ONE), rate, model.dead_s, s * PREHEAT_PERIOD_MS)
+        == PREHEAT_EVENT_COAST)
+      out = preheat_hold(&model, preheat.setpoint, ceiling);
+  }
+
+  const unsigned fastest_s = sim_full_power(from, to, band);
+  const double   over      = (double) (preheat.peak - preheat.setpoint) / TEMP_ONE;
+
+  printf("%4.0f to %4.0f C: in the band after %5.1f min, full power %5.1f min, fastest %5.1f min,"
+         " %5.2f C over\n",
+         from, to, preheat.reached_ms / 60000.0, preheat.boost_ms / 60000.0, fastest_s / 60.0,
+         over > 0 ? over : 0);
+
+  CHECK(preheat.state == PREHEAT_DONE && preheat.reached_ms != PREHEAT_NEVER, "%.0f to %.0f C: %s",
+        from, to, preheat_state_name(preheat.state));
+  CHECK(preheat.reached_ms <= (fastest_s + model.dead_s) * 1000u, "%.0f to %.0f C: %u s, full power takes %u s",
+        from, to, (unsigned) (preheat.reached_ms / 1000), fastest_s);
+  CHECK(over <= band, "%.0f to %.0f C: %.2f C over", from, to, over);
+}
+
+int
+main(int argc, char** argv)
+{
+  double noise = 0;
+  int    opt;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n': noise = strtod(optarg, NULL); break;
+      default:
+        return 1;
+    }
+  }
+
+  srand(1);
+
+  test_run();
+  test_hold();
+
+  test_furnace(25, 700, noise);
+  test_furnace(300, 800, noise);
+  test_furnace(600, 750, noise);
+
+  printf("run, hold and %u jumps of the furnace model: %s\n", 3, failures ? "FAILED" : "ok");
+
+  return failures ? 1 : 0;
+}
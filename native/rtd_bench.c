@@ -0,0 +1,143 @@
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "common.h"
+#include "rtd.h"
+#include CONSTEVAL_HEADER
+
+/*
+ * Benchmark of the MAX31865 conversion from ADC code to temperature.
+ *
+ * Compares the float formula the driver used to evaluate on every sample
+ * with the rtd_table lookup generated by consteval: time per conversion on
+ * this host and the worst error against the exact Callendar-Van Dusen
+ * curve, over every ADC code between -200 C and 850 C.
+ *
+ * The RP2040 emulates floats in software, so the gap on the board is much
+ * wider than the one measured here.
+ *
+ *   rtd_bench [-r rounds]
+ *
+ *   -r  passes over the ADC range for the timing (default 200)
+ *
+ * Exits with 1 if the table is off by more than 2/256 C anywhere.
+ */
+
+#define BENCH_MIN_C -200.0
+#define BENCH_MAX_C  850.0
+
+typedef struct {
+  const char* name;
+  temp_t      (*convert)(uint32_t adc);
+} bench_method_t;
+
+/* What max31865.h did before the table, single precision with a double sqrt. */
+static temp_t
+convert_float(uint32_t adc)
+{
+  const float r_rtd = ((float)(adc * R_REF) / (MAX_ADC_VALUE)) - CASUAL_WIRE_RES;
+  const float temperature_f = (sqrt(Z2 + Z3*r_rtd) + Z1)/Z4;
+
+  return (temp_t) lroundf(temperature_f * TEMP_ONE);
+}
+
+static temp_t
+convert_table(uint32_t adc)
+{
+  return rtd_lookup(rtd_table, adc);
+}
+
+static const bench_method_t methods[] = {
+  { "float formula", convert_float },
+  { "rtd_table",     convert_table },
+};
+
+static double
+bench_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static inline uint64_t
+bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  return 0;
+#endif
+}
+
+int
+main(int argc, char** argv)
+{
+  unsigned rounds = 200;
+  int      opt;
+
+  while ((opt = getopt(argc, argv, "r:")) != -1) {
+    switch (opt) {
+      case 'r': rounds = strtoul(optarg, NULL, 0); break;
+      default:
+        return 1;
+    }
+  }
+
+  const uint32_t first = (uint32_t) ceil((rtd_resistance(BENCH_MIN_C) + CASUAL_WIRE_RES)
+                                         * MAX_ADC_VALUE / R_REF);
+  const uint32_t last  = (uint32_t) floor((rtd_resistance(BENCH_MAX_C) + CASUAL_WIRE_RES)
+                                          * MAX_ADC_VALUE / R_REF);
+  const uint32_t zero  = (uint32_t) ceil((RTD_NOMINAL + CASUAL_WIRE_RES) * MAX_ADC_VALUE / R_REF);
+  bool ok = true;
+
+  printf("ADC codes %u..%u (%.0f C..%.0f C), %u rounds\n\n",
+         first, last, BENCH_MIN_C, BENCH_MAX_C, rounds);
+  printf("%-14s %9s %9s %13s %13s\n",
+         "method", "ns/conv", "cyc/conv", "max err <0 C", "max err >=0 C");
+
+  for (size_t m = 0; m < sizeof(methods) / sizeof(methods[0]); m++) {
+    const bench_method_t* method = &methods[m];
+    double err_below = 0.0, err_above = 0.0;
+
+    for (uint32_t adc = first; adc <= last; adc++) {
+      const double exact = rtd_temperature(rtd_adc_resistance(adc));
+      const double err   = fabs((double) method->convert(adc) / TEMP_ONE - exact);
+
+      if (adc < zero) {
+        if (err > err_below)
+          err_below = err;
+      } else if (err > err_above) {
+        err_above = err;
+      }
+    }
+
+    volatile temp_t sink = 0;
+    const double    start_ns     = bench_now_ns();
+    const uint64_t  start_cycles = bench_cycles();
+
+    for (unsigned r = 0; r < rounds; r++)
+      for (uint32_t adc = first; adc <= last; adc++)
+        sink += method->convert(adc);
+
+    const uint64_t cycles = bench_cycles() - start_cycles;
+    const double   ns     = bench_now_ns() - start_ns;
+    const double   n      = (double) rounds * (last - first + 1);
+
+    (void) sink;
+
+    printf("%-14s %9.2f %9.1f %11.4f C %11.4f C\n",
+           method->name, ns / n, cycles / n, err_below, err_above);
+
+    if (method->convert == convert_table && fmax(err_below, err_above) > 2.0 / TEMP_ONE)
+      ok = false;
+  }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,232 @@
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "common.h"
+#include "sample.h"
+
+/*
+ * Benchmark of the sample pipeline from sample.c.
+ *
+ * Feeds a synthetic thermocouple signal through the pipeline in several
+ * configurations of the sample command: a 1 C/s ramp with white noise,
+ * occasional spikes and a 30 C step halfway through. For every
+ * configuration it reports the time per sample on this host, how far the
+ * output lags the ramp, the noise left on the output, the spikes that got
+ * through and how long the step took to show up.
+ *
+ *   sample_bench [-r rate] [-s seconds] [-n noise] [-p spikes]
+ *
+ *   -r  samples per second (default 50, the MAX31865's pace)
+ *   -s  seconds of signal (default 1000)
+ *   -n  noise standard deviation in C (default 0.5)
+ *   -p  spike probability per sample (default 0.01)
+ *
+ * Exits with 1 if a configuration with outlier rejection let a spike
+ * through, or one missed the step.
+ */
+
+#define BENCH_SLOPE     1.0  /* C/s */
+#define BENCH_SPIKE     60.0 /* C */
+#define BENCH_STEP      30.0 /* C */
+#define BENCH_TOLERANCE 5.0  /* C off the lag corrected truth is a spike */
+
+typedef struct {
+  const char*     name;
+  sample_config_t config;
+} bench_config_t;
+
+static const bench_config_t configs[] = {
+  { "raw",                { .median = 1, .ema_shift = 0, .decimate = 1,  .reject = 0         } },
+  { "median 3",           { .median = 3, .ema_shift = 0, .decimate = 1,  .reject = 0         } },
+  { "median 5",           { .median = 5, .ema_shift = 0, .decimate = 1,  .reject = 0         } },
+  { "reject 5",           { .median = 3, .ema_shift = 0, .decimate = 1,  .reject = TEMP_C(5) } },
+  { "reject 5, ema 2",    { .median = 3, .ema_shift = 2, .decimate = 1,  .reject = TEMP_C(5) } },
+  { "median 5, ema 3",    { .median = 5, .ema_shift = 3, .decimate = 1,  .reject = TEMP_C(5) } },
+  { "ema 4, decimate 10", { .median = 1, .ema_shift = 4, .decimate = 10, .reject = 0         } },
+};
+
+typedef struct {
+  double rate;
+  double seconds;
+  double noise;
+  double spikes;
+} bench_signal_t;
+
+typedef struct {
+  temp_t* raw;
+  double* truth;
+  size_t  count;
+  size_t  step_at;
+} bench_input_t;
+
+static double
+bench_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Box-Muller, good enough for test noise. */
+static double
+bench_gauss(void)
+{
+  const double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+  const double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+  return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+static bool
+bench_generate(const bench_signal_t* signal, bench_input_t* input)
+{
+  input->count   = (size_t) (signal->rate * signal->seconds);
+  input->step_at = input->count / 2;
+  input->raw     = calloc(input->count, sizeof(*input->raw));
+  input->truth   = calloc(input->count, sizeof(*input->truth));
+
+  if (!input->raw || !input->truth) {
+    perror("calloc");
+    return false;
+  }
+
+  srand(1);
+
+  for (size_t i = 0; i < input->count; i++) {
+    double t = 20.0 + BENCH_SLOPE * i / signal->rate;
+
+    if (i >= input->step_at)
+      t += BENCH_STEP;
+
+    double v = t + signal->noise * bench_gauss();
+
+    if (rand() < signal->spikes * RAND_MAX)
+      v += rand() & 1 ? BENCH_SPIKE : -BENCH_SPIKE;
+
+    input->truth[i] = t;
+    input->raw[i]   = (temp_t) lround(v * TEMP_ONE);
+  }
+
+  return true;
+}
+
+static bool
+bench_run(const bench_config_t* bench, const bench_signal_t* signal, const bench_input_t* input)
+{
+  static temp_t     out[1 << 20];
+  static bool       valid[1 << 20];
+  sample_pipeline_t pipe;
+
+  if (input->count > sizeof(out) / sizeof(out[0])) {
+    fprintf(stderr, "too many samples\n");
+    return false;
+  }
+
+  sample_pipeline_init(&pipe, &bench->config);
+
+  const double start = bench_now_ns();
+
+  for (size_t i = 0; i < input->count; i++)
+    valid[i] = sample_pipeline_push(&pipe, input->raw[i], &out[i]);
+
+  const double ns = (bench_now_ns() - start) / input->count;
+
+  /* Mean error on the ramp is the lag, what is left around it is noise. */
+  const size_t settle = (size_t) (2 * signal->rate);
+  double sum = 0, sum2 = 0;
+  size_t n   = 0;
+
+  for (size_t i = settle; i < input->count; i++) {
+    if (!valid[i] || (i >= input->step_at && i < input->step_at + settle))
+      continue;
+
+    const double err = input->truth[i] - (double) out[i] / TEMP_ONE;
+
+    sum += err;
+    n++;
+  }
+
+  const double lag = n ? sum / n : 0;
+  size_t passed    = 0;
+
+  for (size_t i = settle; i < input->count; i++) {
+    if (!valid[i] || (i >= input->step_at && i < input->step_at + settle))
+      continue;
+
+    const double err = input->truth[i] - (double) out[i] / TEMP_ONE - lag;
+
+    sum2 += err * err;
+    if (fabs(err) > BENCH_TOLERANCE)
+      passed++;
+  }
+
+  /* Step shows up once the output is past its middle. */
+  const double half = input->truth[input->step_at - 1] + BENCH_STEP / 2;
+  long step_ms      = -1;
+
+  for (size_t i = input->step_at; i < input->count; i++) {
+    if (valid[i] && (double) out[i] / TEMP_ONE > half) {
+      step_ms = lround((i - input->step_at) * 1000.0 / signal->rate);
+      break;
+    }
+  }
+
+  const bool ok = !bench->config.reject || (passed == 0 && step_ms >= 0);
+
+  printf("%-20s %6.1f ns  lag %7.1f ms  noise %6.3f C  spikes %5zu  step %6ld ms  rejected %5u  %s\n",
+         bench->name, ns, lag / BENCH_SLOPE * 1000.0, n ? sqrt(sum2 / n) : 0,
+         passed, step_ms, (unsigned) pipe.rejected, ok ? "ok" : "FAILED");
+
+  return ok;
+}
+
+int
+main(int argc, char** argv)
+{
+  bench_signal_t signal = {
+    .rate    = 50,
+    .seconds = 1000,
+    .noise   = 0.5,
+    .spikes  = 0.01,
+  };
+  bench_input_t input;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "r:s:n:p:")) != -1) {
+    switch (opt) {
+      case 'r': signal.rate    = strtod(optarg, NULL); break;
+      case 's': signal.seconds = strtod(optarg, NULL); break;
+      case 'n': signal.noise   = strtod(optarg, NULL); break;
+      case 'p': signal.spikes  = strtod(optarg, NULL); break;
+      default:
+        return 1;
+    }
+  }
+
+  if (signal.rate <= 0 || signal.seconds * signal.rate < 10 * signal.rate) {
+    fprintf(stderr, "needs a positive rate and at least 10 s of signal\n");
+    return 1;
+  }
+
+  if (!bench_generate(&signal, &input))
+    return 1;
+
+  printf("%zu samples at %.0f Hz, noise %.2f C, spikes %.1f%%\n",
+         input.count, signal.rate, signal.noise, signal.spikes * 100);
+
+  bool ok = true;
+
+  for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++)
+    ok &= bench_run(&configs[i], &signal, &input);
+
+  free(input.raw);
+  free(input.truth);
+
+  return ok ? 0 : 1;
+}
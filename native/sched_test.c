@@ -0,0 +1,207 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pico/time.h"
+
+#include "scheduler.h"
+#include "sim.h"
+#include "check.h"
+
+/*
+ * Host test of the deadline scheduler from scheduler.c, on the virtual
+ * clock.
+ *
+ * A refresh asks every task exactly once and leaves each one on the
+ * deadline it answered, in a heap again: no parent after its children and
+ * every heap_index where the task is. The head is the earliest deadline.
+ * First the case where a parent and its earliest child both move in one
+ * refresh, then rounds of random deadlines for every number of tasks.
+ *
+ * A run calls every task that is due once, earliest first, and none that
+ * isn't.
+ *
+ *   sched_test [-n rounds]
+ *
+ *   -n  random refreshes per number of tasks (default 10000)
+ *
+ * Exits with 1 if anything went wrong.
+ */
+
+#define TEST_TASKS SCHED_MAX_TASKS
+
+static absolute_time_t want[TEST_TASKS];  /* what next() answers */
+static unsigned        asked[TEST_TASKS]; /* next() calls */
+static unsigned        ran[TEST_TASKS];   /* order of the last run, 0 if it didn't */
+static unsigned        run_count;
+
+#define TEST_TASK(n)                                                        \
+  static absolute_time_t test_next_##n(void* arg) { (void) arg; asked[n]++; return want[n]; } \
+  static void            test_work_##n(void* arg) { (void) arg; ran[n] = ++run_count; }
+
+TEST_TASK(0)  TEST_TASK(1)  TEST_TASK(2)  TEST_TASK(3)
+TEST_TASK(4)  TEST_TASK(5)  TEST_TASK(6)  TEST_TASK(7)
+TEST_TASK(8)  TEST_TASK(9)  TEST_TASK(10) TEST_TASK(11)
+
+#define TEST_ENTRY(n) { .name = #n, .next = test_next_##n, .work = test_work_##n }
+
+static const sched_task_t templates[TEST_TASKS] = {
+  TEST_ENTRY(0), TEST_ENTRY(1), TEST_ENTRY(2),  TEST_ENTRY(3),
+  TEST_ENTRY(4), TEST_ENTRY(5), TEST_ENTRY(6),  TEST_ENTRY(7),
+  TEST_ENTRY(8), TEST_ENTRY(9), TEST_ENTRY(10), TEST_ENTRY(11),
+};
+
+_Static_assert(sizeof(templates) / sizeof(templates[0]) == TEST_TASKS, "one template per task");
+
+static scheduler_t  sched;
+static sched_task_t tasks[TEST_TASKS];
+
+static void
+test_setup(unsigned count)
+{
+  sched_init(&sched);
+
+  for (unsigned i = 0; i < count; i++) {
+    tasks[i] = templates[i];
+    sched_add(&sched, &tasks[i], NULL);
+  }
+}
+
+/* Every task asked once since the counts were cleared, on its answer, in a heap. */
+static void
+test_check(unsigned count, const char* what)
+{
+  absolute_time_t earliest = at_the_end_of_time;
+
+  for (unsigned i = 0; i < count; i++) {
+    CHECK(asked[i] == 1, "%s: task %u asked %u times", what, i, asked[i]);
+    CHECK(tasks[i].deadline == want[i], "%s: task %u on %llu, answered %llu", what, i,
+          (unsigned long long) tasks[i].deadline, (unsigned long long) want[i]);
+
+    if (want[i] < earliest)
+      earliest = want[i];
+  }
+
+  for (unsigned i = 0; i < sched.count; i++) {
+    CHECK(sched.heap[i]->heap_index == i, "%s: task %s at %u says %u", what, sched.heap[i]->name, i,
+          sched.heap[i]->heap_index);
+    CHECK(i == 0 || sched.heap[(i - 1) / 2]->deadline <= sched.heap[i]->deadline,
+          "%s: %s before its parent %s", what, sched.heap[i]->name, sched.heap[(i - 1) / 2]->name);
+  }
+
+  CHECK(sched_next_deadline(&sched) == earliest, "%s: head on %llu, earliest %llu", what,
+        (unsigned long long) sched_next_deadline(&sched), (unsigned long long) earliest);
+}
+
+static void
+test_refresh(unsigned count)
+{
+  for (unsigned i = 0; i < count; i++)
+    asked[i] = 0;
+
+  sched_refresh(&sched, NULL);
+}
+
+/* The root and its earliest child both move, the child to the front. */
+static void
+test_parent_and_child(void)
+{
+  want[0] = 100;
+  want[1] = 101;
+  want[2] = 200;
+  test_setup(3);
+
+  want[0] = 300;
+  want[1] = 1;
+  test_refresh(3);
+  test_check(3, "parent and child");
+}
+
+static void
+test_random(unsigned count, unsigned rounds)
+{
+  for (unsigned i = 0; i < count; i++)
+    want[i] = rand() % 1000;
+  test_setup(count);
+
+  for (unsigned round = 0; round < rounds; round++) {
+    /* Some keep their deadline, some park, the rest move anywhere. */
+    for (unsigned i = 0; i < count; i++) {
+      const int dice = rand() % 8;
+
+      if (dice == 0)
+        want[i] = at_the_end_of_time;
+      else if (dice > 2)
+        want[i] = rand() % 1000;
+    }
+
+    test_refresh(count);
+    test_check(count, "random");
+  }
+}
+
+static void
+test_run(void)
+{
+  const absolute_time_t now = get_absolute_time();
+
+  for (unsigned i = 0; i < TEST_TASKS; i++) {
+    want[i] = i % 3 == 0 ? at_the_end_of_time : now - 1 - (i * 7) % 5;
+    ran[i]  = 0;
+  }
+  want[1] = now + 1000;
+  run_count = 0;
+
+  test_setup(TEST_TASKS);
+  CHECK(sched_run(&sched, NULL), "nothing ran");
+
+  for (unsigned i = 0; i < TEST_TASKS; i++) {
+    const bool due = want[i] < now;
+
+    CHECK(due == (ran[i] != 0), "task %u %s", i, due ? "didn't run" : "ran");
+
+    for (unsigned j = 0; j < TEST_TASKS && due; j++)
+      CHECK(!ran[j] || want[j] >= want[i] || ran[j] < ran[i], "task %u ran before the earlier %u", i, j);
+  }
+
+  /* Parked by the run, the refresh after it puts them back on their answer. */
+  for (unsigned i = 0; i < TEST_TASKS; i++)
+    CHECK(tasks[i].deadline == want[i], "task %u on %llu after the run", i,
+          (unsigned long long) tasks[i].deadline);
+
+  for (unsigned i = 0; i < TEST_TASKS; i++)
+    want[i] = at_the_end_of_time;
+  sched_refresh(&sched, NULL);
+  CHECK(!sched_run(&sched, NULL), "ran with nothing due");
+}
+
+int
+main(int argc, char** argv)
+{
+  unsigned rounds = 10000;
+  int      opt;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n': rounds = strtoul(optarg, NULL, 0); break;
+      default:
+        return 1;
+    }
+  }
+
+  sim_time_use_virtual();
+  sim_time_advance_us(1000000);
+  srand(1);
+
+  test_parent_and_child();
+
+  for (unsigned count = 1; count <= TEST_TASKS; count++)
+    test_random(count, rounds);
+
+  test_run();
+
+  printf("refresh of 1 to %u tasks, %u rounds each, and a run: %s\n", TEST_TASKS, rounds,
+         failures ? "FAILED" : "ok");
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,401 @@
+#include <getopt.h>
+#include <math.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pico/time.h"
+
+#include "common.h"
+#include "sim.h"
+
+/*
+ * Closed loop benchmark of the furnace controllers.
+ *
+ * Runs the unmodified firmware against a sim_plant.c model on the virtual
+ * clock, drives it through the stdio console exactly like an operator would,
+ * and scores the response of the chamber temperature. Heater power is taken
+ * as delivered, averaged over each second, since pwm.c dithers it from one
+ * PWM period to the next.
+ *
+ *   bench_control [-p plant] [-t temp | -m] [-a | -r] [-s temp] [-d hours]
+ *                 [-q quantum_ms] [-b band] [-n noise] [-c command]...
+ *
+ *   -p  plant model from sim_plant.c (default furnace)
+ *   -t  setpoint for the pilot (default 700)
+ *   -m  run the mapper instead of the pilot
+ *   -a  autotune around the setpoint first, the pilot takes over from it
+ *   -r  run the firing program set up with -c "profile add ...", scored
+ *       against -t as the temperature it ends at
+ *   -s  moves the setpoint to temp halfway through, settling and errors are
+ *       judged against it from then on, times still count from the start
+ *   -d  simulated duration in hours (default 6)
+ *   -q  virtual time spent per main loop pass in ms (default 10)
+ *   -b  settling band in degrees (default 5)
+ *   -n  thermocouple noise, standard deviation in degrees (default 0)
+ *   -c  console command to run before the start, e.g. "pid kp 2.5"
+ */
+
+int furnace_main(void);
+
+#define BENCH_SAMPLE_US     1000000u
+#define BENCH_MAX_MAP_STEPS 256
+#define BENCH_CHURN_SAMPLES 60     /* one minute */
+#define BENCH_DUTY_CHANGE   0.001  /* between two minutes, counts as a change */
+
+typedef struct {
+  double duty;
+  double temp_c;
+  double equilibrium_c;
+  double at_s;
+} bench_map_step_t;
+
+typedef struct {
+  const sim_plant_params_t* params;
+  bool                      mapper;
+  bool                      autotune;
+  bool                      profile;
+  bool                      queried;
+  bool                      modeled;
+  double                    target_c;
+  double                    step_c;   /* -s, 0 for none */
+  double                    stepped_from_c;
+  double                    band_c;
+  uint64_t                  start_us;
+  uint64_t                  end_us;
+  uint64_t                  next_sample_us;
+  uint64_t                  passes;
+
+  double                    max_c;
+  double                    min_c;    /* since the step */
+  double                    last_out_of_band_s;
+  bool                      entered_band;
+  double                    final_err_sum;
+  unsigned                  final_err_n;
+
+  /* Delivered heater power over full power, integrated per sample. */
+  uint64_t                  last_hook_us;
+  double                    duty_s;
+
+  double                    churn_sum;
+  unsigned                  churn_n;
+  unsigned                  pwm_changes;
+  double                    pwm_travel;
+  double                    last_duty;
+
+  unsigned                  map_level;
+  double                    map_duty_s;
+  double                    map_since_s;
+
+  bench_map_step_t          steps[BENCH_MAX_MAP_STEPS];
+  unsigned                  step_count;
+
+  jmp_buf                   done;
+} bench_t;
+
+static void
+bench_sample(bench_t* b, double t_s)
+{
+  const sim_plant_t* plant = sim_board_plant();
+  const double       temp  = plant->temp_c;
+  const double       span  = (b->end_us - b->start_us) * 1e-6;
+
+  if (temp > b->max_c)
+    b->max_c = temp;
+  if (temp < b->min_c)
+    b->min_c = temp;
+
+  if (fabs(temp - b->target_c) > b->band_c)
+    b->last_out_of_band_s = t_s;
+  else
+    b->entered_band = true;
+
+  /* Steady state error is judged over the last fifth of the run. */
+  if (t_s >= 0.8 * span) {
+    b->final_err_sum += fabs(temp - b->target_c);
+    b->final_err_n++;
+  }
+}
+
+/*
+ * The heater is dithered from one PWM period to the next, so it is judged
+ * by the power it actually got, averaged over a second: that is exact for
+ * the whole levels the mapper steps through. Churn of the controller
+ * output is counted over minutes.
+ */
+static void
+bench_track_pwm(bench_t* b, double t_s, double duty)
+{
+  const unsigned level = lround(duty * MAX_PWM);
+
+  /* The mapper only ever steps up, remember where each level ended. */
+  if (b->mapper && level > b->map_level && b->step_count < BENCH_MAX_MAP_STEPS) {
+    bench_map_step_t*  step   = &b->steps[b->step_count++];
+    sim_plant_params_t smooth = *b->params;
+
+    /* What the level delivered on average, dither or SSR rounding. */
+    step->duty = t_s > b->map_since_s ? b->map_duty_s / (t_s - b->map_since_s) : 0.0;
+    smooth.ssr_half_cycles = 0.0;
+
+    step->temp_c        = sim_board_plant()->sensor_c;
+    step->equilibrium_c = sim_plant_equilibrium(&smooth, step->duty);
+    step->at_s          = t_s;
+
+    b->map_level   = level;
+    b->map_duty_s  = 0.0;
+    b->map_since_s = t_s;
+  }
+
+  b->map_duty_s += duty * BENCH_SAMPLE_US * 1e-6;
+
+  b->churn_sum += duty;
+
+  if (++b->churn_n < BENCH_CHURN_SAMPLES)
+    return;
+
+  const double mean = b->churn_sum / b->churn_n;
+
+  if (fabs(mean - b->last_duty) >= BENCH_DUTY_CHANGE)
+    b->pwm_changes++;
+
+  b->pwm_travel += fabs(mean - b->last_duty);
+  b->last_duty   = mean;
+  b->churn_sum   = 0.0;
+  b->churn_n     = 0;
+}
+
+static void
+bench_hook(void* arg)
+{
+  bench_t*       b   = arg;
+  const uint64_t now = time_us_64();
+  const double   t_s = (now - b->start_us) * 1e-6;
+
+  b->passes++;
+
+  b->duty_s += sim_board_plant()->power_w / b->params->heater_power_w
+             * (now - b->last_hook_us) * 1e-6;
+  b->last_hook_us = now;
+
+  if (now >= b->next_sample_us) {
+    bench_track_pwm(b, t_s, b->duty_s * 1e6 / BENCH_SAMPLE_US);
+    b->duty_s = 0.0;
+
+    bench_sample(b, t_s);
+    b->next_sample_us += BENCH_SAMPLE_US;
+  }
+
+  /* What the autotune came up with, printed by the firmware itself. */
+  if (b->autotune && !b->queried && now + 2 * BENCH_SAMPLE_US >= b->end_us) {
+    sim_stdio_inject("autotune\npid\n");
+    b->queried = true;
+  }
+
+  /* Same for the table the mapper recorded. */
+  if (b->mapper && !b->queried && now + 2 * BENCH_SAMPLE_US >= b->end_us) {
+    sim_stdio_inject("map\n");
+    b->queried = true;
+  }
+
+  /* Settled on the first setpoint or not, the second one starts now. */
+  if (b->step_c > 0 && now >= b->start_us + (b->end_us - b->start_us) / 2) {
+    char cmd[32];
+    snprintf(cmd, sizeof(cmd), "temp %.0f\n", b->step_c);
+    sim_stdio_inject(cmd);
+
+    b->stepped_from_c = b->target_c;
+    b->target_c       = b->step_c;
+    b->step_c         = 0;
+    b->entered_band   = false;
+    b->max_c          = sim_board_plant()->temp_c;
+    b->min_c          = b->max_c;
+  }
+
+  if (b->profile && !b->queried && now + 2 * BENCH_SAMPLE_US >= b->end_us) {
+    sim_stdio_inject("profile\n");
+    b->queried = true;
+  }
+
+#if CONFIG_THERMO
+  /* And the model it learned along the way, whatever ran. */
+  if (!b->modeled && now + 2 * BENCH_SAMPLE_US >= b->end_us) {
+    sim_stdio_inject("model\n");
+# if CONFIG_AUTO == CONFIG_AUTO_MPC
+    sim_stdio_inject("mpc\n");
+# endif
+    b->modeled = true;
+  }
+#endif
+
+  if (now >= b->end_us)
+    longjmp(b->done, 1);
+}
+
+static void
+bench_report(const bench_t* b, double wall_s)
+{
+  const double hours = (b->end_us - b->start_us) * 1e-6 / 3600.0;
+  const sim_plant_t* plant = sim_board_plant();
+
+  printf("\n");
+  printf("plant            %s\n", b->params->name);
+  if (b->mapper)
+    printf("mode             mapper\n");
+  else if (b->autotune)
+    printf("mode             autotune, then pilot, setpoint %.0f C\n", b->target_c);
+  else if (b->profile)
+    printf("mode             profile, ending at %.0f C\n", b->target_c);
+  else if (b->stepped_from_c > 0)
+    printf("mode             pilot, setpoint %.0f C, then %.0f C\n", b->stepped_from_c, b->target_c);
+  else
+    printf("mode             pilot, setpoint %.0f C\n", b->target_c);
+  printf("simulated        %.2f h in %.2f s (%.0fx real time)\n",
+         hours, wall_s, hours * 3600.0 / wall_s);
+  printf("loop passes      %llu\n", (unsigned long long) b->passes);
+
+  if (!b->mapper) {
+    /* Settled means staying in the band for at least the last fifth. */
+    if (b->entered_band && b->last_out_of_band_s < 0.8 * hours * 3600.0)
+      printf("settling time    %.1f min (+-%.0f C)\n", b->last_out_of_band_s / 60.0, b->band_c);
+    else
+      printf("settling time    not settled (+-%.0f C)\n", b->band_c);
+
+    /* Past the setpoint in the direction it moved. */
+    if (b->stepped_from_c > b->target_c)
+      printf("overshoot        %.1f C\n", b->min_c < b->target_c ? b->target_c - b->min_c : 0.0);
+    else
+      printf("overshoot        %.1f C\n", b->max_c > b->target_c ? b->max_c - b->target_c : 0.0);
+    printf("steady error     %.2f C mean abs over last %.0f min\n",
+           b->final_err_n ? b->final_err_sum / b->final_err_n : 0.0, hours * 60.0 * 0.2);
+  }
+
+  printf("pwm changes      %u (%.1f/h), travel %.1f%%/h, per minute\n",
+         b->pwm_changes, b->pwm_changes / hours, 100.0 * b->pwm_travel / hours);
+  printf("final            %.1f C chamber, %.1f C sensor, duty %.1f%%\n",
+         plant->temp_c, plant->sensor_c, 100.0 * b->last_duty);
+  printf("energy           %.2f kWh\n", plant->energy_j / 3.6e6);
+
+  if (b->mapper) {
+    printf("\n  duty     recorded  equilibrium     error  at\n");
+    for (unsigned i = 0; i < b->step_count; i++) {
+      const bench_map_step_t* s = &b->steps[i];
+      printf("  %5.1f%%  %8.1f C  %9.1f C  %7.1f C  %.1f min\n",
+             100.0 * s->duty, s->temp_c, s->equilibrium_c,
+             s->temp_c - s->equilibrium_c, s->at_s / 60.0);
+    }
+  }
+}
+
+static double
+wall_clock_s(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int
+main(int argc, char** argv)
+{
+  static bench_t b;
+  sim_plant_params_t params = sim_plant_furnace;
+  double hours = 6.0, quantum_ms = 10.0;
+  int opt;
+
+  b.target_c = 700.0;
+  b.band_c   = 5.0;
+
+  char commands[1024] = "";
+
+  while ((opt = getopt(argc, argv, "p:t:mars:d:q:b:n:c:")) != -1) {
+    switch (opt) {
+      case 'p': {
+        const sim_plant_params_t* found = sim_plant_find(optarg);
+        if (!found) {
+          fprintf(stderr, "unknown plant '%s'\n", optarg);
+          return 1;
+        }
+        const double noise = params.noise_c;
+        params = *found;
+        params.noise_c = noise;
+      } break;
+      case 't': b.target_c  = atof(optarg); break;
+      case 'm': b.mapper    = true;         break;
+      case 'a': b.autotune  = true;         break;
+      case 'r': b.profile   = true;         break;
+      case 's': b.step_c    = atof(optarg); break;
+      case 'd': hours       = atof(optarg); break;
+      case 'q': quantum_ms  = atof(optarg); break;
+      case 'b': b.band_c    = atof(optarg); break;
+      case 'n': params.noise_c = atof(optarg); break;
+      case 'c':
+        if (strlen(commands) + strlen(optarg) + 2 > sizeof(commands)) {
+          fprintf(stderr, "too many commands\n");
+          return 1;
+        }
+        strcat(commands, optarg);
+        strcat(commands, "\n");
+        break;
+      default:
+        return 1;
+    }
+  }
+
+#if CONFIG_AUTO == CONFIG_AUTO_NONE
+  fprintf(stderr, "built with CONFIG_AUTO=none, there is no controller to benchmark\n");
+  return 1;
+#else
+# if CONFIG_AUTO != CONFIG_AUTO_MAPPER
+  if (b.mapper) {
+    fprintf(stderr, "the mapper needs CONFIG_AUTO=mapper\n");
+    return 1;
+  }
+# endif
+
+  b.params = &params;
+
+  sim_time_use_virtual();
+  sim_board_set_quantum_us((uint64_t) (quantum_ms * 1000.0));
+  sim_board_use_plant(&params);
+  sim_stdio_detach_host();
+  sim_stdio_inject(commands);
+
+  if (b.mapper) {
+    sim_stdio_inject("map 1\n");
+  } else if (b.autotune) {
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "autotune %.0f\n", b.target_c);
+    sim_stdio_inject(cmd);
+  } else if (b.profile) {
+    sim_stdio_inject("profile start\n");
+  } else {
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "temp %.0f\nauto 1\n", b.target_c);
+    sim_stdio_inject(cmd);
+  }
+
+  b.start_us       = time_us_64();
+  b.end_us         = b.start_us + (uint64_t) (hours * 3600.0 * 1e6);
+  b.next_sample_us = b.start_us;
+  b.last_hook_us   = b.start_us;
+  b.max_c          = params.ambient_c;
+  b.min_c          = params.ambient_c;
+
+  const double wall_start = wall_clock_s();
+
+  sim_board_set_hook(bench_hook, &b);
+
+  if (!setjmp(b.done))
+    furnace_main();
+
+  sim_board_set_hook(NULL, NULL);
+
+  bench_report(&b, wall_clock_s() - wall_start);
+
+  return 0;
+#endif
+}
@@ -0,0 +1,6 @@
+/*
+ * The firmware with its entry point renamed, for host programs that bring
+ * up the simulated board themselves before handing control to it.
+ */
+#define main furnace_main
+#include "furnace.c"
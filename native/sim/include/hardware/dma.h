@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "pico/types.h"
+
+/*
+ * DMA channels. Only the paced transfers between memory and an SPI data
+ * register are simulated, see sim_dma.c.
+ */
+
+#define NUM_DMA_CHANNELS 12
+
+enum dma_channel_transfer_size {
+  DMA_SIZE_8  = 0,
+  DMA_SIZE_16 = 1,
+  DMA_SIZE_32 = 2,
+};
+
+typedef struct {
+  bool read_increment;
+  bool write_increment;
+  uint dreq;
+  enum dma_channel_transfer_size size;
+} dma_channel_config;
+
+int  dma_claim_unused_channel(bool required);
+void dma_channel_unclaim(uint channel);
+
+dma_channel_config dma_channel_get_default_config(uint channel);
+
+static inline void
+channel_config_set_transfer_data_size(dma_channel_config* c, enum dma_channel_transfer_size size)
+{
+  c->size = size;
+}
+
+static inline void
+channel_config_set_dreq(dma_channel_config* c, uint dreq)
+{
+  c->dreq = dreq;
+}
+
+static inline void
+channel_config_set_read_increment(dma_channel_config* c, bool incr)
+{
+  c->read_increment = incr;
+}
+
+static inline void
+channel_config_set_write_increment(dma_channel_config* c, bool incr)
+{
+  c->write_increment = incr;
+}
+
+void dma_channel_configure(uint                      channel,
+                           const dma_channel_config* config,
+                           volatile void*            write_addr,
+                           const volatile void*      read_addr,
+                           uint                      transfer_count,
+                           bool                      trigger);
+
+void dma_channel_set_read_addr(uint channel, const volatile void* read_addr, bool trigger);
+void dma_channel_set_write_addr(uint channel, volatile void* write_addr, bool trigger);
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger);
+void dma_start_channel_mask(uint32_t chan_mask);
+bool dma_channel_is_busy(uint channel);
+void dma_channel_wait_for_finish_blocking(uint channel);
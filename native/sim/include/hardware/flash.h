@@ -0,0 +1,18 @@
+#pragma once
+
+#include "pico/types.h"
+
+#define FLASH_PAGE_SIZE   (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+
+/*
+ * The simulated flash only backs the FLASH_CONFIG region of memmap.ld.
+ * Its XIP window is wherever the host placed it, offsets are computed
+ * by the firmware the same way as on target: (uint32_t) ptr - XIP_BASE.
+ */
+extern uint8_t sim_flash_xip[];
+
+#define XIP_BASE ((uint32_t) (uintptr_t) sim_flash_xip)
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t* data, size_t count);
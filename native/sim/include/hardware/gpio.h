@@ -0,0 +1,43 @@
+#pragma once
+
+#include "pico/types.h"
+#include "hardware/platform_defs.h"
+
+#define GPIO_OUT 1
+#define GPIO_IN  0
+
+enum gpio_function {
+  GPIO_FUNC_XIP  = 0,
+  GPIO_FUNC_SPI  = 1,
+  GPIO_FUNC_UART = 2,
+  GPIO_FUNC_I2C  = 3,
+  GPIO_FUNC_PWM  = 4,
+  GPIO_FUNC_SIO  = 5,
+  GPIO_FUNC_PIO0 = 6,
+  GPIO_FUNC_PIO1 = 7,
+  GPIO_FUNC_GPCK = 8,
+  GPIO_FUNC_USB  = 9,
+  GPIO_FUNC_NULL = 0x1f,
+};
+
+enum gpio_irq_level {
+  GPIO_IRQ_LEVEL_LOW  = 0x1u,
+  GPIO_IRQ_LEVEL_HIGH = 0x2u,
+  GPIO_IRQ_EDGE_FALL  = 0x4u,
+  GPIO_IRQ_EDGE_RISE  = 0x8u,
+};
+
+typedef void (*gpio_irq_callback_t)(uint gpio, uint32_t event_mask);
+
+void gpio_init(uint gpio);
+void gpio_set_function(uint gpio, enum gpio_function fn);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_pull_up(uint gpio);
+void gpio_put(uint gpio, bool value);
+bool gpio_get(uint gpio);
+
+/* Only edge events are simulated, delivered on the core that enabled them. */
+void gpio_set_irq_enabled_with_callback(uint                gpio,
+                                        uint32_t            event_mask,
+                                        bool                enabled,
+                                        gpio_irq_callback_t callback);
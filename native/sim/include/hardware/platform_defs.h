@@ -0,0 +1,6 @@
+#pragma once
+
+#define SYS_CLK_KHZ 125000
+
+#define NUM_BANK0_GPIOS 30
+#define NUM_PWM_SLICES  8
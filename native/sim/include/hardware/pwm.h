@@ -0,0 +1,59 @@
+#pragma once
+
+#include "pico/types.h"
+#include "hardware/gpio.h"
+
+enum pwm_clkdiv_mode {
+  PWM_DIV_FREE_RUNNING = 0,
+  PWM_DIV_B_HIGH       = 1,
+  PWM_DIV_B_RISING     = 2,
+  PWM_DIV_B_FALLING    = 3,
+};
+
+typedef struct {
+  uint32_t csr;
+  uint32_t div;
+  uint32_t top;
+} pwm_config;
+
+static inline uint
+pwm_gpio_to_slice_num(uint gpio)
+{
+  return (gpio >> 1u) & 7u;
+}
+
+static inline uint
+pwm_gpio_to_channel(uint gpio)
+{
+  return gpio & 1u;
+}
+
+static inline pwm_config
+pwm_get_default_config(void)
+{
+  pwm_config c = { .csr = 0, .div = 1u << 4, .top = 0xffff };
+  return c;
+}
+
+static inline void
+pwm_config_set_wrap(pwm_config* c, uint16_t wrap)
+{
+  c->top = wrap;
+}
+
+static inline void
+pwm_config_set_clkdiv_int(pwm_config* c, uint div)
+{
+  c->div = div << 4;
+}
+
+static inline void
+pwm_config_set_clkdiv_mode(pwm_config* c, enum pwm_clkdiv_mode mode)
+{
+  c->csr = (c->csr & ~(3u << 4)) | ((uint32_t) mode << 4);
+}
+
+void pwm_init(uint slice_num, pwm_config* c, bool start);
+void pwm_set_enabled(uint slice_num, bool enabled);
+void pwm_set_irq_enabled(uint slice_num, bool enabled);
+void pwm_set_gpio_level(uint gpio, uint16_t level);
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "pico/types.h"
+
+struct sim_spi_device;
+
+/* Only the data register, DMA transfers point at it. */
+typedef struct {
+  uint32_t dr;
+} spi_hw_t;
+
+typedef struct spi_inst {
+  spi_hw_t               hw;
+  uint                   baudrate;
+  struct sim_spi_device* devices;
+} spi_inst_t;
+
+extern spi_inst_t sim_spi_inst[2];
+
+#define spi0 (&sim_spi_inst[0])
+#define spi1 (&sim_spi_inst[1])
+
+#define DREQ_SPI0_TX 16
+#define DREQ_SPI0_RX 17
+#define DREQ_SPI1_TX 18
+#define DREQ_SPI1_RX 19
+
+static inline spi_hw_t*
+spi_get_hw(spi_inst_t* spi)
+{
+  return &spi->hw;
+}
+
+static inline uint
+spi_get_index(const spi_inst_t* spi)
+{
+  return spi == spi1;
+}
+
+static inline uint
+spi_get_dreq(spi_inst_t* spi, bool is_tx)
+{
+  return DREQ_SPI0_TX + spi_get_index(spi) * 2 + !is_tx;
+}
+
+typedef enum {
+  SPI_CPOL_0 = 0,
+  SPI_CPOL_1 = 1,
+} spi_cpol_t;
+
+typedef enum {
+  SPI_CPHA_0 = 0,
+  SPI_CPHA_1 = 1,
+} spi_cpha_t;
+
+typedef enum {
+  SPI_LSB_FIRST = 0,
+  SPI_MSB_FIRST = 1,
+} spi_order_t;
+
+uint spi_init(spi_inst_t* spi, uint baudrate);
+uint spi_set_baudrate(spi_inst_t* spi, uint baudrate);
+uint spi_get_baudrate(const spi_inst_t* spi);
+void spi_set_format(spi_inst_t* spi,
+                    uint        data_bits,
+                    spi_cpol_t  cpol,
+                    spi_cpha_t  cpha,
+                    spi_order_t order);
+
+int spi_write_read_blocking(spi_inst_t*    spi,
+                            const uint8_t* src,
+                            uint8_t*       dst,
+                            size_t         len);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "pico/types.h"
+
+/* Interrupts are not modelled on the host. */
+static inline uint32_t
+save_and_disable_interrupts(void)
+{
+  return 0;
+}
+
+static inline void
+restore_interrupts(uint32_t status)
+{
+  (void) status;
+}
+
+/* Signals an event to both cores, see best_effort_wfe_or_timeout. */
+void __sev(void);
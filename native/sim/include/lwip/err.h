@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef int8_t   err_t;
+typedef uint8_t  u8_t;
+typedef uint16_t u16_t;
+typedef uint32_t u32_t;
+
+#define ERR_OK    0
+#define ERR_MEM  -1
+#define ERR_BUF  -2
+#define ERR_VAL  -6
+#define ERR_USE  -8
+#define ERR_CONN -11
+#define ERR_ABRT -13
+#define ERR_RST  -14
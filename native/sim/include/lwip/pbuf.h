@@ -0,0 +1,13 @@
+#pragma once
+
+#include "lwip/err.h"
+
+struct pbuf {
+  struct pbuf* next;
+  void*        payload;
+  u16_t        tot_len;
+  u16_t        len;
+};
+
+u16_t pbuf_copy_partial(const struct pbuf* p, void* dataptr, u16_t len, u16_t offset);
+u8_t  pbuf_free(struct pbuf* p);
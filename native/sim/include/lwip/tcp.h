@@ -0,0 +1,86 @@
+#pragma once
+
+/*
+ * Loopback stand-in for the raw lwIP TCP api.
+ *
+ * Every pcb is backed by a non-blocking host socket bound to 127.0.0.1, so
+ * the firmware's TCP server can be driven by any client on the host. All
+ * callbacks are dispatched from cyw43_arch_poll(), exactly like the
+ * pico_cyw43_arch_lwip_poll flavour used on target.
+ */
+
+#include <stdbool.h>
+
+#include "lwip/err.h"
+#include "lwip/pbuf.h"
+
+#define IPADDR_TYPE_V4  0U
+#define IPADDR_TYPE_V6  6U
+#define IPADDR_TYPE_ANY 46U
+
+#define TCP_WRITE_FLAG_COPY 0x01
+#define TCP_WRITE_FLAG_MORE 0x02
+
+/* As in lwipopts.h. */
+#define TCP_MSS 1460
+
+#define SOF_KEEPALIVE 0x08U
+
+enum tcp_state {
+  CLOSED      = 0,
+  LISTEN      = 1,
+  ESTABLISHED = 4,
+};
+
+typedef struct {
+  u32_t addr;
+} ip_addr_t;
+
+typedef ip_addr_t ip4_addr_t;
+
+struct netif {
+  ip4_addr_t ip_addr;
+};
+
+extern struct netif* netif_list;
+
+#define netif_ip4_addr(netif) ((const ip4_addr_t*) &((netif)->ip_addr))
+
+char* ip4addr_ntoa(const ip4_addr_t* addr);
+
+struct tcp_pcb;
+
+typedef err_t (*tcp_accept_fn)(void* arg, struct tcp_pcb* newpcb, err_t err);
+typedef err_t (*tcp_recv_fn)(void* arg, struct tcp_pcb* tpcb, struct pbuf* p, err_t err);
+typedef void  (*tcp_err_fn)(void* arg, err_t err);
+
+struct tcp_pcb {
+  enum tcp_state state;
+  u8_t           so_options;
+  u32_t          keep_intvl;
+  u16_t          local_port;
+
+  void*          callback_arg;
+  tcp_accept_fn  accept;
+  tcp_recv_fn    recv;
+  tcp_err_fn     errf;
+
+  /* Host side of the simulation. */
+  int            fd;
+  bool           in_use;
+};
+
+struct tcp_pcb* tcp_new_ip_type(u8_t type);
+err_t           tcp_bind(struct tcp_pcb* pcb, const ip_addr_t* ipaddr, u16_t port);
+struct tcp_pcb* tcp_listen_with_backlog(struct tcp_pcb* pcb, u8_t backlog);
+err_t           tcp_close(struct tcp_pcb* pcb);
+void            tcp_abort(struct tcp_pcb* pcb);
+
+void tcp_arg(struct tcp_pcb* pcb, void* arg);
+void tcp_accept(struct tcp_pcb* pcb, tcp_accept_fn accept);
+void tcp_recv(struct tcp_pcb* pcb, tcp_recv_fn recv);
+void tcp_err(struct tcp_pcb* pcb, tcp_err_fn err);
+
+err_t tcp_write(struct tcp_pcb* pcb, const void* dataptr, u16_t len, u8_t apiflags);
+void  tcp_recved(struct tcp_pcb* pcb, u16_t len);
+err_t tcp_output(struct tcp_pcb* pcb);
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "pico/types.h"
+
+/* There is no bootloader to fall into, the simulation just exits. */
+void reset_usb_boot(uint32_t usb_activity_gpio_pin_mask,
+                    uint32_t disable_interface_mask) __attribute__((noreturn));
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "pico/types.h"
+#include "pico/time.h"
+
+#define CYW43_WL_GPIO_LED_PIN   0
+#define CYW43_AUTH_WPA2_AES_PSK 0x00400004
+
+int  cyw43_arch_init(void);
+void cyw43_arch_deinit(void);
+void cyw43_arch_enable_sta_mode(void);
+int  cyw43_arch_wifi_connect_timeout_ms(const char* ssid,
+                                        const char* pw,
+                                        uint32_t    auth,
+                                        uint32_t    timeout);
+void cyw43_arch_gpio_put(uint wl_gpio, bool value);
+bool cyw43_arch_gpio_get(uint wl_gpio);
+
+/* Services the loopback lwIP stack and the simulated board. */
+void cyw43_arch_poll(void);
+
+/*
+ * Blocks until lwIP or stdio have something to do, or until the deadline.
+ * In virtual time it jumps straight to the deadline.
+ */
+void cyw43_arch_wait_for_work_until(absolute_time_t until);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "pico/types.h"
+
+/*
+ * Core1 runs on a host thread, or as a coroutine of core0 on the
+ * virtual clock. See sim_multicore.c.
+ */
+void multicore_launch_core1(void (*entry)(void));
+
+void multicore_lockout_victim_init(void);
+void multicore_lockout_start_blocking(void);
+void multicore_lockout_end_blocking(void);
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "pico/types.h"
+
+void panic(const char* fmt, ...) __attribute__((noreturn));
+
+uint get_core_num(void);
+
+static inline void
+tight_loop_contents(void)
+{
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "pico/types.h"
+
+bool stdio_init_all(void);
+
+int getchar_timeout_us(uint32_t timeout_us);
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "pico/types.h"
+#include "pico/platform.h"
+#include "pico/time.h"
+#include "pico/stdio.h"
+#include "hardware/gpio.h"
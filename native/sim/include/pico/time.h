@@ -0,0 +1,97 @@
+#pragma once
+
+#include "pico/types.h"
+
+extern const absolute_time_t at_the_end_of_time;
+extern const absolute_time_t nil_time;
+
+absolute_time_t get_absolute_time(void);
+
+uint64_t time_us_64(void);
+
+static inline uint32_t
+time_us_32(void)
+{
+  return (uint32_t) time_us_64();
+}
+
+static inline uint64_t
+to_us_since_boot(absolute_time_t t)
+{
+  return t;
+}
+
+static inline absolute_time_t
+from_us_since_boot(uint64_t us)
+{
+  return us;
+}
+
+static inline uint32_t
+to_ms_since_boot(absolute_time_t t)
+{
+  return (uint32_t) (t / 1000);
+}
+
+static inline absolute_time_t
+delayed_by_us(const absolute_time_t t, uint64_t us)
+{
+  return t + us;
+}
+
+static inline absolute_time_t
+delayed_by_ms(const absolute_time_t t, uint32_t ms)
+{
+  return t + (uint64_t) ms * 1000;
+}
+
+static inline absolute_time_t
+make_timeout_time_us(uint64_t us)
+{
+  return delayed_by_us(get_absolute_time(), us);
+}
+
+static inline absolute_time_t
+make_timeout_time_ms(uint32_t ms)
+{
+  return delayed_by_ms(get_absolute_time(), ms);
+}
+
+static inline int64_t
+absolute_time_diff_us(absolute_time_t from, absolute_time_t to)
+{
+  return (int64_t) (to - from);
+}
+
+void sleep_until(absolute_time_t target);
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+
+/*
+ * Waits for an event (__sev from the other core) or until the timeout.
+ * Returns true if the timeout was reached.
+ */
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp);
+
+/*
+ * Repeating timers of the default alarm pool. Like on the chip they go off
+ * on core0, from sim_board_poll, at the time they were due.
+ */
+typedef struct repeating_timer repeating_timer_t;
+typedef bool (*repeating_timer_callback_t)(repeating_timer_t* rt);
+
+struct repeating_timer {
+  int64_t                    delay_us; /* < 0 start to start, > 0 end to start */
+  repeating_timer_callback_t callback;
+  void*                      user_data;
+
+  /* Simulation only. */
+  absolute_time_t            next;
+  repeating_timer_t*         link;
+};
+
+bool add_repeating_timer_us(int64_t                    delay_us,
+                            repeating_timer_callback_t callback,
+                            void*                      user_data,
+                            repeating_timer_t*         out);
+bool cancel_repeating_timer(repeating_timer_t* timer);
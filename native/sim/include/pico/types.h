@@ -0,0 +1,22 @@
+#pragma once
+
+/*
+ * Host stand-in for the pico-sdk base types.
+ *
+ * absolute_time_t is a plain microsecond count, same as the sdk build
+ * without PICO_OPAQUE_ABSOLUTE_TIME_T, so the firmware can keep comparing
+ * deadlines with '<' and '>'.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef unsigned int uint;
+
+typedef uint64_t absolute_time_t;
+
+#define PICO_ERROR_NONE     0
+#define PICO_ERROR_TIMEOUT  -1
+#define PICO_ERROR_GENERIC  -2
@@ -0,0 +1,409 @@
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pico/time.h"
+#include "hardware/gpio.h"
+
+#include "max318xx.h"
+#include "sim.h"
+#include "../check.h"
+
+/*
+ * Host test of the MAX318xx driver selected by CONFIG_THERMO against the
+ * register level model of its converter, on the virtual clock. The build
+ * makes one binary per converter, max31856_test and max31865_test.
+ *
+ * The driver configures the model with max318xx_config, checks it with
+ * max318xx_sanity_check and samples it the way furnace.c does: one
+ * max318xx_sample_request burst through spi_async, decoded with
+ * max318xx_snapshot_decode. Then:
+ *
+ *   timing    no result before the conversion time, DRDY low until read
+ *   accuracy  random temperatures over the sensor's range come back within
+ *             the converter's resolution, without faults
+ *   faults    open input, out of range, over/under voltage and cold junction
+ *             faults are decoded, and go away again once cleared
+ *   stuck     results that stop updating keep their value
+ *   noise     injected noise comes through unbiased and at its level
+ *   bits      random bit flips on MISO: how many samples they spoil and
+ *             whether the fault decoding or the temperature gives it away
+ *
+ *   max318xx_test [-n samples] [-e bit error rate]
+ *
+ *   -n  samples for accuracy, noise and bit error runs (default 100000)
+ *   -e  probability of a flipped bit on MISO (default 1e-4)
+ *
+ * Exits with 1 if anything went wrong.
+ */
+
+#define TEST_CS_PIN   5
+#define TEST_DRDY_PIN 6
+
+#if CONFIG_THERMO == CONFIG_THERMO_PT100
+  #define TEST_CHIP      SIM_MAX31865
+  #define TEST_CONFIG    MAX31865_CONF
+  #define TEST_LO        -200.0
+  #define TEST_HI        850.0
+  /* ADC step is ~0.034 C around 850 C, plus the lookup table's error. */
+  #define TEST_TOLERANCE 0.05
+#else
+  #define TEST_CHIP      SIM_MAX31856
+  #define TEST_CONFIG    MAX31856_CR0
+  #define TEST_LO        -200.0
+  #define TEST_HI        1372.0
+  /* 2^-7 C from the converter, 2^-8 C from temp_t. */
+  #define TEST_TOLERANCE (1.0 / 128 + 1.0 / 256)
+#endif
+
+static const max318xx_sensor_t sensor = { "test", TEST_CS_PIN };
+static sim_max318xx_t          model;
+
+static double
+test_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double
+test_random(double lo, double hi)
+{
+  return lo + (hi - lo) * rand() / (double) RAND_MAX;
+}
+
+/* One sample the way furnace.c takes it. */
+static void
+test_sample(max318xx_snapshot_t* snap)
+{
+  static spi_xfer_t xfer = { .cs_pin = TEST_CS_PIN, .len = MAX318xx_SAMPLE_LEN };
+
+  max318xx_sample_request(xfer.tx);
+
+  CHECK(spi_async_start(&xfer), "sample refused");
+  sim_time_advance_us(spi_async_time_us(&xfer));
+  CHECK(spi_async_done(&xfer), "sample not done after its wire time");
+
+  max318xx_snapshot_decode(snap, xfer.rx);
+}
+
+/* Waits out the next conversion and samples it. */
+static void
+test_convert(max318xx_snapshot_t* snap)
+{
+  const uint32_t conversions = model.conversions;
+
+  sim_time_advance_us(sim_max318xx_next_event(&model) - get_absolute_time());
+  sim_max318xx_poll(&model);
+
+  CHECK(model.conversions == conversions + 1, "no conversion at its time");
+
+  test_sample(snap);
+}
+
+static void
+test_clear_faults(void)
+{
+#if CONFIG_THERMO == CONFIG_THERMO_PT100
+  const uint8_t conf = MAX31865_CONF | 0x02; /* fault status clear */
+
+  max318xx_write_regs(TEST_CS_PIN, MAX31865_REG_CONF, &conf, 1);
+#endif
+}
+
+static void
+test_init(void)
+{
+  printf("  ");
+  max318xx_config(&sensor);
+
+  const int rc = max318xx_sanity_check(&sensor);
+
+  if (rc)
+    printf(" failed\n");
+
+  CHECK(rc == 0, "sanity check failed with %d", rc);
+  CHECK(model.regs[0] == TEST_CONFIG, "configuration %02x, want %02x", model.regs[0], TEST_CONFIG);
+}
+
+static void
+test_timing(void)
+{
+  const unsigned      before = failures;
+  max318xx_snapshot_t snap;
+  const uint32_t      period = sim_max318xx_conversion_us(&model);
+
+  CHECK(period / 1000 <= MAX318xx_CONVERSION_MS, "conversions every %u us, driver waits %u ms",
+        period, MAX318xx_CONVERSION_MS);
+
+  sim_time_advance_us(sim_max318xx_next_event(&model) - get_absolute_time() - 1);
+  sim_max318xx_poll(&model);
+  CHECK(model.conversions == 0, "converted early");
+  CHECK(gpio_get(TEST_DRDY_PIN), "DRDY low before the first conversion");
+
+  sim_time_advance_us(1);
+  sim_max318xx_poll(&model);
+  CHECK(model.conversions == 1, "no conversion after %u us", period);
+  CHECK(!gpio_get(TEST_DRDY_PIN), "DRDY not low after a conversion");
+
+  const absolute_time_t converted = get_absolute_time();
+
+  test_sample(&snap);
+  CHECK(gpio_get(TEST_DRDY_PIN), "DRDY still low after the sample");
+  CHECK(snap.faults == 0, "faults %02x at room temperature", snap.faults);
+  CHECK(fabs(snap.temp / (double) TEMP_ONE - 25.0) <= TEST_TOLERANCE, "room temperature read as "
+        TEMP_FMT, TEMP_ARGS(snap.temp));
+
+  /* The next one comes a period after the first, not after the sample. */
+  CHECK(sim_max318xx_next_event(&model) == converted + period, "next conversion off its period");
+
+  printf("timing    %6u us per conversion, %s\n", period, failures == before ? "ok" : "FAILED");
+}
+
+static void
+test_accuracy(unsigned count)
+{
+  const unsigned      before = failures;
+  max318xx_snapshot_t snap;
+  double              worst = 0;
+
+  const double start = test_now_ns();
+
+  for (unsigned i = 0; i < count; i++) {
+    model.celsius = test_random(TEST_LO, TEST_HI);
+
+    test_convert(&snap);
+
+    const double err = fabs(snap.temp / (double) TEMP_ONE - model.celsius);
+
+    if (err > worst)
+      worst = err;
+
+    CHECK(err <= TEST_TOLERANCE, "%.3f C read as " TEMP_FMT, model.celsius, TEMP_ARGS(snap.temp));
+    CHECK(snap.faults == 0, "%.3f C with faults %02x", model.celsius, snap.faults);
+#if CONFIG_THERMO == CONFIG_THERMO_KTYPE
+    CHECK(snap.cold_temp == TEMP_C(25), "cold junction " TEMP_FMT, TEMP_ARGS(snap.cold_temp));
+#endif
+  }
+
+  const double ns = (test_now_ns() - start) / count;
+
+  printf("accuracy  %6u samples, worst %.4f C, %.0f ns per sample, %s\n",
+         count, worst, ns, failures == before ? "ok" : "FAILED");
+}
+
+static void
+test_fault(const char* name, bool* fault, double celsius, uint8_t want)
+{
+  max318xx_snapshot_t snap;
+
+  model.celsius = celsius;
+  if (fault)
+    *fault = true;
+
+  test_convert(&snap);
+  CHECK((snap.faults & want) == want, "%s: faults %02x, want %02x", name, snap.faults, want);
+
+  model.celsius = 25.0;
+  if (fault)
+    *fault = false;
+
+  test_clear_faults();
+  test_convert(&snap);
+  CHECK(snap.faults == 0, "%s: faults %02x after it went away", name, snap.faults);
+}
+
+static void
+test_faults(void)
+{
+  const unsigned before = failures;
+
+  test_fault("open", &model.open, 25.0, MAX318xx_FAULT_OPEN);
+  test_fault("overvoltage", &model.overvoltage, 25.0, MAX318xx_FAULT_SUPPLY);
+
+#if CONFIG_THERMO == CONFIG_THERMO_PT100
+  /* Past the high fault threshold, 300 C in RTD code. */
+  const uint16_t hft   = (uint16_t) ((rtd_resistance(300.0) + CASUAL_WIRE_RES) / R_REF * MAX_ADC_VALUE);
+  const uint8_t  th[2] = { (uint8_t) (hft >> 7), (uint8_t) (hft << 1) };
+  const uint8_t  dflt[2] = { 0xff, 0xff };
+
+  max318xx_write_regs(TEST_CS_PIN, MAX31865_REG_HFT_MSB, th, sizeof(th));
+  test_fault("high threshold", NULL, 400.0, MAX318xx_FAULT_RANGE);
+  max318xx_write_regs(TEST_CS_PIN, MAX31865_REG_HFT_MSB, dflt, sizeof(dflt));
+#else
+  test_fault("thermocouple range", NULL, 1500.0, MAX318xx_FAULT_RANGE);
+
+  /* Cold junction past its range, the reading itself stays usable. */
+  max318xx_snapshot_t snap;
+
+  model.cold_c = 130.0;
+  test_convert(&snap);
+  CHECK(snap.faults == MAX318xx_FAULT_CJ, "hot cold junction: faults %02x", snap.faults);
+  model.cold_c = 25.0;
+  test_convert(&snap);
+  CHECK(snap.faults == 0, "cold junction: faults %02x after it cooled", snap.faults);
+#endif
+
+  printf("faults    %s\n", failures == before ? "ok" : "FAILED");
+}
+
+static void
+test_stuck(void)
+{
+  const unsigned      before = failures;
+  max318xx_snapshot_t snap;
+
+  model.celsius = 100.0;
+  test_convert(&snap);
+
+  const temp_t stuck = snap.temp;
+
+  model.stuck = true;
+
+  for (int i = 0; i < 10; i++) {
+    model.celsius = test_random(TEST_LO, TEST_HI);
+    test_convert(&snap);
+    CHECK(snap.temp == stuck, "stuck converter read " TEMP_FMT, TEMP_ARGS(snap.temp));
+  }
+
+  model.stuck = false;
+  test_convert(&snap);
+  CHECK(fabs(snap.temp / (double) TEMP_ONE - model.celsius) <= TEST_TOLERANCE, "still stuck");
+
+  printf("stuck     %s\n", failures == before ? "ok" : "FAILED");
+}
+
+static void
+test_noise(unsigned count)
+{
+  const unsigned      before = failures;
+  const double        sigma  = 2.0;
+  max318xx_snapshot_t snap;
+  double              sum = 0, sum2 = 0;
+
+  model.celsius = 500.0;
+  model.noise_c = sigma;
+
+  for (unsigned i = 0; i < count; i++) {
+    test_convert(&snap);
+
+    const double err = snap.temp / (double) TEMP_ONE - model.celsius;
+
+    sum  += err;
+    sum2 += err * err;
+  }
+
+  model.noise_c = 0;
+
+  const double mean = sum / count;
+  const double sd   = sqrt(sum2 / count - mean * mean);
+
+  CHECK(fabs(mean) < 5 * sigma / sqrt(count) + TEST_TOLERANCE, "noise biased by %.4f C", mean);
+  CHECK(fabs(sd - sigma) < 0.05 * sigma, "noise of %.3f C, injected %.3f C", sd, sigma);
+
+  printf("noise     %6u samples, mean %+.4f C, sd %.3f C, %s\n",
+         count, mean, sd, failures == before ? "ok" : "FAILED");
+}
+
+/*
+ * Nothing in the register file protects it against bit errors, the only
+ * defence is that a flip in SR or in the top bits of the reading tends to
+ * look like a fault or a jump. Counts what gets through either way, the
+ * check is only that no sample is spoilt without a flipped bit.
+ */
+static void
+test_bits(unsigned count, double rate)
+{
+  const unsigned      before = failures;
+  max318xx_snapshot_t snap;
+  unsigned            hit = 0, faults = 0, wrong = 0, jumps = 0;
+
+  model.bit_error_rate = rate;
+
+  for (unsigned i = 0; i < count; i++) {
+    model.celsius = test_random(TEST_LO, TEST_HI);
+
+    const uint32_t flipped = model.flipped_bits;
+
+    test_convert(&snap);
+
+    const double err = fabs(snap.temp / (double) TEMP_ONE - model.celsius);
+    const bool   bad = snap.faults || err > TEST_TOLERANCE;
+
+    if (model.flipped_bits != flipped)
+      hit++;
+    else
+      CHECK(!bad, "sample spoilt without a bit error");
+
+    if (snap.faults)
+      faults++;
+    else if (err > TEST_TOLERANCE)
+      wrong++;
+    if (!snap.faults && err > 10.0)
+      jumps++;
+  }
+
+  model.bit_error_rate = 0;
+
+  const double bits     = (double) count * MAX318xx_SAMPLE_LEN * 8;
+  const double expected = bits * rate;
+
+  CHECK(fabs(model.flipped_bits - expected) < 5 * sqrt(expected) + 1,
+        "%u bits flipped, expected %.0f", model.flipped_bits, expected);
+
+  printf("bits      %6u samples, %u flipped bits in %u samples: %u faults, %u wrong and %u of"
+         " them off by over 10 C, %s\n",
+         count, model.flipped_bits, hit, faults, wrong, jumps, failures == before ? "ok" : "FAILED");
+}
+
+int
+main(int argc, char** argv)
+{
+  unsigned count = 100000;
+  double   rate  = 1e-4;
+  int      opt;
+
+  while ((opt = getopt(argc, argv, "n:e:")) != -1) {
+    switch (opt) {
+      case 'n': count = strtoul(optarg, NULL, 0); break;
+      case 'e': rate  = strtod(optarg, NULL);     break;
+      default:
+        return 1;
+    }
+  }
+
+  if (count == 0 || rate < 0 || rate > 1) {
+    fprintf(stderr, "needs at least one sample and a bit error rate within 0..1\n");
+    return 1;
+  }
+
+  sim_time_use_virtual();
+  srand(1);
+
+  printf("%s on the model, %u samples\n", TEST_CHIP == SIM_MAX31856 ? "MAX31856" : "MAX31865", count);
+
+  gpio_init(TEST_DRDY_PIN);
+  gpio_init(TEST_CS_PIN);
+  gpio_set_dir(TEST_CS_PIN, GPIO_OUT);
+  gpio_put(TEST_CS_PIN, 1);
+
+  sim_max318xx_init(&model, TEST_CHIP, TEST_CS_PIN, TEST_DRDY_PIN);
+  sim_spi_attach(MAX318xx_SPI_INSTANCE, &model.dev);
+  max318xx_spi_init();
+
+  test_init();
+  test_timing();
+  test_accuracy(count);
+  test_faults();
+  test_stuck();
+  test_noise(count);
+  test_bits(count, rate);
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+/*
+ * Simulated board for running the furnace firmware on a Linux host.
+ *
+ * The headers under native/sim/include replace the pico-sdk, cyw43 and lwIP
+ * headers, and the sim_*.c files implement them on top of the host.
+ * Everything a test or benchmark may want to poke at lives here.
+ */
+
+#include "pico/types.h"
+#include "pico/time.h"
+#include "hardware/spi.h"
+
+#include "sim_plant.h"
+
+/* clock */
+void sim_time_use_virtual(void);
+bool sim_time_is_virtual(void);
+void sim_time_advance_us(uint64_t us);
+
+/* repeating timers, the earliest one due and running it */
+absolute_time_t sim_timer_next(void);
+void            sim_timer_fire(void);
+
+/* stdio, injected bytes are read before the host's stdin */
+void sim_stdio_inject(const char* s);
+void sim_stdio_detach_host(void);
+
+/* gpio & pwm */
+bool     sim_gpio_get_out(uint gpio);
+void     sim_gpio_drive(uint gpio, bool value);
+void     sim_gpio_irq_dispatch(void);
+uint16_t sim_pwm_get_level(uint gpio);
+uint16_t sim_pwm_get_wrap(uint gpio);
+bool     sim_pwm_is_enabled(uint gpio);
+double   sim_pwm_get_duty(uint gpio);
+
+/* spi */
+typedef struct sim_spi_device sim_spi_device_t;
+
+struct sim_spi_device {
+  uint cs_pin;
+  void    (*select)(sim_spi_device_t* dev);
+  uint8_t (*transfer)(sim_spi_device_t* dev, uint8_t mosi);
+  void    (*deselect)(sim_spi_device_t* dev);
+
+  sim_spi_device_t* next;
+};
+
+void sim_spi_attach(spi_inst_t* spi, sim_spi_device_t* dev);
+void sim_spi_cs_changed(uint gpio, bool value);
+
+/* MAX31856 and MAX31865 models */
+#include "sim_max318xx.h"
+
+/* loopback lwIP */
+struct pollfd;
+
+void   sim_lwip_poll(void);
+size_t sim_lwip_pollfds(struct pollfd* fds, size_t max);
+
+/* second core and events */
+void            sim_irq_wake(uint core);
+int             sim_event_fd(void);
+bool            sim_event_take(void);
+void            sim_multicore_poll(void);
+absolute_time_t sim_multicore_core1_timeout(void);
+
+/* board */
+void            sim_board_use_plant(const sim_plant_params_t* params);
+sim_plant_t*    sim_board_plant(void);
+sim_max318xx_t* sim_board_sensor(unsigned index);
+void            sim_board_set_quantum_us(uint64_t us);
+void            sim_board_set_hook(void (*fn)(void* arg), void* arg);
+void            sim_board_poll(void);
+absolute_time_t sim_board_next_event(void);
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "spi_config.h"
+
+#include "sim.h"
+
+/*
+ * Wires the simulated peripherals together the way the furnace PCB does.
+ *
+ * Without a plant model the thermocouples read a fixed temperature, taken
+ * from FURNACE_SIM_TEMP (degrees Celsius) or room temperature by default.
+ * FURNACE_SIM_PLANT=<name> puts one of the sim_plant.c models behind the
+ * heater output instead: the first sensor sees the plant's thermocouple,
+ * the wall sits between chamber and ambient and the element runs hotter
+ * than the chamber the more power goes in.
+ *
+ * FURNACE_SIM_FAULT breaks sensors from the start, a comma separated list
+ * of <sensor>:<fault> with the faults of sim_max318xx.h: open, stuck,
+ * overvoltage, noise=<C> and ber=<bit error rate>.
+ */
+
+static sim_max318xx_t sensors[THERMO_SENSORS];
+
+static sim_plant_t plant;
+static bool        plant_enabled;
+static uint64_t    plant_us;
+
+static uint64_t    quantum_us;
+
+static void      (*hook)(void* arg);
+static void*       hook_arg;
+
+/* Where the wall sensor sits between ambient and chamber. */
+#define SIM_WALL_FRACTION 0.6
+/* Element over chamber temperature per watt of heater power. */
+#define SIM_ELEMENT_KW    0.05
+
+static void
+sim_board_attach_sensors(void)
+{
+  static const struct {
+    const char* name;
+    uint        cs_pin;
+  } table[] = { FURNACE_THERMO_SENSORS };
+
+  const sim_max318xx_chip_t chip = CONFIG_THERMO == CONFIG_THERMO_PT100 ? SIM_MAX31865 : SIM_MAX31856;
+
+  for (unsigned i = 0; i < THERMO_SENSORS; i++) {
+    /* DRDY is only wired up for the first MAX31856. */
+    const int drdy = i == 0 && chip == SIM_MAX31856 ? FURNACE_SPI_DRDY_PIN : -1;
+
+    sim_max318xx_init(&sensors[i], chip, table[i].cs_pin, drdy);
+    sim_spi_attach(FURNACE_SPI_INSTANCE, &sensors[i].dev);
+  }
+}
+
+static void
+sim_board_inject_faults(const char* spec)
+{
+  char  buf[256];
+  char* save;
+
+  snprintf(buf, sizeof(buf), "%s", spec);
+
+  for (char* tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+    char*          fault;
+    const unsigned i = strtoul(tok, &fault, 0);
+
+    if (*fault != ':' || i >= THERMO_SENSORS) {
+      fprintf(stderr, "FURNACE_SIM_FAULT: bad sensor in '%s'\n", tok);
+      exit(1);
+    }
+
+    sim_max318xx_t* m = &sensors[i];
+
+    fault++;
+
+    if (strcmp(fault, "open") == 0)
+      m->open = true;
+    else if (strcmp(fault, "stuck") == 0)
+      m->stuck = true;
+    else if (strcmp(fault, "overvoltage") == 0)
+      m->overvoltage = true;
+    else if (strncmp(fault, "noise=", 6) == 0)
+      m->noise_c = atof(fault + 6);
+    else if (strncmp(fault, "ber=", 4) == 0)
+      m->bit_error_rate = atof(fault + 4);
+    else {
+      fprintf(stderr, "FURNACE_SIM_FAULT: unknown fault '%s'\n", fault);
+      exit(1);
+    }
+  }
+}
+
+static void
+sim_board_set_sensors(double celsius)
+{
+  for (unsigned i = 0; i < THERMO_SENSORS; i++)
+    sensors[i].celsius = celsius;
+}
+
+static void
+sim_board_update_sensors(void)
+{
+  sensors[0].celsius = sim_plant_reading(&plant);
+
+  if (THERMO_SENSORS > 1)
+    sensors[1].celsius = plant.p.ambient_c + SIM_WALL_FRACTION * (plant.temp_c - plant.p.ambient_c);
+  if (THERMO_SENSORS > 2)
+    sensors[2].celsius = plant.temp_c + SIM_ELEMENT_KW * plant.power_w;
+}
+
+__attribute__((constructor)) static void
+sim_board_init(void)
+{
+  const char* temp       = getenv("FURNACE_SIM_TEMP");
+  const char* plant_name = getenv("FURNACE_SIM_PLANT");
+  const char* faults     = getenv("FURNACE_SIM_FAULT");
+
+  sim_board_attach_sensors();
+  sim_board_set_sensors(temp ? atof(temp) : 25.0);
+
+  if (faults)
+    sim_board_inject_faults(faults);
+
+  if (plant_name) {
+    const sim_plant_params_t* params = sim_plant_find(plant_name);
+
+    if (!params) {
+      fprintf(stderr, "FURNACE_SIM_PLANT: unknown plant '%s'\n", plant_name);
+      exit(1);
+    }
+
+    sim_board_use_plant(params);
+  }
+}
+
+void
+sim_board_use_plant(const sim_plant_params_t* params)
+{
+  sim_plant_init(&plant, params);
+  sim_board_update_sensors();
+
+  plant_us      = time_us_64();
+  plant_enabled = true;
+}
+
+sim_plant_t*
+sim_board_plant(void)
+{
+  return plant_enabled ? &plant : NULL;
+}
+
+sim_max318xx_t*
+sim_board_sensor(unsigned index)
+{
+  return index < THERMO_SENSORS ? &sensors[index] : NULL;
+}
+
+void
+sim_board_set_quantum_us(uint64_t us)
+{
+  quantum_us = us;
+}
+
+void
+sim_board_set_hook(void (*fn)(void* arg), void* arg)
+{
+  hook     = fn;
+  hook_arg = arg;
+}
+
+/* The heater pin is a PWM output, or a plain one when burst firing. */
+static double
+sim_board_heater_duty(void)
+{
+  if (sim_pwm_is_enabled(CONFIG_FURNACE_FIRE_PIN))
+    return sim_pwm_get_duty(CONFIG_FURNACE_FIRE_PIN);
+
+  return sim_gpio_get_out(CONFIG_FURNACE_FIRE_PIN) ? 1.0 : 0.0;
+}
+
+static void
+sim_board_update_plant(uint64_t now)
+{
+  if (now <= plant_us)
+    return;
+
+  sim_plant_advance(&plant, sim_board_heater_duty(), (now - plant_us) * 1e-6);
+  sim_board_update_sensors();
+
+  plant_us = now;
+}
+
+void
+sim_board_poll(void)
+{
+  if (sim_time_is_virtual())
+    sim_time_advance_us(quantum_us);
+
+  const uint64_t now = time_us_64();
+
+  /* Timers go off in order, the plant gets the heater as it was between them. */
+  for (absolute_time_t at; (at = sim_timer_next()) <= now; ) {
+    if (plant_enabled)
+      sim_board_update_plant(at);
+    sim_timer_fire();
+  }
+
+  if (plant_enabled)
+    sim_board_update_plant(now);
+
+  for (unsigned i = 0; i < THERMO_SENSORS; i++)
+    sim_max318xx_poll(&sensors[i]);
+  sim_multicore_poll();
+
+  if (hook)
+    hook(hook_arg);
+}
+
+/* Earliest time a device on the board changes state on its own. */
+absolute_time_t
+sim_board_next_event(void)
+{
+  absolute_time_t next = sim_timer_next();
+
+  for (unsigned i = 0; i < THERMO_SENSORS; i++)
+    if (sim_max318xx_next_event(&sensors[i]) < next)
+      next = sim_max318xx_next_event(&sensors[i]);
+
+  return next;
+}
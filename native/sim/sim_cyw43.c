@@ -0,0 +1,198 @@
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pico/bootrom.h"
+#include "pico/cyw43_arch.h"
+#include "pico/stdlib.h"
+
+#include "sim.h"
+
+/*
+ * Wireless chip, stdio and the rest of the runtime glue. The link is always
+ * up, stdin/stdout stand in for the USB CDC console.
+ */
+
+#define SIM_STDIO_INJECT_SIZE 1024
+#define SIM_POLL_FDS          8
+
+static bool led;
+static bool stdin_eof;
+
+static char   inject[SIM_STDIO_INJECT_SIZE];
+static size_t inject_head, inject_tail;
+
+int
+cyw43_arch_init(void)
+{
+  return 0;
+}
+
+void
+cyw43_arch_deinit(void)
+{
+}
+
+void
+cyw43_arch_enable_sta_mode(void)
+{
+}
+
+int
+cyw43_arch_wifi_connect_timeout_ms(const char* ssid,
+                                   const char* pw,
+                                   uint32_t    auth,
+                                   uint32_t    timeout)
+{
+  (void) ssid;
+  (void) pw;
+  (void) auth;
+  (void) timeout;
+
+  return 0;
+}
+
+void
+cyw43_arch_gpio_put(uint wl_gpio, bool value)
+{
+  if (wl_gpio == CYW43_WL_GPIO_LED_PIN)
+    led = value;
+}
+
+bool
+cyw43_arch_gpio_get(uint wl_gpio)
+{
+  return wl_gpio == CYW43_WL_GPIO_LED_PIN ? led : false;
+}
+
+void
+cyw43_arch_poll(void)
+{
+  sim_lwip_poll();
+  sim_board_poll();
+  sim_gpio_irq_dispatch();
+}
+
+void
+cyw43_arch_wait_for_work_until(absolute_time_t until)
+{
+  if (inject_head != inject_tail || sim_event_take())
+    return;
+
+  if (sim_time_is_virtual()) {
+    /* Nothing outside the simulation can wake us up, but core1 might. */
+    const absolute_time_t core1_timeout = sim_multicore_core1_timeout();
+    const absolute_time_t board_event   = sim_board_next_event();
+
+    if (core1_timeout < until)
+      until = core1_timeout;
+    if (board_event < until)
+      until = board_event;
+
+    sleep_until(until);
+    return;
+  }
+
+  /* Devices on the board only change state when polled. */
+  const absolute_time_t board_event = sim_board_next_event();
+
+  if (board_event < until)
+    until = board_event;
+
+  struct pollfd fds[SIM_POLL_FDS];
+  size_t        n = sim_lwip_pollfds(fds, SIM_POLL_FDS - 2);
+
+  fds[n].fd      = sim_event_fd();
+  fds[n].events  = POLLIN;
+  fds[n].revents = 0;
+  n++;
+
+  if (!stdin_eof) {
+    fds[n].fd      = STDIN_FILENO;
+    fds[n].events  = POLLIN;
+    fds[n].revents = 0;
+    n++;
+  }
+
+  const int64_t us = absolute_time_diff_us(get_absolute_time(), until);
+  if (us <= 0)
+    return;
+
+  const int timeout_ms = until == at_the_end_of_time ? -1
+                       : us / 1000 > INT32_MAX       ? INT32_MAX
+                       : (int) ((us + 999) / 1000);
+
+  poll(fds, n, timeout_ms);
+  sim_event_take();
+}
+
+bool
+stdio_init_all(void)
+{
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  return true;
+}
+
+void
+sim_stdio_inject(const char* s)
+{
+  while (*s && inject_tail - inject_head < SIM_STDIO_INJECT_SIZE)
+    inject[inject_tail++ % SIM_STDIO_INJECT_SIZE] = *s++;
+}
+
+void
+sim_stdio_detach_host(void)
+{
+  stdin_eof = true;
+}
+
+int
+getchar_timeout_us(uint32_t timeout_us)
+{
+  if (inject_head != inject_tail)
+    return (unsigned char) inject[inject_head++ % SIM_STDIO_INJECT_SIZE];
+
+  if (stdin_eof)
+    return PICO_ERROR_TIMEOUT;
+
+  struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+
+  if (poll(&pfd, 1, (int) (timeout_us / 1000)) <= 0)
+    return PICO_ERROR_TIMEOUT;
+
+  unsigned char c;
+
+  if (read(STDIN_FILENO, &c, 1) != 1) {
+    stdin_eof = true;
+    return PICO_ERROR_TIMEOUT;
+  }
+
+  return c;
+}
+
+void
+reset_usb_boot(uint32_t usb_activity_gpio_pin_mask, uint32_t disable_interface_mask)
+{
+  (void) usb_activity_gpio_pin_mask;
+  (void) disable_interface_mask;
+
+  fflush(stdout);
+  exit(0);
+}
+
+void
+panic(const char* fmt, ...)
+{
+  va_list args;
+
+  va_start(args, fmt);
+  fputs("\n*** PANIC ***\n\n", stderr);
+  vfprintf(stderr, fmt, args);
+  fputc('\n', stderr);
+  va_end(args);
+
+  abort();
+}
@@ -0,0 +1,178 @@
+#include "pico/platform.h"
+#include "pico/time.h"
+#include "hardware/dma.h"
+#include "hardware/spi.h"
+
+#include "sim.h"
+
+/*
+ * DMA channels paced by the SPI DREQs.
+ *
+ * Starting a TX channel together with the RX channel of the same SPI
+ * shifts all bytes through the selected devices right away, but both
+ * channels stay busy for as long as the bytes would take on the wire at
+ * the current baudrate. The firmware sees the answer no sooner than it
+ * would on the board, as long as it waits for the RX channel first.
+ */
+
+typedef struct {
+  bool                 claimed;
+  dma_channel_config   config;
+  volatile void*       write_addr;
+  const volatile void* read_addr;
+  uint32_t             count;
+  absolute_time_t      busy_until;
+} sim_dma_channel_t;
+
+static sim_dma_channel_t channels[NUM_DMA_CHANNELS];
+
+int
+dma_claim_unused_channel(bool required)
+{
+  for (uint i = 0; i < NUM_DMA_CHANNELS; i++) {
+    if (!channels[i].claimed) {
+      channels[i].claimed = true;
+      return (int) i;
+    }
+  }
+
+  if (required)
+    panic("No DMA channels available");
+
+  return -1;
+}
+
+void
+dma_channel_unclaim(uint channel)
+{
+  channels[channel].claimed = false;
+}
+
+dma_channel_config
+dma_channel_get_default_config(uint channel)
+{
+  (void) channel;
+
+  return (dma_channel_config) {
+    .read_increment  = true,
+    .write_increment = false,
+    .dreq            = 0x3f, /* DREQ_FORCE, unpaced */
+    .size            = DMA_SIZE_32,
+  };
+}
+
+void
+dma_channel_configure(uint                      channel,
+                      const dma_channel_config* config,
+                      volatile void*            write_addr,
+                      const volatile void*      read_addr,
+                      uint                      transfer_count,
+                      bool                      trigger)
+{
+  channels[channel].config     = *config;
+  channels[channel].write_addr = write_addr;
+  channels[channel].read_addr  = read_addr;
+  channels[channel].count      = transfer_count;
+
+  if (trigger)
+    dma_start_channel_mask(1u << channel);
+}
+
+void
+dma_channel_set_read_addr(uint channel, const volatile void* read_addr, bool trigger)
+{
+  channels[channel].read_addr = read_addr;
+
+  if (trigger)
+    dma_start_channel_mask(1u << channel);
+}
+
+void
+dma_channel_set_write_addr(uint channel, volatile void* write_addr, bool trigger)
+{
+  channels[channel].write_addr = write_addr;
+
+  if (trigger)
+    dma_start_channel_mask(1u << channel);
+}
+
+void
+dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger)
+{
+  channels[channel].count = trans_count;
+
+  if (trigger)
+    dma_start_channel_mask(1u << channel);
+}
+
+static spi_inst_t*
+sim_dma_spi(uint dreq, bool* is_tx)
+{
+  if (dreq < DREQ_SPI0_TX || dreq > DREQ_SPI1_RX)
+    return NULL;
+
+  *is_tx = !((dreq - DREQ_SPI0_TX) & 1);
+
+  return &sim_spi_inst[(dreq - DREQ_SPI0_TX) / 2];
+}
+
+void
+dma_start_channel_mask(uint32_t chan_mask)
+{
+  sim_dma_channel_t* tx[2] = { NULL, NULL };
+  sim_dma_channel_t* rx[2] = { NULL, NULL };
+
+  for (uint i = 0; i < NUM_DMA_CHANNELS; i++) {
+    if (!(chan_mask & (1u << i)))
+      continue;
+
+    sim_dma_channel_t* ch = &channels[i];
+    bool               is_tx;
+    spi_inst_t*        spi = sim_dma_spi(ch->config.dreq, &is_tx);
+
+    if (!spi || ch->config.size != DMA_SIZE_8)
+      panic("DMA channel %u: only byte transfers to/from SPI are simulated", i);
+
+    if (is_tx)
+      tx[spi_get_index(spi)] = ch;
+    else
+      rx[spi_get_index(spi)] = ch;
+  }
+
+  for (uint s = 0; s < 2; s++) {
+    if (!tx[s] && !rx[s])
+      continue;
+
+    /* The SPI only shifts in as many bytes as were written out. */
+    if (!tx[s] || !rx[s] || tx[s]->count != rx[s]->count)
+      panic("SPI%u: DMA TX and RX have to be started together, same length", s);
+
+    spi_inst_t*    spi = &sim_spi_inst[s];
+    const uint32_t len = tx[s]->count;
+    uint8_t        out[len], in[len];
+
+    for (uint32_t i = 0; i < len; i++)
+      out[i] = ((const volatile uint8_t*) tx[s]->read_addr)[tx[s]->config.read_increment ? i : 0];
+
+    spi_write_read_blocking(spi, out, in, len);
+
+    for (uint32_t i = 0; i < len; i++)
+      ((volatile uint8_t*) rx[s]->write_addr)[rx[s]->config.write_increment ? i : 0] = in[i];
+
+    const uint64_t wire_us = ((uint64_t) len * 8 * 1000000 + spi->baudrate - 1) / spi->baudrate;
+
+    tx[s]->busy_until = rx[s]->busy_until = make_timeout_time_us(wire_us);
+  }
+}
+
+bool
+dma_channel_is_busy(uint channel)
+{
+  return get_absolute_time() < channels[channel].busy_until;
+}
+
+void
+dma_channel_wait_for_finish_blocking(uint channel)
+{
+  sleep_until(channels[channel].busy_until);
+}
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware/flash.h"
+
+/*
+ * Two erase sectors backing FLASH_CONFIG from memmap.ld.
+ *
+ * Set FURNACE_SIM_FLASH to a file name to keep the contents between runs,
+ * which is handy for replaying power loss scenarios of flash_io.c.
+ */
+
+#define SIM_FLASH_SIZE (2 * FLASH_SECTOR_SIZE)
+
+uint8_t sim_flash_xip[SIM_FLASH_SIZE] __attribute__((aligned(FLASH_SECTOR_SIZE)));
+
+/* flash_io.c refers to the region through the linker script symbol. */
+extern size_t FLASH_CONFIG_DATA_START __attribute__((alias("sim_flash_xip")));
+
+static const char* sim_flash_path;
+
+static void
+sim_flash_store(void)
+{
+  if (!sim_flash_path)
+    return;
+
+  FILE* f = fopen(sim_flash_path, "wb");
+  if (!f)
+    return;
+
+  fwrite(sim_flash_xip, 1, SIM_FLASH_SIZE, f);
+  fclose(f);
+}
+
+__attribute__((constructor)) static void
+sim_flash_init(void)
+{
+  memset(sim_flash_xip, 0xff, SIM_FLASH_SIZE);
+
+  sim_flash_path = getenv("FURNACE_SIM_FLASH");
+  if (!sim_flash_path)
+    return;
+
+  FILE* f = fopen(sim_flash_path, "rb");
+  if (!f)
+    return;
+
+  fread(sim_flash_xip, 1, SIM_FLASH_SIZE, f);
+  fclose(f);
+}
+
+void
+flash_range_erase(uint32_t flash_offs, size_t count)
+{
+  if (flash_offs % FLASH_SECTOR_SIZE || count % FLASH_SECTOR_SIZE
+      || flash_offs + count > SIM_FLASH_SIZE) {
+    fprintf(stderr, "flash_range_erase: bad range %#x+%#zx\n", flash_offs, count);
+    abort();
+  }
+
+  memset(sim_flash_xip + flash_offs, 0xff, count);
+  sim_flash_store();
+}
+
+void
+flash_range_program(uint32_t flash_offs, const uint8_t* data, size_t count)
+{
+  if (flash_offs % FLASH_PAGE_SIZE || count % FLASH_PAGE_SIZE
+      || flash_offs + count > SIM_FLASH_SIZE) {
+    fprintf(stderr, "flash_range_program: bad range %#x+%#zx\n", flash_offs, count);
+    abort();
+  }
+
+  /* NOR flash can only clear bits, erasing is the only way back to 1. */
+  for (size_t i = 0; i < count; i++)
+    sim_flash_xip[flash_offs + i] &= data[i];
+
+  sim_flash_store();
+}
@@ -0,0 +1,210 @@
+#include <string.h>
+
+#include "pico/platform.h"
+#include "hardware/gpio.h"
+#include "hardware/pwm.h"
+
+#include "sim.h"
+
+typedef struct {
+  enum gpio_function function;
+  bool               out;
+  bool               value;
+  uint16_t           level;
+
+  /* Level driven onto an input by a simulated device. */
+  bool               driven;
+  bool               input;
+  bool               pull_up;
+
+  uint32_t           irq_events;
+  uint               irq_core;
+  uint32_t           irq_pending; /* GPIO_IRQ_EDGE_*, taken by sim_gpio_irq_dispatch */
+} sim_gpio_t;
+
+typedef struct {
+  pwm_config cfg;
+  bool       enabled;
+} sim_pwm_slice_t;
+
+static sim_gpio_t      gpios[NUM_BANK0_GPIOS];
+static sim_pwm_slice_t slices[NUM_PWM_SLICES];
+
+/* Like on the chip every core has its own callback and pending gpios. */
+static gpio_irq_callback_t irq_callback[2];
+static uint32_t            irq_pending[2];
+
+_Static_assert(NUM_BANK0_GPIOS <= 32, "pending gpios are a 32-bit mask");
+
+void
+gpio_init(uint gpio)
+{
+  gpios[gpio].function = GPIO_FUNC_SIO;
+  gpios[gpio].out      = false;
+  gpios[gpio].value    = false;
+}
+
+void
+gpio_set_function(uint gpio, enum gpio_function fn)
+{
+  gpios[gpio].function = fn;
+}
+
+void
+gpio_set_dir(uint gpio, bool out)
+{
+  gpios[gpio].out = out;
+}
+
+void
+gpio_pull_up(uint gpio)
+{
+  gpios[gpio].pull_up = true;
+}
+
+void
+gpio_put(uint gpio, bool value)
+{
+  const bool changed = gpios[gpio].value != value;
+
+  gpios[gpio].value = value;
+
+  if (changed)
+    sim_spi_cs_changed(gpio, value);
+}
+
+bool
+gpio_get(uint gpio)
+{
+  if (!gpios[gpio].out && gpios[gpio].driven)
+    return gpios[gpio].input;
+
+  if (!gpios[gpio].out && gpios[gpio].pull_up)
+    return true;
+
+  return gpios[gpio].value;
+}
+
+void
+gpio_set_irq_enabled_with_callback(uint                gpio,
+                                   uint32_t            event_mask,
+                                   bool                enabled,
+                                   gpio_irq_callback_t callback)
+{
+  const uint core = get_core_num();
+
+  irq_callback[core]   = callback;
+  gpios[gpio].irq_core = core;
+
+  if (enabled)
+    gpios[gpio].irq_events |= event_mask;
+  else
+    gpios[gpio].irq_events &= ~event_mask;
+}
+
+/*
+ * A device outside the chip drives an input. Edges the firmware asked for
+ * are latched and the owning core is woken up, the callback runs the next
+ * time that core calls sim_gpio_irq_dispatch.
+ */
+void
+sim_gpio_drive(uint gpio, bool value)
+{
+  const bool previous = gpio_get(gpio);
+
+  gpios[gpio].input  = value;
+  gpios[gpio].driven = true;
+
+  if (previous == value)
+    return;
+
+  const uint32_t event = value ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL;
+  const uint     core  = gpios[gpio].irq_core;
+
+  if (!(gpios[gpio].irq_events & event))
+    return;
+
+  __atomic_fetch_or(&gpios[gpio].irq_pending, event, __ATOMIC_RELAXED);
+  __atomic_fetch_or(&irq_pending[core], 1u << gpio, __ATOMIC_RELEASE);
+  sim_irq_wake(core);
+}
+
+void
+sim_gpio_irq_dispatch(void)
+{
+  const uint core    = get_core_num();
+  uint32_t   pending = __atomic_exchange_n(&irq_pending[core], 0, __ATOMIC_ACQUIRE);
+
+  while (pending) {
+    const uint     gpio   = __builtin_ctz(pending);
+    const uint32_t events = __atomic_exchange_n(&gpios[gpio].irq_pending, 0, __ATOMIC_RELAXED);
+
+    pending &= pending - 1;
+
+    if (events && irq_callback[core])
+      irq_callback[core](gpio, events);
+  }
+}
+
+bool
+sim_gpio_get_out(uint gpio)
+{
+  return gpios[gpio].value;
+}
+
+void
+pwm_init(uint slice_num, pwm_config* c, bool start)
+{
+  slices[slice_num].cfg     = *c;
+  slices[slice_num].enabled = start;
+}
+
+void
+pwm_set_enabled(uint slice_num, bool enabled)
+{
+  slices[slice_num].enabled = enabled;
+}
+
+void
+pwm_set_irq_enabled(uint slice_num, bool enabled)
+{
+  (void) slice_num;
+  (void) enabled;
+}
+
+void
+pwm_set_gpio_level(uint gpio, uint16_t level)
+{
+  gpios[gpio].level = level;
+}
+
+uint16_t
+sim_pwm_get_level(uint gpio)
+{
+  return gpios[gpio].level;
+}
+
+uint16_t
+sim_pwm_get_wrap(uint gpio)
+{
+  return slices[pwm_gpio_to_slice_num(gpio)].cfg.top;
+}
+
+bool
+sim_pwm_is_enabled(uint gpio)
+{
+  return gpios[gpio].function == GPIO_FUNC_PWM
+      && slices[pwm_gpio_to_slice_num(gpio)].enabled;
+}
+
+double
+sim_pwm_get_duty(uint gpio)
+{
+  if (!sim_pwm_is_enabled(gpio))
+    return 0.0;
+
+  const double top = (double) sim_pwm_get_wrap(gpio) + 1.0;
+  const double on  = (double) sim_pwm_get_level(gpio);
+
+  return on >= top ? 1.0 : on / top;
+}
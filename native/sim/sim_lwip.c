@@ -0,0 +1,329 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "lwip/tcp.h"
+
+#include "common.h"
+#include "sim.h"
+
+/*
+ * Loopback lwIP, see lwip/tcp.h.
+ *
+ * The listening port is the one requested by the firmware, unless
+ * FURNACE_SIM_PORT overrides it so several simulations can run side by side.
+ */
+
+#define SIM_TCP_MAX_PCBS 4
+
+/*
+ * furnace.c terminates the received string at recv_buffer[p->tot_len],
+ * so never hand it a segment that fills its whole BUF_SIZE buffer.
+ */
+#define SIM_TCP_MSS (BUF_SIZE - 1)
+
+static struct tcp_pcb pcbs[SIM_TCP_MAX_PCBS];
+
+static struct netif  sim_netif = { .ip_addr = { .addr = 0x0100007f } };
+struct netif*        netif_list = &sim_netif;
+
+char*
+ip4addr_ntoa(const ip4_addr_t* addr)
+{
+  static char buf[INET_ADDRSTRLEN];
+  struct in_addr in = { .s_addr = addr->addr };
+
+  return (char*) inet_ntop(AF_INET, &in, buf, sizeof(buf));
+}
+
+u16_t
+pbuf_copy_partial(const struct pbuf* p, void* dataptr, u16_t len, u16_t offset)
+{
+  u16_t copied = 0;
+
+  for (; p && len; p = p->next) {
+    if (offset >= p->len) {
+      offset -= p->len;
+      continue;
+    }
+
+    u16_t n = p->len - offset;
+    if (n > len)
+      n = len;
+
+    memcpy((uint8_t*) dataptr + copied, (const uint8_t*) p->payload + offset, n);
+
+    copied += n;
+    len    -= n;
+    offset  = 0;
+  }
+
+  return copied;
+}
+
+u8_t
+pbuf_free(struct pbuf* p)
+{
+  /* Segments live in a static buffer of sim_lwip_poll(). */
+  (void) p;
+
+  return 1;
+}
+
+static struct tcp_pcb*
+sim_pcb_alloc(void)
+{
+  for (size_t i = 0; i < SIM_TCP_MAX_PCBS; i++) {
+    if (pcbs[i].in_use)
+      continue;
+
+    memset(&pcbs[i], 0, sizeof(pcbs[i]));
+    pcbs[i].in_use = true;
+    pcbs[i].fd     = -1;
+    pcbs[i].state  = CLOSED;
+
+    return &pcbs[i];
+  }
+
+  return NULL;
+}
+
+static void
+sim_pcb_free(struct tcp_pcb* pcb)
+{
+  if (pcb->fd >= 0)
+    close(pcb->fd);
+
+  pcb->fd     = -1;
+  pcb->state  = CLOSED;
+  pcb->in_use = false;
+}
+
+struct tcp_pcb*
+tcp_new_ip_type(u8_t type)
+{
+  (void) type;
+
+  return sim_pcb_alloc();
+}
+
+err_t
+tcp_bind(struct tcp_pcb* pcb, const ip_addr_t* ipaddr, u16_t port)
+{
+  (void) ipaddr;
+
+  const char* override = getenv("FURNACE_SIM_PORT");
+
+  pcb->local_port = override ? (u16_t) atoi(override) : port;
+
+  return ERR_OK;
+}
+
+struct tcp_pcb*
+tcp_listen_with_backlog(struct tcp_pcb* pcb, u8_t backlog)
+{
+  const int one = 1;
+  struct sockaddr_in addr = {
+    .sin_family      = AF_INET,
+    .sin_port        = htons(pcb->local_port),
+    .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+  };
+
+  const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (fd < 0)
+    return NULL;
+
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) || listen(fd, backlog)) {
+    close(fd);
+    return NULL;
+  }
+
+  pcb->fd    = fd;
+  pcb->state = LISTEN;
+
+  return pcb;
+}
+
+err_t
+tcp_close(struct tcp_pcb* pcb)
+{
+  sim_pcb_free(pcb);
+
+  return ERR_OK;
+}
+
+void
+tcp_abort(struct tcp_pcb* pcb)
+{
+  sim_pcb_free(pcb);
+}
+
+void
+tcp_arg(struct tcp_pcb* pcb, void* arg)
+{
+  pcb->callback_arg = arg;
+}
+
+void
+tcp_accept(struct tcp_pcb* pcb, tcp_accept_fn accept)
+{
+  pcb->accept = accept;
+}
+
+void
+tcp_recv(struct tcp_pcb* pcb, tcp_recv_fn recv)
+{
+  pcb->recv = recv;
+}
+
+void
+tcp_err(struct tcp_pcb* pcb, tcp_err_fn err)
+{
+  pcb->errf = err;
+}
+
+err_t
+tcp_write(struct tcp_pcb* pcb, const void* dataptr, u16_t len, u8_t apiflags)
+{
+  (void) apiflags;
+
+  if (!pcb || pcb->state != ESTABLISHED)
+    return ERR_CONN;
+
+  const ssize_t n = send(pcb->fd, dataptr, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+  if (n == len)
+    return ERR_OK;
+
+  if (n >= 0 || errno == EAGAIN || errno == EWOULDBLOCK)
+    return ERR_MEM;
+
+  return ERR_CONN;
+}
+
+void
+tcp_recved(struct tcp_pcb* pcb, u16_t len)
+{
+  (void) pcb;
+  (void) len;
+}
+
+err_t
+tcp_output(struct tcp_pcb* pcb)
+{
+  (void) pcb;
+
+  return ERR_OK;
+}
+
+static void
+sim_lwip_accept(struct tcp_pcb* listener)
+{
+  const int fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK);
+  if (fd < 0)
+    return;
+
+  struct tcp_pcb* pcb = sim_pcb_alloc();
+  if (!pcb) {
+    close(fd);
+    return;
+  }
+
+  pcb->fd           = fd;
+  pcb->state        = ESTABLISHED;
+  pcb->local_port   = listener->local_port;
+  pcb->callback_arg = listener->callback_arg;
+
+  if (!listener->accept || listener->accept(listener->callback_arg, pcb, ERR_OK) != ERR_OK)
+    sim_pcb_free(pcb);
+}
+
+static void
+sim_lwip_receive(struct tcp_pcb* pcb)
+{
+  static uint8_t payload[SIM_TCP_MSS];
+  static struct pbuf p;
+
+  const ssize_t n = recv(pcb->fd, payload, sizeof(payload), MSG_DONTWAIT);
+
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return;
+
+  if (n < 0) {
+    /* lwIP frees the pcb before reporting a fatal error. */
+    tcp_err_fn errf = pcb->errf;
+    void*      arg  = pcb->callback_arg;
+
+    sim_pcb_free(pcb);
+
+    if (errf)
+      errf(arg, ERR_RST);
+
+    return;
+  }
+
+  if (!pcb->recv)
+    return;
+
+  if (n == 0) {
+    /* Remote end closed the connection. */
+    pcb->recv(pcb->callback_arg, pcb, NULL, ERR_OK);
+    return;
+  }
+
+  p.next    = NULL;
+  p.payload = payload;
+  p.tot_len = (u16_t) n;
+  p.len     = (u16_t) n;
+
+  pcb->recv(pcb->callback_arg, pcb, &p, ERR_OK);
+}
+
+void
+sim_lwip_poll(void)
+{
+  for (size_t i = 0; i < SIM_TCP_MAX_PCBS; i++) {
+    struct tcp_pcb* pcb = &pcbs[i];
+
+    if (!pcb->in_use)
+      continue;
+
+    if (pcb->state == LISTEN)
+      sim_lwip_accept(pcb);
+    else if (pcb->state == ESTABLISHED)
+      sim_lwip_receive(pcb);
+  }
+}
+
+size_t
+sim_lwip_pollfds(struct pollfd* fds, size_t max)
+{
+  size_t n = 0;
+
+  for (size_t i = 0; i < SIM_TCP_MAX_PCBS && n < max; i++) {
+    const struct tcp_pcb* pcb = &pcbs[i];
+
+    if (!pcb->in_use || pcb->fd < 0)
+      continue;
+
+    if (pcb->state != LISTEN && pcb->state != ESTABLISHED)
+      continue;
+
+    fds[n].fd      = pcb->fd;
+    fds[n].events  = POLLIN;
+    fds[n].revents = 0;
+    n++;
+  }
+
+  return n;
+}
@@ -0,0 +1,421 @@
+#include <math.h>
+#include <string.h>
+
+#include "rtd.h"
+
+#include "sim.h"
+
+/*
+ * MAX31856 and MAX31865 models, see sim_max318xx.h.
+ *
+ * Register numbers and bits are spelled out here rather than taken from
+ * max31856.h and max31865.h: the model follows the datasheets, so a
+ * mistake in the driver headers shows up as a test failure instead of
+ * being copied into the device.
+ */
+
+/* MAX31856 */
+#define CR0           0x00
+#define CR1           0x01
+#define CJHF          0x03
+#define CJLF          0x04
+#define LTHFTH        0x05
+#define LTLFTH        0x07
+#define CJTO          0x09
+#define CJTH          0x0a
+#define LTCBH         0x0c
+#define SR            0x0f
+
+#define CR0_CMODE     0x80
+#define CR0_1SHOT     0x40
+#define CR0_OCFAULT   0x30
+#define CR0_CJ        0x08 /* cold junction sensor disabled */
+#define CR0_FAULT     0x04 /* interrupt mode, faults latch until cleared */
+#define CR0_FAULTCLR  0x02
+#define CR0_50HZ      0x01
+
+#define SR_CJ_RANGE   0x80
+#define SR_TC_RANGE   0x40
+#define SR_CJHIGH     0x20
+#define SR_CJLOW      0x10
+#define SR_TCHIGH     0x08
+#define SR_TCLOW      0x04
+#define SR_OVUV       0x02
+#define SR_OPEN       0x01
+
+/* MAX31865 */
+#define CONF          0x00
+#define RTD_MSB       0x01
+#define HFT_MSB       0x03
+#define LFT_MSB       0x05
+#define FS            0x07
+
+#define CONF_VBIAS    0x80
+#define CONF_AUTO     0x40
+#define CONF_1SHOT    0x20
+#define CONF_FAULTCLR 0x02
+#define CONF_50HZ     0x01
+
+#define FS_HIGH       0x80
+#define FS_LOW        0x40
+#define FS_REFIN_HIGH 0x20
+#define FS_OVUV       0x04
+
+/* Typical conversion times from the datasheets. */
+#define MAX31856_AUTO_50HZ_US  100000
+#define MAX31856_AUTO_60HZ_US  83333
+#define MAX31856_SHOT_50HZ_US  169000
+#define MAX31856_SHOT_60HZ_US  143000
+#define MAX31865_AUTO_50HZ_US  20000
+#define MAX31865_AUTO_60HZ_US  16667
+#define MAX31865_SHOT_50HZ_US  62500
+#define MAX31865_SHOT_60HZ_US  52000
+
+/* Thermocouple ranges in C by CR1.TC_TYPE, voltage modes pass anything. */
+static const struct {
+  double lo, hi;
+} tc_range[16] = {
+  { 250, 1820 },  /* B */
+  { -200, 1000 }, /* E */
+  { -210, 1200 }, /* J */
+  { -200, 1372 }, /* K */
+  { -200, 1300 }, /* N */
+  { -50, 1768 },  /* R */
+  { -50, 1768 },  /* S */
+  { -200, 400 },  /* T */
+  [8 ... 15] = { -INFINITY, INFINITY },
+};
+
+static uint8_t
+sim_max318xx_regs(const sim_max318xx_t* m)
+{
+  return m->chip == SIM_MAX31856 ? 16 : 8;
+}
+
+static bool
+sim_max318xx_writable(const sim_max318xx_t* m, uint8_t reg)
+{
+  if (m->chip == SIM_MAX31865)
+    return reg == CONF || (reg >= HFT_MSB && reg < FS);
+
+  /* The cold junction registers take a temperature while the sensor is off. */
+  if (reg == CJTH || reg == CJTH + 1)
+    return m->regs[CR0] & CR0_CJ;
+
+  return reg < CJTH;
+}
+
+static void
+sim_max318xx_drdy(sim_max318xx_t* m, bool value)
+{
+  if (m->drdy_pin >= 0)
+    sim_gpio_drive((uint) m->drdy_pin, value);
+}
+
+static double
+sim_max318xx_gaussian(sim_max318xx_t* m)
+{
+  double u[2];
+
+  for (int i = 0; i < 2; i++) {
+    m->rng ^= m->rng >> 12;
+    m->rng ^= m->rng << 25;
+    m->rng ^= m->rng >> 27;
+    u[i] = ((m->rng * 0x2545f4914f6cdd1dull) >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+  return sqrt(-2.0 * log(u[0] + 1e-300)) * cos(2.0 * M_PI * u[1]);
+}
+
+static uint8_t
+sim_max318xx_corrupt(sim_max318xx_t* m, uint8_t miso)
+{
+  if (m->bit_error_rate <= 0.0)
+    return miso;
+
+  for (int bit = 0; bit < 8; bit++) {
+    m->rng ^= m->rng >> 12;
+    m->rng ^= m->rng << 25;
+    m->rng ^= m->rng >> 27;
+
+    if (((m->rng * 0x2545f4914f6cdd1dull) >> 11) * (1.0 / 9007199254740992.0) < m->bit_error_rate) {
+      miso ^= 1u << bit;
+      m->flipped_bits++;
+    }
+  }
+
+  return miso;
+}
+
+/* Every step of CR1.AVGSEL doubles the samples, each one a filter period more. */
+static uint32_t
+sim_max31856_averaging_us(const sim_max318xx_t* m)
+{
+  const uint8_t avgsel = (m->regs[CR1] >> 4) & 7;
+
+  return ((1u << (avgsel > 4 ? 4 : avgsel)) - 1) * (m->regs[CR0] & CR0_50HZ ? 20000 : 16667);
+}
+
+uint32_t
+sim_max318xx_conversion_us(const sim_max318xx_t* m)
+{
+  if (m->chip == SIM_MAX31865)
+    return m->regs[CONF] & CONF_50HZ ? MAX31865_AUTO_50HZ_US : MAX31865_AUTO_60HZ_US;
+
+  return (m->regs[CR0] & CR0_50HZ ? MAX31856_AUTO_50HZ_US : MAX31856_AUTO_60HZ_US)
+       + sim_max31856_averaging_us(m);
+}
+
+static uint32_t
+sim_max318xx_one_shot_us(const sim_max318xx_t* m)
+{
+  if (m->chip == SIM_MAX31865)
+    return m->regs[CONF] & CONF_50HZ ? MAX31865_SHOT_50HZ_US : MAX31865_SHOT_60HZ_US;
+
+  return (m->regs[CR0] & CR0_50HZ ? MAX31856_SHOT_50HZ_US : MAX31856_SHOT_60HZ_US)
+       + sim_max31856_averaging_us(m);
+}
+
+static bool
+sim_max318xx_continuous(const sim_max318xx_t* m)
+{
+  if (m->chip == SIM_MAX31865)
+    return (m->regs[CONF] & (CONF_VBIAS | CONF_AUTO)) == (CONF_VBIAS | CONF_AUTO);
+
+  return m->regs[CR0] & CR0_CMODE;
+}
+
+static bool
+sim_max318xx_one_shot(const sim_max318xx_t* m)
+{
+  if (m->chip == SIM_MAX31865)
+    return (m->regs[CONF] & (CONF_VBIAS | CONF_1SHOT)) == (CONF_VBIAS | CONF_1SHOT);
+
+  return m->regs[CR0] & CR0_1SHOT;
+}
+
+/* A configuration write starts, stops or restarts conversions. */
+static void
+sim_max318xx_configure(sim_max318xx_t* m)
+{
+  const uint8_t clear = m->chip == SIM_MAX31856 ? CR0_FAULTCLR : CONF_FAULTCLR;
+
+  if (m->regs[0] & clear) {
+    m->regs[0] &= ~clear;
+    m->regs[m->chip == SIM_MAX31856 ? SR : FS] = 0;
+
+    if (m->chip == SIM_MAX31865)
+      m->regs[RTD_MSB + 1] &= ~1;
+  }
+
+  if (sim_max318xx_continuous(m)) {
+    if (m->next_conversion == at_the_end_of_time)
+      m->next_conversion = make_timeout_time_us(sim_max318xx_conversion_us(m));
+  } else if (sim_max318xx_one_shot(m)) {
+    m->next_conversion = make_timeout_time_us(sim_max318xx_one_shot_us(m));
+  } else {
+    m->next_conversion = at_the_end_of_time;
+  }
+}
+
+static void
+sim_max318xx_convert_31856(sim_max318xx_t* m)
+{
+  uint8_t sr = 0;
+
+  if (!(m->regs[CR0] & CR0_CJ)) {
+    const double  cj   = m->cold_c + (int8_t) m->regs[CJTO] / 16.0;
+    const int32_t code = (int32_t) lround(fmax(fmin(cj, 127.98), -128.0) * 64.0) * 4;
+
+    m->regs[CJTH]     = (uint8_t) (code >> 8);
+    m->regs[CJTH + 1] = (uint8_t) code;
+  }
+
+  const double cj = (int16_t) ((m->regs[CJTH] << 8) | m->regs[CJTH + 1]) / 256.0;
+  double       tc = m->celsius + m->noise_c * sim_max318xx_gaussian(m);
+
+  /* A floating input rails the ADC. */
+  if (m->open)
+    tc = 2047.0;
+
+  const int32_t ltc = (int32_t) lround(fmax(fmin(tc, 2047.99), -2048.0) * 128.0) * 32;
+
+  m->regs[LTCBH]     = (uint8_t) (ltc >> 16);
+  m->regs[LTCBH + 1] = (uint8_t) (ltc >> 8);
+  m->regs[LTCBH + 2] = (uint8_t) ltc;
+
+  const double t = ltc / 4096.0;
+
+  if (m->open && (m->regs[CR0] & CR0_OCFAULT))
+    sr |= SR_OPEN;
+  if (m->overvoltage)
+    sr |= SR_OVUV;
+  if (tc < tc_range[m->regs[CR1] & 0x0f].lo || tc > tc_range[m->regs[CR1] & 0x0f].hi)
+    sr |= SR_TC_RANGE;
+  if (cj < -55.0 || cj > 125.0)
+    sr |= SR_CJ_RANGE;
+  if (t > (int16_t) ((m->regs[LTHFTH] << 8) | m->regs[LTHFTH + 1]) / 16.0)
+    sr |= SR_TCHIGH;
+  if (t < (int16_t) ((m->regs[LTLFTH] << 8) | m->regs[LTLFTH + 1]) / 16.0)
+    sr |= SR_TCLOW;
+  if (cj > (int8_t) m->regs[CJHF])
+    sr |= SR_CJHIGH;
+  if (cj < (int8_t) m->regs[CJLF])
+    sr |= SR_CJLOW;
+
+  m->regs[SR] = m->regs[CR0] & CR0_FAULT ? m->regs[SR] | sr : sr;
+}
+
+static void
+sim_max318xx_convert_31865(sim_max318xx_t* m)
+{
+  const double r   = rtd_resistance(m->celsius + m->noise_c * sim_max318xx_gaussian(m))
+                   + CASUAL_WIRE_RES;
+  long         adc = lround(r / R_REF * MAX_ADC_VALUE);
+  uint8_t      fs  = 0;
+
+  /* Without the RTD REFIN- is pulled up to the bias and the ADC reads full scale. */
+  if (m->open) {
+    adc = MAX_ADC_VALUE - 1;
+    fs |= FS_REFIN_HIGH;
+  }
+
+  if (adc < 0)
+    adc = 0;
+  if (adc > (long) MAX_ADC_VALUE - 1)
+    adc = MAX_ADC_VALUE - 1;
+
+  const long hft = (m->regs[HFT_MSB] << 7) | (m->regs[HFT_MSB + 1] >> 1);
+  const long lft = (m->regs[LFT_MSB] << 7) | (m->regs[LFT_MSB + 1] >> 1);
+
+  if (adc > hft)
+    fs |= FS_HIGH;
+  if (adc < lft)
+    fs |= FS_LOW;
+  if (m->overvoltage)
+    fs |= FS_OVUV;
+
+  /* Fault status latches until cleared, bit 0 of RTD_LSB says whether any is set. */
+  m->regs[FS] |= fs;
+  m->regs[RTD_MSB]     = (uint8_t) (adc >> 7);
+  m->regs[RTD_MSB + 1] = (uint8_t) (adc << 1) | (m->regs[FS] ? 1 : 0);
+}
+
+static void
+sim_max318xx_convert(sim_max318xx_t* m)
+{
+  m->conversions++;
+
+  if (!m->stuck) {
+    if (m->chip == SIM_MAX31856)
+      sim_max318xx_convert_31856(m);
+    else
+      sim_max318xx_convert_31865(m);
+  }
+
+  sim_max318xx_drdy(m, 0);
+}
+
+static void
+sim_max318xx_select(sim_spi_device_t* dev)
+{
+  sim_max318xx_t* m = (sim_max318xx_t*) dev;
+
+  m->addressed = false;
+}
+
+static uint8_t
+sim_max318xx_transfer(sim_spi_device_t* dev, uint8_t mosi)
+{
+  sim_max318xx_t* m = (sim_max318xx_t*) dev;
+
+  if (!m->addressed) {
+    m->addressed = true;
+    m->write     = mosi & 0x80;
+    m->addr      = (mosi & 0x7f) % sim_max318xx_regs(m);
+    return sim_max318xx_corrupt(m, 0xff);
+  }
+
+  const uint8_t reg = m->addr;
+
+  m->addr = (m->addr + 1) % sim_max318xx_regs(m);
+
+  if (m->write) {
+    if (sim_max318xx_writable(m, reg)) {
+      m->regs[reg] = mosi;
+
+      if (reg == 0)
+        sim_max318xx_configure(m);
+    }
+
+    return sim_max318xx_corrupt(m, 0xff);
+  }
+
+  /* Reading the first result register releases DRDY. */
+  if (reg == (m->chip == SIM_MAX31856 ? LTCBH : RTD_MSB))
+    sim_max318xx_drdy(m, 1);
+
+  return sim_max318xx_corrupt(m, m->regs[reg]);
+}
+
+void
+sim_max318xx_init(sim_max318xx_t* m, sim_max318xx_chip_t chip, uint cs_pin, int drdy_pin)
+{
+  memset(m, 0, sizeof(*m));
+
+  m->dev.cs_pin   = cs_pin;
+  m->dev.select   = sim_max318xx_select;
+  m->dev.transfer = sim_max318xx_transfer;
+  m->dev.deselect = NULL;
+
+  m->chip            = chip;
+  m->drdy_pin        = drdy_pin;
+  m->celsius         = 25.0;
+  m->cold_c          = 25.0;
+  m->rng             = 0x9e3779b97f4a7c15ull ^ cs_pin;
+  m->next_conversion = at_the_end_of_time;
+
+  if (chip == SIM_MAX31856) {
+    m->regs[CR1]        = 0x03;
+    m->regs[0x02]       = 0xff; /* MASK */
+    m->regs[CJHF]       = 0x7f;
+    m->regs[CJLF]       = 0xc0;
+    m->regs[LTHFTH]     = 0x7f;
+    m->regs[LTHFTH + 1] = 0xff;
+    m->regs[LTLFTH]     = 0x80;
+  } else {
+    m->regs[HFT_MSB]     = 0xff;
+    m->regs[HFT_MSB + 1] = 0xff;
+  }
+
+  sim_max318xx_drdy(m, 1);
+}
+
+void
+sim_max318xx_poll(sim_max318xx_t* m)
+{
+  const absolute_time_t now = get_absolute_time();
+
+  if (now < m->next_conversion)
+    return;
+
+  if (!sim_max318xx_continuous(m)) {
+    /* One-shot done, the bit clears itself. */
+    m->regs[0] &= m->chip == SIM_MAX31856 ? ~CR0_1SHOT : ~CONF_1SHOT;
+    m->next_conversion = at_the_end_of_time;
+  } else {
+    /* Conversions missed while nobody polled are gone, only the last one counts. */
+    const uint32_t period = sim_max318xx_conversion_us(m);
+    const uint64_t behind = now - m->next_conversion;
+
+    m->next_conversion += (behind / period + 1) * period;
+  }
+
+  sim_max318xx_convert(m);
+}
+
+absolute_time_t
+sim_max318xx_next_event(const sim_max318xx_t* m)
+{
+  return m->next_conversion;
+}
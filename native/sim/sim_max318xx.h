@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pico/types.h"
+#include "pico/time.h"
+
+/*
+ * Register level models of the MAX31856 thermocouple and MAX31865 RTD
+ * converters, as seen over SPI.
+ *
+ * Both answer the byte sequences the datasheets describe: the first byte
+ * of a transaction is the address with bit 7 set for a write, following
+ * bytes read or write consecutive registers and the address wraps around
+ * at the end of the register file. Read-only registers ignore writes.
+ *
+ * Conversions run on the simulated clock at the rate the configuration
+ * selects, automatic or one-shot, and latch the temperature, the fault
+ * status and the DRDY pin the way the real parts do. Thresholds, fault
+ * status clear and the comparator/interrupt fault modes of the MAX31856
+ * are modelled, the MAX31865 fault detection cycle is not.
+ *
+ * The fields under "faults" can be changed at any time to break the
+ * sensor: an open input, results that stop updating, noise on every
+ * conversion, over/under voltage and random bit flips on MISO.
+ *
+ * A model is not tied to CONFIG_THERMO, host tests can put either chip on
+ * any chip select. sim_board.c wires up the ones the firmware expects.
+ */
+
+typedef enum {
+  SIM_MAX31856,
+  SIM_MAX31865,
+} sim_max318xx_chip_t;
+
+#define SIM_MAX318xx_REGS 16
+
+typedef struct {
+  sim_spi_device_t    dev;
+  sim_max318xx_chip_t chip;
+  int                 drdy_pin;     /* -1 when not wired */
+
+  uint8_t             regs[SIM_MAX318xx_REGS];
+  uint8_t             addr;
+  bool                write;
+  bool                addressed;
+  absolute_time_t     next_conversion;
+
+  /* What the sensor sees. */
+  double              celsius;
+  double              cold_c;       /* MAX31856 cold junction */
+
+  /* faults */
+  bool                open;
+  bool                stuck;        /* result registers keep their last value */
+  bool                overvoltage;
+  double              noise_c;      /* standard deviation per conversion */
+  double              bit_error_rate; /* per bit clocked out on MISO */
+
+  uint64_t            rng;
+  uint32_t            conversions;
+  uint32_t            flipped_bits;
+} sim_max318xx_t;
+
+/* Power-on state, conversions stay off until the configuration starts them. */
+void            sim_max318xx_init(sim_max318xx_t* m, sim_max318xx_chip_t chip,
+                                  uint cs_pin, int drdy_pin);
+void            sim_max318xx_poll(sim_max318xx_t* m);
+absolute_time_t sim_max318xx_next_event(const sim_max318xx_t* m);
+
+/* Time between automatic conversions with the current configuration. */
+uint32_t        sim_max318xx_conversion_us(const sim_max318xx_t* m);
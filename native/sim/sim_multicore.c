@@ -0,0 +1,289 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "hardware/sync.h"
+#include "pico/multicore.h"
+#include "pico/time.h"
+
+#include "sim.h"
+
+/*
+ * The second core and the SEV/WFE event registers.
+ *
+ * On the real clock core1 is a host thread, so the SPSC rings between the
+ * cores are exercised with real concurrency. Core1 holds core1_running
+ * except while it waits for an event, which is where the multicore lockout
+ * parks it.
+ *
+ * On the virtual clock that would make the simulation nondeterministic, so
+ * core1 becomes a coroutine instead: sim_board_poll switches to it whenever
+ * it has an event pending or its timeout passed, and it switches back as
+ * soon as it waits again. Core0 never runs concurrently with it then, which
+ * also makes the lockout a no-op.
+ */
+
+#define SIM_CORE1_STACK_SIZE (256 * 1024)
+
+static __thread uint this_core;
+
+static pthread_mutex_t event_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  event_cond;
+static bool            event[2];
+static int             event_fd = -1;
+
+static void          (*core1_entry)(void);
+static bool            core1_launched;
+static bool            core1_coroutine;
+
+static pthread_t       core1_thread;
+static pthread_mutex_t core1_running = PTHREAD_MUTEX_INITIALIZER;
+
+static ucontext_t      core0_uc;
+static ucontext_t      core1_uc;
+static absolute_time_t core1_timeout;
+
+__attribute__((constructor)) static void
+sim_multicore_init(void)
+{
+  pthread_condattr_t attr;
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&event_cond, &attr);
+  pthread_condattr_destroy(&attr);
+
+  event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+uint
+get_core_num(void)
+{
+  return this_core;
+}
+
+static void
+sim_event_set(bool core0, bool core1)
+{
+  pthread_mutex_lock(&event_lock);
+  event[0] |= core0;
+  event[1] |= core1;
+  pthread_cond_broadcast(&event_cond);
+  pthread_mutex_unlock(&event_lock);
+
+  const uint64_t one = 1;
+  if (core0 && write(event_fd, &one, sizeof(one)) < 0) {
+    /* Counter saturated, core0 has a wake up pending anyway. */
+  }
+}
+
+void
+__sev(void)
+{
+  sim_event_set(true, true);
+}
+
+/* An interrupt for that core is pending, it wakes it up from WFE. */
+void
+sim_irq_wake(uint core)
+{
+  sim_event_set(core == 0, core == 1);
+}
+
+int
+sim_event_fd(void)
+{
+  return event_fd;
+}
+
+bool
+sim_event_take(void)
+{
+  uint64_t count;
+
+  pthread_mutex_lock(&event_lock);
+  const bool pending = event[this_core];
+  event[this_core] = false;
+  pthread_mutex_unlock(&event_lock);
+
+  if (this_core == 0 && read(event_fd, &count, sizeof(count)) < 0) {
+    /* Nothing to drain. */
+  }
+
+  return pending;
+}
+
+static void
+timeout_to_timespec(absolute_time_t timeout, struct timespec* ts)
+{
+  const int64_t us = absolute_time_diff_us(get_absolute_time(), timeout);
+
+  clock_gettime(CLOCK_MONOTONIC, ts);
+
+  if (us <= 0)
+    return;
+
+  ts->tv_sec  += us / 1000000;
+  ts->tv_nsec += (us % 1000000) * 1000;
+
+  if (ts->tv_nsec >= 1000000000) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000;
+  }
+}
+
+bool
+best_effort_wfe_or_timeout(absolute_time_t timeout)
+{
+  if (core1_coroutine && this_core == 1) {
+    core1_timeout = timeout;
+    swapcontext(&core1_uc, &core0_uc);
+    sim_gpio_irq_dispatch();
+
+    return get_absolute_time() >= timeout;
+  }
+
+  if (sim_time_is_virtual()) {
+    if (!sim_event_take())
+      sleep_until(timeout);
+    sim_gpio_irq_dispatch();
+
+    return get_absolute_time() >= timeout;
+  }
+
+  pthread_mutex_lock(&event_lock);
+
+  if (this_core == 1)
+    pthread_mutex_unlock(&core1_running);
+
+  while (!event[this_core] && get_absolute_time() < timeout) {
+    if (timeout == at_the_end_of_time) {
+      pthread_cond_wait(&event_cond, &event_lock);
+    } else {
+      struct timespec ts;
+
+      timeout_to_timespec(timeout, &ts);
+      pthread_cond_timedwait(&event_cond, &event_lock, &ts);
+    }
+  }
+
+  event[this_core] = false;
+  pthread_mutex_unlock(&event_lock);
+
+  if (this_core == 1)
+    pthread_mutex_lock(&core1_running);
+
+  sim_gpio_irq_dispatch();
+
+  return get_absolute_time() >= timeout;
+}
+
+static void
+core1_coroutine_main(void)
+{
+  core1_entry();
+
+  fprintf(stderr, "sim: core1 returned\n");
+  abort();
+}
+
+static void*
+core1_thread_main(void* arg)
+{
+  (void) arg;
+
+  this_core = 1;
+  pthread_mutex_lock(&core1_running);
+
+  core1_entry();
+
+  pthread_mutex_unlock(&core1_running);
+
+  return NULL;
+}
+
+void
+multicore_launch_core1(void (*entry)(void))
+{
+  if (core1_launched) {
+    fprintf(stderr, "sim: core1 launched twice\n");
+    abort();
+  }
+
+  core1_entry    = entry;
+  core1_launched = true;
+
+  if (!sim_time_is_virtual()) {
+    if (pthread_create(&core1_thread, NULL, core1_thread_main, NULL) != 0) {
+      perror("sim: core1");
+      abort();
+    }
+
+    return;
+  }
+
+  void* stack = malloc(SIM_CORE1_STACK_SIZE);
+  if (!stack) {
+    perror("sim: core1 stack");
+    abort();
+  }
+
+  getcontext(&core1_uc);
+  core1_uc.uc_stack.ss_sp   = stack;
+  core1_uc.uc_stack.ss_size = SIM_CORE1_STACK_SIZE;
+  core1_uc.uc_link          = NULL;
+  makecontext(&core1_uc, core1_coroutine_main, 0);
+
+  core1_coroutine = true;
+  core1_timeout   = nil_time;
+}
+
+void
+sim_multicore_poll(void)
+{
+  if (!core1_coroutine || this_core == 1)
+    return;
+
+  pthread_mutex_lock(&event_lock);
+  const bool pending = event[1];
+  event[1] = false;
+  pthread_mutex_unlock(&event_lock);
+
+  if (!pending && get_absolute_time() < core1_timeout)
+    return;
+
+  this_core = 1;
+  swapcontext(&core0_uc, &core1_uc);
+  this_core = 0;
+}
+
+absolute_time_t
+sim_multicore_core1_timeout(void)
+{
+  return core1_coroutine ? core1_timeout : at_the_end_of_time;
+}
+
+void
+multicore_lockout_victim_init(void)
+{
+}
+
+void
+multicore_lockout_start_blocking(void)
+{
+  if (core1_launched && !core1_coroutine)
+    pthread_mutex_lock(&core1_running);
+}
+
+void
+multicore_lockout_end_blocking(void)
+{
+  if (core1_launched && !core1_coroutine)
+    pthread_mutex_unlock(&core1_running);
+}
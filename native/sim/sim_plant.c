@@ -0,0 +1,185 @@
+#include <math.h>
+#include <string.h>
+
+#include "sim_plant.h"
+
+#define KELVIN 273.15
+
+/*
+ * About 2.5 kW into a 20 kJ/K chamber, tops out around 1200 C and heats
+ * at ~7 C/min from cold, with the thermocouple a few cm behind a ceramic
+ * muffle.
+ */
+const sim_plant_params_t sim_plant_furnace = {
+  .name            = "furnace",
+  .heater_power_w  = 2500.0,
+  .ssr_half_cycles = 12.5, /* 50 Hz mains, 8 Hz PWM */
+  .thermal_mass_jk = 20000.0,
+  .loss_wk         = 1.6,
+  .radiation_wk4   = 1.5e-10,
+  .ambient_c       = 25.0,
+  .dead_time_s     = 20.0,
+  .sensor_lag_s    = 30.0,
+  .noise_c         = 0.0,
+};
+
+/* Small aluminium plate with a PT100 glued underneath. */
+const sim_plant_params_t sim_plant_hotplate = {
+  .name            = "hotplate",
+  .heater_power_w  = 400.0,
+  .ssr_half_cycles = 12.5,
+  .thermal_mass_jk = 900.0,
+  .loss_wk         = 1.2,
+  .radiation_wk4   = 0.0,
+  .ambient_c       = 25.0,
+  .dead_time_s     = 2.0,
+  .sensor_lag_s    = 5.0,
+  .noise_c         = 0.0,
+};
+
+const sim_plant_params_t*
+sim_plant_find(const char* name)
+{
+  static const sim_plant_params_t* const plants[] = {
+    &sim_plant_furnace,
+    &sim_plant_hotplate,
+  };
+
+  for (size_t i = 0; i < sizeof(plants) / sizeof(plants[0]); i++)
+    if (strcmp(plants[i]->name, name) == 0)
+      return plants[i];
+
+  return NULL;
+}
+
+double
+sim_plant_power(const sim_plant_params_t* params, double duty)
+{
+  if (duty < 0.0)
+    duty = 0.0;
+  if (duty > 1.0)
+    duty = 1.0;
+
+  /* Held on (burst firing) it is on, not a rounded up half-cycle more. */
+  if (params->ssr_half_cycles > 0.0 && duty < 1.0)
+    duty = round(duty * params->ssr_half_cycles) / params->ssr_half_cycles;
+
+  return params->heater_power_w * duty;
+}
+
+static double
+sim_plant_losses(const sim_plant_params_t* params, double temp_c)
+{
+  const double t  = temp_c + KELVIN;
+  const double ta = params->ambient_c + KELVIN;
+
+  return params->loss_wk * (temp_c - params->ambient_c)
+       + params->radiation_wk4 * (t * t * t * t - ta * ta * ta * ta);
+}
+
+double
+sim_plant_equilibrium(const sim_plant_params_t* params, double duty)
+{
+  const double power = sim_plant_power(params, duty);
+  double lo = params->ambient_c, hi = params->ambient_c + 5000.0;
+
+  /* Losses are monotonic in temperature, bisect for the balance point. */
+  for (int i = 0; i < 64; i++) {
+    const double mid = 0.5 * (lo + hi);
+
+    if (sim_plant_losses(params, mid) < power)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  return 0.5 * (lo + hi);
+}
+
+void
+sim_plant_init(sim_plant_t* plant, const sim_plant_params_t* params)
+{
+  memset(plant, 0, sizeof(*plant));
+
+  plant->p        = *params;
+  plant->temp_c   = params->ambient_c;
+  plant->sensor_c = params->ambient_c;
+  plant->rng      = 0x853c49e6748fea9bull;
+
+  plant->delay_len = (unsigned) lround(params->dead_time_s / SIM_PLANT_STEP_S);
+  if (plant->delay_len >= SIM_PLANT_MAX_DELAY)
+    plant->delay_len = SIM_PLANT_MAX_DELAY - 1;
+
+  for (unsigned i = 0; i <= plant->delay_len; i++)
+    plant->delay[i] = params->ambient_c;
+}
+
+static void
+sim_plant_step(sim_plant_t* plant, double power_w)
+{
+  const double dt = SIM_PLANT_STEP_S;
+  const double dT = (power_w - sim_plant_losses(&plant->p, plant->temp_c))
+                  / plant->p.thermal_mass_jk;
+
+  plant->temp_c   += dT * dt;
+  plant->energy_j += power_w * dt;
+
+  /* Transport delay, then the thermocouple's own lag. */
+  plant->delay[plant->delay_pos] = plant->temp_c;
+  plant->delay_pos = (plant->delay_pos + 1) % (plant->delay_len + 1);
+
+  const double seen = plant->delay[plant->delay_pos];
+
+  if (plant->p.sensor_lag_s > 0.0)
+    plant->sensor_c += (seen - plant->sensor_c) * (1.0 - exp(-dt / plant->p.sensor_lag_s));
+  else
+    plant->sensor_c = seen;
+}
+
+void
+sim_plant_advance(sim_plant_t* plant, double duty, double dt_s)
+{
+  plant->power_w = sim_plant_power(&plant->p, duty);
+
+  /*
+   * The heater may switch within a step, the dither in pwm.c does every
+   * PWM period: each step gets the power applied over it on average.
+   */
+  while (plant->carry_s + dt_s >= SIM_PLANT_STEP_S) {
+    const double part = SIM_PLANT_STEP_S - plant->carry_s;
+
+    sim_plant_step(plant, (plant->carry_j + plant->power_w * part) / SIM_PLANT_STEP_S);
+
+    plant->carry_s = 0.0;
+    plant->carry_j = 0.0;
+    dt_s -= part;
+  }
+
+  plant->carry_s += dt_s;
+  plant->carry_j += plant->power_w * dt_s;
+}
+
+static double
+sim_plant_gaussian(sim_plant_t* plant)
+{
+  /* xorshift64* feeding Box-Muller, deterministic between runs. */
+  double u[2];
+
+  for (int i = 0; i < 2; i++) {
+    plant->rng ^= plant->rng >> 12;
+    plant->rng ^= plant->rng << 25;
+    plant->rng ^= plant->rng >> 27;
+    u[i] = ((plant->rng * 0x2545f4914f6cdd1dull) >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+  return sqrt(-2.0 * log(u[0] + 1e-300)) * cos(2.0 * M_PI * u[1]);
+}
+
+double
+sim_plant_reading(sim_plant_t* plant)
+{
+  if (plant->p.noise_c <= 0.0)
+    return plant->sensor_c;
+
+  return plant->sensor_c + plant->p.noise_c * sim_plant_gaussian(plant);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+/*
+ * Lumped thermal model of a resistively heated furnace.
+ *
+ *   C dT/dt = P(duty) - G (T - Ta) - R (T^4 - Ta^4)
+ *
+ * P is the heater power after the SSR, which can only switch whole mains
+ * half cycles within each PWM period. The thermocouple sees the chamber
+ * through a transport delay followed by a first order lag, plus noise.
+ */
+
+#include <stdint.h>
+
+#define SIM_PLANT_STEP_S     0.1
+#define SIM_PLANT_MAX_DELAY  8192
+
+typedef struct {
+  const char* name;
+  double      heater_power_w;  /* at 100% duty */
+  double      ssr_half_cycles; /* mains half cycles per PWM period, 0 = ideal */
+  double      thermal_mass_jk;
+  double      loss_wk;         /* conduction through the insulation */
+  double      radiation_wk4;   /* emissivity * sigma * area, kelvin based */
+  double      ambient_c;
+  double      dead_time_s;
+  double      sensor_lag_s;
+  double      noise_c;         /* standard deviation of the reading */
+} sim_plant_params_t;
+
+typedef struct {
+  sim_plant_params_t p;
+
+  double   temp_c;   /* chamber */
+  double   sensor_c; /* thermocouple junction, noise free */
+  double   carry_s;  /* integration time not yet stepped */
+  double   carry_j;  /* heater energy over carry_s */
+  double   power_w;  /* last applied heater power */
+  double   energy_j;
+
+  double   delay[SIM_PLANT_MAX_DELAY];
+  unsigned delay_len;
+  unsigned delay_pos;
+
+  uint64_t rng;
+} sim_plant_t;
+
+extern const sim_plant_params_t sim_plant_furnace;
+extern const sim_plant_params_t sim_plant_hotplate;
+
+const sim_plant_params_t* sim_plant_find(const char* name);
+
+void   sim_plant_init(sim_plant_t* plant, const sim_plant_params_t* params);
+void   sim_plant_advance(sim_plant_t* plant, double duty, double dt_s);
+double sim_plant_reading(sim_plant_t* plant);
+double sim_plant_power(const sim_plant_params_t* params, double duty);
+double sim_plant_equilibrium(const sim_plant_params_t* params, double duty);
@@ -0,0 +1,88 @@
+#include "hardware/gpio.h"
+#include "hardware/spi.h"
+
+#include "sim.h"
+
+/*
+ * SPI master with devices hanging off it. Chip selects are plain gpios in
+ * the firmware, so a device is selected whenever its cs_pin is driven low
+ * and every byte clocked out on the bus is shifted through it.
+ */
+
+spi_inst_t sim_spi_inst[2];
+
+uint
+spi_init(spi_inst_t* spi, uint baudrate)
+{
+  return spi_set_baudrate(spi, baudrate);
+}
+
+uint
+spi_set_baudrate(spi_inst_t* spi, uint baudrate)
+{
+  spi->baudrate = baudrate;
+
+  return baudrate;
+}
+
+uint
+spi_get_baudrate(const spi_inst_t* spi)
+{
+  return spi->baudrate;
+}
+
+void
+spi_set_format(spi_inst_t* spi,
+               uint        data_bits,
+               spi_cpol_t  cpol,
+               spi_cpha_t  cpha,
+               spi_order_t order)
+{
+  (void) spi;
+  (void) data_bits;
+  (void) cpol;
+  (void) cpha;
+  (void) order;
+}
+
+void
+sim_spi_attach(spi_inst_t* spi, sim_spi_device_t* dev)
+{
+  dev->next    = spi->devices;
+  spi->devices = dev;
+}
+
+void
+sim_spi_cs_changed(uint gpio, bool value)
+{
+  for (size_t i = 0; i < sizeof(sim_spi_inst) / sizeof(sim_spi_inst[0]); i++) {
+    for (sim_spi_device_t* dev = sim_spi_inst[i].devices; dev; dev = dev->next) {
+      if (dev->cs_pin != gpio)
+        continue;
+
+      if (!value && dev->select)
+        dev->select(dev);
+      else if (value && dev->deselect)
+        dev->deselect(dev);
+    }
+  }
+}
+
+int
+spi_write_read_blocking(spi_inst_t* spi, const uint8_t* src, uint8_t* dst, size_t len)
+{
+  for (size_t i = 0; i < len; i++) {
+    uint8_t miso = 0xff; /* Pulled up when nobody drives the line. */
+
+    for (sim_spi_device_t* dev = spi->devices; dev; dev = dev->next) {
+      if (gpio_get(dev->cs_pin))
+        continue;
+
+      miso &= dev->transfer(dev, src[i]);
+    }
+
+    dst[i] = miso;
+  }
+
+  return (int) len;
+}
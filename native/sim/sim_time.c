@@ -0,0 +1,213 @@
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "pico/time.h"
+
+#include "sim.h"
+
+/*
+ * Host clock. Time starts at 0 when the process starts, the same way the
+ * RP2040 timer starts counting at reset.
+ *
+ * In virtual mode time only moves when the simulation says so: every pass
+ * through the board poll costs a fixed quantum and sleeping jumps straight
+ * to the wake up time, so the firmware runs as fast as the host allows.
+ */
+
+const absolute_time_t at_the_end_of_time = INT64_MAX;
+const absolute_time_t nil_time           = 0;
+
+static uint64_t
+host_monotonic_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000u + (uint64_t) ts.tv_nsec / 1000u;
+}
+
+static uint64_t boot_us;
+
+static bool     virtual_clock;
+static uint64_t virtual_us;
+
+__attribute__((constructor)) static void
+sim_time_init(void)
+{
+  boot_us = host_monotonic_us();
+}
+
+void
+sim_time_use_virtual(void)
+{
+  virtual_us    = time_us_64();
+  virtual_clock = true;
+}
+
+bool
+sim_time_is_virtual(void)
+{
+  return virtual_clock;
+}
+
+void
+sim_time_advance_us(uint64_t us)
+{
+  virtual_us += us;
+}
+
+uint64_t
+time_us_64(void)
+{
+  if (virtual_clock)
+    return virtual_us;
+
+  return host_monotonic_us() - boot_us;
+}
+
+absolute_time_t
+get_absolute_time(void)
+{
+  return time_us_64();
+}
+
+void
+sleep_until(absolute_time_t target)
+{
+  const absolute_time_t now = get_absolute_time();
+
+  if (target <= now)
+    return;
+
+  if (virtual_clock) {
+    virtual_us = target;
+    return;
+  }
+
+  const uint64_t us = target - now;
+  struct timespec ts = {
+    .tv_sec  = us / 1000000u,
+    .tv_nsec = (us % 1000000u) * 1000u,
+  };
+
+  while (nanosleep(&ts, &ts) && errno == EINTR)
+    ;
+}
+
+void
+sleep_us(uint64_t us)
+{
+  sleep_until(make_timeout_time_us(us));
+}
+
+void
+sleep_ms(uint32_t ms)
+{
+  sleep_us((uint64_t) ms * 1000u);
+}
+
+/*
+ * Repeating timers, a list sorted by when they are due. Either core may add
+ * or cancel one while core0 runs them, hence the lock.
+ */
+static pthread_mutex_t    timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static repeating_timer_t* timers;
+
+static void
+sim_timer_insert(repeating_timer_t* timer)
+{
+  repeating_timer_t** at = &timers;
+
+  while (*at && (*at)->next <= timer->next)
+    at = &(*at)->link;
+
+  timer->link = *at;
+  *at = timer;
+}
+
+static bool
+sim_timer_remove(repeating_timer_t* timer)
+{
+  for (repeating_timer_t** at = &timers; *at; at = &(*at)->link) {
+    if (*at == timer) {
+      *at = timer->link;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool
+add_repeating_timer_us(int64_t                    delay_us,
+                       repeating_timer_callback_t callback,
+                       void*                      user_data,
+                       repeating_timer_t*         out)
+{
+  if (delay_us == 0)
+    return false;
+
+  out->delay_us  = delay_us;
+  out->callback  = callback;
+  out->user_data = user_data;
+  out->next      = delayed_by_us(get_absolute_time(), delay_us < 0 ? -delay_us : delay_us);
+
+  pthread_mutex_lock(&timer_lock);
+  sim_timer_insert(out);
+  pthread_mutex_unlock(&timer_lock);
+
+  return true;
+}
+
+bool
+cancel_repeating_timer(repeating_timer_t* timer)
+{
+  pthread_mutex_lock(&timer_lock);
+  const bool found = sim_timer_remove(timer);
+  pthread_mutex_unlock(&timer_lock);
+
+  return found;
+}
+
+absolute_time_t
+sim_timer_next(void)
+{
+  pthread_mutex_lock(&timer_lock);
+  const absolute_time_t next = timers ? timers->next : at_the_end_of_time;
+  pthread_mutex_unlock(&timer_lock);
+
+  return next;
+}
+
+void
+sim_timer_fire(void)
+{
+  pthread_mutex_lock(&timer_lock);
+
+  repeating_timer_t* timer = timers;
+
+  if (timer)
+    timers = timer->link;
+
+  pthread_mutex_unlock(&timer_lock);
+
+  if (!timer)
+    return;
+
+  const absolute_time_t due = timer->next;
+
+  if (!timer->callback(timer))
+    return;
+
+  /* Start to start keeps the rate, end to start counts from now. */
+  if (timer->delay_us < 0)
+    timer->next = delayed_by_us(due, -timer->delay_us);
+  else
+    timer->next = make_timeout_time_us(timer->delay_us);
+
+  pthread_mutex_lock(&timer_lock);
+  sim_timer_insert(timer);
+  pthread_mutex_unlock(&timer_lock);
+}
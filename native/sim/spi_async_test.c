@@ -0,0 +1,168 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/time.h"
+#include "hardware/gpio.h"
+#include "hardware/spi.h"
+
+#include "spi_async.h"
+#include "sim.h"
+#include "../check.h"
+
+/*
+ * Host test of spi_async.h against a fake SPI device, on the virtual clock.
+ *
+ * The device answers every byte with a function of the byte and its
+ * position in the transaction, so a lost, duplicated or shifted byte shows
+ * up in rx. The test checks that starting a transaction does not wait for
+ * the bus, that the answer is not reported before it would have been
+ * clocked in and that the chip select is held for the whole transaction.
+ *
+ *   spi_async_test [-n transactions]
+ *
+ * Exits with 1 if anything went wrong.
+ */
+
+#define TEST_CS_PIN   5
+#define TEST_BAUDRATE 1000000
+
+typedef struct {
+  sim_spi_device_t dev;
+  unsigned         selects;
+  unsigned         deselects;
+  unsigned         bytes;
+  uint8_t          pos;
+} fake_device_t;
+
+static uint8_t
+fake_answer(uint8_t mosi, uint8_t pos)
+{
+  return (uint8_t) (mosi * 7 + pos) ^ 0x5a;
+}
+
+static void
+fake_select(sim_spi_device_t* dev)
+{
+  fake_device_t* f = (fake_device_t*) dev;
+
+  f->selects++;
+  f->pos = 0;
+}
+
+static uint8_t
+fake_transfer(sim_spi_device_t* dev, uint8_t mosi)
+{
+  fake_device_t* f = (fake_device_t*) dev;
+
+  f->bytes++;
+
+  return fake_answer(mosi, f->pos++);
+}
+
+static void
+fake_deselect(sim_spi_device_t* dev)
+{
+  fake_device_t* f = (fake_device_t*) dev;
+
+  f->deselects++;
+}
+
+static fake_device_t fake = {
+  .dev = {
+    .cs_pin   = TEST_CS_PIN,
+    .select   = fake_select,
+    .transfer = fake_transfer,
+    .deselect = fake_deselect,
+  },
+};
+
+static void
+test_one(spi_xfer_t* xfer, uint8_t len)
+{
+  static spi_xfer_t other = { .len = 1, .cs_pin = TEST_CS_PIN };
+  const unsigned    selects = fake.selects, deselects = fake.deselects;
+
+  for (uint8_t i = 0; i < len; i++)
+    xfer->tx[i] = (uint8_t) rand();
+  memset(xfer->rx, 0, sizeof(xfer->rx));
+  xfer->len = len;
+
+  const uint64_t start = time_us_64();
+
+  CHECK(spi_async_start(xfer), "start of %u bytes refused", len);
+  CHECK(time_us_64() == start, "start waited for the bus");
+  CHECK(!gpio_get(TEST_CS_PIN), "chip select not asserted");
+  CHECK(fake.selects == selects + 1, "device not selected once");
+  CHECK(!spi_async_start(&other), "second transaction started while busy");
+
+  const uint32_t wire_us = spi_async_time_us(xfer);
+
+  CHECK(wire_us == (len * 8u * 1000000u + TEST_BAUDRATE - 1) / TEST_BAUDRATE,
+        "%u bytes take %u us", len, wire_us);
+
+  sim_time_advance_us(wire_us - 1);
+  CHECK(!spi_async_done(xfer), "%u bytes done after %u us", len, wire_us - 1);
+  CHECK(!gpio_get(TEST_CS_PIN), "chip select released early");
+
+  sim_time_advance_us(1);
+  CHECK(spi_async_done(xfer), "%u bytes not done after %u us", len, wire_us);
+  CHECK(gpio_get(TEST_CS_PIN), "chip select not released");
+  CHECK(fake.deselects == deselects + 1, "device not deselected once");
+  CHECK(spi_async_done(xfer), "done is not sticky");
+
+  for (uint8_t i = 0; i < len; i++)
+    CHECK(xfer->rx[i] == fake_answer(xfer->tx[i], i),
+          "byte %u of %u: got %02x want %02x",
+          i, len, xfer->rx[i], fake_answer(xfer->tx[i], i));
+}
+
+int
+main(int argc, char** argv)
+{
+  unsigned count = 100000;
+  int      opt;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n': count = strtoul(optarg, NULL, 0); break;
+      default:
+        return 1;
+    }
+  }
+
+  sim_time_use_virtual();
+  srand(1);
+
+  spi_init(spi0, TEST_BAUDRATE);
+  gpio_init(TEST_CS_PIN);
+  gpio_set_dir(TEST_CS_PIN, GPIO_OUT);
+  gpio_put(TEST_CS_PIN, 1);
+  sim_spi_attach(spi0, &fake.dev);
+  spi_async_init(spi0);
+
+  spi_xfer_t xfer = { .cs_pin = TEST_CS_PIN };
+
+  /* Lengths outside of 1..SPI_XFER_MAX never reach the bus. */
+  xfer.len = 0;
+  CHECK(!spi_async_start(&xfer), "empty transaction started");
+  xfer.len = SPI_XFER_MAX + 1;
+  CHECK(!spi_async_start(&xfer), "oversized transaction started");
+  CHECK(fake.selects == 0 && gpio_get(TEST_CS_PIN), "rejected transaction touched the bus");
+
+  unsigned bytes = 0;
+
+  for (unsigned n = 0; n < count; n++) {
+    const uint8_t len = 1 + rand() % SPI_XFER_MAX;
+
+    test_one(&xfer, len);
+    bytes += len;
+  }
+
+  CHECK(fake.bytes == bytes, "device saw %u bytes, sent %u", fake.bytes, bytes);
+
+  printf("%u transactions, %u bytes, %s\n", count, bytes, failures ? "FAILED" : "ok");
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,175 @@
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "spsc.h"
+
+/*
+ * Stress test of the inter-core rings from spsc.h.
+ *
+ * A producer and a consumer thread push a numbered sequence through rings
+ * of several sizes as fast as they can. The consumer checks that every
+ * message arrives exactly once, in order and not torn. The ring indices
+ * start just below 2^32 so that they wrap around during the run.
+ *
+ *   spsc_stress [-n messages] [-s slots]
+ *
+ *   -n  messages per ring size (default 10000000)
+ *   -s  only test this ring size (default 1, 2, 16 and 256 slots)
+ *
+ * Exits with 1 if anything went wrong.
+ */
+
+typedef struct {
+  uint32_t seq;
+  uint32_t inverted;
+  uint64_t mixed;
+} stress_msg_t;
+
+typedef struct {
+  spsc_ring_t ring;
+  uint64_t    count;
+  uint64_t    full;
+  uint64_t    empty;
+  uint64_t    errors;
+} stress_t;
+
+static uint64_t
+stress_mix(uint32_t seq)
+{
+  return (uint64_t) seq * 0x9e3779b97f4a7c15ull;
+}
+
+static void*
+stress_producer(void* arg)
+{
+  stress_t* s = arg;
+
+  for (uint64_t i = 0; i < s->count; i++) {
+    const stress_msg_t msg = {
+      .seq      = (uint32_t) i,
+      .inverted = ~(uint32_t) i,
+      .mixed    = stress_mix((uint32_t) i),
+    };
+
+    while (!spsc_push(&s->ring, &msg)) {
+      s->full++;
+      sched_yield();
+    }
+  }
+
+  return NULL;
+}
+
+static void*
+stress_consumer(void* arg)
+{
+  stress_t* s = arg;
+
+  for (uint64_t i = 0; i < s->count; i++) {
+    stress_msg_t msg;
+
+    while (!spsc_pop(&s->ring, &msg)) {
+      s->empty++;
+      sched_yield();
+    }
+
+    const uint32_t want = (uint32_t) i;
+
+    if (msg.seq != want || msg.inverted != ~want || msg.mixed != stress_mix(want)) {
+      if (s->errors++ < 10)
+        fprintf(stderr, "message %llu: got seq %u/%08x/%016llx\n",
+                (unsigned long long) i, msg.seq, msg.inverted,
+                (unsigned long long) msg.mixed);
+    }
+  }
+
+  return NULL;
+}
+
+static double
+stress_now_s(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool
+stress_run(uint16_t slots, uint64_t count)
+{
+  static stress_t s;
+  stress_msg_t*   storage = calloc(slots, sizeof(*storage));
+  pthread_t       producer, consumer;
+
+  if (!storage) {
+    perror("calloc");
+    return false;
+  }
+
+  spsc_init(&s.ring, storage, sizeof(*storage), slots);
+  s.ring.head = s.ring.tail = UINT32_MAX - slots * 4u;
+  s.count     = count;
+  s.full      = 0;
+  s.empty     = 0;
+  s.errors    = 0;
+
+  const double start = stress_now_s();
+
+  pthread_create(&consumer, NULL, stress_consumer, &s);
+  pthread_create(&producer, NULL, stress_producer, &s);
+  pthread_join(producer, NULL);
+  pthread_join(consumer, NULL);
+
+  const double elapsed = stress_now_s() - start;
+  const bool   ok      = s.errors == 0 && spsc_count(&s.ring) == 0
+                      && s.ring.drops == s.full;
+
+  printf("%5u slots  %10llu msgs  %6.1f Mmsg/s  full %10llu  empty %10llu  %s\n",
+         slots, (unsigned long long) count, count / elapsed * 1e-6,
+         (unsigned long long) s.full, (unsigned long long) s.empty,
+         ok ? "ok" : "FAILED");
+
+  free(storage);
+
+  return ok;
+}
+
+int
+main(int argc, char** argv)
+{
+  static const uint16_t default_slots[] = { 1, 2, 16, 256 };
+  uint64_t count = 10000000;
+  unsigned slots = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+    switch (opt) {
+      case 'n': count = strtoull(optarg, NULL, 0); break;
+      case 's': slots = strtoul(optarg, NULL, 0);  break;
+      default:
+        return 1;
+    }
+  }
+
+  if (slots) {
+    if (slots > UINT16_MAX || (slots & (slots - 1))) {
+      fprintf(stderr, "-s needs a power of two up to %u\n", UINT16_MAX / 2 + 1);
+      return 1;
+    }
+
+    return stress_run(slots, count) ? 0 : 1;
+  }
+
+  bool ok = true;
+
+  for (size_t i = 0; i < sizeof(default_slots) / sizeof(default_slots[0]); i++)
+    ok &= stress_run(default_slots[i], count);
+
+  return ok ? 0 : 1;
+}
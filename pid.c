@@ -0,0 +1,78 @@
+#include <string.h>
+
+#include "pid.h"
+
+/* kp * t for t in temp_t, in output units. */
+static int64_t
+pid_gain(const pid_config_t* config, int64_t t)
+{
+  return config->kp * t * PID_OUT_ONE / ((int64_t) PID_GAIN_ONE * TEMP_ONE);
+}
+
+static int32_t
+pid_clamp(int64_t value, int32_t min, int32_t max)
+{
+  if (value < min)
+    return min;
+
+  if (value > max)
+    return max;
+
+  return (int32_t) value;
+}
+
+void
+pid_init(pid_controller_t* pid, const pid_config_t* config)
+{
+  memset(pid, 0, sizeof(*pid));
+  pid->config = *config;
+}
+
+void
+pid_configure(pid_controller_t* pid, const pid_config_t* config)
+{
+  pid->config = *config;
+}
+
+void
+pid_reset(pid_controller_t* pid, int32_t out)
+{
+  pid->p        = 0;
+  pid->integral = out;
+  pid->d        = 0;
+  pid->out      = out;
+}
+
+int32_t
+pid_update(pid_controller_t* pid, temp_t setpoint, temp_t pv, int32_t rate, int32_t out_max)
+{
+  const pid_config_t* config = &pid->config;
+  const temp_t        error  = setpoint - pv;
+
+  const int64_t p = pid_gain(config, error);
+
+  if (config->td_s) {
+    const int64_t d = -pid_gain(config, rate) * config->td_s / 3600;
+
+    pid->d += (pid_clamp(d, -out_max, out_max) - pid->d) >> PID_D_FILTER_SHIFT;
+  } else {
+    pid->d = 0;
+  }
+
+  int64_t integral = pid->integral;
+
+  if (config->ti_s) {
+    const int64_t step = p * config->period_ms / ((int64_t) config->ti_s * 1000);
+    const int64_t out  = p + integral + step + pid->d;
+
+    /* Don't push any further into a limit the output is already at. */
+    if ((step > 0 && out < out_max) || (step < 0 && out > 0))
+      integral += step;
+  }
+
+  pid->p        = pid_clamp(p, -2 * out_max, 2 * out_max);
+  pid->integral = pid_clamp(integral, 0, out_max);
+  pid->out      = pid_clamp(p + pid->integral + pid->d, 0, out_max);
+
+  return pid->out;
+}
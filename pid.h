@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Fixed point PID controller for the pilot, in the form furnace
+ * controllers usually speak: a proportional gain, an integral time and a
+ * derivative time.
+ *
+ *   out = kp * (e + 1/ti * integral(e dt) - td * d(pv)/dt)
+ *
+ * e is des_temp - pv. The derivative acts on the measurement, not on the
+ * error, so a new setpoint doesn't kick the heater: it is the heating rate
+ * the caller estimated (estimator.c), not a difference over one period,
+ * and goes through a first order filter of 2^-PID_D_FILTER_SHIFT per
+ * period.
+ *
+ * The integral is kept in output units. It never leaves 0..out_max and
+ * stops integrating towards a limit the output already sits at, so it
+ * doesn't wind up while the heater is maxed out (or off) on a big step.
+ *
+ * Outputs are PWM levels with PID_OUT_BITS fraction bits, kp is in
+ * thousandths of a level per degree, ti and td in seconds. ti 0 and td 0
+ * switch their term off.
+ */
+
+#define PID_OUT_BITS       16
+#define PID_OUT_ONE        ((int32_t) 1 << PID_OUT_BITS)
+#define PID_GAIN_ONE       1000
+#define PID_D_FILTER_SHIFT 2
+
+#define PID_KP_MAX_LEVELS  100
+#define PID_KP_MAX         (PID_KP_MAX_LEVELS * PID_GAIN_ONE)
+#define PID_TIME_MAX_S     36000
+#define PID_PERIOD_MIN_MS  100
+#define PID_PERIOD_MAX_MS  60000
+
+typedef struct __attribute__((packed)) {
+  uint32_t kp;        /* PID_GAIN_ONE is one level per degree */
+  uint16_t ti_s;
+  uint16_t td_s;
+  uint16_t period_ms; /* between two updates */
+} pid_config_t;
+
+typedef struct {
+  pid_config_t config;
+
+  int32_t p;        /* terms of the last update, output units */
+  int32_t integral;
+  int32_t d;
+  int32_t out;
+} pid_controller_t;
+
+void
+pid_init(pid_controller_t* pid, const pid_config_t* config);
+
+/* Changes the gains, keeps the integral so the output doesn't jump. */
+void
+pid_configure(pid_controller_t* pid, const pid_config_t* config);
+
+/*
+ * Starts over from out, so that taking over from manual control continues
+ * at the PWM the heater already runs at.
+ */
+void
+pid_reset(pid_controller_t* pid, int32_t out);
+
+/*
+ * One period worth of control on pv rising at rate (temp_t per hour),
+ * returns the output in 0..out_max.
+ */
+int32_t
+pid_update(pid_controller_t* pid, temp_t setpoint, temp_t pv, int32_t rate, int32_t out_max);
+
+/* Output units to whole PWM levels, rounded to nearest. */
+static inline unsigned
+pid_level(int32_t out)
+{
+  return (unsigned) (out + PID_OUT_ONE / 2) >> PID_OUT_BITS;
+}
+
+/* Prints an output with two decimals: printf(PID_OUT_FMT, PID_OUT_ARGS(o)) */
+#define PID_OUT_FMT     "%s%d.%02d"
+#define PID_OUT_ARGS(o) ((o) < 0 ? "-" : ""),                                      \
+                        (int) (((o) < 0 ? -(o) : (o)) >> PID_OUT_BITS),            \
+                        (int) (((((o) < 0 ? -(o) : (o)) & (PID_OUT_ONE - 1)) * 100) >> PID_OUT_BITS)
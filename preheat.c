@@ -0,0 +1,116 @@
+#include "preheat.h"
+
+bool
+preheat_active(const preheat_t* preheat)
+{
+  return preheat->state == PREHEAT_BOOST || preheat->state == PREHEAT_APPROACH
+         || preheat->state == PREHEAT_WATCH;
+}
+
+bool
+preheat_start(preheat_t* preheat, temp_t setpoint, temp_t temp, temp_t band, bool boost,
+              uint32_t now_ms)
+{
+  if (setpoint - temp < PREHEAT_JUMP)
+    return false;
+
+  preheat->state      = boost ? PREHEAT_BOOST : PREHEAT_APPROACH;
+  preheat->setpoint   = setpoint;
+  preheat->band       = band;
+  preheat->from       = temp;
+  preheat->start_ms   = now_ms;
+  preheat->boost_ms   = 0;
+  preheat->reached_ms = PREHEAT_NEVER;
+  preheat->peak       = temp;
+  preheat->now_ms     = now_ms;
+
+  return true;
+}
+
+bool
+preheat_stop(preheat_t* preheat)
+{
+  if (!preheat_active(preheat))
+    return false;
+
+  preheat_coast(preheat);
+  preheat->state = PREHEAT_DONE;
+
+  return true;
+}
+
+void
+preheat_coast(preheat_t* preheat)
+{
+  if (preheat->state != PREHEAT_BOOST)
+    return;
+
+  preheat->boost_ms = preheat->now_ms - preheat->start_ms;
+  preheat->state    = PREHEAT_APPROACH;
+}
+
+uint8_t
+preheat_update(preheat_t* preheat, temp_t temp, int32_t rate, uint32_t dead_s, uint32_t now_ms)
+{
+  uint8_t event = PREHEAT_EVENT_NONE;
+
+  if (!preheat_active(preheat))
+    return event;
+
+  preheat->now_ms = now_ms;
+  if (temp > preheat->peak)
+    preheat->peak = temp;
+
+  const uint32_t elapsed_ms = now_ms - preheat->start_ms;
+
+  if (preheat->state == PREHEAT_BOOST) {
+    /* The next look is a period away, the heater's last dead time is on its way already. */
+    const int64_t lead_s    = dead_s + PREHEAT_PERIOD_MS / 1000;
+    const int64_t predicted = temp + (int64_t) rate * lead_s / 3600;
+
+    if (predicted >= preheat->setpoint) {
+      preheat_coast(preheat);
+      event = PREHEAT_EVENT_COAST;
+    }
+  }
+
+  if (preheat->state == PREHEAT_APPROACH && temp >= preheat->setpoint - preheat->band) {
+    preheat->reached_ms = elapsed_ms;
+    preheat->state      = PREHEAT_WATCH;
+  }
+
+  if (preheat->state == PREHEAT_WATCH && elapsed_ms - preheat->reached_ms >= PREHEAT_WATCH_MS) {
+    preheat->state = PREHEAT_DONE;
+    event          = PREHEAT_EVENT_DONE;
+  }
+
+  return event;
+}
+
+int32_t
+preheat_hold(const model_fopdt_t* model, temp_t setpoint, int32_t ceiling)
+{
+  if (model->gain <= 0)
+    return ceiling;
+
+  const int64_t out = ((int64_t) (setpoint - model->ambient) << PWM_FINE_BITS) / model->gain;
+
+  if (out < 0)
+    return 0;
+
+  return out > ceiling ? ceiling : (int32_t) out;
+}
+
+const char*
+preheat_state_name(uint8_t state)
+{
+  switch (state) {
+    case PREHEAT_IDLE:     return "idle";
+    case PREHEAT_BOOST:    return "boost";
+    case PREHEAT_APPROACH: return "approach";
+    case PREHEAT_WATCH:    return "watch";
+    case PREHEAT_DONE:     return "done";
+  }
+
+  return "?";
+}
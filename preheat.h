@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "model.h"
+
+/*
+ * Preheat of the pilot: the shortest way up a large setpoint jump.
+ *
+ * The pilot would get there on its own, but it only moves the output
+ * once a period and has to integrate its way to the power that holds
+ * the setpoint. Quicker is the heater at the ceiling all the way, cut
+ * back to exactly that power at the last moment: the furnace then comes
+ * to rest on the setpoint instead of going past it.
+ *
+ * The last moment is the coast point. What the heater did over the dead
+ * time of the model is already on its way to the sensor, so it is where
+ * the temperature a dead time ahead reaches the setpoint: at the rate it
+ * climbs now, which holds over a dead time that is short against the
+ * time constant. From there the pilot takes over, started from the power
+ * that holds the setpoint on the model, see preheat_hold.
+ *
+ * A run starts on every jump of at least PREHEAT_JUMP up, with the full
+ * power part (boost) or without it, and clocks the time to setpoint:
+ * from the jump until the temperature first comes within band of the
+ * setpoint. Aiming at the setpoint itself leaves the band both ways for
+ * a model that is off. After that the run watches for PREHEAT_WATCH_MS
+ * how far the temperature goes past the setpoint, then it is done. Both
+ * times are now_ms since the jump.
+ */
+
+#define PREHEAT_PERIOD_MS  1000
+#define PREHEAT_JUMP_C     50                   /* smaller jumps are the pilot's alone */
+#define PREHEAT_JUMP       TEMP_C(PREHEAT_JUMP_C)
+#define PREHEAT_WATCH_MS   (30 * 60 * 1000)     /* for overshoot, once in the band */
+
+#define PREHEAT_BAND       TEMP_C(5)
+#define PREHEAT_BAND_MIN_C 1
+#define PREHEAT_BAND_MAX_C 50
+
+/* reached_ms until the run gets there. */
+#define PREHEAT_NEVER      UINT32_MAX
+
+enum {
+  PREHEAT_IDLE,
+  PREHEAT_BOOST,    /* heater at the ceiling, up to the coast point */
+  PREHEAT_APPROACH, /* the pilot has it, on the way into the band */
+  PREHEAT_WATCH,    /* in the band, looking for overshoot */
+  PREHEAT_DONE,     /* over or cut short, has a result */
+};
+
+enum {
+  PREHEAT_EVENT_NONE,
+  PREHEAT_EVENT_COAST, /* hand over to the pilot now */
+  PREHEAT_EVENT_DONE,  /* the result is in */
+};
+
+typedef struct {
+  uint8_t  state;      /* PREHEAT_* */
+  temp_t   setpoint;
+  temp_t   band;
+  temp_t   from;       /* temperature at the start */
+  uint32_t start_ms;
+  uint32_t boost_ms;   /* at full power, after the start */
+  uint32_t reached_ms; /* into the band, after the start */
+  temp_t   peak;       /* highest temperature seen */
+  uint32_t now_ms;     /* last update */
+} preheat_t;
+
+/*
+ * Starts a run if setpoint is at least PREHEAT_JUMP above temp, with the
+ * full power part if boost. Returns whether it did.
+ */
+bool
+preheat_start(preheat_t* preheat, temp_t setpoint, temp_t temp, temp_t band, bool boost,
+              uint32_t now_ms);
+
+/* Boosting, approaching or watching. */
+bool
+preheat_active(const preheat_t* preheat);
+
+/* Cuts a run short, it is done with what it got. Returns whether one was going. */
+bool
+preheat_stop(preheat_t* preheat);
+
+/* Ends the full power part before the coast point, the run goes on without it. */
+void
+preheat_coast(preheat_t* preheat);
+
+/*
+ * One period: the temperature, its rate (temp_t per hour) and the dead
+ * time of the model. Returns PREHEAT_EVENT_*.
+ */
+uint8_t
+preheat_update(preheat_t* preheat, temp_t temp, int32_t rate, uint32_t dead_s, uint32_t now_ms);
+
+/* Output (PWM_FINE_BITS) that holds setpoint on the model, within 0 .. ceiling. */
+int32_t
+preheat_hold(const model_fopdt_t* model, temp_t setpoint, int32_t ceiling);
+
+const char*
+preheat_state_name(uint8_t state);
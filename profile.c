@@ -0,0 +1,208 @@
+#include <string.h>
+
+#include "profile.h"
+
+#define MS_PER_HOUR (3600u * 1000)
+
+void
+profile_segment_unpack(profile_segment_t* segment, uint32_t packed)
+{
+  segment->target   = TEMP_C(packed >> 21);
+  segment->rate     = (packed >> 10) & 0x7ff;
+  segment->hold_min = packed & 0x3ff;
+}
+
+bool
+profile_add(profile_t* profile, const profile_segment_t* segment)
+{
+  profile_program_t* program = &profile->program;
+
+  if (profile->state == PROFILE_RUNNING || profile->state == PROFILE_PAUSED)
+    return false;
+
+  if (program->count >= PROFILE_SEGMENTS_MAX)
+    return false;
+
+  program->segments[program->count++] = *segment;
+
+  return true;
+}
+
+bool
+profile_clear(profile_t* profile)
+{
+  if (profile->state == PROFILE_RUNNING || profile->state == PROFILE_PAUSED)
+    return false;
+
+  memset(&profile->program, 0, sizeof(profile->program));
+  profile->state = PROFILE_IDLE;
+
+  return true;
+}
+
+static void
+profile_enter(profile_t* profile, uint8_t segment, temp_t from)
+{
+  profile->segment  = segment;
+  profile->phase    = PROFILE_RAMP;
+  profile->from     = from;
+  profile->setpoint = from;
+  profile->phase_ms = 0;
+}
+
+bool
+profile_start(profile_t* profile, temp_t from, uint32_t now_ms)
+{
+  if (profile->program.count == 0)
+    return false;
+
+  profile_enter(profile, 0, from);
+  profile->state   = PROFILE_RUNNING;
+  profile->last_ms = now_ms;
+
+  return true;
+}
+
+void
+profile_stop(profile_t* profile)
+{
+  profile->state = PROFILE_IDLE;
+}
+
+void
+profile_pause(profile_t* profile)
+{
+  if (profile->state == PROFILE_RUNNING)
+    profile->state = PROFILE_PAUSED;
+}
+
+void
+profile_resume(profile_t* profile, uint32_t now_ms)
+{
+  if (profile->state != PROFILE_PAUSED)
+    return;
+
+  profile->state   = PROFILE_RUNNING;
+  profile->last_ms = now_ms;
+}
+
+void
+profile_skip(profile_t* profile, uint32_t now_ms)
+{
+  if (profile->state != PROFILE_RUNNING && profile->state != PROFILE_PAUSED)
+    return;
+
+  if (profile->segment + 1 >= profile->program.count) {
+    profile->state = PROFILE_DONE;
+    return;
+  }
+
+  profile_enter(profile, profile->segment + 1, profile->setpoint);
+  profile->last_ms = now_ms;
+}
+
+/* Where the ramp of the current segment is after phase_ms. */
+static temp_t
+profile_ramp(const profile_t* profile, const profile_segment_t* segment)
+{
+  const temp_t distance = segment->target - profile->from;
+
+  if (segment->rate == 0)
+    return segment->target;
+
+  const int64_t moved = (int64_t) segment->rate * TEMP_ONE * profile->phase_ms / MS_PER_HOUR;
+
+  if (distance >= 0)
+    return moved >= distance ? segment->target : profile->from + (temp_t) moved;
+
+  return moved >= -distance ? segment->target : profile->from - (temp_t) moved;
+}
+
+temp_t
+profile_update(profile_t* profile, temp_t pv, uint32_t now_ms)
+{
+  if (profile->state != PROFILE_RUNNING)
+    return profile->setpoint;
+
+  const profile_segment_t* segment = &profile->program.segments[profile->segment];
+
+  profile->phase_ms += now_ms - profile->last_ms;
+  profile->last_ms   = now_ms;
+
+  switch (profile->phase) {
+    case PROFILE_RAMP:
+      profile->setpoint = profile_ramp(profile, segment);
+      if (profile->setpoint != segment->target)
+        break;
+
+      profile->phase    = PROFILE_SOAK;
+      profile->phase_ms = 0;
+      /* fall through */
+
+    case PROFILE_SOAK: {
+      const temp_t diff = pv - segment->target;
+
+      if (diff > PROFILE_SOAK_BAND || diff < -PROFILE_SOAK_BAND)
+        break;
+
+      profile->phase    = PROFILE_HOLD;
+      profile->phase_ms = 0;
+    } /* fall through */
+
+    case PROFILE_HOLD:
+      if (profile->phase_ms < (uint32_t) segment->hold_min * 60 * 1000)
+        break;
+
+      if (profile->segment + 1 >= profile->program.count)
+        profile->state = PROFILE_DONE;
+      else
+        profile_enter(profile, profile->segment + 1, segment->target);
+      break;
+  }
+
+  return profile->setpoint;
+}
+
+uint32_t
+profile_phase_left_min(const profile_t* profile)
+{
+  const profile_segment_t* segment = &profile->program.segments[profile->segment];
+
+  switch (profile->phase) {
+    case PROFILE_RAMP: {
+      if (segment->rate == 0)
+        return 0;
+
+      const temp_t left = segment->target > profile->setpoint ? segment->target - profile->setpoint
+                                                              : profile->setpoint - segment->target;
+
+      return ((int64_t) left * 60 / TEMP_ONE + segment->rate - 1) / segment->rate;
+    }
+
+    case PROFILE_HOLD: {
+      const uint32_t hold_ms = (uint32_t) segment->hold_min * 60 * 1000;
+
+      return profile->phase_ms >= hold_ms ? 0 : (hold_ms - profile->phase_ms + 59999) / 60000;
+    }
+  }
+
+  return 0;
+}
+
+const char*
+profile_phase_name(uint8_t state, uint8_t phase)
+{
+  switch (state) {
+    case PROFILE_IDLE:   return "idle";
+    case PROFILE_PAUSED: return "paused";
+    case PROFILE_DONE:   return "done";
+  }
+
+  switch (phase) {
+    case PROFILE_RAMP: return "ramp";
+    case PROFILE_SOAK: return "soak";
+    case PROFILE_HOLD: return "hold";
+  }
+
+  return "?";
+}
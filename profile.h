@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Ramp/soak firing programs for the pilot.
+ *
+ * A program is a list of segments. Each one moves the setpoint from where
+ * the previous one left it (the temperature at the start, for the first)
+ * towards its target at rate degrees per hour, or in one step with rate 0.
+ * Once the setpoint is there, the segment waits for the furnace to come
+ * within PROFILE_SOAK_BAND of it and then holds it for hold_min minutes.
+ *
+ * Pausing freezes the setpoint and the hold timer, skipping goes on with
+ * the next segment from the setpoint as it is. After the last segment the
+ * program is done and the heater is left to the caller.
+ *
+ * Ramp and hold go by the now_ms between two updates while running, so a
+ * pause costs neither.
+ */
+
+#define PROFILE_SEGMENTS_MAX 16
+#define PROFILE_SOAK_BAND    TEMP_C(5)
+#define PROFILE_PERIOD_MS    1000
+
+/* A segment has to fit one control message, see PROFILE_SEGMENT_PACK. */
+#define PROFILE_RATE_MAX     2047 /* C/h */
+#define PROFILE_HOLD_MAX     1023 /* min */
+
+typedef struct __attribute__((packed)) {
+  temp_t   target;
+  uint16_t rate;     /* C/h, 0 steps right to target */
+  uint16_t hold_min;
+} profile_segment_t;
+
+typedef struct __attribute__((packed)) {
+  uint8_t           count;
+  profile_segment_t segments[PROFILE_SEGMENTS_MAX];
+} profile_program_t;
+
+enum {
+  PROFILE_IDLE,
+  PROFILE_RUNNING,
+  PROFILE_PAUSED,
+  PROFILE_DONE,
+};
+
+enum {
+  PROFILE_RAMP,
+  PROFILE_SOAK, /* setpoint at target, waiting for the furnace */
+  PROFILE_HOLD,
+};
+
+typedef struct {
+  profile_program_t program;
+
+  uint8_t  state;    /* PROFILE_IDLE .. */
+  uint8_t  segment;  /* running one */
+  uint8_t  phase;    /* PROFILE_RAMP .. */
+  temp_t   from;     /* setpoint the ramp started at */
+  temp_t   setpoint;
+  uint32_t phase_ms; /* spent in the phase, pauses not counted */
+  uint32_t last_ms;
+} profile_t;
+
+/* Whole degrees, C/h and minutes in one 32 bit control message argument. */
+#define PROFILE_SEGMENT_PACK(target, rate, hold) \
+  (((uint32_t) (target) << 21) | ((uint32_t) (rate) << 10) | (uint32_t) (hold))
+
+void
+profile_segment_unpack(profile_segment_t* segment, uint32_t packed);
+
+/* Appends a segment, false if the program is full or running. */
+bool
+profile_add(profile_t* profile, const profile_segment_t* segment);
+
+/* Drops all segments, false if the program is running. */
+bool
+profile_clear(profile_t* profile);
+
+/* Runs the program from the first segment, the setpoint starts at from. */
+bool
+profile_start(profile_t* profile, temp_t from, uint32_t now_ms);
+
+void
+profile_stop(profile_t* profile);
+
+void
+profile_pause(profile_t* profile);
+
+void
+profile_resume(profile_t* profile, uint32_t now_ms);
+
+void
+profile_skip(profile_t* profile, uint32_t now_ms);
+
+/* Moves the program along, returns the setpoint the pilot should follow. */
+temp_t
+profile_update(profile_t* profile, temp_t pv, uint32_t now_ms);
+
+/* Whole minutes left in the current ramp or hold, 0 while soaking. */
+uint32_t
+profile_phase_left_min(const profile_t* profile);
+
+const char*
+profile_phase_name(uint8_t state, uint8_t phase);
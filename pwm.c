@@ -3,19 +3,178 @@
 #include "hardware/platform_defs.h"
 
 #include "common.h" // for MAX_PWM
+#include "burst.h"
+#include "dither.h"
+#include "spsc.h"
 
 #define PWM_DUTY ((uint16_t) 62500)
 #define PWM_SYSCLK_DIV ((uint8_t) 250)
+#define PWM_FREQ_HZ 8U
+#define PWM_PERIOD_US (1000000 / PWM_FREQ_HZ)
 
 #define PWM_LEVEL_SCALE (PWM_DUTY / MAX_PWM)
 _Static_assert(PWM_DUTY % MAX_PWM == 0);
 
+/*
+ * The SSR switches at zero crossings, so the heater is on for whole mains
+ * half-cycles. That is PWM_HALF_CYCLE counts of the PWM counter, with
+ * DITHER_FRAC_BITS fraction bits: 5000 at 8 Hz on 50 Hz mains.
+ */
+#define PWM_MAINS_HZ 50
+#define PWM_HALF_CYCLE                                                          \
+  ((uint32_t) (((uint64_t) PWM_DUTY * PWM_FREQ_HZ << DITHER_FRAC_BITS) / (2 * PWM_MAINS_HZ)))
+
+/*
+ * Burst firing ticks once per half-cycle, heater_output looks in four times
+ * a window. The ticks come from the crystal: there is no zero-cross input,
+ * so they drift against the mains and only a zero-cross SSR turns them into
+ * whole half-cycles. A burst may come out one half-cycle long or short.
+ */
+#define BURST_HALF_CYCLE_US (1000000 / (2 * PWM_MAINS_HZ))
+#define BURST_POLL_US       (BURST_HALF_CYCLES * BURST_HALF_CYCLE_US / 4)
+
+_Static_assert(PWM_FINE_BITS == DITHER_FRAC_BITS);
+_Static_assert((uint64_t) MAX_PWM * PWM_LEVEL_SCALE << PWM_FINE_BITS <= UINT32_MAX);
+
 static unsigned
 pwm_scale_level(unsigned unscaled_pwm)
 {
   return unscaled_pwm * PWM_LEVEL_SCALE;
 }
 
+/*
+ * Heater output with PWM_FINE_BITS fraction bits, clamped to ceiling_pwm.
+ * Off is written right away, anything else goes out through heater_output
+ * from the next PWM period on.
+ */
+static void
+set_heater_fine(furnace_context_t *ctx, int32_t fine)
+{
+  const int32_t ceiling = (int32_t) ctx->ceiling_pwm << PWM_FINE_BITS;
+
+  if (fine < 0)
+    fine = 0;
+  if (fine > ceiling)
+    fine = ceiling;
+
+  if (fine != 0 && ctx->pwm_fine == 0)
+    ctx->heater_deadline = get_absolute_time();
+
+  ctx->pwm_fine  = fine;
+  ctx->pwm_level = (fine + PWM_FINE_ONE / 2) >> PWM_FINE_BITS;
+
+  if (fine == 0) {
+    dither_reset(&ctx->heater_dither);
+    pwm_set_gpio_level(FURNACE_FIRE_PIN, 0);
+
+    if (ctx->burst.runs) {
+      __atomic_store_n(&ctx->burst.gen, ctx->burst.gen + 1, __ATOMIC_RELEASE);
+      gpio_put(FURNACE_FIRE_PIN, 0);
+    }
+  }
+}
+
+/* Every period_us from the last deadline, unless the loop fell a whole one behind. */
+static void
+heater_next_deadline(furnace_context_t *ctx, uint64_t period_us)
+{
+  ctx->heater_deadline = delayed_by_us(ctx->heater_deadline, period_us);
+
+  if (absolute_time_diff_us(get_absolute_time(), ctx->heater_deadline) < 0)
+    ctx->heater_deadline = make_timeout_time_us(period_us);
+}
+
+/*
+ * Timer callback, once per half-cycle of nominal mains. Without a pattern
+ * for the next window nobody is steering the heater any more, so it stays
+ * off.
+ */
+static bool
+burst_timer_tick(repeating_timer_t *rt)
+{
+  heater_burst_t *burst = (heater_burst_t*) rt->user_data;
+
+  if (burst->pos == 0 && !spsc_pop(&burst->ring, &burst->playing))
+    memset(&burst->playing.pattern, 0, sizeof(burst->playing.pattern));
+
+  const bool on = burst->playing.gen == __atomic_load_n(&burst->gen, __ATOMIC_ACQUIRE)
+               && burst_bit(&burst->playing.pattern, burst->pos);
+
+  gpio_put(FURNACE_FIRE_PIN, on);
+
+  if (++burst->pos == BURST_HALF_CYCLES)
+    burst->pos = 0;
+
+  return true;
+}
+
+/* Next window's pattern, as soon as the timer took the last one. */
+static void
+heater_burst_output(furnace_context_t *ctx)
+{
+  heater_burst_t *burst = &ctx->burst;
+
+  if (spsc_count(&burst->ring) == 0) {
+    const uint32_t duty = (uint64_t) ctx->pwm_fine * BURST_HALF_CYCLES / MAX_PWM;
+    const unsigned on   = dither_next(&ctx->heater_dither, duty, 2 << DITHER_FRAC_BITS,
+                                      BURST_HALF_CYCLES);
+    burst_slot_t   slot = { .gen = burst->gen };
+
+    burst_pattern(&slot.pattern, on, burst->runs);
+    spsc_push(&burst->ring, &slot);
+  }
+
+  heater_next_deadline(ctx, BURST_POLL_US);
+}
+
+/*
+ * Burst firing with that many runs per window, or PWM again with 0. The
+ * heater carries on at the same output either way.
+ */
+static void
+set_heater_burst(furnace_context_t *ctx, unsigned runs)
+{
+  heater_burst_t *burst = &ctx->burst;
+
+  if (burst->runs && !runs) {
+    cancel_repeating_timer(&burst->timer);
+    gpio_put(FURNACE_FIRE_PIN, 0);
+    gpio_set_function(FURNACE_FIRE_PIN, GPIO_FUNC_PWM);
+  } else if (!burst->runs && runs) {
+    pwm_set_gpio_level(FURNACE_FIRE_PIN, 0);
+    gpio_init(FURNACE_FIRE_PIN);
+    gpio_set_dir(FURNACE_FIRE_PIN, GPIO_OUT);
+
+    spsc_init(&burst->ring, burst->slots, sizeof(burst->slots[0]), 1);
+    memset(&burst->playing, 0, sizeof(burst->playing));
+    burst->pos = 0;
+    add_repeating_timer_us(-(int64_t) BURST_HALF_CYCLE_US, burst_timer_tick, burst, &burst->timer);
+  }
+
+  burst->runs = runs;
+
+  dither_reset(&ctx->heater_dither);
+  ctx->heater_deadline = get_absolute_time();
+}
+
+/*
+ * Counter level for the next PWM period. The level register only takes
+ * effect when the counter wraps, so this runs once per period while the
+ * heater is on.
+ */
+static void
+heater_output(furnace_context_t *ctx)
+{
+  if (ctx->burst.runs)
+    return heater_burst_output(ctx);
+
+  const uint32_t duty  = (uint32_t) ctx->pwm_fine * PWM_LEVEL_SCALE;
+  const uint32_t level = dither_next(&ctx->heater_dither, duty, PWM_HALF_CYCLE, PWM_DUTY);
+
+  pwm_set_gpio_level(FURNACE_FIRE_PIN, level);
+  heater_next_deadline(ctx, PWM_PERIOD_US);
+}
+
 static inline int
 set_pwm_safe(unsigned pin, furnace_context_t *ctx, unsigned new_pwm)
 {
@@ -36,13 +195,7 @@ set_pwm_safe(unsigned pin, furnace_context_t *ctx, unsigned new_pwm)
 #endif
 
     case FURNACE_FIRE_PIN:
-      if (new_pwm > ctx->ceiling_pwm)
-              new_pwm = ctx->ceiling_pwm;
-
-      ctx->pwm_level = new_pwm;
-
-      const unsigned new_pwm_scaled = pwm_scale_level(new_pwm);
-      pwm_set_gpio_level(FURNACE_FIRE_PIN, new_pwm_scaled);
+      set_heater_fine(ctx, (int32_t) new_pwm << PWM_FINE_BITS);
       break;
 
     default:
@@ -67,7 +220,7 @@ set_pwm_safe(unsigned pin, furnace_context_t *ctx, unsigned new_pwm)
 static void
 pwm_config_freq(pwm_config *cfg)
 {
-  _Static_assert(SYS_CLK_KHZ * 1000U == PWM_DUTY * PWM_SYSCLK_DIV * 8U);
+  _Static_assert(SYS_CLK_KHZ * 1000U == PWM_DUTY * PWM_SYSCLK_DIV * PWM_FREQ_HZ);
 
   pwm_config_set_wrap(cfg, PWM_DUTY);
   pwm_config_set_clkdiv_int(cfg, PWM_SYSCLK_DIV);
@@ -0,0 +1,50 @@
+#include <string.h>
+
+#include "pid.h"
+#include "pwm_map.h"
+
+void
+pwm_map_clear(pwm_map_t* map)
+{
+  memset(map, 0, sizeof(*map));
+}
+
+bool
+pwm_map_record(pwm_map_t* map, unsigned level, temp_t temp)
+{
+  if (level != map->levels || level > MAX_PWM)
+    return false;
+
+  map->temp[map->levels++] = temp;
+
+  return true;
+}
+
+bool
+pwm_map_lookup(const pwm_map_t* map, temp_t temp, int32_t* out)
+{
+  /* Loaded from flash, maybe written by a build with a bigger MAX_PWM. */
+  if (map->levels < 2 || map->levels > MAX_PWM + 1)
+    return false;
+
+  if (temp <= map->temp[0]) {
+    *out = 0;
+    return true;
+  }
+
+  for (unsigned i = 1; i < map->levels; i++) {
+    const temp_t lo = map->temp[i - 1];
+    const temp_t hi = map->temp[i];
+
+    /* lo < temp <= hi, so hi > lo and the division is safe. */
+    if (temp <= hi) {
+      *out = (int32_t) (i - 1) * PID_OUT_ONE
+           + (int32_t) ((int64_t) (temp - lo) * PID_OUT_ONE / (hi - lo));
+      return true;
+    }
+  }
+
+  *out = (int32_t) (map->levels - 1) * PID_OUT_ONE;
+
+  return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * PWM to temperature table recorded by the mapper.
+ *
+ * Entry n is the temperature the furnace settled at with the heater on PWM
+ * level n, levels 0 .. levels - 1 are known. The pilot reads it backwards:
+ * given a setpoint, which output holds it, interpolated linearly between
+ * the two levels around it. That is where the PID starts from on a new
+ * setpoint, instead of integrating its way there from whatever the heater
+ * ran at before.
+ */
+
+typedef struct __attribute__((packed)) {
+  uint8_t levels;
+  temp_t  temp[MAX_PWM + 1];
+} pwm_map_t;
+
+void
+pwm_map_clear(pwm_map_t* map);
+
+/* Appends the next level, false if level isn't the next one. */
+bool
+pwm_map_record(pwm_map_t* map, unsigned level, temp_t temp);
+
+/*
+ * Output that holds temp, PID_OUT_BITS fraction bits. False with fewer
+ * than two levels mapped. Above the top of the map it is the top level,
+ * the pilot takes it from there.
+ */
+bool
+pwm_map_lookup(const pwm_map_t* map, temp_t temp, int32_t* out);
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * PT100 behind the MAX31865, shared between the driver and consteval,
+ * which turns the Callendar-Van Dusen equation into a lookup table so that
+ * the firmware never touches a float (the RP2040 has no FPU).
+ */
+
+#define R_REF           430
+#define RTD_NOMINAL     100
+#define CASUAL_WIRE_RES 2
+#define MAX_ADC_VALUE   (1U << 15)
+
+/* Callendar-Van Dusen, IEC 60751 coefficients. C only applies below 0 C. */
+#define RTD_A           3.9083e-3
+#define RTD_B           -5.775e-7
+#define RTD_C           -4.183e-12
+
+/*
+ * Closed form of the above for 0 C and up.
+ * source : https://www.analog.com/media/en/technical-documentation/application-notes/AN709_0.pdf, page 4
+ */
+#define Z1          -3.9083e-3
+#define Z2          1.758480889e-5
+#define Z3          -2.31e-8
+#define Z4          -1.155e-6
+
+/*
+ * Exact curve in double precision, for consteval and host tools only.
+ */
+static inline double
+rtd_resistance(double t)
+{
+  double r = RTD_NOMINAL * (1.0 + RTD_A * t + RTD_B * t * t);
+
+  if (t < 0.0)
+    r += RTD_NOMINAL * RTD_C * (t - 100.0) * t * t * t;
+
+  return r;
+}
+
+static inline double
+rtd_temperature(double r)
+{
+  if (r >= RTD_NOMINAL)
+    return (sqrt(Z2 + Z3 * r) + Z1) / Z4;
+
+  /* No closed form below 0 C, Newton converges in a handful of steps. */
+  double t = (r - RTD_NOMINAL) / (RTD_NOMINAL * RTD_A);
+
+  for (int i = 0; i < 20; i++) {
+    const double slope = RTD_NOMINAL * (RTD_A + 2.0 * RTD_B * t
+                                        + RTD_C * (4.0 * t - 300.0) * t * t);
+    t -= (rtd_resistance(t) - r) / slope;
+  }
+
+  return t;
+}
+
+/* Resistance the ADC code stands for, minus the leads. */
+static inline double
+rtd_adc_resistance(double adc)
+{
+  return adc * R_REF / MAX_ADC_VALUE - CASUAL_WIRE_RES;
+}
+
+/*
+ * rtd_table holds the temperature at the start of 2^RTD_TABLE_BITS equal
+ * segments of the 15 bit ADC range, plus one past the end. Linear
+ * interpolation within a segment stays within 0.01 C of the exact curve
+ * between -200 C and 850 C.
+ */
+#define RTD_TABLE_BITS  8
+#define RTD_TABLE_SHIFT (15 - RTD_TABLE_BITS)
+#define RTD_TABLE_SIZE  ((1 << RTD_TABLE_BITS) + 1)
+
+static inline temp_t
+rtd_lookup(const temp_t* table, uint32_t adc)
+{
+  const uint32_t i    = adc >> RTD_TABLE_SHIFT;
+  const int32_t  frac = adc & ((1 << RTD_TABLE_SHIFT) - 1);
+  const int32_t  step = table[i + 1] - table[i];
+
+  return table[i] + ((step * frac + (1 << (RTD_TABLE_SHIFT - 1))) >> RTD_TABLE_SHIFT);
+}
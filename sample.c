@@ -0,0 +1,94 @@
+#include <string.h>
+
+#include "sample.h"
+
+_Static_assert((SAMPLE_RING_SIZE & (SAMPLE_RING_SIZE - 1)) == 0);
+_Static_assert(SAMPLE_MEDIAN_MAX <= SAMPLE_RING_SIZE);
+
+static temp_t
+sample_at(const sample_pipeline_t* pipe, unsigned age)
+{
+  return pipe->ring[(pipe->head - 1 - age) & (SAMPLE_RING_SIZE - 1)];
+}
+
+/* Median of the newest n samples, insertion sort is plenty for n <= 9. */
+static temp_t
+sample_median(const sample_pipeline_t* pipe, unsigned n)
+{
+  temp_t sorted[SAMPLE_MEDIAN_MAX];
+
+  if (n > pipe->count)
+    n = pipe->count;
+
+  for (unsigned i = 0; i < n; i++) {
+    const temp_t v = sample_at(pipe, i);
+    unsigned     j = i;
+
+    for (; j > 0 && sorted[j - 1] > v; j--)
+      sorted[j] = sorted[j - 1];
+
+    sorted[j] = v;
+  }
+
+  /* Lower middle for an even count, which only happens while filling up. */
+  return sorted[(n - 1) / 2];
+}
+
+void
+sample_pipeline_init(sample_pipeline_t* pipe, const sample_config_t* config)
+{
+  memset(pipe, 0, sizeof(*pipe));
+  pipe->config = *config;
+}
+
+void
+sample_pipeline_configure(sample_pipeline_t* pipe, const sample_config_t* config)
+{
+  pipe->config = *config;
+  pipe->phase  = 0;
+}
+
+bool
+sample_pipeline_push(sample_pipeline_t* pipe, temp_t raw, temp_t* out)
+{
+  const sample_config_t* config = &pipe->config;
+
+  pipe->samples++;
+
+  if (config->reject && pipe->count) {
+    const temp_t median = sample_median(pipe, config->median);
+    const temp_t diff   = raw > median ? raw - median : median - raw;
+
+    if (diff > config->reject && pipe->dropped + 1 < config->median) {
+      pipe->dropped++;
+      pipe->rejected++;
+      return false;
+    }
+  }
+
+  pipe->dropped = 0;
+
+  pipe->ring[pipe->head] = raw;
+  pipe->head = (pipe->head + 1) & (SAMPLE_RING_SIZE - 1);
+  if (pipe->count < SAMPLE_RING_SIZE)
+    pipe->count++;
+
+  const int32_t x = sample_median(pipe, config->median) * (1 << SAMPLE_EMA_BITS);
+
+  if (!pipe->primed) {
+    pipe->ema    = x;
+    pipe->primed = true;
+  } else {
+    pipe->ema += (x - pipe->ema) >> config->ema_shift;
+  }
+
+  if (++pipe->phase < config->decimate)
+    return false;
+
+  pipe->phase = 0;
+
+  /* Round to nearest, >> rounds towards minus infinity. */
+  *out = (pipe->ema + (1 << (SAMPLE_EMA_BITS - 1))) >> SAMPLE_EMA_BITS;
+
+  return true;
+}
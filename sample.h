@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Per-sensor sample pipeline, from raw conversions to the temperature the
+ * controllers see.
+ *
+ *   raw -> outlier rejection -> ring -> median -> EMA -> decimation -> out
+ *
+ * A raw sample further than reject from the median of the ring is dropped,
+ * unless as many samples in a row were dropped as the median looks at:
+ * then it is a real step and goes through. So reject needs a median of 3 or
+ * more, with 1 nothing is ever dropped. The median runs over the last
+ * median samples of the ring, the EMA smooths with a weight of 2^-ema_shift
+ * and only every decimate-th result is handed out.
+ *
+ * Every stage can be switched off: reject 0, median 1, ema_shift 0 and
+ * decimate 1 pass raw samples straight through.
+ */
+
+#define SAMPLE_RING_SIZE   16 /* power of two */
+#define SAMPLE_MEDIAN_MAX  9
+#define SAMPLE_EMA_MAX     8
+#define SAMPLE_DECIMATE_MAX 100
+
+/* Extra fraction bits the EMA keeps, so small steps don't get lost. */
+#define SAMPLE_EMA_BITS    8
+
+typedef struct {
+  uint16_t period_ms; /* time between two acquisitions */
+  uint8_t  median;    /* odd, 1..SAMPLE_MEDIAN_MAX */
+  uint8_t  ema_shift; /* 0..SAMPLE_EMA_MAX */
+  uint8_t  decimate;  /* 1..SAMPLE_DECIMATE_MAX */
+  temp_t   reject;    /* 0 keeps every sample */
+} sample_config_t;
+
+typedef struct {
+  sample_config_t config;
+
+  temp_t   ring[SAMPLE_RING_SIZE];
+  uint8_t  head;      /* next slot to write */
+  uint8_t  count;     /* valid samples in ring */
+  uint8_t  dropped;   /* rejected in a row */
+  uint8_t  phase;     /* samples since the last output */
+  bool     primed;    /* ema holds a value */
+  int32_t  ema;       /* temp_t << SAMPLE_EMA_BITS */
+
+  uint32_t samples;   /* raw samples pushed */
+  uint32_t rejected;  /* raw samples dropped as outliers */
+} sample_pipeline_t;
+
+void
+sample_pipeline_init(sample_pipeline_t* pipe, const sample_config_t* config);
+
+/* Changes the filter settings, keeps the samples collected so far. */
+void
+sample_pipeline_configure(sample_pipeline_t* pipe, const sample_config_t* config);
+
+/* Feeds one raw sample, returns true and sets *out when an output is due. */
+bool
+sample_pipeline_push(sample_pipeline_t* pipe, temp_t raw, temp_t* out);
@@ -0,0 +1,159 @@
+#include <string.h>
+
+#include "scheduler.h"
+
+static inline bool
+sched_before(const sched_task_t* a, const sched_task_t* b)
+{
+  return a->deadline < b->deadline;
+}
+
+static void
+sched_swap(scheduler_t* sched, uint8_t i, uint8_t j)
+{
+  sched_task_t* tmp = sched->heap[i];
+
+  sched->heap[i] = sched->heap[j];
+  sched->heap[j] = tmp;
+
+  sched->heap[i]->heap_index = i;
+  sched->heap[j]->heap_index = j;
+}
+
+static void
+sched_sift_up(scheduler_t* sched, uint8_t i)
+{
+  while (i > 0) {
+    const uint8_t parent = (i - 1) / 2;
+
+    if (!sched_before(sched->heap[i], sched->heap[parent]))
+      return;
+
+    sched_swap(sched, i, parent);
+    i = parent;
+  }
+}
+
+static void
+sched_sift_down(scheduler_t* sched, uint8_t i)
+{
+  while (1) {
+    const uint8_t left  = 2 * i + 1;
+    const uint8_t right = left + 1;
+    uint8_t       min   = i;
+
+    if (left < sched->count && sched_before(sched->heap[left], sched->heap[min]))
+      min = left;
+
+    if (right < sched->count && sched_before(sched->heap[right], sched->heap[min]))
+      min = right;
+
+    if (min == i)
+      return;
+
+    sched_swap(sched, i, min);
+    i = min;
+  }
+}
+
+static void
+sched_set_deadline(scheduler_t* sched, sched_task_t* task, absolute_time_t deadline)
+{
+  const bool earlier = deadline < task->deadline;
+
+  task->deadline = deadline;
+
+  if (earlier)
+    sched_sift_up(sched, task->heap_index);
+  else
+    sched_sift_down(sched, task->heap_index);
+}
+
+void
+sched_init(scheduler_t* sched)
+{
+  memset(sched, 0, sizeof(*sched));
+}
+
+void
+sched_add(scheduler_t* sched, sched_task_t* task, void* arg)
+{
+  if (sched->count == SCHED_MAX_TASKS)
+    return;
+
+  task->deadline     = task->next(arg);
+  task->heap_index   = sched->count;
+  task->runs         = 0;
+  task->last_late_us = 0;
+  task->max_late_us  = 0;
+
+  sched->heap[sched->count++] = task;
+  sched_sift_up(sched, task->heap_index);
+}
+
+/*
+ * Asks every task first and only then rebuilds the heap: sifting while
+ * walking it moves tasks past the walk or back into it.
+ */
+void
+sched_refresh(scheduler_t* sched, void* arg)
+{
+  for (uint8_t i = 0; i < sched->count; i++)
+    sched->heap[i]->deadline = sched->heap[i]->next(arg);
+
+  for (uint8_t i = sched->count / 2; i-- > 0;)
+    sched_sift_down(sched, i);
+}
+
+/*
+ * Runs every task that is due, each one at most once per call so that a
+ * task which does not move its own deadline can't starve the I/O.
+ * Returns true if anything ran.
+ */
+bool
+sched_run(scheduler_t* sched, void* arg)
+{
+  uint8_t ndone = 0;
+
+  while (sched->count > ndone) {
+    sched_task_t*         task = sched->heap[0];
+    const absolute_time_t now  = get_absolute_time();
+
+    if (now <= task->deadline)
+      break;
+
+    const int64_t late = absolute_time_diff_us(task->deadline, now);
+
+    task->last_late_us = late > UINT32_MAX ? UINT32_MAX : (uint32_t) late;
+    if (task->last_late_us > task->max_late_us)
+      task->max_late_us = task->last_late_us;
+    task->runs++;
+
+    const uint32_t start = time_us_32();
+
+    task->work(arg);
+
+    if (task->stats)
+      stats_record(task->stats, time_us_32() - start);
+
+    /* Park it at the back until everything due had its turn. */
+    sched_set_deadline(sched, task, at_the_end_of_time);
+    ndone++;
+  }
+
+  if (ndone == 0)
+    return false;
+
+  sched_refresh(sched, arg);
+
+  return true;
+}
+
+absolute_time_t
+sched_next_deadline(const scheduler_t* sched)
+{
+  if (sched->count == 0)
+    return at_the_end_of_time;
+
+  return sched->heap[0]->deadline;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pico/time.h"
+
+#include "stats.h"
+
+/*
+ * Tickless deadline scheduler for main_work_loop.
+ *
+ * Every task knows when it wants to run next (next) and how to do its work
+ * (work). Tasks are kept in a binary min-heap ordered by that deadline, so
+ * the loop only calls the ones that are due and otherwise sleeps until the
+ * head of the heap, or until an I/O event wakes it up earlier.
+ *
+ * Same convention as the rest of the firmware: a deadline is met once the
+ * current time is past it. A task that has nothing to do returns
+ * at_the_end_of_time from next.
+ *
+ * Work done by one task (or by a command) may change when others want to
+ * run, so every task is asked again with sched_refresh after anything ran.
+ */
+
+#define SCHED_MAX_TASKS 12
+
+typedef struct {
+  const char*     name;
+  absolute_time_t (*next)(void* arg);
+  void            (*work)(void* arg);
+
+  /* Managed by the scheduler. */
+  absolute_time_t deadline;
+  uint8_t         heap_index;
+
+  /* How late the task was dispatched, in microseconds past its deadline. */
+  uint32_t        runs;
+  uint32_t        last_late_us;
+  uint32_t        max_late_us;
+
+  /* Optional, time spent in work() is recorded there. */
+  stats_hist_t*   stats;
+} sched_task_t;
+
+typedef struct {
+  sched_task_t* heap[SCHED_MAX_TASKS];
+  uint8_t       count;
+} scheduler_t;
+
+void
+sched_init(scheduler_t* sched);
+
+void
+sched_add(scheduler_t* sched, sched_task_t* task, void* arg);
+
+void
+sched_refresh(scheduler_t* sched, void* arg);
+
+bool
+sched_run(scheduler_t* sched, void* arg);
+
+absolute_time_t
+sched_next_deadline(const scheduler_t* sched);
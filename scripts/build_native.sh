@@ -1,5 +1,7 @@
 #!/bin/sh
 
-cmake -B native/build/ -S native/ -GNinja &&
-ninja -C native/build/  &&
+# Builds the targets given, or the whole native tree (simulator, benches,
+# tests) without any. The firmware only needs consteval.
+cmake -B native/build/ -S native/ -GNinja -DFLASH=${CONFIG_FLASH:-ON} &&
+ninja -C native/build/ "$@" &&
 ./native/build/consteval
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 
 #include "spi_config.h"
+#include "spi_async.h"
 
 #include "pico/stdlib.h"
 #include "pico/binary_info.h"
@@ -9,23 +10,13 @@
 #include "hardware/spi.h"
 #include "hardware/dma.h"
 
-#define TEST_SIZE 1024
-
-#define DMA 0
-
 void max318xx_spi_init(void)
 {
-    /* Enable SPI at 1 MHz and connect to GPIOs */
-    spi_init(FURNACE_SPI_INSTANCE, 1000 * 512);
+    /* Enable SPI and connect to GPIOs */
+    spi_init(FURNACE_SPI_INSTANCE, FURNACE_SPI_BAUDRATE);
     gpio_set_function(FURNACE_SPI_RX_PIN, GPIO_FUNC_SPI);
 
-    /*
-     * We set chipselect to gpio to make sure It's pulled up/down when we want.
-     * By default raspberry was pulling the CS up after each byte.
-     */
-    gpio_init(FURNACE_SPI_CSN_PIN);
-    gpio_set_dir(FURNACE_SPI_CSN_PIN, GPIO_OUT);
-    gpio_put(FURNACE_SPI_CSN_PIN, 1);
+    /* Chip selects are plain GPIOs, max318xx_init sets them up per sensor. */
 
     gpio_set_function(FURNACE_SPI_SCK_PIN, GPIO_FUNC_SPI);
     gpio_set_function(FURNACE_SPI_TX_PIN, GPIO_FUNC_SPI);
@@ -34,94 +25,101 @@ void max318xx_spi_init(void)
 
     // Force loopback for testing
     // hw_set_bits(&spi_get_hw(FURNACE_SPI_INSTANCE)->cr1, SPI_SSPCR1_LBM_BITS);
+
+    spi_async_init(FURNACE_SPI_INSTANCE);
 }
 
-int spi_main()
-{
+static spi_inst_t* async_spi;
+static uint        dma_tx;
+static uint        dma_rx;
+static spi_xfer_t* in_flight;
 
-    printf("SPI DMA example\n");
+void
+spi_async_init(spi_inst_t* spi)
+{
+    if (async_spi)
+        return;
 
-    max318xx_spi_init();
+    async_spi = spi;
 
-#if DMA
     // Grab some unused dma channels
-    const uint dma_tx = dma_claim_unused_channel(true);
-    const uint dma_rx = dma_claim_unused_channel(true);
-#endif
-
-    static uint8_t txbuf[TEST_SIZE];
-    static uint8_t rxbuf[TEST_SIZE];
-    for (uint i = 0; i < TEST_SIZE; ++i) {
-        txbuf[i] = i;
-    }
-
-#if DMA
+    dma_tx = dma_claim_unused_channel(true);
+    dma_rx = dma_claim_unused_channel(true);
 
     // We set the outbound DMA to transfer from a memory buffer to the SPI transmit FIFO paced by the SPI TX FIFO DREQ
     // The default is for the read address to increment every element (in this case 1 byte = DMA_SIZE_8)
     // and for the write address to remain unchanged.
-
-    printf("Configure TX DMA\n");
     dma_channel_config c = dma_channel_get_default_config(dma_tx);
     channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
-    channel_config_set_dreq(&c, spi_get_dreq(FURNACE_SPI_INSTANCE, true));
+    channel_config_set_dreq(&c, spi_get_dreq(spi, true));
     dma_channel_configure(dma_tx, &c,
-                          &spi_get_hw(FURNACE_SPI_INSTANCE)->dr, // write address
-                          txbuf, // read address
-                          TEST_SIZE, // element count (each element is of size transfer_data_size)
+                          &spi_get_hw(spi)->dr, // write address
+                          NULL, // read address, set for every transaction
+                          0, // element count, set for every transaction
                           false); // don't start yet
 
-    printf("Configure RX DMA\n");
-
     // We set the inbound DMA to transfer from the SPI receive FIFO to a memory buffer paced by the SPI RX FIFO DREQ
     // We configure the read address to remain unchanged for each element, but the write
     // address to increment (so data is written throughout the buffer)
     c = dma_channel_get_default_config(dma_rx);
     channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
-    channel_config_set_dreq(&c, spi_get_dreq(FURNACE_SPI_INSTANCE, false));
+    channel_config_set_dreq(&c, spi_get_dreq(spi, false));
     channel_config_set_read_increment(&c, false);
     channel_config_set_write_increment(&c, true);
     dma_channel_configure(dma_rx, &c,
-                          rxbuf, // write address
-                          &spi_get_hw(FURNACE_SPI_INSTANCE)->dr, // read address
-                          TEST_SIZE, // element count (each element is of size transfer_data_size)
+                          NULL, // write address, set for every transaction
+                          &spi_get_hw(spi)->dr, // read address
+                          0, // element count, set for every transaction
                           false); // don't start yet
+}
+
+bool
+spi_async_start(spi_xfer_t* xfer)
+{
+    if (in_flight || xfer->len == 0 || xfer->len > SPI_XFER_MAX)
+        return false;
+
+    in_flight  = xfer;
+    xfer->busy = true;
+
+    gpio_put(xfer->cs_pin, 0);
+
+    dma_channel_set_read_addr(dma_tx, xfer->tx, false);
+    dma_channel_set_trans_count(dma_tx, xfer->len, false);
+    dma_channel_set_write_addr(dma_rx, xfer->rx, false);
+    dma_channel_set_trans_count(dma_rx, xfer->len, false);
 
-    printf("Starting DMAs...\n");
     // start them exactly simultaneously to avoid races (in extreme cases the FIFO could overflow)
     dma_start_channel_mask((1u << dma_tx) | (1u << dma_rx));
-    printf("Wait for RX complete...\n");
-    dma_channel_wait_for_finish_blocking(dma_rx);
-    if (dma_channel_is_busy(dma_tx)) {
-        panic("RX completed before TX");
-    }
 
-#else
+    return true;
+}
 
-    spi_write_read_blocking(FURNACE_SPI_INSTANCE, txbuf, rxbuf, TEST_SIZE);
+bool
+spi_async_done(spi_xfer_t* xfer)
+{
+    if (!xfer->busy)
+        return true;
 
-#endif
+    // RX completes last, the final byte has been shifted in once it is done
+    if (dma_channel_is_busy(dma_rx))
+        return false;
 
-    printf("Done. Checking...");
-    for (uint i = 0; i < TEST_SIZE; ++i) {
-        if (rxbuf[i] != txbuf[i]) {
-            panic("Mismatch at %d/%d: expected %02x, got %02x",
-                  i, TEST_SIZE, txbuf[i], rxbuf[i]
-            );
-        }
-    }
+    if (dma_channel_is_busy(dma_tx))
+        panic("RX completed before TX");
 
-    printf("All good\n");
+    gpio_put(xfer->cs_pin, 1);
 
-#if DMA
-    dma_channel_unclaim(dma_tx);
-    dma_channel_unclaim(dma_rx);
-#endif
+    xfer->busy = false;
+    in_flight  = NULL;
 
-    while(1) {
-        printf(".");
-        sleep_ms(1000);
-    }
+    return true;
+}
+
+uint32_t
+spi_async_time_us(const spi_xfer_t* xfer)
+{
+    const uint baudrate = spi_get_baudrate(async_spi);
 
-    return 0;
+    return ((uint64_t) xfer->len * 8 * 1000000 + baudrate - 1) / baudrate;
 }
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hardware/spi.h"
+
+/*
+ * Asynchronous SPI transactions.
+ *
+ * A transaction asserts its chip select, clocks len bytes out of tx and
+ * into rx with a pair of DMA channels, and releases the chip select once
+ * the caller notices it is done. spi_async_start returns right away, the
+ * caller polls spi_async_done on a later loop pass, ideally no sooner than
+ * spi_async_time_us after the start.
+ *
+ * There is one bus and one transaction in flight at a time.
+ */
+
+/* Fits a whole MAX31856 register file and the address byte. */
+#define SPI_XFER_MAX 24
+
+typedef struct {
+  uint8_t tx[SPI_XFER_MAX];
+  uint8_t rx[SPI_XFER_MAX];
+  uint8_t len;
+  uint    cs_pin;
+  bool    busy;
+} spi_xfer_t;
+
+void
+spi_async_init(spi_inst_t* spi);
+
+/* Returns false if another transaction is still in flight. */
+bool
+spi_async_start(spi_xfer_t* xfer);
+
+/* True once xfer->rx holds the answer, releases the chip select then. */
+bool
+spi_async_done(spi_xfer_t* xfer);
+
+/* How long the transaction takes on the wire at the current baudrate. */
+uint32_t
+spi_async_time_us(const spi_xfer_t* xfer);
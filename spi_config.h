@@ -4,6 +4,18 @@
 #define FURNACE_SPI_CSN_PIN   17
 #define FURNACE_SPI_SCK_PIN   18
 #define FURNACE_SPI_TX_PIN    19
+/* MAX31856 DRDY, open drain, low while a conversion waits to be read. */
+#define FURNACE_SPI_DRDY_PIN  22
 
 #define FURNACE_SPI_INSTANCE spi0
+/* Both MAX31856 and MAX31865 take up to 5 MHz, the RP2040 gets 4.8 out of it. */
+#define FURNACE_SPI_BAUDRATE (5000 * 1000)
 
+/*
+ * Converters on the bus, name and chip select of each. Only the first
+ * CONFIG_THERMO_SENSORS are fitted, the first one also drives DRDY.
+ */
+#define FURNACE_THERMO_SENSORS            \
+  { "crucible", FURNACE_SPI_CSN_PIN },    \
+  { "wall",     14 },                     \
+  { "element",  15 },
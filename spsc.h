@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Lock-free single-producer/single-consumer ring of fixed-size slots.
+ *
+ * Used to pass messages between the two cores: one side only ever calls
+ * spsc_push, the other only spsc_pop. head is written by the producer
+ * alone and tail by the consumer alone, both run freely and wrap around
+ * at 2^32, so the number of used slots is always head - tail.
+ *
+ * The release store of head publishes the slot contents to the consumer,
+ * the release store of tail hands the slot back to the producer. Plain
+ * 32-bit loads and stores are single-copy atomic on the Cortex-M0+, so
+ * this needs no exclusive access instructions (which armv6-m lacks).
+ *
+ * The slot count has to be a power of two.
+ */
+
+typedef struct {
+  uint32_t head;      /* next slot to write, owned by the producer */
+  uint32_t tail;      /* next slot to read, owned by the consumer */
+  uint32_t drops;     /* pushes refused because the ring was full */
+  uint16_t slot_size;
+  uint16_t mask;
+  uint8_t* slots;
+} spsc_ring_t;
+
+static inline void
+spsc_init(spsc_ring_t* ring, void* slots, uint16_t slot_size, uint16_t count)
+{
+  ring->head      = 0;
+  ring->tail      = 0;
+  ring->drops     = 0;
+  ring->slot_size = slot_size;
+  ring->mask      = count - 1;
+  ring->slots     = (uint8_t*) slots;
+}
+
+static inline bool
+spsc_push(spsc_ring_t* ring, const void* item)
+{
+  const uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  const uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+  if (head - tail > ring->mask) {
+    ring->drops++;
+    return false;
+  }
+
+  memcpy(ring->slots + (head & ring->mask) * ring->slot_size, item, ring->slot_size);
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+static inline bool
+spsc_pop(spsc_ring_t* ring, void* item)
+{
+  const uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+  const uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+  if (head == tail)
+    return false;
+
+  memcpy(item, ring->slots + (tail & ring->mask) * ring->slot_size, ring->slot_size);
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+/* Safe to call from either side, the answer may be stale by the time it returns. */
+static inline uint32_t
+spsc_count(const spsc_ring_t* ring)
+{
+  return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)
+       - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
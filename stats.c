@@ -0,0 +1,87 @@
+#include <string.h>
+
+#include "stats.h"
+
+#define STATS_SUB_COUNT (1u << STATS_SUB_BITS)
+
+static unsigned
+stats_bucket(uint32_t us)
+{
+  if (us < STATS_SUB_COUNT)
+    return us;
+
+  const unsigned exp    = 31 - __builtin_clz(us);
+  const unsigned sub    = (us >> (exp - STATS_SUB_BITS)) & (STATS_SUB_COUNT - 1);
+  const unsigned bucket = (exp - STATS_SUB_BITS + 1) * STATS_SUB_COUNT + sub;
+
+  return bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1;
+}
+
+static uint32_t
+stats_bucket_upper(unsigned bucket)
+{
+  if (bucket < STATS_SUB_COUNT)
+    return bucket;
+
+  const unsigned exp   = bucket / STATS_SUB_COUNT + STATS_SUB_BITS - 1;
+  const unsigned sub   = bucket % STATS_SUB_COUNT;
+  const uint32_t lower = (STATS_SUB_COUNT + sub) << (exp - STATS_SUB_BITS);
+
+  return lower + (1u << (exp - STATS_SUB_BITS)) - 1;
+}
+
+void
+stats_reset(stats_hist_t* hist)
+{
+  memset(hist, 0, sizeof(*hist));
+  hist->min_us = UINT32_MAX;
+}
+
+void
+stats_record(stats_hist_t* hist, uint32_t us)
+{
+  if (us < hist->min_us)
+    hist->min_us = us;
+  if (us > hist->max_us)
+    hist->max_us = us;
+
+  hist->count++;
+  hist->total_us += us;
+  hist->buckets[stats_bucket(us)]++;
+}
+
+uint32_t
+stats_percentile(const stats_hist_t* hist, unsigned pct)
+{
+  if (hist->count == 0)
+    return 0;
+
+  /* Rank of the sample we are after, rounded up. */
+  const uint32_t rank = ((uint64_t) hist->count * pct + 99) / 100;
+  uint32_t       seen = 0;
+
+  for (unsigned i = 0; i < STATS_BUCKETS; i++) {
+    seen += hist->buckets[i];
+
+    if (seen < rank)
+      continue;
+
+    const uint32_t upper = stats_bucket_upper(i);
+
+    if (upper < hist->min_us)
+      return hist->min_us;
+
+    return upper < hist->max_us ? upper : hist->max_us;
+  }
+
+  return hist->max_us;
+}
+
+uint32_t
+stats_average(const stats_hist_t* hist)
+{
+  if (hist->count == 0)
+    return 0;
+
+  return hist->total_us / hist->count;
+}
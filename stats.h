@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Fixed-bucket latency histograms.
+ *
+ * Buckets are logarithmic with 2^STATS_SUB_BITS linear steps per power of
+ * two, so a percentile read back is at most 25% above the real value.
+ * They cover 0 us to about two seconds, anything longer lands in the last
+ * bucket (max_us still tells how long it really was).
+ */
+
+#define STATS_SUB_BITS 2
+#define STATS_BUCKETS  80
+
+typedef struct {
+  uint32_t count;
+  uint32_t min_us;
+  uint32_t max_us;
+  uint64_t total_us;
+  uint32_t buckets[STATS_BUCKETS];
+} stats_hist_t;
+
+void
+stats_reset(stats_hist_t* hist);
+
+void
+stats_record(stats_hist_t* hist, uint32_t us);
+
+/* Upper bound of the pct-th percentile, 0 if nothing was recorded. */
+uint32_t
+stats_percentile(const stats_hist_t* hist, unsigned pct);
+
+uint32_t
+stats_average(const stats_hist_t* hist);
@@ -0,0 +1,86 @@
+#include <string.h>
+
+#include "steady.h"
+
+bool
+steady_config_valid(const steady_config_t* config)
+{
+  return config->slope >= 0 && config->slope <= STEADY_SLOPE_MAX &&
+         config->dwell_min_min >= 1 &&
+         config->dwell_min_min <= config->dwell_max_min &&
+         config->dwell_max_min <= STEADY_DWELL_LIMIT;
+}
+
+void
+steady_reset(steady_t* steady)
+{
+  memset(steady, 0, sizeof(*steady));
+}
+
+void
+steady_push(steady_t* steady, temp_t temp)
+{
+  steady->samples[steady->next] = temp;
+  steady->next = (steady->next + 1) % STEADY_WINDOW;
+
+  if (steady->count < STEADY_WINDOW)
+    steady->count++;
+}
+
+/* i-th sample of the window, oldest first. */
+static temp_t
+steady_sample(const steady_t* steady, unsigned i)
+{
+  return steady->samples[(steady->next + STEADY_WINDOW - steady->count + i) % STEADY_WINDOW];
+}
+
+int32_t
+steady_slope(const steady_t* steady, const steady_config_t* config)
+{
+  const int32_t n = steady->count;
+
+  if (n < 2)
+    return 0;
+
+  /*
+   * Least squares over x = i - (n - 1) / 2, doubled to stay integer:
+   * k = 2i - (n - 1), sum(k^2) = n (n^2 - 1) / 3, slope = 2 sum(k y) / sum(k^2)
+   * per sample.
+   */
+  int64_t sum_ky = 0;
+
+  for (int32_t i = 0; i < n; i++)
+    sum_ky += (int64_t) (2 * i - (n - 1)) * steady_sample(steady, i);
+
+  const int64_t sum_kk = (int64_t) n * (n * n - 1) / 3;
+
+  return 2 * sum_ky * 3600 * 1000 / (sum_kk * steady_period_ms(config));
+}
+
+temp_t
+steady_mean(const steady_t* steady)
+{
+  int64_t sum = 0;
+
+  if (steady->count == 0)
+    return 0;
+
+  for (unsigned i = 0; i < steady->count; i++)
+    sum += steady->samples[i];
+
+  return sum / steady->count;
+}
+
+bool
+steady_settled(const steady_t* steady, const steady_config_t* config, uint32_t dwell_ms)
+{
+  if (dwell_ms >= (uint32_t) config->dwell_max_min * 60 * 1000)
+    return true;
+
+  if (dwell_ms < (uint32_t) config->dwell_min_min * 60 * 1000 || steady->count < STEADY_WINDOW)
+    return false;
+
+  const int32_t slope = steady_slope(steady, config);
+
+  return slope <= config->slope && slope >= -config->slope;
+}
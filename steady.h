@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Steady state detection for the mapper.
+ *
+ * The last STEADY_WINDOW samples, taken evenly over the minimum dwell, get
+ * a straight line fitted through them by least squares. A step is over
+ * once the slope of that line is within the threshold, or once it took
+ * the maximum dwell, whichever comes first. What it settled at is the mean
+ * of the window.
+ *
+ * A first order plant is still short of equilibrium by slope * time
+ * constant, so the threshold is what trades mapping time for accuracy:
+ * 1 C/h on a furnace with a 3 h time constant leaves it about 3 C short.
+ */
+
+#define STEADY_WINDOW        24
+
+#define STEADY_SLOPE         TEMP_C(1)      /* per hour */
+#define STEADY_SLOPE_MAX_C   100
+#define STEADY_SLOPE_MAX     TEMP_C(STEADY_SLOPE_MAX_C)
+#define STEADY_DWELL_MIN_MIN 5
+#define STEADY_DWELL_MAX_MIN 240
+#define STEADY_DWELL_LIMIT   1440           /* minutes, for either */
+
+typedef struct __attribute__((packed)) {
+  temp_t   slope;         /* per hour */
+  uint16_t dwell_min_min; /* the window spans it */
+  uint16_t dwell_max_min;
+} steady_config_t;
+
+typedef struct {
+  temp_t  samples[STEADY_WINDOW];
+  uint8_t count;          /* up to STEADY_WINDOW */
+  uint8_t next;           /* where the next sample goes */
+} steady_t;
+
+/* Limits hold: 1 <= dwell_min_min <= dwell_max_min <= STEADY_DWELL_LIMIT. */
+bool
+steady_config_valid(const steady_config_t* config);
+
+/* How often steady_push wants a sample. */
+static inline uint32_t
+steady_period_ms(const steady_config_t* config)
+{
+  return (uint32_t) config->dwell_min_min * 60 * 1000 / STEADY_WINDOW;
+}
+
+void
+steady_reset(steady_t* steady);
+
+void
+steady_push(steady_t* steady, temp_t temp);
+
+/* Slope of the window in temp_t per hour, 0 with fewer than two samples. */
+int32_t
+steady_slope(const steady_t* steady, const steady_config_t* config);
+
+/* Mean of the window, 0 if it is empty. */
+temp_t
+steady_mean(const steady_t* steady);
+
+/* Whether a step that has run for dwell_ms is over. */
+bool
+steady_settled(const steady_t* steady, const steady_config_t* config, uint32_t dwell_ms);
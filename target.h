@@ -1,8 +1,39 @@
 #pragma once
 
+#include "burst.h"
+#include "common.h"
+#include "dither.h"
+#include "scheduler.h"
+#include "spsc.h"
+
 #if CONFIG_SHUTTER
   #include "shutter.h"
 #endif
+#if CONFIG_THERMO
+  #include "estimator.h"
+  #include "max318xx.h"
+  #include "model.h"
+  #include "sample.h"
+#endif
+#if CONFIG_PILOT
+  #include "pid.h"
+  #include "profile.h"
+#endif
+#if CONFIG_THERMO && CONFIG_PILOT
+  #include "autotune.h"
+  #include "ident.h"
+  #include "preheat.h"
+#endif
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+  #include "pwm_map.h"
+  #include "steady.h"
+#endif
+#if CONFIG_AUTO == CONFIG_AUTO_MPC
+  #if !CONFIG_THERMO
+    #error "CONFIG_AUTO=mpc needs the model, which needs CONFIG_THERMO"
+  #endif
+  #include "mpc.h"
+#endif
 
 
 typedef struct {
@@ -12,23 +43,158 @@ typedef struct {
   uint16_t        recv_len; /* Received, valid bytes in recv_buffer */
 } tcp_context_t;
 
-#if CONFIG_AUTO == CONFIG_AUTO_PILOT || CONFIG_AUTO == CONFIG_AUTO_MAPPER
+/*
+ * Burst firing, see the heater command. The heater task fills the ring a
+ * window ahead of the timer, the timer callback (core0, interrupt) takes
+ * a pattern from it at the start of every window and plays it one
+ * half-cycle per tick. Switching the heater off bumps gen, a pattern made
+ * before that plays as off.
+ */
 typedef struct {
-  absolute_time_t pilot_deadline;
-  bool            is_enabled;
-  int             des_temp;
-  int             last_temp;
+  burst_pattern_t pattern;
+  uint32_t        gen;
+} burst_slot_t;
+
+typedef struct {
+  uint8_t           runs;     /* per window, 0 is PWM instead */
+  uint32_t          gen;
+  repeating_timer_t timer;
+  spsc_ring_t       ring;
+  burst_slot_t      slots[1];
+
+  /* Owned by the timer callback. */
+  burst_slot_t      playing;
+  uint8_t           pos;      /* half-cycle of the window up next */
+} heater_burst_t;
+
+#if CONFIG_PILOT
+typedef struct {
+  absolute_time_t  pilot_deadline;
+  bool             is_enabled;
+  bool             faulted; /* sat out a sensor fault, starts over once it is back */
+  temp_t           des_temp;
+  pid_controller_t pid; /* see the pid command */
+#if CONFIG_AUTO == CONFIG_AUTO_MPC
+  mpc_t            mpc; /* has the heater instead of pid once there is a model */
+#endif
 } pilot_context_t;
 #endif
 
-#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+#if CONFIG_PILOT
+/* Firing program of the profile command, steers pilot.des_temp while it runs. */
 typedef struct {
   absolute_time_t deadline;
+  profile_t       engine;
+} profile_context_t;
+#endif
+
+#if CONFIG_THERMO && CONFIG_PILOT
+/* Relay experiment of the autotune command, hands over to the pilot when done. */
+typedef struct {
+  absolute_time_t deadline;
+  temp_t          hysteresis; /* for the next run */
+  autotune_t      tune;
+} autotune_context_t;
+
+/*
+ * PRBS run of the ident command. The control path fills run's log, core0
+ * streams it to the TCP client once the run is over, a few lines per
+ * pass as lwIP takes them (dump_*).
+ */
+typedef struct {
+  absolute_time_t deadline;      /* of the next bit */
+  uint32_t        bit_ms;        /* for the next run */
+  bool            pilot;         /* had the heater before, gets it back */
+  ident_t         run;
+
+  /* Owned by core0. */
+  bool            dumping;
+  uint32_t        dump_line;     /* 0 is the header, then one per sample */
+  struct tcp_pcb* dump_pcb;      /* starts over for another client */
+  absolute_time_t dump_deadline;
+} ident_context_t;
+
+/*
+ * Preheat on a large setpoint jump, see the preheat command. While run
+ * is in PREHEAT_BOOST it has the heater instead of the pilot.
+ */
+typedef struct {
+  absolute_time_t deadline;
+  bool            boost;         /* full power up to the coast point, else runs are only clocked */
+  temp_t          band;          /* for the next run */
+  preheat_t       run;
+} preheat_context_t;
+#endif
+
+#if CONFIG_AUTO == CONFIG_AUTO_MAPPER
+typedef struct {
+  absolute_time_t deadline;     /* of the next steady sample */
   bool            is_enabled;
-  int             max_pwm_temp;
+  temp_t          max_pwm_temp; /* where the last level settled */
+  pwm_map_t       map;          /* feed-forward for the pilot */
+  absolute_time_t step_at;      /* the current level started */
+  steady_config_t steady_config;
+  steady_t        steady;
 } mapper_context_t;
+#endif
 
-  #define PWM_MAPPER_MINUTES 1
+#if CONFIG_THERMO
+/* One fitted converter, in the order of max318xx_sensors. */
+typedef struct {
+  temp_t              temp;      /* out of pipe, what the controllers see */
+  absolute_time_t     sample_at; /* when the conversion in temp completed */
+  max318xx_snapshot_t snapshot;  /* last register file read */
+  sample_pipeline_t   pipe;
+} thermo_sensor_t;
+
+/*
+ * Sampling the converters is split across loop passes: one pass starts
+ * the SPI transaction, a later one decodes the answer once it is in and
+ * starts the next sensor's right away, until the round is through.
+ *
+ * Converters with a DRDY line start a round from its interrupt, as soon
+ * as a conversion of the first sensor completes. poll_deadline only
+ * matters without one, or if a DRDY edge got lost.
+ *
+ * Every sample goes through the sensor's pipe before it ends up in
+ * sensors[].temp, see the sample command, unless the converter reports
+ * a fault. cur_temp follows the sensor picked with the sensor command,
+ * and every new sample of it goes to the estimator, see the estimate
+ * command.
+ */
+typedef struct {
+  spi_xfer_t      xfer;
+  bool            pending;       /* xfer started, waiting for the answer */
+  uint8_t         sensor;        /* the one xfer is for */
+  uint8_t         regulate;      /* the one cur_temp follows */
+  uint8_t         faults;        /* MAX318xx_FAULT_FATAL of that one, last round */
+  absolute_time_t deadline;      /* earliest time the answer can be in */
+  absolute_time_t poll_deadline; /* sample anyway once past this */
+  absolute_time_t xfer_at;       /* when the conversions of this round completed */
+  absolute_time_t next_sample;   /* conversions before this are skipped */
+  thermo_sensor_t sensors[THERMO_SENSORS];
+  estimator_t     estimator;     /* of the regulated sensor */
+  absolute_time_t estimated_at;  /* sample_at of the last sample it got */
+
+  /* Written by the DRDY interrupt on the control core. */
+  volatile bool     drdy;
+  volatile uint32_t drdy_us;
+} thermo_context_t;
+
+/*
+ * Once a minute the estimated temperature and the mean heater output
+ * since the last time go to the model, see the model command. Flash
+ * keeps saved, refreshed every MODEL_SAVE_PERIODS only: the fit moves a
+ * little every minute and a record a minute would wear the sector out.
+ */
+typedef struct {
+  absolute_time_t deadline;
+  int64_t         input_sum;     /* pwm_fine at every sample since the last update */
+  uint32_t        input_count;
+  uint32_t        periods;       /* since saved was refreshed */
+  model_params_t  saved;
+  model_t         model;
+} model_context_t;
 #endif
 
 typedef struct {
@@ -36,24 +202,160 @@ typedef struct {
   uint8_t* parser;
 } stdio_context_t;
 
+/*
+ * The control path (thermocouple, pilot, mapper, pwm, magnetron, shutter)
+ * runs on core1 with CONFIG_MULTICORE, otherwise from the main loop.
+ * It is the only writer of the heater state in furnace_context_t, core0
+ * (lwIP, stdio, command_handler) may only read it. Core0 asks for changes
+ * through the inbox, the control path reports through the outbox.
+ */
+#define CONTROL_INBOX_SIZE  16
+#define CONTROL_OUTBOX_SIZE 16
+
+enum {
+  CONTROL_PWM,
+  CONTROL_MAX_PWM,
+  CONTROL_AUTO,
+  CONTROL_TEMP,
+  CONTROL_PULSE,
+  CONTROL_WATER,
+  CONTROL_SHUTTER,
+  CONTROL_SHUTTER_ON,
+  CONTROL_SHUTTER_OFF,
+  CONTROL_MAP,
+  CONTROL_STATS_RESET,
+  CONTROL_SAMPLE_PERIOD,
+  CONTROL_SAMPLE_MEDIAN,
+  CONTROL_SAMPLE_EMA,
+  CONTROL_SAMPLE_DECIMATE,
+  CONTROL_SAMPLE_REJECT,
+  CONTROL_SENSOR,
+  CONTROL_PID_KP,
+  CONTROL_PID_TI,
+  CONTROL_PID_TD,
+  CONTROL_PID_PERIOD,
+  CONTROL_AUTOTUNE,
+  CONTROL_AUTOTUNE_HYSTERESIS,
+  CONTROL_PROFILE_ADD,
+  CONTROL_PROFILE_CLEAR,
+  CONTROL_PROFILE_START,
+  CONTROL_PROFILE_STOP,
+  CONTROL_PROFILE_PAUSE,
+  CONTROL_PROFILE_RESUME,
+  CONTROL_PROFILE_SKIP,
+  CONTROL_MAP_SLOPE,
+  CONTROL_MAP_DWELL,
+  CONTROL_HEATER,
+  CONTROL_ESTIMATE_ALPHA,
+  CONTROL_ESTIMATE_GAIN,
+  CONTROL_MODEL_RESET,
+  CONTROL_MODEL_MEMORY,
+  CONTROL_IDENT,
+  CONTROL_IDENT_BIT,
+  CONTROL_MPC_RATE,
+  CONTROL_PREHEAT,
+  CONTROL_PREHEAT_BAND,
+};
+
+typedef struct {
+  uint8_t  op;  /* CONTROL_* */
+  uint32_t arg; /* already validated by command_handler */
+} control_msg_t;
+
+enum {
+  TELEMETRY_STATUS,
+  TELEMETRY_MAPPER_STEP,
+  TELEMETRY_MAPPER_MAX_PWM,
+  TELEMETRY_MAPPER_MAX_TEMP,
+  TELEMETRY_SENSOR_FAULT,
+  TELEMETRY_AUTOTUNE_DONE,
+  TELEMETRY_AUTOTUNE_FAILED,
+  TELEMETRY_PROFILE_DONE,
+  TELEMETRY_IDENT_DONE,
+  TELEMETRY_IDENT_FAILED,
+  TELEMETRY_PREHEAT_DONE,
+};
+
+typedef struct {
+  uint8_t kind; /* TELEMETRY_* */
+  uint8_t pwm_level;
+  uint8_t ceiling_pwm;
+  bool    auto_enabled;
+  temp_t  cur_temp;
+#if CONFIG_THERMO == CONFIG_THERMO_KTYPE
+  temp_t  cold_temp;
+#endif
+#if CONFIG_THERMO
+  uint32_t sample_age_ms; /* since the conversion behind cur_temp completed */
+  uint8_t  regulate;
+  uint8_t  faults;        /* of the regulated sensor, MAX318xx_FAULT_* */
+  temp_t   sensor_temp[THERMO_SENSORS];
+  int32_t  rate;          /* estimated, temp_t per hour */
+#endif
+  temp_t  des_temp;
+  temp_t  max_pwm_temp;
+#if CONFIG_PILOT
+  uint8_t  profile_state; /* PROFILE_*, nothing on the status line while idle */
+  uint8_t  profile_phase;
+  uint8_t  profile_segment;
+  uint8_t  profile_count;
+  uint16_t profile_left_min;
+#endif
+#if CONFIG_THERMO && CONFIG_PILOT
+  uint32_t     autotune_ku; /* result of the relay experiment */
+  uint32_t     autotune_pu_ms;
+  temp_t       autotune_amplitude;
+  pid_config_t pid;         /* gains it came up with */
+  preheat_t    preheat;     /* the last run */
+#endif
+} telemetry_t;
+
+typedef struct {
+  scheduler_t   sched;
+  spsc_ring_t   inbox;
+  spsc_ring_t   outbox;
+  control_msg_t inbox_slots[CONTROL_INBOX_SIZE];
+  telemetry_t   outbox_slots[CONTROL_OUTBOX_SIZE];
+  uint32_t      seq; /* odd while a pass runs, see control_read_begin */
+} control_context_t;
+
 typedef struct {
   absolute_time_t update_deadline;
-  int             cur_temp;
+  scheduler_t     sched;
+  temp_t          cur_temp;
+#if CONFIG_THERMO == CONFIG_THERMO_KTYPE
+  temp_t          cold_temp;
+#endif
+#if CONFIG_THERMO
+  thermo_context_t thermo;
+  model_context_t  model;
+#endif
   tcp_context_t   tcp;
   stdio_context_t stdio;
   uint8_t         log_bits;
 
-#if CONFIG_AUTO == CONFIG_AUTO_PILOT || CONFIG_AUTO == CONFIG_AUTO_MAPPER
+#if CONFIG_PILOT
   pilot_context_t       pilot;
 #endif
   uint8_t pwm_level;
 
+  /*
+   * What the heater is asked for, PWM_FINE_BITS fraction bits, pwm_level
+   * is it rounded. heater_output dithers it onto the counter once every
+   * PWM period, at heater_deadline, or onto burst patterns with burst.runs.
+   */
+  int32_t         pwm_fine;
+  dither_t        heater_dither;
+  absolute_time_t heater_deadline;
+  heater_burst_t  burst;
+
   /*
    * Similar to MAX_PWM, but can be lowered at runtime to
    * make pwm never reach certain levels.
    *
    * This always holds true:
    *     pwm_level <= ceiling_pwm <= MAX_PWM
+   *     pwm_fine  <= ceiling_pwm << PWM_FINE_BITS
    */
   int             ceiling_pwm;
 
@@ -77,11 +379,21 @@ typedef struct {
 #if CONFIG_AUTO == CONFIG_AUTO_MAPPER
   mapper_context_t  mapper;
 #endif
+#if CONFIG_PILOT
+  profile_context_t  profile;
+#endif
+#if CONFIG_THERMO && CONFIG_PILOT
+  autotune_context_t autotune;
+  ident_context_t    ident;
+  preheat_context_t  preheat;
+#endif
 
 #if CONFIG_FLASH
   absolute_time_t flash_deadline;
 #endif
 
+  control_context_t control;
+
 } furnace_context_t;
 
 